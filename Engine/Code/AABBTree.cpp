@@ -0,0 +1,555 @@
+#include "AABBTree.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <float.h>
+
+namespace BVH
+{
+    static AABB Union(const AABB& a, const AABB& b)
+    {
+        return AABB{ glm::min(a.min, b.min), glm::max(a.max, b.max) };
+    }
+
+    static f32 SurfaceArea(const AABB& box)
+    {
+        vec3 size = box.max - box.min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    static bool Contains(const AABB& outer, const AABB& inner)
+    {
+        return glm::all(glm::lessThanEqual(outer.min, inner.min)) && glm::all(glm::greaterThanEqual(outer.max, inner.max));
+    }
+
+    static AABB Fatten(const AABB& box)
+    {
+        vec3 margin = (box.max - box.min) * AABB_TREE_FAT_MARGIN;
+        return AABB{ box.min - margin, box.max + margin };
+    }
+
+    static u32 AllocateNode(AABBTree& tree)
+    {
+        u32 node;
+        if (tree.freeList != AABB_TREE_NULL_NODE)
+        {
+            node = tree.freeList;
+            tree.freeList = tree.nodes[node].parent;
+        }
+        else
+        {
+            node = tree.nodes.size();
+            tree.nodes.push_back(AABBTreeNode{});
+        }
+
+        AABBTreeNode& newNode = tree.nodes[node];
+        newNode.parent = AABB_TREE_NULL_NODE;
+        newNode.left = AABB_TREE_NULL_NODE;
+        newNode.right = AABB_TREE_NULL_NODE;
+        newNode.userData = AABB_TREE_NULL_NODE;
+        newNode.dirty = false;
+        return node;
+    }
+
+    static void FreeNode(AABBTree& tree, u32 node)
+    {
+        tree.nodes[node].parent = tree.freeList;
+        tree.freeList = node;
+    }
+
+    static void RefitAncestors(AABBTree& tree, u32 node)
+    {
+        while (node != AABB_TREE_NULL_NODE)
+        {
+            AABBTreeNode& current = tree.nodes[node];
+            current.box = Union(tree.nodes[current.left].box, tree.nodes[current.right].box);
+            node = current.parent;
+        }
+    }
+
+    static void InsertLeaf(AABBTree& tree, u32 leaf)
+    {
+        if (tree.root == AABB_TREE_NULL_NODE)
+        {
+            tree.root = leaf;
+            tree.nodes[leaf].parent = AABB_TREE_NULL_NODE;
+            return;
+        }
+
+        // Walk down following the cheapest surface area heuristic cost
+        const AABB leafBox = tree.nodes[leaf].box;
+        u32 index = tree.root;
+        while (!tree.nodes[index].IsLeaf())
+        {
+            const AABBTreeNode& node = tree.nodes[index];
+            f32 area = SurfaceArea(node.box);
+            f32 combinedArea = SurfaceArea(Union(node.box, leafBox));
+
+            // Cost of making a new parent for this node and the leaf, and the cost pushed down to the children
+            f32 cost = 2.0f * combinedArea;
+            f32 inheritanceCost = 2.0f * (combinedArea - area);
+
+            f32 childCosts[2];
+            u32 children[2] = { node.left, node.right };
+            for (u32 c = 0; c < 2; ++c)
+            {
+                const AABBTreeNode& child = tree.nodes[children[c]];
+                f32 unionArea = SurfaceArea(Union(child.box, leafBox));
+                childCosts[c] = (child.IsLeaf() ? unionArea : unionArea - SurfaceArea(child.box)) + inheritanceCost;
+            }
+
+            if (cost < childCosts[0] && cost < childCosts[1])
+                break;
+
+            index = childCosts[0] < childCosts[1] ? node.left : node.right;
+        }
+
+        u32 sibling = index;
+        u32 oldParent = tree.nodes[sibling].parent;
+        u32 newParent = AllocateNode(tree);
+        tree.nodes[newParent].parent = oldParent;
+        tree.nodes[newParent].box = Union(leafBox, tree.nodes[sibling].box);
+        tree.nodes[newParent].left = sibling;
+        tree.nodes[newParent].right = leaf;
+        tree.nodes[sibling].parent = newParent;
+        tree.nodes[leaf].parent = newParent;
+
+        if (oldParent == AABB_TREE_NULL_NODE)
+        {
+            tree.root = newParent;
+        }
+        else
+        {
+            if (tree.nodes[oldParent].left == sibling)
+                tree.nodes[oldParent].left = newParent;
+            else
+                tree.nodes[oldParent].right = newParent;
+            RefitAncestors(tree, oldParent);
+        }
+    }
+
+    static void RemoveLeaf(AABBTree& tree, u32 leaf)
+    {
+        if (leaf == tree.root)
+        {
+            tree.root = AABB_TREE_NULL_NODE;
+            return;
+        }
+
+        u32 parent = tree.nodes[leaf].parent;
+        u32 grandParent = tree.nodes[parent].parent;
+        u32 sibling = tree.nodes[parent].left == leaf ? tree.nodes[parent].right : tree.nodes[parent].left;
+
+        if (grandParent == AABB_TREE_NULL_NODE)
+        {
+            tree.root = sibling;
+            tree.nodes[sibling].parent = AABB_TREE_NULL_NODE;
+        }
+        else
+        {
+            if (tree.nodes[grandParent].left == parent)
+                tree.nodes[grandParent].left = sibling;
+            else
+                tree.nodes[grandParent].right = sibling;
+            tree.nodes[sibling].parent = grandParent;
+            RefitAncestors(tree, grandParent);
+        }
+
+        FreeNode(tree, parent);
+    }
+
+    u32 CreateProxy(AABBTree& tree, const AABB& box, u32 userData)
+    {
+        u32 proxy = AllocateNode(tree);
+        tree.nodes[proxy].box = Fatten(box);
+        tree.nodes[proxy].userData = userData;
+        InsertLeaf(tree, proxy);
+        tree.leafCount++;
+        return proxy;
+    }
+
+    void DestroyProxy(AABBTree& tree, u32 proxy)
+    {
+        // A pending refit would walk up from a node that is no longer in the tree
+        tree.dirtyLeaves.erase(std::remove(tree.dirtyLeaves.begin(), tree.dirtyLeaves.end(), proxy), tree.dirtyLeaves.end());
+
+        RemoveLeaf(tree, proxy);
+        FreeNode(tree, proxy);
+        tree.leafCount--;
+    }
+
+    bool MoveProxy(AABBTree& tree, u32 proxy, const AABB& box)
+    {
+        AABBTreeNode& leaf = tree.nodes[proxy];
+        if (Contains(leaf.box, box))
+            return false;
+
+        leaf.box = Fatten(box);
+        if (!leaf.dirty)
+        {
+            leaf.dirty = true;
+            tree.dirtyLeaves.push_back(proxy);
+        }
+        return true;
+    }
+
+    f32 Cost(const AABBTree& tree)
+    {
+        if (tree.root == AABB_TREE_NULL_NODE)
+            return 0.0f;
+
+        f32 cost = 0.0f;
+        std::vector<u32> stack;
+        stack.push_back(tree.root);
+        while (!stack.empty())
+        {
+            const AABBTreeNode& node = tree.nodes[stack.back()];
+            stack.pop_back();
+            if (node.IsLeaf())
+                continue;
+
+            cost += SurfaceArea(node.box);
+            stack.push_back(node.left);
+            stack.push_back(node.right);
+        }
+        return cost;
+    }
+
+    void Refit(AABBTree& tree)
+    {
+        if (tree.dirtyLeaves.empty())
+            return;
+
+        for (u32 leaf : tree.dirtyLeaves)
+        {
+            tree.nodes[leaf].dirty = false;
+            RefitAncestors(tree, tree.nodes[leaf].parent);
+        }
+        tree.dirtyLeaves.clear();
+
+        // Refitting keeps the topology, so the boxes of moved objects can end up spanning
+        // half the scene. Start again from scratch once that costs too much.
+        if (tree.leafCount > 2 && Cost(tree) > tree.costAfterRebuild * AABB_TREE_REBUILD_RATIO)
+            Rebuild(tree);
+    }
+
+    struct BuildLeaf
+    {
+        u32  node;
+        vec3 centroid;
+    };
+
+    static u32 BuildRange(AABBTree& tree, BuildLeaf* leaves, u32 count)
+    {
+        if (count == 1)
+            return leaves[0].node;
+
+        AABB centroidBounds = { leaves[0].centroid, leaves[0].centroid };
+        for (u32 i = 1; i < count; ++i)
+        {
+            centroidBounds.min = glm::min(centroidBounds.min, leaves[i].centroid);
+            centroidBounds.max = glm::max(centroidBounds.max, leaves[i].centroid);
+        }
+
+        vec3 extent = centroidBounds.max - centroidBounds.min;
+        u32 axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+        u32 splitCount = count / 2;
+        if (extent[axis] > 0.0f)
+        {
+            // Binned SAH along the largest centroid axis
+            u32  binCounts[AABB_TREE_SAH_BINS] = {};
+            AABB binBoxes[AABB_TREE_SAH_BINS];
+            for (u32 b = 0; b < AABB_TREE_SAH_BINS; ++b)
+                binBoxes[b] = AABB{ vec3(FLT_MAX), vec3(-FLT_MAX) };
+
+            f32 binScale = AABB_TREE_SAH_BINS / extent[axis];
+            auto BinOf = [&](const BuildLeaf& leaf)
+            {
+                u32 bin = (u32)((leaf.centroid[axis] - centroidBounds.min[axis]) * binScale);
+                return bin < AABB_TREE_SAH_BINS ? bin : AABB_TREE_SAH_BINS - 1;
+            };
+
+            for (u32 i = 0; i < count; ++i)
+            {
+                u32 bin = BinOf(leaves[i]);
+                binCounts[bin]++;
+                binBoxes[bin] = Union(binBoxes[bin], tree.nodes[leaves[i].node].box);
+            }
+
+            f32 bestCost = FLT_MAX;
+            u32 bestSplit = 0;
+            for (u32 split = 0; split < AABB_TREE_SAH_BINS - 1; ++split)
+            {
+                AABB leftBox = { vec3(FLT_MAX), vec3(-FLT_MAX) };
+                AABB rightBox = leftBox;
+                u32 leftCount = 0;
+                u32 rightCount = 0;
+                for (u32 b = 0; b <= split; ++b)
+                {
+                    leftCount += binCounts[b];
+                    if (binCounts[b] > 0)
+                        leftBox = Union(leftBox, binBoxes[b]);
+                }
+                for (u32 b = split + 1; b < AABB_TREE_SAH_BINS; ++b)
+                {
+                    rightCount += binCounts[b];
+                    if (binCounts[b] > 0)
+                        rightBox = Union(rightBox, binBoxes[b]);
+                }
+                if (leftCount == 0 || rightCount == 0)
+                    continue;
+
+                f32 cost = SurfaceArea(leftBox) * leftCount + SurfaceArea(rightBox) * rightCount;
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestSplit = split;
+                }
+            }
+
+            if (bestCost < FLT_MAX)
+            {
+                BuildLeaf* middle = std::partition(leaves, leaves + count, [&](const BuildLeaf& leaf) { return BinOf(leaf) <= bestSplit; });
+                splitCount = (u32)(middle - leaves);
+            }
+        }
+
+        if (splitCount == 0 || splitCount == count)
+        {
+            // Every centroid fell in the same bin, split at the median
+            splitCount = count / 2;
+            std::nth_element(leaves, leaves + splitCount, leaves + count,
+                [axis](const BuildLeaf& a, const BuildLeaf& b) { return a.centroid[axis] < b.centroid[axis]; });
+        }
+
+        u32 left = BuildRange(tree, leaves, splitCount);
+        u32 right = BuildRange(tree, leaves + splitCount, count - splitCount);
+
+        u32 node = AllocateNode(tree);
+        tree.nodes[node].left = left;
+        tree.nodes[node].right = right;
+        tree.nodes[node].box = Union(tree.nodes[left].box, tree.nodes[right].box);
+        tree.nodes[left].parent = node;
+        tree.nodes[right].parent = node;
+        return node;
+    }
+
+    void Rebuild(AABBTree& tree)
+    {
+        if (tree.root == AABB_TREE_NULL_NODE)
+            return;
+
+        // Keep the leaves (their ids are the proxies) and recycle every internal node
+        std::vector<BuildLeaf> leaves;
+        leaves.reserve(tree.leafCount);
+        std::vector<u32> stack;
+        stack.push_back(tree.root);
+        while (!stack.empty())
+        {
+            u32 index = stack.back();
+            stack.pop_back();
+
+            const AABBTreeNode& node = tree.nodes[index];
+            if (node.IsLeaf())
+            {
+                leaves.push_back(BuildLeaf{ index, (node.box.min + node.box.max) * 0.5f });
+            }
+            else
+            {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+                FreeNode(tree, index);
+            }
+        }
+
+        tree.root = BuildRange(tree, leaves.data(), leaves.size());
+        tree.nodes[tree.root].parent = AABB_TREE_NULL_NODE;
+        tree.costAfterRebuild = Cost(tree);
+        tree.rebuildCount++;
+    }
+
+    static void CollectLeaves(const AABBTree& tree, u32 index, std::vector<u32>& stack, std::vector<u32>& result)
+    {
+        size_t base = stack.size();
+        stack.push_back(index);
+        while (stack.size() > base)
+        {
+            const AABBTreeNode& node = tree.nodes[stack.back()];
+            stack.pop_back();
+            if (node.IsLeaf())
+            {
+                result.push_back(node.userData);
+            }
+            else
+            {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+    }
+
+    static void QueryFrustum(const AABBTree& tree, const Frustum& frustum, std::vector<u32>& result)
+    {
+        if (tree.root == AABB_TREE_NULL_NODE)
+            return;
+
+        std::vector<u32> stack;
+        stack.reserve(64);
+        stack.push_back(tree.root);
+        while (!stack.empty())
+        {
+            u32 index = stack.back();
+            stack.pop_back();
+            const AABBTreeNode& node = tree.nodes[index];
+
+            vec3 center = (node.box.min + node.box.max) * 0.5f;
+            vec3 extent = (node.box.max - node.box.min) * 0.5f;
+
+            bool outside = false;
+            bool inside = true;
+            for (u32 p = 0; p < 6; ++p)
+            {
+                const vec4& plane = frustum.planes[p];
+                f32 distance = glm::dot(vec3(plane), center) + plane.w;
+                f32 radius = glm::dot(glm::abs(vec3(plane)), extent);
+                if (distance + radius < 0.0f)
+                {
+                    outside = true;
+                    break;
+                }
+                if (distance - radius < 0.0f)
+                    inside = false;
+            }
+
+            if (outside)
+                continue;
+
+            if (inside || node.IsLeaf())
+            {
+                // Everything below is visible, no more plane tests needed
+                CollectLeaves(tree, index, stack, result);
+            }
+            else
+            {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+    }
+
+    static void QuerySphere(const AABBTree& tree, const vec4& sphere, std::vector<u32>& result)
+    {
+        if (tree.root == AABB_TREE_NULL_NODE)
+            return;
+
+        vec3 center = vec3(sphere);
+        f32 radiusSq = sphere.w * sphere.w;
+
+        std::vector<u32> stack;
+        stack.reserve(64);
+        stack.push_back(tree.root);
+        while (!stack.empty())
+        {
+            const AABBTreeNode& node = tree.nodes[stack.back()];
+            stack.pop_back();
+
+            vec3 closest = glm::clamp(center, node.box.min, node.box.max);
+            if (glm::dot(closest - center, closest - center) > radiusSq)
+                continue;
+
+            if (node.IsLeaf())
+            {
+                result.push_back(node.userData);
+            }
+            else
+            {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+    }
+
+    // Slab test, returns the entry distance or FLT_MAX on miss
+    static f32 RayBox(const vec3& origin, const vec3& invDirection, f32 maxDistance, const AABB& box)
+    {
+        vec3 t0 = (box.min - origin) * invDirection;
+        vec3 t1 = (box.max - origin) * invDirection;
+        vec3 tNear = glm::min(t0, t1);
+        vec3 tFar = glm::max(t0, t1);
+        f32 enter = glm::max(glm::max(tNear.x, tNear.y), glm::max(tNear.z, 0.0f));
+        f32 exit = glm::min(glm::min(tFar.x, tFar.y), glm::min(tFar.z, maxDistance));
+        return enter <= exit ? enter : FLT_MAX;
+    }
+
+    static RayHit QueryRay(const AABBTree& tree, const Ray& ray)
+    {
+        RayHit hit = { AABB_TREE_NULL_NODE, ray.maxDistance };
+        if (tree.root == AABB_TREE_NULL_NODE)
+            return hit;
+
+        vec3 invDirection = 1.0f / ray.direction;
+
+        std::vector<u32> stack;
+        stack.reserve(64);
+        stack.push_back(tree.root);
+        while (!stack.empty())
+        {
+            const AABBTreeNode& node = tree.nodes[stack.back()];
+            stack.pop_back();
+
+            f32 distance = RayBox(ray.origin, invDirection, hit.distance, node.box);
+            if (distance == FLT_MAX)
+                continue;
+
+            if (node.IsLeaf())
+            {
+                hit.userData = node.userData;
+                hit.distance = distance;
+                continue;
+            }
+
+            // Visit the nearest child first so the farther one is more likely to be skipped
+            f32 leftDistance = RayBox(ray.origin, invDirection, hit.distance, tree.nodes[node.left].box);
+            f32 rightDistance = RayBox(ray.origin, invDirection, hit.distance, tree.nodes[node.right].box);
+            if (leftDistance < rightDistance)
+            {
+                if (rightDistance != FLT_MAX) stack.push_back(node.right);
+                stack.push_back(node.left);
+            }
+            else
+            {
+                if (leftDistance != FLT_MAX) stack.push_back(node.left);
+                if (rightDistance != FLT_MAX) stack.push_back(node.right);
+            }
+        }
+        return hit;
+    }
+
+    void QueryFrustums(const AABBTree& tree, const Frustum* frustums, u32 count, std::vector<u32>* results)
+    {
+        JobSystem::ParallelFor(count, 1, [&](u32 begin, u32 end)
+        {
+            for (u32 i = begin; i < end; ++i)
+                QueryFrustum(tree, frustums[i], results[i]);
+        });
+    }
+
+    void QuerySpheres(const AABBTree& tree, const vec4* spheres, u32 count, std::vector<u32>* results)
+    {
+        JobSystem::ParallelFor(count, 16, [&](u32 begin, u32 end)
+        {
+            for (u32 i = begin; i < end; ++i)
+                QuerySphere(tree, spheres[i], results[i]);
+        });
+    }
+
+    void QueryRays(const AABBTree& tree, const Ray* rays, u32 count, RayHit* hits)
+    {
+        JobSystem::ParallelFor(count, 64, [&](u32 begin, u32 end)
+        {
+            for (u32 i = begin; i < end; ++i)
+                hits[i] = QueryRay(tree, rays[i]);
+        });
+    }
+}
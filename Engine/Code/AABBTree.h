@@ -0,0 +1,91 @@
+#ifndef AABB_TREE_FUNC
+#define AABB_TREE_FUNC
+
+#include "Globals.h"
+#include "Culling.h"
+
+#define AABB_TREE_NULL_NODE 0xFFFFFFFFu
+
+// Leaves are enlarged by this fraction of their size so small moves don't touch the tree
+#define AABB_TREE_FAT_MARGIN 0.1f
+
+// A rebuild is triggered when the tree cost grows this much over the last rebuild
+#define AABB_TREE_REBUILD_RATIO 1.5f
+
+#define AABB_TREE_SAH_BINS 12
+
+struct AABB
+{
+    vec3 min;
+    vec3 max;
+};
+
+struct AABBTreeNode
+{
+    AABB box;
+    u32  parent;    // next free node when the node is in the free list
+    u32  left;
+    u32  right;
+    u32  userData;  // only meaningful for leaves
+    bool dirty;
+
+    bool IsLeaf() const { return left == AABB_TREE_NULL_NODE; }
+};
+
+struct AABBTree
+{
+    std::vector<AABBTreeNode> nodes;
+    u32 root = AABB_TREE_NULL_NODE;
+    u32 freeList = AABB_TREE_NULL_NODE;
+    u32 leafCount = 0;
+
+    std::vector<u32> dirtyLeaves;
+    f32 costAfterRebuild = 0.0f;
+    u32 rebuildCount = 0;
+};
+
+struct Ray
+{
+    vec3 origin;
+    vec3 direction;
+    f32  maxDistance;
+};
+
+struct RayHit
+{
+    u32 userData;   // AABB_TREE_NULL_NODE when nothing was hit
+    f32 distance;
+};
+
+namespace BVH
+{
+    // Inserts a leaf with a fattened copy of the box, returns its proxy id
+    u32 CreateProxy(AABBTree& tree, const AABB& box, u32 userData);
+
+    void DestroyProxy(AABBTree& tree, u32 proxy);
+
+    // Updates a leaf. When the new box leaves the fat box the leaf is enlarged in place and
+    // its ancestors are refitted on the next Refit. Returns true if the tree was touched.
+    bool MoveProxy(AABBTree& tree, u32 proxy, const AABB& box);
+
+    // Recomputes the ancestors of the moved leaves and rebuilds the whole tree
+    // with SAH when its quality degraded too much
+    void Refit(AABBTree& tree);
+
+    // Top down binned SAH build over the current leaves
+    void Rebuild(AABBTree& tree);
+
+    // Sum of the surface areas of the internal nodes
+    f32 Cost(const AABBTree& tree);
+
+    // Batched queries, every query appends the userData of the leaves it touches to its own result list.
+    // Big batches are split across the worker threads.
+    void QueryFrustums(const AABBTree& tree, const Frustum* frustums, u32 count, std::vector<u32>* results);
+
+    void QuerySpheres(const AABBTree& tree, const vec4* spheres, u32 count, std::vector<u32>* results);
+
+    // Closest leaf box hit by every ray
+    void QueryRays(const AABBTree& tree, const Ray* rays, u32 count, RayHit* hits);
+}
+
+#endif // !AABB_TREE_FUNC
@@ -1,4 +1,5 @@
 #include "BufferSupFuncs.h"
+#include "RenderStats.h"
 
 namespace BufferManager
 {
@@ -56,5 +57,6 @@ namespace BufferManager
         AlignHead(buffer, alignment);
         memcpy((u8*)buffer.data + buffer.head, data, size);
         buffer.head += size;
+        GlobalRenderStats.mappedBytes += size;
     }
 }
@@ -0,0 +1,334 @@
+#include "engine.h"
+#include "CascadedShadows.h"
+
+#include <algorithm>
+
+namespace CascadedShadows
+{
+    static const char* CascadeScopeNames[SHADOW_MAX_CASCADES] = { "Cascade 0", "Cascade 1", "Cascade 2", "Cascade 3" };
+
+    // Region and casters a cascade would be rendered with this frame
+    struct CascadeFit
+    {
+        vec3      center;
+        f32       radius;
+        glm::mat4 viewProjection;
+        Frustum   casterFrustum;
+        u64       casterHash;
+        std::vector<ShadowCaster> casters;
+    };
+
+    static void AllocateDepthArray(CascadedShadowMap& shadows)
+    {
+        if (shadows.depthArray != 0)
+            glDeleteTextures(1, &shadows.depthArray);
+
+        glGenTextures(1, &shadows.depthArray);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadows.depthArray);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, shadows.resolution, shadows.resolution, shadows.cascadeCount);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        f32 border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        shadows.allocatedResolution = shadows.resolution;
+        shadows.allocatedCascadeCount = shadows.cascadeCount;
+        for (ShadowCascade& cascade : shadows.cascades)
+            cascade.rendered = false;
+    }
+
+    void Init(App* app)
+    {
+        CascadedShadowMap& shadows = app->cascadedShadows;
+        shadows.casterProgramIdx = LoadProgram(app, "DepthPrePass.glsl", "SHADOW_CASTER");
+        const Program& casterProgram = app->programs[shadows.casterProgramIdx];
+        shadows.casterProgram_uWorldLightViewProjection = glGetUniformLocation(casterProgram.handle, "uWorldLightViewProjection");
+
+        glGenFramebuffers(1, &shadows.framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadows.framebuffer);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        AllocateDepthArray(shadows);
+        shadows.lightIndex = -1;
+    }
+
+    static glm::mat4 LightView(const vec3& lightDirection, const vec3& eye)
+    {
+        vec3 up = glm::abs(lightDirection.y) > 0.99f ? vec3(1.0f, 0.0f, 0.0f) : vec3(0.0f, 1.0f, 0.0f);
+        return glm::lookAt(eye, eye - lightDirection, up);
+    }
+
+    // Orthographic projection around the sphere, looking along the light. The center moves in whole
+    // texels so the shadow edges don't shimmer when the camera moves.
+    static void FitCascade(const CascadedShadowMap& shadows, vec3 center, f32 radius, CascadeFit& fit)
+    {
+        glm::mat4 rotation = LightView(shadows.lightDirection, vec3(0.0f));
+        vec3 lightSpaceCenter = vec3(rotation * vec4(center, 1.0f));
+        f32 texelSize = 2.0f * radius / shadows.resolution;
+        lightSpaceCenter.x = floorf(lightSpaceCenter.x / texelSize) * texelSize;
+        lightSpaceCenter.y = floorf(lightSpaceCenter.y / texelSize) * texelSize;
+
+        fit.center = vec3(glm::inverse(rotation) * vec4(lightSpaceCenter, 1.0f));
+        fit.radius = radius;
+
+        glm::mat4 view = LightView(shadows.lightDirection, fit.center + shadows.lightDirection * radius);
+        glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * radius);
+        fit.viewProjection = projection * view;
+
+        // Casters behind the near plane still shadow the region, depth clamp flattens them onto it
+        fit.casterFrustum = Culling::ExtractFrustum(fit.viewProjection);
+        fit.casterFrustum.planes[4] = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    }
+
+    u64 FindCasters(App* app, const Frustum& frustum, const std::vector<u32>& candidates, std::vector<ShadowCaster>& casters)
+    {
+        casters.clear();
+        u64 hash = HASH_SEED;
+        const EntityStorage& entities = app->entities;
+        for (u32 e : candidates)
+        {
+            u32 submeshCount = app->meshes[app->models[entities.modelIndices[e]].meshIdx].submeshes.size();
+            for (u32 i = 0; i < submeshCount; ++i)
+            {
+                if (!Culling::IsItemVisible(frustum, app->cullingSet, entities.cullItemOffsets[e] + i))
+                    continue;
+
+                casters.push_back({ e, i });
+                hash = HashBytes(hash, &e, sizeof(e));
+                hash = HashBytes(hash, &i, sizeof(i));
+                hash = HashBytes(hash, &entities.modelIndices[e], sizeof(u32));
+                hash = HashBytes(hash, glm::value_ptr(entities.worldMatrices[e]), sizeof(glm::mat4));
+            }
+        }
+        return hash;
+    }
+
+    u32 RenderCasters(App* app, const std::vector<ShadowCaster>& casters, const glm::mat4& viewProjection, GLint worldViewProjectionLocation)
+    {
+        const EntityStorage& entities = app->entities;
+        for (const ShadowCaster& caster : casters)
+        {
+            const SubMesh& submesh = app->meshes[app->models[entities.modelIndices[caster.entity]].meshIdx].submeshes[caster.submesh];
+
+            glm::mat4 worldViewProjection = viewProjection * entities.worldMatrices[caster.entity];
+            glUniformMatrix4fv(worldViewProjectionLocation, 1, GL_FALSE, glm::value_ptr(worldViewProjection));
+            glBindVertexArray(submesh.depthOnlyVao);
+            glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+        }
+        return casters.size();
+    }
+
+    static void Commit(CascadedShadowMap& shadows, u32 index, CascadeFit& fit)
+    {
+        ShadowCascade& cascade = shadows.cascades[index];
+        cascade.center = fit.center;
+        cascade.radius = fit.radius;
+        cascade.viewProjection = fit.viewProjection;
+        cascade.casterFrustum = fit.casterFrustum;
+        cascade.casterHash = fit.casterHash;
+        cascade.casters.swap(fit.casters);
+        cascade.rendered = true;
+        cascade.scheduled = true;
+        cascade.lastRenderFrame = shadows.frame;
+        shadows.renderedCascadeCount++;
+    }
+
+    void Update(App* app)
+    {
+        PROFILE_SCOPE("Shadow cascades");
+        CascadedShadowMap& shadows = app->cascadedShadows;
+        shadows.frame++;
+        shadows.renderedCascadeCount = 0;
+        for (ShadowCascade& cascade : shadows.cascades)
+            cascade.scheduled = false;
+
+        shadows.lightIndex = -1;
+        for (u32 i = 0; i < app->lights.size() && shadows.enabled; ++i)
+        {
+            if (app->lights[i].type == LightType_Directional && glm::length(app->lights[i].direction) > 1e-6f)
+            {
+                shadows.lightIndex = i;
+                break;
+            }
+        }
+        if (shadows.lightIndex < 0)
+            return;
+
+        shadows.cascadeCount = glm::clamp(shadows.cascadeCount, 1u, (u32)SHADOW_MAX_CASCADES);
+        if (shadows.resolution != shadows.allocatedResolution || shadows.cascadeCount != shadows.allocatedCascadeCount)
+            AllocateDepthArray(shadows);
+
+        vec3 lightDirection = glm::normalize(app->lights[shadows.lightIndex].direction);
+        if (glm::dot(lightDirection, shadows.lightDirection) < 0.99999f)
+        {
+            shadows.lightDirection = lightDirection;
+            for (ShadowCascade& cascade : shadows.cascades)
+                cascade.rendered = false;
+        }
+
+        // Practical split scheme, a blend of uniform and logarithmic splits
+        f32 nearPlane = app->cameraNear;
+        f32 farPlane = glm::min(shadows.maxDistance, app->cameraFar);
+        for (u32 i = 0; i <= shadows.cascadeCount; ++i)
+        {
+            f32 f = (f32)i / shadows.cascadeCount;
+            f32 uniformSplit = nearPlane + (farPlane - nearPlane) * f;
+            f32 logSplit = nearPlane * powf(farPlane / nearPlane, f);
+            shadows.splits[i] = glm::mix(uniformSplit, logSplit, shadows.splitLambda);
+        }
+
+        // The edges of the view frustum go from the camera to the far corners, view depth grows linearly along them
+        glm::mat4 inverseViewProjection = glm::inverse(app->projectionMatrix * app->viewMatrix);
+        vec3 farCorners[4];
+        for (u32 i = 0; i < 4; ++i)
+        {
+            vec4 corner = inverseViewProjection * vec4(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, 1.0f, 1.0f);
+            farCorners[i] = vec3(corner) / corner.w;
+        }
+
+        CascadeFit fits[SHADOW_MAX_CASCADES];
+        Frustum frustums[SHADOW_MAX_CASCADES];
+        bool refit[SHADOW_MAX_CASCADES];
+        for (u32 c = 0; c < shadows.cascadeCount; ++c)
+        {
+            vec3 corners[8];
+            for (u32 i = 0; i < 4; ++i)
+            {
+                vec3 edge = farCorners[i] - app->cameraPosition;
+                corners[i] = app->cameraPosition + edge * (shadows.splits[c] / app->cameraFar);
+                corners[i + 4] = app->cameraPosition + edge * (shadows.splits[c + 1] / app->cameraFar);
+            }
+
+            // The bounding sphere of the slice doesn't change with the camera orientation, nor does the texel size.
+            // The radius is rounded up so float noise doesn't change it either.
+            vec3 center = vec3(0.0f);
+            for (const vec3& corner : corners)
+                center += corner / 8.0f;
+            f32 radius = 0.0f;
+            for (const vec3& corner : corners)
+                radius = glm::max(radius, glm::distance(center, corner));
+            radius = ceilf(radius * 16.0f) / 16.0f;
+
+            const ShadowCascade& cascade = shadows.cascades[c];
+            if (c >= shadows.firstCachedCascade)
+            {
+                // Cached cascades keep their region while it still contains the slice
+                refit[c] = !cascade.rendered || glm::distance(center, cascade.center) + radius > cascade.radius;
+                if (refit[c])
+                    FitCascade(shadows, center, radius * (1.0f + shadows.cachePadding), fits[c]);
+            }
+            else
+            {
+                FitCascade(shadows, center, radius, fits[c]);
+                refit[c] = !cascade.rendered || fits[c].center != cascade.center || fits[c].radius != cascade.radius;
+            }
+
+            if (!refit[c])
+            {
+                fits[c].center = cascade.center;
+                fits[c].radius = cascade.radius;
+                fits[c].viewProjection = cascade.viewProjection;
+                fits[c].casterFrustum = cascade.casterFrustum;
+            }
+            frustums[c] = fits[c].casterFrustum;
+        }
+
+        // Per cascade caster culling, entities from the BVH then their submeshes
+        std::vector<u32> candidates[SHADOW_MAX_CASCADES];
+        BVH::QueryFrustums(app->entityTree, frustums, shadows.cascadeCount, candidates);
+
+        std::vector<u32> pending;
+        for (u32 c = 0; c < shadows.cascadeCount; ++c)
+        {
+            // Tree rebuilds reorder the results, the hash must not see it
+            std::sort(candidates[c].begin(), candidates[c].end());
+            fits[c].casterHash = FindCasters(app, fits[c].casterFrustum, candidates[c], fits[c].casters);
+
+            const ShadowCascade& cascade = shadows.cascades[c];
+            if (!refit[c] && fits[c].casterHash == cascade.casterHash)
+                continue;
+
+            // A layer holding nothing valid, or a near one, can't wait
+            if (!cascade.rendered || c < shadows.firstCachedCascade)
+                Commit(shadows, c, fits[c]);
+            else
+                pending.push_back(c);
+        }
+
+        // Time slicing: the layers that waited longest are refreshed first, the others keep their
+        // previous content and matrices, which stay consistent with each other
+        std::sort(pending.begin(), pending.end(), [&](u32 a, u32 b) { return shadows.cascades[a].lastRenderFrame < shadows.cascades[b].lastRenderFrame; });
+        for (u32 i = 0; i < pending.size() && i < shadows.cachedUpdatesPerFrame; ++i)
+            Commit(shadows, pending[i], fits[pending[i]]);
+    }
+
+    void Render(App* app)
+    {
+        CascadedShadowMap& shadows = app->cascadedShadows;
+        shadows.casterDrawCount = 0;
+        if (shadows.lightIndex < 0 || shadows.renderedCascadeCount == 0)
+            return;
+
+        const Program& casterProgram = app->programs[shadows.casterProgramIdx];
+        glUseProgram(casterProgram.handle);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadows.framebuffer);
+        glViewport(0, 0, shadows.resolution, shadows.resolution);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_DEPTH_CLAMP);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 1.0f);
+
+        for (u32 c = 0; c < shadows.cascadeCount; ++c)
+        {
+            const ShadowCascade& cascade = shadows.cascades[c];
+            if (!cascade.scheduled)
+                continue;
+
+            GPU_SCOPE(app->gpuProfiler, CascadeScopeNames[c]);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadows.depthArray, 0, c);
+            f32 clearDepth = 1.0f;
+            glClearBufferfv(GL_DEPTH, 0, &clearDepth);
+
+            shadows.casterDrawCount += RenderCasters(app, cascade.casters, cascade.viewProjection, shadows.casterProgram_uWorldLightViewProjection);
+        }
+
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_DEPTH_CLAMP);
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+
+    void Bind(App* app, const Program& program, u32 textureUnit)
+    {
+        const CascadedShadowMap& shadows = app->cascadedShadows;
+        glActiveTexture(GL_TEXTURE0 + textureUnit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, shadows.depthArray);
+        glUniform1i(glGetUniformLocation(program.handle, "uShadowMap"), textureUnit);
+
+        u32 cascadeCount = shadows.lightIndex >= 0 ? shadows.cascadeCount : 0;
+        glUniform1i(glGetUniformLocation(program.handle, "uShadowCascadeCount"), cascadeCount);
+        if (cascadeCount == 0)
+            return;
+
+        // From clip space to texture space
+        glm::mat4 bias = glm::translate(vec3(0.5f)) * glm::scale(vec3(0.5f));
+        glm::mat4 matrices[SHADOW_MAX_CASCADES];
+        f32 texelSizes[SHADOW_MAX_CASCADES];
+        for (u32 c = 0; c < cascadeCount; ++c)
+        {
+            matrices[c] = bias * shadows.cascades[c].viewProjection;
+            texelSizes[c] = 2.0f * shadows.cascades[c].radius / shadows.resolution;
+        }
+        glUniformMatrix4fv(glGetUniformLocation(program.handle, "uShadowMatrices"), cascadeCount, GL_FALSE, glm::value_ptr(matrices[0]));
+        glUniform1fv(glGetUniformLocation(program.handle, "uShadowTexelSizes"), cascadeCount, texelSizes);
+    }
+}
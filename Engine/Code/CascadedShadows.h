@@ -0,0 +1,89 @@
+#ifndef CASCADED_SHADOWS_FUNC
+#define CASCADED_SHADOWS_FUNC
+
+#include "Globals.h"
+#include "Culling.h"
+
+struct App;
+
+// Must match FB_TO_BB.glsl
+#define SHADOW_MAX_CASCADES 4
+
+struct ShadowCaster
+{
+    u32 entity;
+    u32 submesh;
+};
+
+struct ShadowCascade
+{
+    // Region the layer was last rendered for
+    vec3      center;
+    f32       radius;
+    glm::mat4 viewProjection;
+    Frustum   casterFrustum; // without near plane, casters between the light and the region are clamped onto it
+
+    u64  casterHash;  // entities and transforms of the casters inside casterFrustum
+    bool rendered;    // the layer holds something for the current light and settings
+    bool scheduled;   // rendered this frame
+    u32  lastRenderFrame;
+
+    std::vector<ShadowCaster> casters; // drawn when scheduled
+};
+
+// Shadows of the first directional light. The view frustum is split in cascades rendered into
+// the layers of a depth array. Every layer keeps its content until its region, its casters or
+// the light change; the far ones are fitted with some room to spare and refreshed one per frame.
+struct CascadedShadowMap
+{
+    bool enabled = true;
+    u32  cascadeCount = 4;
+    u32  resolution = 2048;
+    f32  maxDistance = 80.0f;    // shadows end here, or at the camera far plane
+    f32  splitLambda = 0.75f;    // 0 uniform splits, 1 logarithmic
+    u32  firstCachedCascade = 2; // this one and the following are fitted with padding and time sliced
+    f32  cachePadding = 0.25f;   // extra radius of the cached cascades
+    u32  cachedUpdatesPerFrame = 1;
+
+    GLuint depthArray;
+    GLuint framebuffer;
+    u32    allocatedResolution;
+    u32    allocatedCascadeCount;
+
+    u32 casterProgramIdx;
+    GLint casterProgram_uWorldLightViewProjection;
+
+    i32  lightIndex;  // -1 when there is no directional light
+    vec3 lightDirection;
+    f32  splits[SHADOW_MAX_CASCADES + 1]; // view depths
+    ShadowCascade cascades[SHADOW_MAX_CASCADES];
+    u32  frame;
+
+    // Stats of the last frame
+    u32 renderedCascadeCount;
+    u32 casterDrawCount;
+};
+
+namespace CascadedShadows
+{
+    void Init(App* app);
+
+    // Fits the cascades to the camera, culls their casters and decides which layers are rendered
+    // this frame. Runs after the entity bounds are updated.
+    void Update(App* app);
+
+    // Depth only draw of the scheduled cascades
+    void Render(App* app);
+
+    // Shadow map and cascade uniforms of the lighting shaders. Without shadows the cascade count is 0.
+    void Bind(App* app, const Program& program, u32 textureUnit);
+
+    // Submeshes of the candidate entities inside the frustum, returns a hash of them and their transforms.
+    // Shared with the point light shadows.
+    u64 FindCasters(App* app, const Frustum& frustum, const std::vector<u32>& candidates, std::vector<ShadowCaster>& casters);
+
+    // Draws the casters with the bound depth only program, returns the number of draws
+    u32 RenderCasters(App* app, const std::vector<ShadowCaster>& casters, const glm::mat4& viewProjection, GLint worldViewProjectionLocation);
+}
+
+#endif // !CASCADED_SHADOWS_FUNC
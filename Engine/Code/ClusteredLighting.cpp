@@ -0,0 +1,126 @@
+#include "engine.h"
+#include "ClusteredLighting.h"
+
+#define CLUSTER_BUILD_GROUP_SIZE 64
+
+namespace ClusteredLighting
+{
+    static void CreateLightBuffer(ClusteredLights& clustered, u32 capacity)
+    {
+        if (clustered.lightCapacity != 0)
+            glDeleteBuffers(1, &clustered.lights.handle);
+
+        clustered.lightCapacity = capacity;
+        clustered.lights = BufferManager::CreateBuffer(capacity * sizeof(LightData), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+    }
+
+    void Init(App* app)
+    {
+        ClusteredLights& clustered = app->clusteredLights;
+        clustered.buildProgramIdx = LoadComputeProgram(app, "ClusteredLighting.glsl", "CLUSTER_BUILD");
+        clustered.shadeProgramIdx = LoadProgram(app, "FB_TO_BB.glsl", "FB_TO_BB_CLUSTERED");
+
+        CreateLightBuffer(clustered, 64);
+        clustered.clusterLightCounts = BufferManager::CreateBuffer(CLUSTER_COUNT * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+        clustered.clusterLightIndices = BufferManager::CreateBuffer(CLUSTER_COUNT * CLUSTER_MAX_LIGHTS * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+    }
+
+    void UploadLights(App* app)
+    {
+        ClusteredLights& clustered = app->clusteredLights;
+        clustered.lightCount = app->lights.size();
+        clustered.directionalLightCount = 0;
+        if (clustered.lightCount == 0)
+            return;
+
+        if (clustered.lightCount > clustered.lightCapacity)
+            CreateLightBuffer(clustered, clustered.lightCount + clustered.lightCount / 2);
+
+        // Directional lights first, they are applied to every pixel
+        BufferManager::MapBuffer(clustered.lights, GL_WRITE_ONLY);
+        for (u32 pass = 0; pass < 2; ++pass)
+        {
+            LightType type = pass == 0 ? LightType_Directional : LightType_Point;
+            for (u32 i = 0; i < app->lights.size(); ++i)
+            {
+                const Light& light = app->lights[i];
+                if (light.type != type)
+                    continue;
+
+                // Point lights too dim to reach anything are left out
+                f32 radius = light.type == LightType_Point ? PointLightRadius(light) : 0.0f;
+                if (light.type == LightType_Point && radius <= 0.0f)
+                    continue;
+
+                LightData data;
+                data.color = vec4(light.color, (f32)light.type);
+                data.direction = vec4(light.direction, (f32)i);
+                data.position = vec4(light.position, radius);
+                PushData(clustered.lights, &data, sizeof(data));
+
+                if (type == LightType_Directional)
+                    ++clustered.directionalLightCount;
+            }
+        }
+        clustered.lightCount = clustered.lights.head / sizeof(LightData);
+        BufferManager::UnmapBuffer(clustered.lights);
+    }
+
+    void BuildClusters(App* app)
+    {
+        UploadLights(app);
+
+        ClusteredLights& clustered = app->clusteredLights;
+        const Program& program = app->programs[clustered.buildProgramIdx];
+        glUseProgram(program.handle);
+
+        glm::mat4 inverseProjection = glm::inverse(app->projectionMatrix);
+        glUniformMatrix4fv(glGetUniformLocation(program.handle, "uInverseProjection"), 1, GL_FALSE, glm::value_ptr(inverseProjection));
+        glUniformMatrix4fv(glGetUniformLocation(program.handle, "uView"), 1, GL_FALSE, glm::value_ptr(app->viewMatrix));
+        glUniform1ui(glGetUniformLocation(program.handle, "uLightCount"), clustered.lightCount);
+        glUniform1ui(glGetUniformLocation(program.handle, "uDirectionalLightCount"), clustered.directionalLightCount);
+        glUniform1f(glGetUniformLocation(program.handle, "uNear"), app->cameraNear);
+        glUniform1f(glGetUniformLocation(program.handle, "uFar"), app->cameraFar);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, clustered.lights.handle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, clustered.clusterLightCounts.handle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, clustered.clusterLightIndices.handle);
+
+        glDispatchCompute((CLUSTER_COUNT + CLUSTER_BUILD_GROUP_SIZE - 1) / CLUSTER_BUILD_GROUP_SIZE, 1, 1);
+
+        glUseProgram(0);
+    }
+
+    void Bind(App* app, const Program& program)
+    {
+        const ClusteredLights& clustered = app->clusteredLights;
+
+        // Maps the view depth to a slice: log(z) * scale + bias
+        f32 logDepthRange = logf(app->cameraFar / app->cameraNear);
+        glUniform1f(glGetUniformLocation(program.handle, "uSliceScale"), CLUSTER_GRID_Z / logDepthRange);
+        glUniform1f(glGetUniformLocation(program.handle, "uSliceBias"), -CLUSTER_GRID_Z * logf(app->cameraNear) / logDepthRange);
+        ivec2 viewportSize = app->dynamicResolution.internalSize;
+        glUniform2f(glGetUniformLocation(program.handle, "uTileSize"), (f32)viewportSize.x / CLUSTER_GRID_X, (f32)viewportSize.y / CLUSTER_GRID_Y);
+        glUniformMatrix4fv(glGetUniformLocation(program.handle, "uView"), 1, GL_FALSE, glm::value_ptr(app->viewMatrix));
+        glUniform1ui(glGetUniformLocation(program.handle, "uDirectionalLightCount"), clustered.directionalLightCount);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, clustered.lights.handle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, clustered.clusterLightCounts.handle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, clustered.clusterLightIndices.handle);
+    }
+
+    void Shade(App* app)
+    {
+        const Program& program = app->programs[app->clusteredLights.shadeProgramIdx];
+        glUseProgram(program.handle);
+
+        Bind(app, program);
+        app->BindGBuffer(program);
+
+        glBindVertexArray(app->vao);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef CLUSTERED_LIGHTING_FUNC
+#define CLUSTERED_LIGHTING_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+// Screen tiles x exponential depth slices
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT  (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+
+// Light indices stored per cluster, must match ClusteredLighting.glsl
+#define CLUSTER_MAX_LIGHTS 256
+
+// Light as read by the clustered shaders (std430)
+struct LightData
+{
+    vec4 color;     // w: LightType
+    vec4 direction; // w: index in App::lights
+    vec4 position;  // w: radius
+};
+
+// Lights live in an SSBO, directional lights first. A compute pass assigns the point
+// lights to the clusters they touch and the shading pass only loops over its cluster's list.
+struct ClusteredLights
+{
+    u32    lightCapacity;
+    u32    lightCount;
+    u32    directionalLightCount;
+    Buffer lights;
+    Buffer clusterLightCounts;
+    Buffer clusterLightIndices;
+
+    u32    buildProgramIdx;
+    u32    shadeProgramIdx;
+};
+
+namespace ClusteredLighting
+{
+    void Init(App* app);
+
+    // Copies App::lights to the light buffer, directional lights first. Also used by Forward+.
+    void UploadLights(App* app);
+
+    // Uploads App::lights and bins the point lights into the clusters of the current camera.
+    // The cluster buffers need a shader storage barrier before Shade reads them.
+    void BuildClusters(App* app);
+
+    // Light buffers and the uniforms mapping a pixel to its cluster, for any shader using the clustered main
+    void Bind(App* app, const Program& program);
+
+    // Full screen pass reading the G-buffer, expects the destination framebuffer to be bound
+    void Shade(App* app);
+}
+
+#endif // !CLUSTERED_LIGHTING_FUNC
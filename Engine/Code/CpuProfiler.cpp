@@ -0,0 +1,191 @@
+#include "platform.h"
+#include "CpuProfiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+namespace CpuProfiling
+{
+    // Init, the asset loading and the first frame are captured, then the profiler idles
+    std::atomic<bool> recording(true);
+    static bool capturingStartup = true;
+
+    static std::mutex                     threadsMutex;
+    static std::vector<CpuThreadEvents*>  threads;
+    static thread_local CpuThreadEvents*  localEvents = nullptr;
+
+    static u64 startTicks;
+    static f64 ticksPerMs = 1.0;
+    static u64 frameBegin;
+    static u64 lastFrameBegin;
+    static u64 lastFrameEnd;
+
+    static CpuThreadEvents* LocalEvents()
+    {
+        if (!localEvents)
+        {
+            localEvents = new CpuThreadEvents();
+            localEvents->head = 0;
+            localEvents->depth = 0;
+
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            localEvents->index = threads.size();
+            localEvents->name = "Thread " + std::to_string(localEvents->index);
+            threads.push_back(localEvents);
+        }
+        return localEvents;
+    }
+
+    void Init()
+    {
+        // rdtsc runs at a constant rate on anything recent, measure it against the steady clock
+        auto clockBegin = std::chrono::steady_clock::now();
+        u64 ticksBegin = __rdtsc();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        u64 ticksEnd = __rdtsc();
+        f64 elapsedMs = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - clockBegin).count();
+
+        ticksPerMs = (ticksEnd - ticksBegin) / elapsedMs;
+        startTicks = ticksBegin;
+        frameBegin = ticksEnd;
+        SetThreadName("Main");
+    }
+
+    void Shutdown()
+    {
+        recording = false;
+
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for (CpuThreadEvents* events : threads)
+            delete events;
+        threads.clear();
+        localEvents = nullptr;
+    }
+
+    void SetThreadName(const char* name)
+    {
+        LocalEvents()->name = name;
+    }
+
+    void BeginFrame()
+    {
+        u64 now = __rdtsc();
+        if (capturingStartup && lastFrameEnd != 0)
+        {
+            capturingStartup = false;
+            recording = false;
+        }
+        lastFrameBegin = frameBegin;
+        lastFrameEnd = now;
+        frameBegin = now;
+    }
+
+    void BeginScope()
+    {
+        LocalEvents()->depth++;
+    }
+
+    void EndScope(const char* name, u64 begin)
+    {
+        u64 end = __rdtsc();
+        CpuThreadEvents* events = localEvents;
+
+        u64 head = events->head.load(std::memory_order_relaxed);
+        CpuEvent& event = events->events[head & (CPU_PROFILER_RING_SIZE - 1)];
+        event.name = name;
+        event.begin = begin;
+        event.end = end;
+        event.depth = --events->depth;
+        events->head.store(head + 1, std::memory_order_release);
+    }
+
+    void LastFrame(u64& begin, u64& end)
+    {
+        begin = lastFrameBegin;
+        end = lastFrameEnd;
+    }
+
+    f64 TicksToMs(u64 ticks)
+    {
+        return ticks / ticksPerMs;
+    }
+
+    // Events are stored in the order they end, walk back from the newest until they end before begin
+    static void CopyRing(const CpuThreadEvents& ring, u64 begin, u64 end, std::vector<CpuEvent>& out)
+    {
+        u64 head = ring.head.load(std::memory_order_acquire);
+        u64 first = head > CPU_PROFILER_RING_SIZE ? head - CPU_PROFILER_RING_SIZE : 0;
+
+        size_t outBegin = out.size();
+        u64 i = head;
+        for (; i > first; --i)
+        {
+            const CpuEvent& event = ring.events[(i - 1) & (CPU_PROFILER_RING_SIZE - 1)];
+            if (event.end < begin)
+                break;
+            out.push_back(event);
+        }
+
+        // Drop what the owner thread may have overwritten while it was being copied. Only the events after
+        // headAfter - RING survive, that one shares its slot with the event being written at headAfter.
+        // If the writer lapped the whole copy nothing does.
+        u64 headAfter = ring.head.load(std::memory_order_acquire);
+        i64 validCount = (i64)head + CPU_PROFILER_RING_SIZE - 1 - (i64)headAfter;
+        if (validCount < (i64)(out.size() - outBegin))
+            out.resize(outBegin + (size_t)std::max<i64>(validCount, 0));
+
+        std::reverse(out.begin() + outBegin, out.end());
+        out.erase(std::remove_if(out.begin() + outBegin, out.end(), [end](const CpuEvent& event) { return event.begin > end; }), out.end());
+    }
+
+    void CopyEvents(u64 begin, u64 end, std::vector<std::string>& threadNames, std::vector<std::vector<CpuEvent>>& threadEvents)
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        threadNames.resize(threads.size());
+        threadEvents.resize(threads.size());
+        for (u32 i = 0; i < threads.size(); ++i)
+        {
+            threadNames[i] = threads[i]->name;
+            threadEvents[i].clear();
+            CopyRing(*threads[i], begin, end, threadEvents[i]);
+        }
+    }
+
+    bool ExportChromeTrace(const char* path)
+    {
+        std::vector<std::string> threadNames;
+        std::vector<std::vector<CpuEvent>> threadEvents;
+        CopyEvents(0, UINT64_MAX, threadNames, threadEvents);
+
+        FILE* file = fopen(path, "w");
+        if (!file)
+        {
+            ELOG("fopen() failed writing file %s", path);
+            return false;
+        }
+
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        bool first = true;
+        for (u32 t = 0; t < threadNames.size(); ++t)
+        {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                first ? "" : ",\n", t, threadNames[t].c_str());
+            first = false;
+
+            for (const CpuEvent& event : threadEvents[t])
+            {
+                // Microseconds since Init
+                f64 ts = TicksToMs(event.begin - startTicks) * 1000.0;
+                f64 dur = TicksToMs(event.end - event.begin) * 1000.0;
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", event.name, t, ts, dur);
+            }
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+
+        ILOG("CPU trace written to %s", path);
+        return true;
+    }
+}
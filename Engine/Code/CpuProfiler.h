@@ -0,0 +1,104 @@
+#ifndef CPU_PROFILER_FUNC
+#define CPU_PROFILER_FUNC
+
+#include "Globals.h"
+
+#include <atomic>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
+// Compiles the PROFILE_SCOPE markers in. While not recording, a marker costs one relaxed load.
+#ifndef CPU_PROFILER_ENABLED
+#define CPU_PROFILER_ENABLED 1
+#endif
+
+// Events kept per thread, must be a power of two
+#define CPU_PROFILER_RING_SIZE 16384
+
+struct CpuEvent
+{
+    const char* name; // string literal, only the pointer is stored
+    u64 begin;        // rdtsc ticks
+    u64 end;
+    u32 depth;
+};
+
+// Ring written by its own thread only. The reader checks head again after copying
+// and throws away what may have been overwritten in the meantime.
+struct CpuThreadEvents
+{
+    u32         index;
+    std::string name;
+    CpuEvent    events[CPU_PROFILER_RING_SIZE];
+    std::atomic<u64> head; // events written so far
+    u32         depth;
+};
+
+namespace CpuProfiling
+{
+    // On from Init until the first frame ends so the startup is in the trace, then off until toggled
+    // from the GUI or with O. The markers stay compiled in but idle.
+    extern std::atomic<bool> recording;
+
+    // Calibrates the tick rate and registers the calling thread as the main one
+    void Init();
+
+    // Frees the thread rings, nothing may be recorded afterwards
+    void Shutdown();
+
+    void SetThreadName(const char* name);
+
+    // Marks the start of a main thread frame
+    void BeginFrame();
+
+    // Used by CpuScope
+    void BeginScope();
+    void EndScope(const char* name, u64 begin);
+
+    // Main thread frame before the current one, in ticks
+    void LastFrame(u64& begin, u64& end);
+
+    f64 TicksToMs(u64 ticks);
+
+    // Events of every thread overlapping [begin, end], grouped by thread
+    void CopyEvents(u64 begin, u64 end, std::vector<std::string>& threadNames, std::vector<std::vector<CpuEvent>>& threadEvents);
+
+    // Everything still in the rings, in the Chrome trace event format (chrome://tracing, Perfetto)
+    bool ExportChromeTrace(const char* path);
+}
+
+struct CpuScope
+{
+    const char* name;
+    u64 begin;
+
+    CpuScope(const char* scopeName)
+    {
+        name = nullptr;
+        if (CpuProfiling::recording.load(std::memory_order_relaxed))
+        {
+            name = scopeName;
+            CpuProfiling::BeginScope();
+            begin = __rdtsc();
+        }
+    }
+
+    ~CpuScope()
+    {
+        if (name)
+            CpuProfiling::EndScope(name, begin);
+    }
+};
+
+#if CPU_PROFILER_ENABLED
+#define PROFILE_SCOPE_CONCAT_(a, b) a##b
+#define PROFILE_SCOPE_CONCAT(a, b) PROFILE_SCOPE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) CpuScope PROFILE_SCOPE_CONCAT(cpuScope, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name)
+#endif
+
+#endif // !CPU_PROFILER_FUNC
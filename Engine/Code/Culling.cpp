@@ -0,0 +1,223 @@
+#include "Culling.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <immintrin.h>
+
+namespace Culling
+{
+    Frustum ExtractFrustum(const glm::mat4& viewProjection)
+    {
+        // Gribb-Hartmann: the planes are combinations of the rows of the clip matrix
+        const glm::mat4& m = viewProjection;
+        vec4 row0 = vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+        vec4 row1 = vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+        vec4 row2 = vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+        vec4 row3 = vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        Frustum frustum = {};
+        frustum.planes[0] = row3 + row0; // left
+        frustum.planes[1] = row3 - row0; // right
+        frustum.planes[2] = row3 + row1; // bottom
+        frustum.planes[3] = row3 - row1; // top
+        frustum.planes[4] = row3 + row2; // near
+        frustum.planes[5] = row3 - row2; // far
+
+        for (u32 i = 0; i < 6; ++i)
+        {
+            f32 length = glm::length(vec3(frustum.planes[i]));
+            frustum.planes[i] /= length;
+        }
+
+        return frustum;
+    }
+
+    void ResizeCullingSet(CullingSet& set, u32 count)
+    {
+        u32 paddedCount = (count + CULLING_SIMD_WIDTH - 1) & ~(CULLING_SIMD_WIDTH - 1);
+
+        set.count = count;
+        set.centerX.assign(paddedCount, 0.0f);
+        set.centerY.assign(paddedCount, 0.0f);
+        set.centerZ.assign(paddedCount, 0.0f);
+        set.extentX.assign(paddedCount, 0.0f);
+        set.extentY.assign(paddedCount, 0.0f);
+        set.extentZ.assign(paddedCount, 0.0f);
+        set.visible.assign(paddedCount, 1);
+    }
+
+    void SetItemBounds(CullingSet& set, u32 item, const glm::mat4& world, const vec3& aabbMin, const vec3& aabbMax)
+    {
+        vec3 localCenter = (aabbMin + aabbMax) * 0.5f;
+        vec3 localExtent = (aabbMax - aabbMin) * 0.5f;
+
+        vec3 center = vec3(world * vec4(localCenter, 1.0f));
+        vec3 extent = glm::abs(vec3(world[0])) * localExtent.x +
+                      glm::abs(vec3(world[1])) * localExtent.y +
+                      glm::abs(vec3(world[2])) * localExtent.z;
+
+        set.centerX[item] = center.x;
+        set.centerY[item] = center.y;
+        set.centerZ[item] = center.z;
+        set.extentX[item] = extent.x;
+        set.extentY[item] = extent.y;
+        set.extentZ[item] = extent.z;
+    }
+
+    // An AABB is outside a plane when even its most positive corner is behind it:
+    // dot(n, c) + w + dot(|n|, e) < 0
+#if defined(__AVX__)
+    static void CullRange(const Frustum& frustum, CullingSet& set, u32 begin, u32 end)
+    {
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+        for (u32 i = begin; i < end; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(&set.centerX[i]);
+            __m256 cy = _mm256_loadu_ps(&set.centerY[i]);
+            __m256 cz = _mm256_loadu_ps(&set.centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&set.extentX[i]);
+            __m256 ey = _mm256_loadu_ps(&set.extentY[i]);
+            __m256 ez = _mm256_loadu_ps(&set.extentZ[i]);
+
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (u32 p = 0; p < 6; ++p)
+            {
+                const vec4& plane = frustum.planes[p];
+                __m256 px = _mm256_set1_ps(plane.x);
+                __m256 py = _mm256_set1_ps(plane.y);
+                __m256 pz = _mm256_set1_ps(plane.z);
+                __m256 pw = _mm256_set1_ps(plane.w);
+
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, cx), _mm256_mul_ps(py, cy)),
+                                                _mm256_add_ps(_mm256_mul_ps(pz, cz), pw));
+                __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(signMask, px), ex),
+                                                            _mm256_mul_ps(_mm256_andnot_ps(signMask, py), ey)),
+                                              _mm256_mul_ps(_mm256_andnot_ps(signMask, pz), ez));
+
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_GE_OQ));
+            }
+
+            int mask = _mm256_movemask_ps(inside);
+            for (u32 lane = 0; lane < 8; ++lane)
+                set.visible[i + lane] = (mask >> lane) & 1;
+        }
+    }
+#else
+    static void CullRange(const Frustum& frustum, CullingSet& set, u32 begin, u32 end)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+
+        for (u32 i = begin; i < end; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&set.centerX[i]);
+            __m128 cy = _mm_loadu_ps(&set.centerY[i]);
+            __m128 cz = _mm_loadu_ps(&set.centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&set.extentX[i]);
+            __m128 ey = _mm_loadu_ps(&set.extentY[i]);
+            __m128 ez = _mm_loadu_ps(&set.extentZ[i]);
+
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (u32 p = 0; p < 6; ++p)
+            {
+                const vec4& plane = frustum.planes[p];
+                __m128 px = _mm_set1_ps(plane.x);
+                __m128 py = _mm_set1_ps(plane.y);
+                __m128 pz = _mm_set1_ps(plane.z);
+                __m128 pw = _mm_set1_ps(plane.w);
+
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)),
+                                             _mm_add_ps(_mm_mul_ps(pz, cz), pw));
+                __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, px), ex),
+                                                      _mm_mul_ps(_mm_andnot_ps(signMask, py), ey)),
+                                           _mm_mul_ps(_mm_andnot_ps(signMask, pz), ez));
+
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+            }
+
+            int mask = _mm_movemask_ps(inside);
+            set.visible[i + 0] = (mask >> 0) & 1;
+            set.visible[i + 1] = (mask >> 1) & 1;
+            set.visible[i + 2] = (mask >> 2) & 1;
+            set.visible[i + 3] = (mask >> 3) & 1;
+        }
+    }
+#endif
+
+    void CullFrustum(const Frustum& frustum, CullingSet& set)
+    {
+        u32 paddedCount = (u32)set.visible.size();
+        if (set.count < CULLING_PARALLEL_THRESHOLD)
+        {
+            CullRange(frustum, set, 0, paddedCount);
+            return;
+        }
+
+        // Work in blocks of SIMD groups so no two threads write the same group
+        u32 groupCount = paddedCount / CULLING_SIMD_WIDTH;
+        JobSystem::ParallelFor(groupCount, CULLING_BATCH_SIZE / CULLING_SIMD_WIDTH, [&](u32 begin, u32 end)
+        {
+            CullRange(frustum, set, begin * CULLING_SIMD_WIDTH, end * CULLING_SIMD_WIDTH);
+        });
+    }
+
+    void CullFrustumRanges(const Frustum& frustum, CullingSet& set, std::vector<CullingRange>& ranges)
+    {
+        std::sort(ranges.begin(), ranges.end(), [](const CullingRange& a, const CullingRange& b) { return a.begin < b.begin; });
+
+        // Widen the ranges to whole SIMD groups and merge the ones sharing a group, so no two threads write it
+        std::vector<CullingRange> groups;
+        for (const CullingRange& range : ranges)
+        {
+            u32 begin = range.begin & ~(CULLING_SIMD_WIDTH - 1);
+            u32 end = (range.end + CULLING_SIMD_WIDTH - 1) & ~(CULLING_SIMD_WIDTH - 1);
+            if (!groups.empty() && begin <= groups.back().end)
+                groups.back().end = glm::max(groups.back().end, end);
+            else
+                groups.push_back({ begin, end });
+        }
+
+        JobSystem::ParallelFor(groups.size(), CULLING_BATCH_SIZE / CULLING_SIMD_WIDTH, [&](u32 begin, u32 end)
+        {
+            for (u32 i = begin; i < end; ++i)
+                CullRange(frustum, set, groups[i].begin, groups[i].end);
+        });
+
+        // Everything between the ranges, including the neighbours that shared their groups
+        u32 previousEnd = 0;
+        for (const CullingRange& range : ranges)
+        {
+            std::fill(set.visible.begin() + previousEnd, set.visible.begin() + range.begin, 0);
+            previousEnd = range.end;
+        }
+        std::fill(set.visible.begin() + previousEnd, set.visible.end(), 0);
+    }
+
+    bool IsItemVisible(const Frustum& frustum, const CullingSet& set, u32 item)
+    {
+        vec3 center(set.centerX[item], set.centerY[item], set.centerZ[item]);
+        vec3 extent(set.extentX[item], set.extentY[item], set.extentZ[item]);
+        for (u32 p = 0; p < 6; ++p)
+        {
+            const vec4& plane = frustum.planes[p];
+            f32 distance = glm::dot(vec3(plane), center) + plane.w;
+            f32 radius = glm::dot(glm::abs(vec3(plane)), extent);
+            if (distance + radius < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    bool IsSphereVisible(const Frustum& frustum, const vec3& center, f32 radius)
+    {
+        for (u32 p = 0; p < 6; ++p)
+        {
+            const vec4& plane = frustum.planes[p];
+            if (glm::dot(vec3(plane), center) + plane.w < -radius)
+                return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef CULLING_FUNC
+#define CULLING_FUNC
+
+#include "Globals.h"
+
+// Items are processed in groups of 8 by the SIMD kernel, the arrays are padded to it
+#define CULLING_SIMD_WIDTH 8
+#define CULLING_PARALLEL_THRESHOLD 4096
+#define CULLING_BATCH_SIZE 1024
+
+struct Frustum
+{
+    // Normalized planes (xyz normal pointing inside, w distance)
+    vec4 planes[6];
+};
+
+// World space bounds of every drawable item stored as a structure of arrays
+// so the kernel can test several items per instruction.
+struct CullingSet
+{
+    u32 count;
+    std::vector<f32> centerX;
+    std::vector<f32> centerY;
+    std::vector<f32> centerZ;
+    std::vector<f32> extentX;
+    std::vector<f32> extentY;
+    std::vector<f32> extentZ;
+    std::vector<u8>  visible;
+};
+
+// Consecutive items [begin, end), the submeshes of an entity
+struct CullingRange
+{
+    u32 begin;
+    u32 end;
+};
+
+namespace Culling
+{
+    Frustum ExtractFrustum(const glm::mat4& viewProjection);
+
+    void ResizeCullingSet(CullingSet& set, u32 count);
+
+    // Transforms an object space AABB by the world matrix and stores the resulting world AABB
+    void SetItemBounds(CullingSet& set, u32 item, const glm::mat4& world, const vec3& aabbMin, const vec3& aabbMax);
+
+    // Writes 1 into set.visible for every item that intersects the frustum and 0 otherwise.
+    // Large sets are split across the worker threads.
+    void CullFrustum(const Frustum& frustum, CullingSet& set);
+
+    // Same kernel over the given items only, the others get 0. Sorts the ranges, they must not overlap.
+    void CullFrustumRanges(const Frustum& frustum, CullingSet& set, std::vector<CullingRange>& ranges);
+
+    // Scalar test of a single item, for callers that only need a few of them
+    bool IsItemVisible(const Frustum& frustum, const CullingSet& set, u32 item);
+
+    // Sphere against the frustum planes, e.g. the reach of a point light
+    bool IsSphereVisible(const Frustum& frustum, const vec3& center, f32 radius);
+}
+
+#endif // !CULLING_FUNC
@@ -0,0 +1,120 @@
+#include "engine.h"
+#include "DynamicResolution.h"
+
+namespace ResolutionScaling
+{
+    void Init(App* app)
+    {
+        DynamicResolution& resolution = app->dynamicResolution;
+        resolution.enabled = true;
+        resolution.targetMs = 8.0f;
+        resolution.sharpness = 0.8f;
+        resolution.scale = 1.0f;
+        resolution.timerStarted = false;
+        resolution.upscaleProgramIdx = LoadProgram(app, "Upscale.glsl", "UPSCALE");
+        resolution.sharpenProgramIdx = LoadProgram(app, "Upscale.glsl", "SHARPEN");
+        glGenQueries(4, &resolution.queries[0][0]);
+    }
+
+    void BeginFrame(App* app)
+    {
+        DynamicResolution& resolution = app->dynamicResolution;
+        u32 slot = resolution.current;
+        // Issued two frames ago, the result is normally there already. When it isn't the sample is
+        // dropped, the slot is reissued this frame and waiting on it would stall the CPU.
+        GLint available = 0;
+        if (resolution.pending[slot])
+            glGetQueryObjectiv(resolution.queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        resolution.pending[slot] = resolution.pending[slot] && available;
+        if (resolution.pending[slot])
+        {
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(resolution.queries[slot][0], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(resolution.queries[slot][1], GL_QUERY_RESULT, &end);
+            resolution.pending[slot] = false;
+
+            f32 timeMs = (end - begin) / 1000000.0f;
+            resolution.gpuTimeMs = resolution.gpuTimeMs * 0.8f + timeMs * 0.2f;
+
+            // The cost follows the pixel count, the square of the scale of the measured frame.
+            // Drop quickly when over budget, climb back slowly.
+            f32 desired = resolution.frameScale[slot] * sqrtf(resolution.targetMs / glm::max(resolution.gpuTimeMs, 0.01f));
+            f32 delta = glm::clamp(desired - resolution.scale, -0.1f, 0.02f);
+            if (glm::abs(delta) > DYNAMIC_RESOLUTION_DEADBAND)
+                resolution.scale = glm::clamp(resolution.scale + delta, DYNAMIC_RESOLUTION_MIN_SCALE, 1.0f);
+        }
+
+        if (!resolution.enabled)
+            resolution.scale = 1.0f;
+
+        ivec2 renderSize = app->renderTargetPool.renderSize;
+        resolution.internalSize = glm::clamp(ivec2(vec2(renderSize) * resolution.scale + 0.5f), ivec2(1), renderSize);
+    }
+
+    void BeginTimer(App* app)
+    {
+        DynamicResolution& resolution = app->dynamicResolution;
+        glQueryCounter(resolution.queries[resolution.current][0], GL_TIMESTAMP);
+        resolution.timerStarted = true;
+    }
+
+    void EndTimer(App* app)
+    {
+        DynamicResolution& resolution = app->dynamicResolution;
+        if (!resolution.timerStarted)
+            return;
+        resolution.timerStarted = false;
+
+        u32 slot = resolution.current;
+        glQueryCounter(resolution.queries[slot][1], GL_TIMESTAMP);
+        resolution.pending[slot] = true;
+        resolution.frameScale[slot] = resolution.scale;
+        resolution.current ^= 1;
+    }
+
+    void AddUpscalePasses(App* app, u32 sceneColor, u32 backBuffer)
+    {
+        FrameGraph& graph = app->frameGraph;
+        u32 upscaled = FrameGraphs::CreateTexture(graph, "Upscaled", { GL_RGBA8, app->displaySize, 1 });
+
+        u32 upscalePass = FrameGraphs::AddPass(graph, "Upscale", [app, sceneColor]()
+        {
+            // Everything before this pass renders at the internal resolution
+            EndTimer(app);
+
+            const DynamicResolution& resolution = app->dynamicResolution;
+            const Program& program = app->programs[resolution.upscaleProgramIdx];
+            glUseProgram(program.handle);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, FrameGraphs::GetHandle(app->frameGraph, sceneColor));
+            glUniform1i(glGetUniformLocation(program.handle, "uInput"), 0);
+            glUniform2f(glGetUniformLocation(program.handle, "uInputSize"), (f32)resolution.internalSize.x, (f32)resolution.internalSize.y);
+            glUniform2f(glGetUniformLocation(program.handle, "uOutputSize"), (f32)app->displaySize.x, (f32)app->displaySize.y);
+
+            glBindVertexArray(app->vao);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+            glBindVertexArray(0);
+            glUseProgram(0);
+        });
+        FrameGraphs::Read(graph, upscalePass, sceneColor, FrameGraphAccess_Sampled);
+        FrameGraphs::Write(graph, upscalePass, upscaled, FrameGraphAccess_ColorAttachment);
+
+        u32 sharpenPass = FrameGraphs::AddPass(graph, "Sharpen", [app, upscaled]()
+        {
+            const DynamicResolution& resolution = app->dynamicResolution;
+            const Program& program = app->programs[resolution.sharpenProgramIdx];
+            glUseProgram(program.handle);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, FrameGraphs::GetHandle(app->frameGraph, upscaled));
+            glUniform1i(glGetUniformLocation(program.handle, "uInput"), 0);
+            glUniform1f(glGetUniformLocation(program.handle, "uSharpness"), resolution.sharpness);
+
+            glBindVertexArray(app->vao);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+            glBindVertexArray(0);
+            glUseProgram(0);
+        });
+        FrameGraphs::Read(graph, sharpenPass, upscaled, FrameGraphAccess_Sampled);
+        FrameGraphs::Write(graph, sharpenPass, backBuffer, FrameGraphAccess_ColorAttachment);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef DYNAMIC_RESOLUTION_FUNC
+#define DYNAMIC_RESOLUTION_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+// Lowest scale of renderSize, per axis
+#define DYNAMIC_RESOLUTION_MIN_SCALE 0.5f
+
+// Changes smaller than this are ignored so the resolution doesn't oscillate
+#define DYNAMIC_RESOLUTION_DEADBAND 0.02f
+
+// The deferred and visibility buffer passes render into the bottom left corner of the screen
+// sized targets. A controller measures their GPU time and resizes the corner to fit the budget,
+// an edge adaptive upscale followed by a sharpening pass brings the image back to displaySize.
+struct DynamicResolution
+{
+    bool  enabled;
+    f32   targetMs;    // GPU budget of the scaled passes
+    f32   sharpness;   // 0: none, 1: strongest
+    f32   scale;
+    ivec2 internalSize; // region of the targets rendered this frame
+
+    // Timestamps around the scaled passes, double buffered
+    GLuint queries[2][2];
+    bool   timerStarted; // the begin timestamp of this frame was issued
+    bool   pending[2];
+    f32    frameScale[2];
+    u32    current;
+    f32    gpuTimeMs;
+
+    u32 upscaleProgramIdx;
+    u32 sharpenProgramIdx;
+};
+
+namespace ResolutionScaling
+{
+    void Init(App* app);
+
+    // Reads the timing of an earlier frame, updates the scale and the internal size of this frame
+    void BeginFrame(App* app);
+
+    // Every path reaching the upscale must begin the timer before its first scaled pass. An end without
+    // a begin this frame records no sample.
+    void BeginTimer(App* app);
+    void EndTimer(App* app);
+
+    // Upscales the internalSize region of sceneColor to the back buffer
+    void AddUpscalePasses(App* app, u32 sceneColor, u32 backBuffer);
+}
+
+#endif // !DYNAMIC_RESOLUTION_FUNC
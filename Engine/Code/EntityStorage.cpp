@@ -0,0 +1,381 @@
+#include "engine.h"
+#include "EntityStorage.h"
+
+#define ENTITY_BENCHMARK_RUNS 5
+
+namespace Entities
+{
+    static void MarkDirty(EntityStorage& storage, u32 index)
+    {
+        if (storage.transformDirty[index])
+            return;
+        storage.transformDirty[index] = 1;
+        storage.dirtyEntities.push_back(index);
+    }
+
+    static void QueueUpload(EntityStorage& storage, u32 index)
+    {
+        if (storage.uploadPending[index])
+            return;
+        storage.uploadPending[index] = 1;
+        storage.uploadEntities.push_back(index);
+    }
+
+    EntityHandle Create(App* app, u32 modelIndex, const vec3& position, const glm::quat& rotation, const vec3& scale)
+    {
+        EntityStorage& storage = app->entities;
+        u32 index = storage.count++;
+
+        storage.localPositions.push_back(position);
+        storage.localRotations.push_back(rotation);
+        storage.localScales.push_back(scale);
+        storage.parents.push_back(ENTITY_INVALID_INDEX);
+        storage.firstChildren.push_back(ENTITY_INVALID_INDEX);
+        storage.nextSiblings.push_back(ENTITY_INVALID_INDEX);
+        storage.worldMatrices.push_back(glm::mat4(1.0f));
+        storage.previousWorldMatrices.push_back(glm::mat4(1.0f));
+        storage.hasHistory.push_back(0);
+        storage.transformDirty.push_back(0);
+        storage.uploadPending.push_back(0);
+        storage.modelIndices.push_back(modelIndex);
+        storage.bounds.push_back({ vec3(0.0f), vec3(0.0f) });
+        storage.proxies.push_back(AABB_TREE_NULL_NODE); // created by the first culling pass
+        storage.cullItemOffsets.push_back(0);
+        storage.visible.push_back(0);
+        MarkDirty(storage, index);
+
+        u32 slot;
+        if (!storage.freeSlots.empty())
+        {
+            slot = storage.freeSlots.back();
+            storage.freeSlots.pop_back();
+        }
+        else
+        {
+            slot = storage.slotGenerations.size();
+            storage.slotGenerations.push_back(0);
+            storage.slotIndices.push_back(ENTITY_INVALID_INDEX);
+        }
+        storage.slotIndices[slot] = index;
+        storage.denseSlots.push_back(slot);
+
+        return { slot, storage.slotGenerations[slot] };
+    }
+
+    template <typename T>
+    static void MoveLast(std::vector<T>& pool, u32 index)
+    {
+        pool[index] = pool.back();
+        pool.pop_back();
+    }
+
+    static void Unlink(EntityStorage& storage, u32 index)
+    {
+        u32 parent = storage.parents[index];
+        if (parent == ENTITY_INVALID_INDEX)
+            return;
+
+        if (storage.firstChildren[parent] == index)
+        {
+            storage.firstChildren[parent] = storage.nextSiblings[index];
+        }
+        else
+        {
+            u32 sibling = storage.firstChildren[parent];
+            while (storage.nextSiblings[sibling] != index)
+                sibling = storage.nextSiblings[sibling];
+            storage.nextSiblings[sibling] = storage.nextSiblings[index];
+        }
+        storage.parents[index] = ENTITY_INVALID_INDEX;
+        storage.nextSiblings[index] = ENTITY_INVALID_INDEX;
+    }
+
+    // Points the links to an entity at its new dense index
+    static void Relink(EntityStorage& storage, u32 from, u32 to)
+    {
+        u32 parent = storage.parents[to];
+        if (parent != ENTITY_INVALID_INDEX)
+        {
+            if (storage.firstChildren[parent] == from)
+            {
+                storage.firstChildren[parent] = to;
+            }
+            else
+            {
+                u32 sibling = storage.firstChildren[parent];
+                while (storage.nextSiblings[sibling] != from)
+                    sibling = storage.nextSiblings[sibling];
+                storage.nextSiblings[sibling] = to;
+            }
+        }
+        for (u32 child = storage.firstChildren[to]; child != ENTITY_INVALID_INDEX; child = storage.nextSiblings[child])
+            storage.parents[child] = to;
+    }
+
+    void Destroy(App* app, EntityHandle handle)
+    {
+        EntityStorage& storage = app->entities;
+        u32 index = Index(storage, handle);
+        if (index == ENTITY_INVALID_INDEX)
+            return;
+
+        // Destroying a child can move this entity, so it is found again through its handle
+        while (storage.firstChildren[index] != ENTITY_INVALID_INDEX)
+        {
+            u32 childSlot = storage.denseSlots[storage.firstChildren[index]];
+            Destroy(app, { childSlot, storage.slotGenerations[childSlot] });
+            index = Index(storage, handle);
+        }
+        Unlink(storage, index);
+
+        if (storage.proxies[index] != AABB_TREE_NULL_NODE)
+            BVH::DestroyProxy(app->entityTree, storage.proxies[index]);
+
+        // The leaf of the moved entity points at its new dense index
+        u32 last = storage.count - 1;
+        if (index != last && storage.proxies[last] != AABB_TREE_NULL_NODE)
+            app->entityTree.nodes[storage.proxies[last]].userData = index;
+
+        MoveLast(storage.localPositions, index);
+        MoveLast(storage.localRotations, index);
+        MoveLast(storage.localScales, index);
+        MoveLast(storage.parents, index);
+        MoveLast(storage.firstChildren, index);
+        MoveLast(storage.nextSiblings, index);
+        MoveLast(storage.worldMatrices, index);
+        MoveLast(storage.previousWorldMatrices, index);
+        MoveLast(storage.hasHistory, index);
+        MoveLast(storage.transformDirty, index);
+        MoveLast(storage.uploadPending, index);
+        MoveLast(storage.modelIndices, index);
+        MoveLast(storage.bounds, index);
+        MoveLast(storage.proxies, index);
+        MoveLast(storage.cullItemOffsets, index);
+        MoveLast(storage.visible, index);
+        MoveLast(storage.denseSlots, index);
+        --storage.count;
+
+        if (index != last)
+        {
+            storage.slotIndices[storage.denseSlots[index]] = index;
+            Relink(storage, last, index);
+
+            // Pending work was queued under the old index and the GPU slot changed with the dense index
+            storage.transformDirty[index] = 0;
+            storage.uploadPending[index] = 0;
+            MarkDirty(storage, index);
+        }
+        storage.slotIndices[handle.slot] = ENTITY_INVALID_INDEX;
+        ++storage.slotGenerations[handle.slot];
+        storage.freeSlots.push_back(handle.slot);
+    }
+
+    void SetParent(App* app, EntityHandle child, EntityHandle parent)
+    {
+        EntityStorage& storage = app->entities;
+        u32 index = Index(storage, child);
+        if (index == ENTITY_INVALID_INDEX)
+            return;
+
+        u32 parentIndex = Index(storage, parent);
+        for (u32 ancestor = parentIndex; ancestor != ENTITY_INVALID_INDEX; ancestor = storage.parents[ancestor])
+        {
+            if (ancestor == index)
+            {
+                ELOG("Entities::SetParent() - the parent is the entity itself or one of its descendants");
+                return;
+            }
+        }
+
+        Unlink(storage, index);
+        if (parentIndex != ENTITY_INVALID_INDEX)
+        {
+            storage.parents[index] = parentIndex;
+            storage.nextSiblings[index] = storage.firstChildren[parentIndex];
+            storage.firstChildren[parentIndex] = index;
+        }
+        MarkDirty(storage, index);
+    }
+
+    void SetLocalTransform(App* app, EntityHandle handle, const vec3& position, const glm::quat& rotation, const vec3& scale)
+    {
+        EntityStorage& storage = app->entities;
+        u32 index = Index(storage, handle);
+        if (index == ENTITY_INVALID_INDEX)
+            return;
+
+        storage.localPositions[index] = position;
+        storage.localRotations[index] = rotation;
+        storage.localScales[index] = scale;
+        MarkDirty(storage, index);
+    }
+
+    // The parent of the root is up to date, every entity below it is recomputed
+    static void UpdateSubtree(EntityStorage& storage, u32 index)
+    {
+        glm::mat4 local = glm::translate(storage.localPositions[index]) * glm::mat4_cast(storage.localRotations[index]) * glm::scale(storage.localScales[index]);
+        u32 parent = storage.parents[index];
+        glm::mat4 world = parent != ENTITY_INVALID_INDEX ? storage.worldMatrices[parent] * local : local;
+
+        storage.previousWorldMatrices[index] = storage.hasHistory[index] ? storage.worldMatrices[index] : world;
+        storage.worldMatrices[index] = world;
+        storage.hasHistory[index] = 1;
+        storage.transformDirty[index] = 0;
+        storage.movedEntities.push_back(index);
+        QueueUpload(storage, index);
+        ++storage.updatedCount;
+
+        for (u32 child = storage.firstChildren[index]; child != ENTITY_INVALID_INDEX; child = storage.nextSiblings[child])
+            UpdateSubtree(storage, child);
+    }
+
+    // Slots are only rewritten when their entity changed, a bigger buffer starts over
+    static void UploadTransforms(App* app)
+    {
+        EntityStorage& storage = app->entities;
+        if (storage.count > storage.transformCapacity)
+        {
+            if (storage.transforms.handle != 0)
+                glDeleteBuffers(1, &storage.transforms.handle);
+
+            storage.transformCapacity = glm::max(storage.count, storage.transformCapacity * 2);
+            storage.transformStride = BufferManager::Align(ENTITY_TRANSFORM_SIZE, app->uniformBlockAligment);
+            storage.transforms = BufferManager::CreateBuffer(storage.transformCapacity * storage.transformStride, GL_UNIFORM_BUFFER, GL_DYNAMIC_DRAW);
+            for (u32 i = 0; i < storage.count; ++i)
+                QueueUpload(storage, i);
+        }
+
+        glBindBuffer(GL_UNIFORM_BUFFER, storage.transforms.handle);
+        for (u32 index : storage.uploadEntities)
+        {
+            if (index >= storage.count || !storage.uploadPending[index])
+                continue;
+
+            glm::mat4 transform[2] = { storage.worldMatrices[index], storage.previousWorldMatrices[index] };
+            glBufferSubData(GL_UNIFORM_BUFFER, index * storage.transformStride, ENTITY_TRANSFORM_SIZE, transform);
+            storage.uploadPending[index] = 0;
+            ++storage.uploadedCount;
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        storage.uploadEntities.clear();
+    }
+
+    static void UpdateWorldMatrices(EntityStorage& storage)
+    {
+        storage.updatedCount = 0;
+        storage.uploadedCount = 0;
+
+        // Entities that moved last frame stop moving unless they are dirty again
+        for (u32 index : storage.movedEntities)
+        {
+            if (index >= storage.count)
+                continue;
+            storage.previousWorldMatrices[index] = storage.worldMatrices[index];
+            QueueUpload(storage, index);
+        }
+        storage.movedEntities.clear();
+
+        // From the topmost dirty ancestor, so every entity is computed once after its parent
+        for (u32 index : storage.dirtyEntities)
+        {
+            if (index >= storage.count || !storage.transformDirty[index])
+                continue;
+
+            u32 root = index;
+            for (u32 ancestor = storage.parents[index]; ancestor != ENTITY_INVALID_INDEX; ancestor = storage.parents[ancestor])
+            {
+                if (storage.transformDirty[ancestor])
+                    root = ancestor;
+            }
+            UpdateSubtree(storage, root);
+        }
+        storage.dirtyEntities.clear();
+    }
+
+    void UpdateTransforms(App* app)
+    {
+        PROFILE_SCOPE("UpdateTransforms");
+        UpdateWorldMatrices(app->entities);
+        UploadTransforms(app);
+    }
+
+    void BindTransform(App* app, u32 entityIdx)
+    {
+        const EntityStorage& storage = app->entities;
+        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), storage.transforms.handle, entityIdx * storage.transformStride, ENTITY_TRANSFORM_SIZE);
+    }
+
+    bool IsAlive(const EntityStorage& storage, EntityHandle handle)
+    {
+        return Index(storage, handle) != ENTITY_INVALID_INDEX;
+    }
+
+    u32 Index(const EntityStorage& storage, EntityHandle handle)
+    {
+        if (handle.slot >= storage.slotGenerations.size() || storage.slotGenerations[handle.slot] != handle.generation)
+            return ENTITY_INVALID_INDEX;
+        return storage.slotIndices[handle.slot];
+    }
+
+    EntityBenchmarkResult Benchmark(App* app, u32 entityCount)
+    {
+        PROFILE_SCOPE("Entity benchmark");
+        EntityBenchmarkResult result = {};
+        result.entityCount = entityCount;
+        for (u32 i = 0; i < 3; ++i)
+            result.ms[i] = FLT_MAX;
+        if (app->models.empty())
+            return result;
+
+        // The systems run on a storage, culling set and tree of their own, the scene is put back afterwards
+        EntityStorage sceneEntities = {};
+        CullingSet sceneCullingSet = {};
+        AABBTree sceneTree;
+        std::swap(app->entities, sceneEntities);
+        std::swap(app->cullingSet, sceneCullingSet);
+        std::swap(app->entityTree, sceneTree);
+        u32 sceneVisibleItemCount = app->visibleItemCount;
+
+        // A grid of the first model around the origin
+        u32 side = (u32)ceilf(sqrtf((f32)entityCount));
+        for (u32 i = 0; i < entityCount; ++i)
+        {
+            vec3 position = vec3((f32)(i % side) - side * 0.5f, 0.0f, (f32)(i / side) - side * 0.5f) * 3.0f;
+            Create(app, 0, position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), vec3(1.0f));
+        }
+        UpdateTransforms(app);
+        app->CullEntities();
+
+        // Every entity moves in every run, best of the runs for each system
+        EntityStorage& storage = app->entities;
+        for (u32 run = 0; run < ENTITY_BENCHMARK_RUNS; ++run)
+        {
+            for (u32 i = 0; i < storage.count; ++i)
+            {
+                storage.localPositions[i].y = (f32)(run + 1);
+                MarkDirty(storage, i);
+            }
+
+            f64 start = glfwGetTime();
+            UpdateWorldMatrices(storage);
+            f64 transformEnd = glfwGetTime();
+            UploadTransforms(app);
+            f64 uploadEnd = glfwGetTime();
+            app->CullEntities();
+            f64 cullEnd = glfwGetTime();
+
+            result.ms[0] = glm::min(result.ms[0], (f32)((transformEnd - start) * 1000.0));
+            result.ms[1] = glm::min(result.ms[1], (f32)((uploadEnd - transformEnd) * 1000.0));
+            result.ms[2] = glm::min(result.ms[2], (f32)((cullEnd - uploadEnd) * 1000.0));
+        }
+
+        if (storage.transforms.handle != 0)
+            glDeleteBuffers(1, &storage.transforms.handle);
+        std::swap(app->entities, sceneEntities);
+        std::swap(app->cullingSet, sceneCullingSet);
+        std::swap(app->entityTree, sceneTree);
+        app->visibleItemCount = sceneVisibleItemCount;
+
+        return result;
+    }
+}
@@ -0,0 +1,120 @@
+#ifndef ENTITY_STORAGE_FUNC
+#define ENTITY_STORAGE_FUNC
+
+#include "Globals.h"
+#include "AABBTree.h"
+#include <glm/gtc/quaternion.hpp>
+
+struct App;
+
+#define ENTITY_INVALID_INDEX 0xFFFFFFFFu
+
+// World and previous world matrix of an entity in EntityStorage::transforms, must match the LocalParams
+// block of the shaders
+#define ENTITY_TRANSFORM_SIZE (2 * sizeof(glm::mat4))
+
+// Slot of the entity and the generation the slot had when the handle was made. Destroying an entity
+// bumps the generation, so stale handles stop resolving instead of pointing at the next entity.
+struct EntityHandle
+{
+    u32 slot;
+    u32 generation;
+};
+
+// Entities as parallel component arrays indexed by a dense index in [0, count). Destroying an entity
+// moves the last one into its place, the per frame systems loop over packed arrays and only touch the
+// components they need. Dense indices change on Destroy, handles don't.
+//
+// Transforms are local to the parent. Changing one marks the entity dirty, UpdateTransforms recomputes
+// the world matrices of the dirty subtrees only and rewrites their slots of the persistent transform
+// buffer, so a still scene costs nothing per frame.
+struct EntityStorage
+{
+    u32 count;
+
+    // Local transforms and hierarchy, links are dense indices or ENTITY_INVALID_INDEX
+    std::vector<vec3>      localPositions;
+    std::vector<glm::quat> localRotations;
+    std::vector<vec3>      localScales;
+    std::vector<u32>       parents;
+    std::vector<u32>       firstChildren;
+    std::vector<u32>       nextSiblings;
+
+    // World transforms
+    std::vector<glm::mat4> worldMatrices;
+    std::vector<glm::mat4> previousWorldMatrices; // for the motion vectors, valid once hasHistory is set
+    std::vector<u8>        hasHistory;
+
+    // Dirty tracking, the lists may hold stale indices and are checked against the flags
+    std::vector<u8>  transformDirty;
+    std::vector<u32> dirtyEntities;
+    std::vector<u32> movedEntities;  // world changed this frame, their history settles next frame
+    std::vector<u8>  uploadPending;
+    std::vector<u32> uploadEntities;
+
+    // Model references
+    std::vector<u32> modelIndices;
+
+    // Bounds: world box around the submeshes, its BVH leaf and the first submesh in App::cullingSet
+    std::vector<AABB> bounds;
+    std::vector<u32>  proxies;
+    std::vector<u32>  cullItemOffsets;
+
+    // Visibility, any submesh passed the culling
+    std::vector<u8> visible;
+
+    // GPU slots: the LocalParams of dense index i start at i * transformStride
+    Buffer transforms;
+    u32    transformCapacity;
+    u32    transformStride;
+
+    // Work of the last UpdateTransforms
+    u32 updatedCount;
+    u32 uploadedCount;
+
+    // Handle slots
+    std::vector<u32> slotGenerations;
+    std::vector<u32> slotIndices;  // dense index, ENTITY_INVALID_INDEX while free
+    std::vector<u32> denseSlots;   // slot of every dense index
+    std::vector<u32> freeSlots;
+};
+
+// Milliseconds of the per frame systems when every entity moved
+struct EntityBenchmarkResult
+{
+    u32 entityCount;
+    f32 ms[3]; // world matrices of UpdateTransforms, its upload, CullEntities
+};
+
+namespace Entities
+{
+    // A root entity, its world matrix is computed by the next UpdateTransforms
+    EntityHandle Create(App* app, u32 modelIndex, const vec3& position, const glm::quat& rotation, const vec3& scale);
+
+    // Destroys the children too and removes the BVH leaves. The last entity takes the dense index of the
+    // destroyed one.
+    void Destroy(App* app, EntityHandle handle);
+
+    // An invalid parent handle makes the entity a root. The local transform is kept, so the world one
+    // follows the new parent. Parenting to a descendant is refused.
+    void SetParent(App* app, EntityHandle child, EntityHandle parent);
+
+    void SetLocalTransform(App* app, EntityHandle handle, const vec3& position, const glm::quat& rotation, const vec3& scale);
+
+    // Recomputes the dirty subtrees and uploads the changed slots, before anything reads the world matrices
+    void UpdateTransforms(App* app);
+
+    // Binds the LocalParams block of an entity
+    void BindTransform(App* app, u32 entityIdx);
+
+    bool IsAlive(const EntityStorage& storage, EntityHandle handle);
+
+    // Dense index of a live entity, ENTITY_INVALID_INDEX otherwise. Valid until the next Destroy.
+    u32 Index(const EntityStorage& storage, EntityHandle handle);
+
+    // Best of a few runs of the real systems over a grid of entities. App::entities, the culling set and
+    // the entity tree are swapped out meanwhile and restored after.
+    EntityBenchmarkResult Benchmark(App* app, u32 entityCount);
+}
+
+#endif // !ENTITY_STORAGE_FUNC
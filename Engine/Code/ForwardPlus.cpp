@@ -0,0 +1,89 @@
+#include "engine.h"
+#include "ForwardPlus.h"
+
+namespace ForwardPlus
+{
+    static void CreateTileBuffers(ForwardPlusLights& forwardPlus, u32 capacity)
+    {
+        if (forwardPlus.tileCapacity != 0)
+        {
+            glDeleteBuffers(1, &forwardPlus.tileLightCounts.handle);
+            glDeleteBuffers(1, &forwardPlus.tileLightIndices.handle);
+        }
+
+        forwardPlus.tileCapacity = capacity;
+        forwardPlus.tileLightCounts = BufferManager::CreateBuffer(capacity * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+        forwardPlus.tileLightIndices = BufferManager::CreateBuffer(capacity * FORWARD_PLUS_MAX_LIGHTS * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+    }
+
+    void Init(App* app)
+    {
+        ForwardPlusLights& forwardPlus = app->forwardPlus;
+        forwardPlus.sampleCount = 4;
+        forwardPlus.cullProgramIdx = LoadComputeProgram(app, "ForwardPlus.glsl", "FORWARD_PLUS_CULL");
+        forwardPlus.cullMultisampleProgramIdx = LoadComputeProgram(app, "ForwardPlus.glsl", "FORWARD_PLUS_CULL_MULTISAMPLE");
+        forwardPlus.shadeProgramIdx = LoadProgram(app, "RENDER_TO_BB.glsl", "RENDER_TO_BB_TILED");
+    }
+
+    void Update(App* app, ivec2 viewportSize)
+    {
+        ForwardPlusLights& forwardPlus = app->forwardPlus;
+        forwardPlus.tileCount = (viewportSize + FORWARD_PLUS_TILE_SIZE - 1) / FORWARD_PLUS_TILE_SIZE;
+
+        u32 tileCount = forwardPlus.tileCount.x * forwardPlus.tileCount.y;
+        if (tileCount > forwardPlus.tileCapacity)
+            CreateTileBuffers(forwardPlus, tileCount);
+    }
+
+    void BuildTiles(App* app, GLuint depthTexture, ivec2 viewportSize)
+    {
+        ClusteredLighting::UploadLights(app);
+
+        const ClusteredLights& clustered = app->clusteredLights;
+        const ForwardPlusLights& forwardPlus = app->forwardPlus;
+        bool multisampled = forwardPlus.sampleCount > 1;
+        const Program& program = app->programs[multisampled ? forwardPlus.cullMultisampleProgramIdx : forwardPlus.cullProgramIdx];
+        glUseProgram(program.handle);
+
+        glm::mat4 inverseProjection = glm::inverse(app->projectionMatrix);
+        glUniformMatrix4fv(glGetUniformLocation(program.handle, "uInverseProjection"), 1, GL_FALSE, glm::value_ptr(inverseProjection));
+        glUniformMatrix4fv(glGetUniformLocation(program.handle, "uView"), 1, GL_FALSE, glm::value_ptr(app->viewMatrix));
+        glUniform1ui(glGetUniformLocation(program.handle, "uLightCount"), clustered.lightCount);
+        glUniform1ui(glGetUniformLocation(program.handle, "uDirectionalLightCount"), clustered.directionalLightCount);
+        glUniform2i(glGetUniformLocation(program.handle, "uViewportSize"), viewportSize.x, viewportSize.y);
+        glUniform2i(glGetUniformLocation(program.handle, "uTileCount"), forwardPlus.tileCount.x, forwardPlus.tileCount.y);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(multisampled ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, depthTexture);
+        glUniform1i(glGetUniformLocation(program.handle, "uDepth"), 0);
+        glUniform1i(glGetUniformLocation(program.handle, "uSampleCount"), forwardPlus.sampleCount);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, clustered.lights.handle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, forwardPlus.tileLightCounts.handle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, forwardPlus.tileLightIndices.handle);
+
+        glDispatchCompute(forwardPlus.tileCount.x, forwardPlus.tileCount.y, 1);
+
+        glBindTexture(multisampled ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D, 0);
+        glUseProgram(0);
+    }
+
+    void Shade(App* app)
+    {
+        const ClusteredLights& clustered = app->clusteredLights;
+        const ForwardPlusLights& forwardPlus = app->forwardPlus;
+        const Program& program = app->programs[forwardPlus.shadeProgramIdx];
+        glUseProgram(program.handle);
+
+        glUniform1ui(glGetUniformLocation(program.handle, "uDirectionalLightCount"), clustered.directionalLightCount);
+        glUniform1i(glGetUniformLocation(program.handle, "uTileCountX"), forwardPlus.tileCount.x);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, clustered.lights.handle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, forwardPlus.tileLightCounts.handle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, forwardPlus.tileLightIndices.handle);
+
+        app->RenderGeometry(program);
+
+        glUseProgram(0);
+    }
+}
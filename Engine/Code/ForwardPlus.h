@@ -0,0 +1,47 @@
+#ifndef FORWARD_PLUS_FUNC
+#define FORWARD_PLUS_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+// Screen tile size in pixels and light indices stored per tile, must match ForwardPlus.glsl
+#define FORWARD_PLUS_TILE_SIZE 16
+#define FORWARD_PLUS_MAX_LIGHTS 256
+
+// Forward shading that scales with the light count. A depth pre-pass gives the depth range of every
+// screen tile, a compute pass keeps the point lights whose sphere touches the tile frustum between
+// those depths and the shading pass only loops over the list of its tile. Lights come from the
+// clustered lighting light buffer, directional lights are applied everywhere.
+//
+// With MSAA the color and depth targets are multisampled, the tile depth range covers every sample and
+// the color is resolved before it is presented.
+struct ForwardPlusLights
+{
+    u32    sampleCount;
+    ivec2  tileCount;
+    u32    tileCapacity;
+    Buffer tileLightCounts;
+    Buffer tileLightIndices;
+
+    u32 cullProgramIdx;
+    u32 cullMultisampleProgramIdx;
+    u32 shadeProgramIdx;
+};
+
+namespace ForwardPlus
+{
+    void Init(App* app);
+
+    // Tile grid of the viewport, grows the tile buffers when needed. Runs before the frame graph imports them.
+    void Update(App* app, ivec2 viewportSize);
+
+    // Uploads the lights and builds the light list of every tile from the depth of the pre-pass, multisampled
+    // when sampleCount > 1
+    void BuildTiles(App* app, GLuint depthTexture, ivec2 viewportSize);
+
+    // Draws the visible entities with the tiled shader, expects the pre-pass depth bound for an equal test
+    void Shade(App* app);
+}
+
+#endif // !FORWARD_PLUS_FUNC
@@ -0,0 +1,425 @@
+#include "platform.h"
+#include "FrameGraph.h"
+#include "CpuProfiler.h"
+#include "RenderStats.h"
+
+namespace FrameGraphs
+{
+    void Reset(FrameGraph& graph)
+    {
+        graph.resources.clear();
+        graph.passes.clear();
+    }
+
+    static u32 AddResource(FrameGraph& graph, const char* name, FrameGraphResourceType type, GLuint handle, const RenderTargetDesc& desc, bool imported)
+    {
+        FrameGraphResource resource = {};
+        resource.name = name;
+        resource.type = type;
+        resource.desc = desc;
+        resource.imported = imported;
+        resource.handle = handle;
+        resource.extent = desc.size;
+        graph.resources.push_back(resource);
+        return graph.resources.size() - 1;
+    }
+
+    u32 CreateTexture(FrameGraph& graph, const char* name, const RenderTargetDesc& desc)
+    {
+        return AddResource(graph, name, FrameGraphResourceType_Texture, 0, desc, false);
+    }
+
+    u32 ImportTexture(FrameGraph& graph, const char* name, GLuint handle, const RenderTargetDesc& desc)
+    {
+        return AddResource(graph, name, FrameGraphResourceType_Texture, handle, desc, true);
+    }
+
+    u32 ImportBuffer(FrameGraph& graph, const char* name, GLuint handle)
+    {
+        return AddResource(graph, name, FrameGraphResourceType_Buffer, handle, {}, true);
+    }
+
+    u32 ImportBackBuffer(FrameGraph& graph, ivec2 size)
+    {
+        return AddResource(graph, "BackBuffer", FrameGraphResourceType_BackBuffer, 0, { GL_RGBA8, size, 1 }, true);
+    }
+
+    void SetExtent(FrameGraph& graph, u32 resource, ivec2 extent)
+    {
+        graph.resources[resource].extent = extent;
+    }
+
+    void ClearColor(FrameGraph& graph, u32 resource, vec4 color)
+    {
+        graph.resources[resource].clear = true;
+        graph.resources[resource].clearColor = color;
+    }
+
+    void ClearDepthStencil(FrameGraph& graph, u32 resource, f32 depth, i32 stencil)
+    {
+        graph.resources[resource].clear = true;
+        graph.resources[resource].clearDepth = depth;
+        graph.resources[resource].clearStencil = stencil;
+    }
+
+    u32 AddPass(FrameGraph& graph, const char* name, std::function<void()> execute)
+    {
+        FrameGraphPass pass = {};
+        pass.name = name;
+        pass.execute = execute;
+        graph.passes.push_back(pass);
+        return graph.passes.size() - 1;
+    }
+
+    void Read(FrameGraph& graph, u32 pass, u32 resource, FrameGraphAccess access)
+    {
+        graph.passes[pass].reads.push_back({ resource, access });
+    }
+
+    void Write(FrameGraph& graph, u32 pass, u32 resource, FrameGraphAccess access)
+    {
+        graph.passes[pass].writes.push_back({ resource, access });
+
+        // What reaches the screen is the output of the frame
+        if (graph.resources[resource].type == FrameGraphResourceType_BackBuffer)
+            graph.passes[pass].hasSideEffects = true;
+    }
+
+    void SetSideEffects(FrameGraph& graph, u32 pass)
+    {
+        graph.passes[pass].hasSideEffects = true;
+    }
+
+    u32 AddBlitPass(FrameGraph& graph, const char* name, u32 src, u32 dst)
+    {
+        u32 pass = AddPass(graph, name, [&graph, src, dst]()
+        {
+            ivec2 srcSize = graph.resources[src].extent;
+            ivec2 dstSize = graph.resources[dst].extent;
+
+            if (graph.blitReadFramebuffer == 0)
+                glGenFramebuffers(1, &graph.blitReadFramebuffer);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, graph.blitReadFramebuffer);
+            glFramebufferTexture(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, graph.resources[src].handle, 0);
+
+            GLenum filter = srcSize == dstSize ? GL_NEAREST : GL_LINEAR;
+            glBlitFramebuffer(0, 0, srcSize.x, srcSize.y, 0, 0, dstSize.x, dstSize.y, GL_COLOR_BUFFER_BIT, filter);
+        });
+        Read(graph, pass, src, FrameGraphAccess_BlitSource);
+        Write(graph, pass, dst, FrameGraphAccess_ColorAttachment);
+        return pass;
+    }
+
+    u32 AddDepthBlitPass(FrameGraph& graph, const char* name, u32 src, u32 dst)
+    {
+        u32 pass = AddPass(graph, name, [&graph, src]()
+        {
+            ivec2 size = graph.resources[src].extent;
+
+            if (graph.blitReadFramebuffer == 0)
+                glGenFramebuffers(1, &graph.blitReadFramebuffer);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, graph.blitReadFramebuffer);
+            glFramebufferTexture(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0);
+            glFramebufferTexture(GL_READ_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, graph.resources[src].handle, 0);
+
+            glBlitFramebuffer(0, 0, size.x, size.y, 0, 0, size.x, size.y, GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT, GL_NEAREST);
+            glFramebufferTexture(GL_READ_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, 0, 0);
+        });
+        Read(graph, pass, src, FrameGraphAccess_BlitSource);
+        Write(graph, pass, dst, FrameGraphAccess_DepthAttachment);
+        return pass;
+    }
+
+    static GLbitfield BarrierBit(FrameGraphAccess access)
+    {
+        switch (access)
+        {
+        case FrameGraphAccess_Sampled:         return GL_TEXTURE_FETCH_BARRIER_BIT;
+        case FrameGraphAccess_ColorAttachment:
+        case FrameGraphAccess_DepthAttachment:
+        case FrameGraphAccess_BlitSource:      return GL_FRAMEBUFFER_BARRIER_BIT;
+        case FrameGraphAccess_Image:           return GL_SHADER_IMAGE_ACCESS_BARRIER_BIT;
+        case FrameGraphAccess_Storage:         return GL_SHADER_STORAGE_BARRIER_BIT;
+        case FrameGraphAccess_Indirect:        return GL_COMMAND_BARRIER_BIT;
+        default:                               return 0;
+        }
+    }
+
+    void Compile(FrameGraph& graph)
+    {
+        PROFILE_SCOPE("FrameGraph compile");
+        for (FrameGraphResource& resource : graph.resources)
+        {
+            resource.refCount = 0;
+            resource.firstPass = UINT32_MAX;
+            resource.lastPass = 0;
+        }
+
+        for (FrameGraphPass& pass : graph.passes)
+        {
+            pass.refCount = pass.writes.size();
+            pass.culled = false;
+            pass.barriers = 0;
+            for (const FrameGraphAccessEntry& read : pass.reads)
+                graph.resources[read.resource].refCount++;
+        }
+
+        // Cull: a resource nobody reads releases its writers, a writer left without readers releases what it reads
+        std::vector<u32> unreferenced;
+        for (u32 i = 0; i < graph.resources.size(); ++i)
+        {
+            if (graph.resources[i].refCount == 0)
+                unreferenced.push_back(i);
+        }
+
+        while (!unreferenced.empty())
+        {
+            u32 resource = unreferenced.back();
+            unreferenced.pop_back();
+
+            for (FrameGraphPass& pass : graph.passes)
+            {
+                if (pass.culled || pass.hasSideEffects)
+                    continue;
+
+                for (const FrameGraphAccessEntry& write : pass.writes)
+                {
+                    if (write.resource != resource || --pass.refCount != 0)
+                        continue;
+
+                    pass.culled = true;
+                    for (const FrameGraphAccessEntry& read : pass.reads)
+                    {
+                        if (--graph.resources[read.resource].refCount == 0)
+                            unreferenced.push_back(read.resource);
+                    }
+                    break;
+                }
+            }
+        }
+
+        // Lifetimes and barriers. Attachment writes are made visible by GL itself,
+        // only shader writes (image stores, storage buffers) need a barrier before the next access.
+        std::vector<bool> shaderWritten(graph.resources.size(), false);
+        graph.culledPassCount = 0;
+        for (u32 i = 0; i < graph.passes.size(); ++i)
+        {
+            FrameGraphPass& pass = graph.passes[i];
+            if (pass.culled)
+            {
+                graph.culledPassCount++;
+                continue;
+            }
+
+            for (u32 list = 0; list < 2; ++list)
+            {
+                for (const FrameGraphAccessEntry& entry : list == 0 ? pass.reads : pass.writes)
+                {
+                    FrameGraphResource& resource = graph.resources[entry.resource];
+                    resource.firstPass = glm::min(resource.firstPass, i);
+                    resource.lastPass = glm::max(resource.lastPass, i);
+
+                    if (shaderWritten[entry.resource])
+                        pass.barriers |= BarrierBit(entry.access);
+                }
+            }
+
+            for (const FrameGraphAccessEntry& read : pass.reads)
+                shaderWritten[read.resource] = false;
+            for (const FrameGraphAccessEntry& write : pass.writes)
+                shaderWritten[write.resource] = write.access == FrameGraphAccess_Image || write.access == FrameGraphAccess_Storage;
+        }
+    }
+
+    static bool HasStencil(GLenum internalFormat)
+    {
+        return internalFormat == GL_DEPTH24_STENCIL8 || internalFormat == GL_DEPTH32F_STENCIL8;
+    }
+
+    static GLuint FindFramebuffer(FrameGraph& graph, const std::vector<GLuint>& attachments, u32 colorCount)
+    {
+        for (FrameGraphFramebuffer& framebuffer : graph.framebuffers)
+        {
+            if (framebuffer.attachments == attachments)
+            {
+                framebuffer.lastUsedFrame = graph.frame;
+                return framebuffer.handle;
+            }
+        }
+
+        FrameGraphFramebuffer framebuffer;
+        framebuffer.attachments = attachments;
+        framebuffer.lastUsedFrame = graph.frame;
+        glGenFramebuffers(1, &framebuffer.handle);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.handle);
+
+        std::vector<GLenum> drawBuffers;
+        for (u32 i = 0; i < colorCount; ++i)
+        {
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, attachments[i], 0);
+            drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+        }
+        if (attachments.size() > colorCount)
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, attachments.back(), 0);
+        glDrawBuffers(drawBuffers.size(), drawBuffers.data());
+
+        GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
+            ELOG("Frame graph framebuffer incomplete: 0x%x", framebufferStatus);
+
+        graph.framebuffers.push_back(framebuffer);
+        return framebuffer.handle;
+    }
+
+    // Binds the attachments of the pass and clears the ones written for the first time this frame
+    static void BeginPass(FrameGraph& graph, const FrameGraphPass& pass, std::vector<bool>& written)
+    {
+        std::vector<u32> colors;
+        u32 depth = UINT32_MAX;
+        for (const FrameGraphAccessEntry& write : pass.writes)
+        {
+            if (write.access == FrameGraphAccess_ColorAttachment)
+                colors.push_back(write.resource);
+            else if (write.access == FrameGraphAccess_DepthAttachment)
+                depth = write.resource;
+        }
+        for (const FrameGraphAccessEntry& read : pass.reads)
+        {
+            if (read.access == FrameGraphAccess_DepthAttachment)
+                depth = read.resource;
+        }
+
+        if (colors.empty() && depth == UINT32_MAX)
+            return;
+
+        const FrameGraphResource& first = graph.resources[colors.empty() ? depth : colors[0]];
+        if (first.type == FrameGraphResourceType_BackBuffer)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+        else
+        {
+            std::vector<GLuint> attachments;
+            for (u32 color : colors)
+                attachments.push_back(graph.resources[color].handle);
+            if (depth != UINT32_MAX)
+                attachments.push_back(graph.resources[depth].handle);
+            glBindFramebuffer(GL_FRAMEBUFFER, FindFramebuffer(graph, attachments, colors.size()));
+        }
+        glViewport(0, 0, first.extent.x, first.extent.y);
+
+        // The back buffer always has a depth buffer, only test against it when the pass asks for it
+        if (depth != UINT32_MAX)
+            glEnable(GL_DEPTH_TEST);
+        else
+            glDisable(GL_DEPTH_TEST);
+
+        bool clearing = false;
+        for (u32 i = 0; i < colors.size(); ++i)
+        {
+            const FrameGraphResource& resource = graph.resources[colors[i]];
+            if (!resource.clear || written[colors[i]])
+                continue;
+
+            if (!clearing)
+            {
+                glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+                clearing = true;
+            }
+            glClearBufferfv(GL_COLOR, i, glm::value_ptr(resource.clearColor));
+            graph.clearCount++;
+        }
+
+        if (depth != UINT32_MAX && graph.resources[depth].clear && !written[depth])
+        {
+            const FrameGraphResource& resource = graph.resources[depth];
+            glDepthMask(GL_TRUE);
+            if (resource.type == FrameGraphResourceType_BackBuffer || HasStencil(resource.desc.internalFormat))
+            {
+                glStencilMask(0xFF);
+                glClearBufferfi(GL_DEPTH_STENCIL, 0, resource.clearDepth, resource.clearStencil);
+            }
+            else
+            {
+                glClearBufferfv(GL_DEPTH, 0, &resource.clearDepth);
+            }
+            graph.clearCount++;
+        }
+
+        for (const FrameGraphAccessEntry& write : pass.writes)
+            written[write.resource] = true;
+    }
+
+    void Execute(FrameGraph& graph, RenderTargetPool& pool, GpuProfiler& profiler)
+    {
+        PROFILE_SCOPE("FrameGraph execute");
+        graph.frame++;
+        graph.transientCount = 0;
+        graph.peakTransientCount = 0;
+        graph.clearCount = 0;
+        graph.barrierCount = 0;
+
+        std::vector<bool> written(graph.resources.size(), false);
+        u32 liveTransients = 0;
+
+        for (u32 i = 0; i < graph.passes.size(); ++i)
+        {
+            FrameGraphPass& pass = graph.passes[i];
+            if (pass.culled)
+                continue;
+
+            for (FrameGraphResource& resource : graph.resources)
+            {
+                if (!resource.imported && resource.firstPass == i)
+                {
+                    resource.handle = RenderTargets::Acquire(pool, resource.desc);
+                    graph.transientCount++;
+                    graph.peakTransientCount = glm::max(graph.peakTransientCount, ++liveTransients);
+                }
+            }
+
+            GpuProfiling::BeginScope(profiler, pass.name.c_str());
+            if (pass.barriers != 0)
+            {
+                glMemoryBarrier(pass.barriers);
+                graph.barrierCount++;
+            }
+
+            BeginPass(graph, pass, written);
+            pass.execute();
+            GpuProfiling::EndScope(profiler);
+
+            // Released right away, a later pass asking for the same description gets the same memory
+            for (FrameGraphResource& resource : graph.resources)
+            {
+                if (!resource.imported && resource.lastPass == i && resource.handle != 0)
+                {
+                    RenderTargets::Release(pool, resource.handle);
+                    liveTransients--;
+                }
+            }
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        // Dropped before the pool can delete any of their attachments and hand the name out again
+        for (size_t i = 0; i < graph.framebuffers.size();)
+        {
+            if (graph.frame - graph.framebuffers[i].lastUsedFrame >= RENDER_TARGET_EVICT_FRAMES)
+            {
+                glDeleteFramebuffers(1, &graph.framebuffers[i].handle);
+                graph.framebuffers[i] = graph.framebuffers.back();
+                graph.framebuffers.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    GLuint GetHandle(const FrameGraph& graph, u32 resource)
+    {
+        return graph.resources[resource].handle;
+    }
+}
@@ -0,0 +1,138 @@
+#ifndef FRAME_GRAPH_FUNC
+#define FRAME_GRAPH_FUNC
+
+#include "Globals.h"
+#include "RenderTargetPool.h"
+#include "GpuProfiler.h"
+
+#include <functional>
+
+// How a pass touches a resource. Decides the framebuffer attachments of the pass and the
+// memory barriers needed before it.
+enum FrameGraphAccess
+{
+    FrameGraphAccess_Sampled,         // texture() / texelFetch()
+    FrameGraphAccess_ColorAttachment, // attached in the order of the Write calls
+    FrameGraphAccess_DepthAttachment, // depth-stencil attachment, a read only attaches it for testing
+    FrameGraphAccess_Image,           // imageLoad / imageStore
+    FrameGraphAccess_Storage,         // shader storage buffer
+    FrameGraphAccess_Indirect,        // draw or dispatch indirect arguments
+    FrameGraphAccess_BlitSource,
+    FrameGraphAccess_Framebuffer,     // drawn through a framebuffer the pass binds itself, e.g. single array layers
+    FrameGraphAccess_Count
+};
+
+enum FrameGraphResourceType
+{
+    FrameGraphResourceType_Texture,
+    FrameGraphResourceType_Buffer,
+    FrameGraphResourceType_BackBuffer
+};
+
+struct FrameGraphResource
+{
+    std::string            name;
+    FrameGraphResourceType type;
+    RenderTargetDesc       desc;
+    bool                   imported; // owned outside the graph, never acquired nor released
+    GLuint                 handle;   // transient textures only have one between their first and last pass
+    ivec2                  extent;   // region holding the image, the viewport of the passes writing it
+
+    // Cleared by the first pass writing it, nothing is cleared otherwise
+    bool clear;
+    vec4 clearColor;
+    f32  clearDepth;
+    i32  clearStencil;
+
+    // Filled by Compile
+    u32 refCount;
+    u32 firstPass;
+    u32 lastPass;
+};
+
+struct FrameGraphAccessEntry
+{
+    u32              resource;
+    FrameGraphAccess access;
+};
+
+struct FrameGraphPass
+{
+    std::string name;
+    std::vector<FrameGraphAccessEntry> reads;
+    std::vector<FrameGraphAccessEntry> writes;
+    std::function<void()> execute;
+
+    bool hasSideEffects; // kept even when nothing reads what it writes
+
+    // Filled by Compile
+    u32        refCount;
+    bool       culled;
+    GLbitfield barriers;
+};
+
+struct FrameGraphFramebuffer
+{
+    std::vector<GLuint> attachments; // colors then depth
+    GLuint handle;
+    u64    lastUsedFrame;
+};
+
+// Rebuilt every frame: passes declare what they read and write, Compile culls the passes nobody
+// depends on and Execute runs the rest in declaration order. Transient textures are taken from the
+// render target pool right before their first pass and given back after their last one, so a later
+// pass asking for the same format and size reuses the memory.
+struct FrameGraph
+{
+    std::vector<FrameGraphResource> resources;
+    std::vector<FrameGraphPass>     passes;
+
+    // Framebuffers survive between frames, they are looked up by attachments
+    std::vector<FrameGraphFramebuffer> framebuffers;
+    GLuint blitReadFramebuffer;
+    u64    frame;
+
+    // Stats of the last executed frame
+    u32 culledPassCount;
+    u32 transientCount;
+    u32 peakTransientCount;
+    u32 clearCount;
+    u32 barrierCount;
+};
+
+namespace FrameGraphs
+{
+    // Drops the passes and resources of the previous frame
+    void Reset(FrameGraph& graph);
+
+    u32 CreateTexture(FrameGraph& graph, const char* name, const RenderTargetDesc& desc);
+    u32 ImportTexture(FrameGraph& graph, const char* name, GLuint handle, const RenderTargetDesc& desc);
+    u32 ImportBuffer(FrameGraph& graph, const char* name, GLuint handle);
+    u32 ImportBackBuffer(FrameGraph& graph, ivec2 size);
+
+    // Only the bottom left extent of the texture is rendered to, the whole texture is still allocated
+    void SetExtent(FrameGraph& graph, u32 resource, ivec2 extent);
+
+    void ClearColor(FrameGraph& graph, u32 resource, vec4 color);
+    void ClearDepthStencil(FrameGraph& graph, u32 resource, f32 depth, i32 stencil);
+
+    u32  AddPass(FrameGraph& graph, const char* name, std::function<void()> execute);
+    void Read(FrameGraph& graph, u32 pass, u32 resource, FrameGraphAccess access);
+    void Write(FrameGraph& graph, u32 pass, u32 resource, FrameGraphAccess access);
+    void SetSideEffects(FrameGraph& graph, u32 pass);
+
+    // Copies src into dst, scaling with linear filtering when the sizes differ
+    u32 AddBlitPass(FrameGraph& graph, const char* name, u32 src, u32 dst);
+
+    // Copies the depth and stencil of src into dst, both of the same size and format
+    u32 AddDepthBlitPass(FrameGraph& graph, const char* name, u32 src, u32 dst);
+
+    void Compile(FrameGraph& graph);
+    // Every pass runs inside a GPU scope named after it
+    void Execute(FrameGraph& graph, RenderTargetPool& pool, GpuProfiler& profiler);
+
+    // Only valid while a pass using the resource executes
+    GLuint GetHandle(const FrameGraph& graph, u32 resource);
+}
+
+#endif // !FRAME_GRAPH_FUNC
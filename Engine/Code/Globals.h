@@ -96,7 +96,14 @@ struct SubMesh
     u32 vertexOffset;
     u32 indexOffset;
 
+    // Object space bounds
+    vec3 aabbMin;
+    vec3 aabbMax;
+    vec3 sphereCenter;
+    f32  sphereRadius;
+
     std::vector<VAO> vaos;
+    GLuint depthOnlyVao; // positions only, attribute 0
 };
 
 struct Mesh
@@ -104,6 +111,7 @@ struct Mesh
     std::vector<SubMesh>    submeshes;
     GLuint                  vertexBufferHandle;
     GLuint                  indexBufferHandle;
+    GLuint                  positionBufferHandle;
 };
 
 struct Image
@@ -139,6 +147,8 @@ enum Mode
 {
    Mode_Forward,
    Mode_Deferred,
+   Mode_ForwardPlus,
+   Mode_Visibility,
    Mode_Count
 };
 
@@ -167,6 +177,17 @@ struct Material
     u32             bumpTextureIdx;
 };
 
+// FNV-1a, chain the calls from HASH_SEED
+#define HASH_SEED 14695981039346656037ull
+
+inline u64 HashBytes(u64 hash, const void* data, u32 size)
+{
+    const u8* bytes = (const u8*)data;
+    for (u32 i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
 struct Buffer 
 {
     GLsizei size;
@@ -176,14 +197,6 @@ struct Buffer
     u32 head;
 };
 
-struct Entity 
-{
-    glm::mat4 worldMatrix;
-    u32 modelIndex;
-    u32 localParamsOffset;
-    u32 localParamsSize;
-};
-
 enum LightType
 {
     LightType_Directional,
@@ -198,6 +211,39 @@ struct Light
     vec3 position;
 };
 
+// Size of the uLight array of the GlobalParams block
+#define MAX_UBO_LIGHTS 16
+
+// Point light attenuation used by every lighting shader
+#define LIGHT_ATTENUATION_CONSTANT  1.0f
+#define LIGHT_ATTENUATION_LINEAR    0.09f
+#define LIGHT_ATTENUATION_QUADRATIC 0.032f
+
+// Below this fraction of its color a light is considered to have no effect
+#define LIGHT_CUTOFF (1.0f / 256.0f)
+
+// Distance at which the attenuation of a point light drops below LIGHT_CUTOFF. 0 for a light that is
+// already below it at its center, callers skip those.
+inline f32 PointLightRadius(const Light& light)
+{
+    f32 intensity = glm::max(glm::max(light.color.r, light.color.g), light.color.b);
+    if (intensity / LIGHT_CUTOFF <= LIGHT_ATTENUATION_CONSTANT)
+        return 0.0f;
+
+    f32 c = LIGHT_ATTENUATION_CONSTANT - intensity / LIGHT_CUTOFF;
+    f32 l = LIGHT_ATTENUATION_LINEAR;
+    f32 q = LIGHT_ATTENUATION_QUADRATIC;
+    return (-l + sqrtf(l * l - 4.0f * q * c)) / (2.0f * q);
+}
+
+enum DeferredLighting
+{
+    DeferredLighting_FullScreen,
+    DeferredLighting_Clustered,
+    DeferredLighting_LightVolumes,
+    DeferredLighting_Count
+};
+
 struct FrameBuffer
 {
     GLuint fbHandle;
@@ -0,0 +1,178 @@
+#include "platform.h"
+#include "GpuProfiler.h"
+
+#include <algorithm>
+
+namespace GpuProfiling
+{
+    void Init(GpuProfiler& profiler)
+    {
+        for (GpuProfilerFrame& frame : profiler.frames)
+            glGenQueries(ARRAY_COUNT(frame.queries), frame.queries);
+    }
+
+    static u32 FindStats(GpuProfiler& profiler, const char* name)
+    {
+        for (u32 i = 0; i < profiler.stats.size(); ++i)
+        {
+            if (profiler.stats[i].name == name)
+                return i;
+        }
+
+        GpuScopeStats stats = {};
+        stats.name = name;
+        profiler.stats.push_back(stats);
+        return profiler.stats.size() - 1;
+    }
+
+    static void AddSample(GpuScopeStats& stats, f32 ms)
+    {
+        stats.lastMs = ms;
+        stats.samples[stats.nextSample] = ms;
+        stats.nextSample = (stats.nextSample + 1) % GPU_PROFILER_HISTORY;
+        stats.sampleCount = glm::min(stats.sampleCount + 1, (u32)GPU_PROFILER_HISTORY);
+
+        f32 sorted[GPU_PROFILER_HISTORY];
+        f32 sum = 0.0f;
+        for (u32 i = 0; i < stats.sampleCount; ++i)
+        {
+            sorted[i] = stats.samples[i];
+            sum += sorted[i];
+        }
+        std::sort(sorted, sorted + stats.sampleCount);
+
+        stats.minMs = sorted[0];
+        stats.avgMs = sum / stats.sampleCount;
+        stats.p99Ms = sorted[(stats.sampleCount * 99 + 99) / 100 - 1];
+    }
+
+    static void Resolve(GpuProfiler& profiler, GpuProfilerFrame& frame)
+    {
+        frame.pending = false;
+
+        for (u32 i = 0; i < frame.scopeCount * 2; ++i)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(frame.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+            {
+                profiler.droppedFrames++;
+                return;
+            }
+        }
+
+        GLuint64 frameBegin = 0;
+        profiler.timeline.clear();
+        for (u32 i = 0; i < frame.scopeCount; ++i)
+        {
+            const GpuScopeQuery& scope = frame.scopes[i];
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(frame.queries[scope.beginQuery], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(frame.queries[scope.endQuery], GL_QUERY_RESULT, &end);
+
+            // The first scope is the frame itself
+            if (i == 0)
+                frameBegin = begin;
+
+            GpuTimelineEntry entry;
+            entry.stats = scope.stats;
+            entry.depth = scope.depth;
+            entry.beginMs = (begin - frameBegin) / 1000000.0f;
+            entry.endMs = (end - frameBegin) / 1000000.0f;
+            profiler.timeline.push_back(entry);
+
+            AddSample(profiler.stats[scope.stats], entry.endMs - entry.beginMs);
+        }
+        profiler.timelineMs = profiler.timeline.empty() ? 0.0f : profiler.timeline[0].endMs;
+    }
+
+    void BeginFrame(GpuProfiler& profiler)
+    {
+        GpuProfilerFrame& frame = profiler.frames[profiler.frame % GPU_PROFILER_FRAMES];
+        if (frame.pending)
+            Resolve(profiler, frame);
+
+        frame.scopeCount = 0;
+        profiler.openScopes.clear();
+        BeginScope(profiler, "Frame");
+    }
+
+    void EndFrame(GpuProfiler& profiler)
+    {
+        EndScope(profiler);
+        ASSERT(profiler.openScopes.empty(), "GPU scope left open at the end of the frame");
+
+        profiler.frames[profiler.frame % GPU_PROFILER_FRAMES].pending = true;
+        profiler.frame++;
+    }
+
+    void BeginScope(GpuProfiler& profiler, const char* name)
+    {
+        GpuProfilerFrame& frame = profiler.frames[profiler.frame % GPU_PROFILER_FRAMES];
+        glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+
+        if (frame.scopeCount == GPU_PROFILER_MAX_SCOPES)
+        {
+            profiler.overflowedScopes++;
+            profiler.openScopes.push_back(UINT32_MAX);
+            return;
+        }
+
+        u32 index = frame.scopeCount++;
+        GpuScopeQuery& scope = frame.scopes[index];
+        scope.stats = FindStats(profiler, name);
+        scope.depth = profiler.openScopes.size();
+        scope.beginQuery = index * 2;
+        scope.endQuery = index * 2 + 1;
+        glQueryCounter(frame.queries[scope.beginQuery], GL_TIMESTAMP);
+
+        profiler.openScopes.push_back(index);
+    }
+
+    void EndScope(GpuProfiler& profiler)
+    {
+        ASSERT(!profiler.openScopes.empty(), "GPU scope ended without being begun");
+        u32 index = profiler.openScopes.back();
+        profiler.openScopes.pop_back();
+
+        if (index != UINT32_MAX)
+        {
+            GpuProfilerFrame& frame = profiler.frames[profiler.frame % GPU_PROFILER_FRAMES];
+            glQueryCounter(frame.queries[frame.scopes[index].endQuery], GL_TIMESTAMP);
+        }
+        glPopDebugGroup();
+    }
+
+    f32 AverageMs(const GpuProfiler& profiler, const char* name)
+    {
+        for (const GpuScopeStats& stats : profiler.stats)
+        {
+            if (stats.name == name)
+                return stats.avgMs;
+        }
+        return 0.0f;
+    }
+
+    bool ExportCsv(const GpuProfiler& profiler, const char* path)
+    {
+        FILE* file = fopen(path, "w");
+        if (!file)
+        {
+            ELOG("fopen() failed writing file %s", path);
+            return false;
+        }
+
+        fprintf(file, "scope,min_ms,avg_ms,p99_ms,samples...\n");
+        for (const GpuScopeStats& stats : profiler.stats)
+        {
+            fprintf(file, "%s,%.4f,%.4f,%.4f", stats.name.c_str(), stats.minMs, stats.avgMs, stats.p99Ms);
+            u32 first = (stats.nextSample + GPU_PROFILER_HISTORY - stats.sampleCount) % GPU_PROFILER_HISTORY;
+            for (u32 i = 0; i < stats.sampleCount; ++i)
+                fprintf(file, ",%.4f", stats.samples[(first + i) % GPU_PROFILER_HISTORY]);
+            fprintf(file, "\n");
+        }
+
+        fclose(file);
+        return true;
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef GPU_PROFILER_FUNC
+#define GPU_PROFILER_FUNC
+
+#include "Globals.h"
+
+// Frames in flight in the query ring, results are read this many frames after being issued
+#define GPU_PROFILER_FRAMES 4
+
+#define GPU_PROFILER_MAX_SCOPES 64
+
+// Samples kept per scope for the statistics and the timeline
+#define GPU_PROFILER_HISTORY 240
+
+struct GpuScopeStats
+{
+    std::string name;
+    f32 samples[GPU_PROFILER_HISTORY]; // ring, in ms
+    u32 sampleCount;
+    u32 nextSample;
+
+    f32 lastMs;
+    f32 minMs;
+    f32 avgMs;
+    f32 p99Ms;
+};
+
+struct GpuScopeQuery
+{
+    u32 stats;
+    u32 depth;
+    u32 beginQuery;
+    u32 endQuery;
+};
+
+struct GpuProfilerFrame
+{
+    GLuint        queries[GPU_PROFILER_MAX_SCOPES * 2];
+    GpuScopeQuery scopes[GPU_PROFILER_MAX_SCOPES];
+    u32           scopeCount;
+    bool          pending;
+};
+
+// One scope of the last resolved frame, relative to the start of the frame
+struct GpuTimelineEntry
+{
+    u32 stats;
+    u32 depth;
+    f32 beginMs;
+    f32 endMs;
+};
+
+// GL_TIMESTAMP pairs around named scopes. Each frame writes its own slot of the query ring,
+// the slot is read back when it comes around again, or dropped if the GPU still hasn't finished it.
+// Scopes are also pushed as KHR_debug groups for external tools.
+struct GpuProfiler
+{
+    GpuProfilerFrame frames[GPU_PROFILER_FRAMES];
+    u64 frame;
+    std::vector<u32> openScopes;
+
+    std::vector<GpuScopeStats>    stats;
+    std::vector<GpuTimelineEntry> timeline;
+    f32 timelineMs;
+
+    u32 droppedFrames;
+    u32 overflowedScopes;
+};
+
+namespace GpuProfiling
+{
+    void Init(GpuProfiler& profiler);
+
+    // Resolves the slot about to be reused and opens the frame scope
+    void BeginFrame(GpuProfiler& profiler);
+    void EndFrame(GpuProfiler& profiler);
+
+    void BeginScope(GpuProfiler& profiler, const char* name);
+    void EndScope(GpuProfiler& profiler);
+
+    // Average of the scope over the history, 0 if it never ran
+    f32 AverageMs(const GpuProfiler& profiler, const char* name);
+
+    // One row per scope: statistics followed by the samples, oldest first
+    bool ExportCsv(const GpuProfiler& profiler, const char* path);
+}
+
+struct GpuScope
+{
+    GpuProfiler& profiler;
+    GpuScope(GpuProfiler& profiler, const char* name) : profiler(profiler) { GpuProfiling::BeginScope(profiler, name); }
+    ~GpuScope() { GpuProfiling::EndScope(profiler); }
+};
+
+#define GPU_SCOPE_CONCAT_(a, b) a##b
+#define GPU_SCOPE_CONCAT(a, b) GPU_SCOPE_CONCAT_(a, b)
+#define GPU_SCOPE(profiler, name) GpuScope GPU_SCOPE_CONCAT(gpuScope, __LINE__)(profiler, name)
+
+#endif // !GPU_PROFILER_FUNC
@@ -0,0 +1,141 @@
+#include "JobSystem.h"
+#include "CpuProfiler.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace JobSystem
+{
+    struct ParallelJob
+    {
+        const std::function<void(u32, u32)>* func;
+        u32 count;
+        u32 batchSize;
+        u32 batchCount;
+        std::atomic<u32> nextBatch;
+        std::atomic<u32> finishedBatches;
+    };
+
+    static std::vector<std::thread> workers;
+    static std::mutex               jobMutex;
+    static std::condition_variable  jobAvailable;
+    static std::condition_variable  jobFinished;
+    static ParallelJob              currentJob;
+    static u64                      jobGeneration = 0;
+    static u32                      activeWorkers = 0;
+    static bool                     quit = false;
+
+    static void RunBatches(ParallelJob& job)
+    {
+        PROFILE_SCOPE("Job batches");
+        u32 batch = job.nextBatch.fetch_add(1);
+        while (batch < job.batchCount)
+        {
+            u32 begin = batch * job.batchSize;
+            u32 end = begin + job.batchSize < job.count ? begin + job.batchSize : job.count;
+            (*job.func)(begin, end);
+
+            job.finishedBatches.fetch_add(1);
+            batch = job.nextBatch.fetch_add(1);
+        }
+    }
+
+    static void WorkerLoop(u32 index)
+    {
+        std::string name = "Worker " + std::to_string(index);
+        CpuProfiling::SetThreadName(name.c_str());
+
+        u64 lastGeneration = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(jobMutex);
+                jobAvailable.wait(lock, [&] { return quit || jobGeneration != lastGeneration; });
+                if (quit)
+                    return;
+                lastGeneration = jobGeneration;
+                ++activeWorkers;
+            }
+
+            RunBatches(currentJob);
+
+            {
+                std::lock_guard<std::mutex> lock(jobMutex);
+                --activeWorkers;
+            }
+            jobFinished.notify_one();
+        }
+    }
+
+    void Init(u32 workerCount)
+    {
+        if (workerCount == 0)
+        {
+            u32 hardwareThreads = std::thread::hardware_concurrency();
+            workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+        }
+
+        quit = false;
+        for (u32 i = 0; i < workerCount; ++i)
+            workers.push_back(std::thread(WorkerLoop, i));
+    }
+
+    void Shutdown()
+    {
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            quit = true;
+        }
+        jobAvailable.notify_all();
+
+        for (std::thread& worker : workers)
+            worker.join();
+        workers.clear();
+    }
+
+    u32 WorkerCount()
+    {
+        return (u32)workers.size();
+    }
+
+    void ParallelFor(u32 count, u32 minBatchSize, const std::function<void(u32 begin, u32 end)>& func)
+    {
+        if (count == 0)
+            return;
+
+        u32 threadCount = WorkerCount() + 1;
+        u32 batchSize = (count + threadCount - 1) / threadCount;
+        if (batchSize < minBatchSize)
+            batchSize = minBatchSize;
+
+        // Not worth waking up anybody
+        if (batchSize >= count || workers.empty())
+        {
+            func(0, count);
+            return;
+        }
+
+        {
+            // A worker that woke up late for the previous job may still be leaving it
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobFinished.wait(lock, [] { return activeWorkers == 0; });
+
+            currentJob.func = &func;
+            currentJob.count = count;
+            currentJob.batchSize = batchSize;
+            currentJob.batchCount = (count + batchSize - 1) / batchSize;
+            currentJob.finishedBatches = 0;
+            currentJob.nextBatch = 0;
+            ++jobGeneration;
+        }
+        jobAvailable.notify_all();
+
+        RunBatches(currentJob);
+
+        // Also wait for the workers to leave the job so none of them touches the next one
+        std::unique_lock<std::mutex> lock(jobMutex);
+        jobFinished.wait(lock, [] { return currentJob.finishedBatches.load() == currentJob.batchCount && activeWorkers == 0; });
+    }
+}
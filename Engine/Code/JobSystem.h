@@ -0,0 +1,23 @@
+#ifndef JOB_SYSTEM_FUNC
+#define JOB_SYSTEM_FUNC
+
+#include "Globals.h"
+#include <functional>
+
+namespace JobSystem
+{
+    // Spawns the worker threads. A workerCount of 0 uses one worker per hardware thread
+    // minus the main thread.
+    void Init(u32 workerCount = 0);
+
+    void Shutdown();
+
+    u32 WorkerCount();
+
+    // Splits [0, count) in batches of at least minBatchSize elements and runs them on the
+    // workers and on the calling thread. It returns once every batch has finished.
+    // It must only be called from the main thread.
+    void ParallelFor(u32 count, u32 minBatchSize, const std::function<void(u32 begin, u32 end)>& func);
+}
+
+#endif // !JOB_SYSTEM_FUNC
@@ -0,0 +1,152 @@
+#include "engine.h"
+#include "LightVolumes.h"
+
+#include <float.h>
+
+namespace LightVolumes
+{
+    // The mesh is a polygonal approximation, measure how far its faces are from the center
+    static f32 InnerRadius(const SubMesh& submesh)
+    {
+        u32 strideInFloats = submesh.vertexBufferLayout.stride / sizeof(float);
+        f32 innerRadius = FLT_MAX;
+        for (u32 i = 0; i + 2 < submesh.indices.size(); i += 3)
+        {
+            vec3 p0 = glm::make_vec3(&submesh.vertices[submesh.indices[i + 0] * strideInFloats]);
+            vec3 p1 = glm::make_vec3(&submesh.vertices[submesh.indices[i + 1] * strideInFloats]);
+            vec3 p2 = glm::make_vec3(&submesh.vertices[submesh.indices[i + 2] * strideInFloats]);
+
+            vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            f32 length = glm::length(normal);
+            if (length < 1e-8f)
+                continue;
+
+            innerRadius = glm::min(innerRadius, glm::abs(glm::dot(normal / length, p0 - submesh.sphereCenter)));
+        }
+        return innerRadius < FLT_MAX ? innerRadius : submesh.sphereRadius;
+    }
+
+    void Init(App* app, u32 sphereModelIdx)
+    {
+        LightVolumePass& pass = app->lightVolumes;
+        pass.stencilProgramIdx = LoadProgram(app, "LightVolumes.glsl", "LIGHT_STENCIL");
+        pass.lightingProgramIdx = LoadProgram(app, "FB_TO_BB.glsl", "LIGHT_VOLUME");
+
+        const SubMesh& sphere = app->meshes[app->models[sphereModelIdx].meshIdx].submeshes[0];
+        pass.sphereModelIdx = sphereModelIdx;
+        pass.sphereCenter = sphere.sphereCenter;
+        pass.sphereInnerRadius = InnerRadius(sphere);
+    }
+
+    void Render(App* app, GLuint depthCopy)
+    {
+        LightVolumePass& pass = app->lightVolumes;
+
+        const Program& stencilProgram = app->programs[pass.stencilProgramIdx];
+        const Program& lightingProgram = app->programs[pass.lightingProgramIdx];
+        GLint stencilWVPLocation = glGetUniformLocation(stencilProgram.handle, "uWorldViewProjection");
+        GLint lightingWVPLocation = glGetUniformLocation(lightingProgram.handle, "uWorldViewProjection");
+        GLint lightTypeLocation = glGetUniformLocation(lightingProgram.handle, "uLightType");
+        GLint lightColorLocation = glGetUniformLocation(lightingProgram.handle, "uLightColor");
+        GLint lightDirectionLocation = glGetUniformLocation(lightingProgram.handle, "uLightDirection");
+        GLint lightPositionLocation = glGetUniformLocation(lightingProgram.handle, "uLightPosition");
+        GLint lightRadiusLocation = glGetUniformLocation(lightingProgram.handle, "uLightRadius");
+        GLint lightShadowedLocation = glGetUniformLocation(lightingProgram.handle, "uLightShadowed");
+        GLint lightIndexLocation = glGetUniformLocation(lightingProgram.handle, "uLightIndex");
+
+        glUseProgram(lightingProgram.handle);
+        app->BindGBuffer(lightingProgram, depthCopy);
+
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        glDepthMask(GL_FALSE);
+
+        // Directional lights affect every pixel, draw them as a full screen quad
+        glDisable(GL_DEPTH_TEST);
+        glBindVertexArray(app->vao);
+        glUniformMatrix4fv(lightingWVPLocation, 1, GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
+        pass.drawnLightCount = 0;
+        for (const Light& light : app->lights)
+        {
+            if (light.type != LightType_Directional)
+                continue;
+
+            glUniform1ui(lightTypeLocation, light.type);
+            glUniform3fv(lightColorLocation, 1, glm::value_ptr(light.color));
+            glUniform3fv(lightDirectionLocation, 1, glm::value_ptr(light.direction));
+            // Only the first directional light has shadows
+            glUniform1i(lightShadowedLocation, pass.drawnLightCount == 0);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+            ++pass.drawnLightCount;
+        }
+
+        Mesh& sphereMesh = app->meshes[app->models[pass.sphereModelIdx].meshIdx];
+        const SubMesh& sphere = sphereMesh.submeshes[0];
+        GLuint stencilVao = FindVAO(sphereMesh, 0, stencilProgram);
+        GLuint lightingVao = FindVAO(sphereMesh, 0, lightingProgram);
+
+        // Rasterized over the jittered G-buffer, culled without the jitter
+        glm::mat4 viewProjection = app->temporalAA.jitteredProjection * app->viewMatrix;
+        Frustum frustum = Culling::ExtractFrustum(app->projectionMatrix * app->viewMatrix);
+
+        glUniform1i(lightShadowedLocation, 0);
+        glEnable(GL_STENCIL_TEST);
+        for (u32 i = 0; i < app->lights.size(); ++i)
+        {
+            const Light& light = app->lights[i];
+            if (light.type != LightType_Point)
+                continue;
+
+            f32 radius = PointLightRadius(light);
+            if (radius <= 0.0f || !Culling::IsSphereVisible(frustum, light.position, radius))
+                continue;
+
+            glm::mat4 world = glm::translate(light.position) * glm::scale(vec3(radius / pass.sphereInnerRadius)) * glm::translate(-pass.sphereCenter);
+            glm::mat4 WVP = viewProjection * world;
+
+            // Stencil: back faces behind the scene increment, front faces behind it decrement,
+            // leaving a non zero value where the scene is inside the sphere
+            glUseProgram(stencilProgram.handle);
+            glUniformMatrix4fv(stencilWVPLocation, 1, GL_FALSE, glm::value_ptr(WVP));
+            glEnable(GL_DEPTH_TEST);
+            glDisable(GL_CULL_FACE);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            glStencilFunc(GL_ALWAYS, 0, 0);
+            glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+            glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+
+            glBindVertexArray(stencilVao);
+            glDrawElements(GL_TRIANGLES, sphere.indices.size(), GL_UNSIGNED_INT, (void*)(u64)sphere.indexOffset);
+
+            // Lighting: back faces so it still works with the camera inside the sphere.
+            // Shaded pixels reset their stencil for the next light.
+            glUseProgram(lightingProgram.handle);
+            glUniformMatrix4fv(lightingWVPLocation, 1, GL_FALSE, glm::value_ptr(WVP));
+            glUniform1ui(lightTypeLocation, light.type);
+            glUniform3fv(lightColorLocation, 1, glm::value_ptr(light.color));
+            glUniform3fv(lightDirectionLocation, 1, glm::value_ptr(light.direction));
+            glUniform3fv(lightPositionLocation, 1, glm::value_ptr(light.position));
+            glUniform1f(lightRadiusLocation, radius);
+            glUniform1ui(lightIndexLocation, i);
+            glDisable(GL_DEPTH_TEST);
+            glEnable(GL_CULL_FACE);
+            glCullFace(GL_FRONT);
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+            glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+
+            glBindVertexArray(lightingVao);
+            glDrawElements(GL_TRIANGLES, sphere.indices.size(), GL_UNSIGNED_INT, (void*)(u64)sphere.indexOffset);
+            glCullFace(GL_BACK);
+
+            ++pass.drawnLightCount;
+        }
+
+        glDisable(GL_STENCIL_TEST);
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef LIGHT_VOLUMES_FUNC
+#define LIGHT_VOLUMES_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+// Deferred lighting where every point light is drawn as a sphere of its effective radius.
+// A stencil pass marks the G-buffer pixels inside the sphere and the lighting pass only
+// shades those, additively, into an accumulation target sharing the G-buffer depth-stencil.
+struct LightVolumePass
+{
+    u32  sphereModelIdx;
+    vec3 sphereCenter;
+    f32  sphereInnerRadius; // distance to the closest face, the mesh is scaled so that it covers the light radius
+
+    u32 stencilProgramIdx;
+    u32 lightingProgramIdx;
+
+    u32 drawnLightCount;
+};
+
+namespace LightVolumes
+{
+    void Init(App* app, u32 sphereModelIdx);
+
+    // Accumulates every light into the bound target, whose depth-stencil must be the G-buffer one
+    // with a cleared stencil. The shaders sample depthCopy, a copy of that depth.
+    void Render(App* app, GLuint depthCopy);
+}
+
+#endif // !LIGHT_VOLUMES_FUNC
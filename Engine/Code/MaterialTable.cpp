@@ -0,0 +1,141 @@
+#include "engine.h"
+#include "MaterialTable.h"
+
+namespace Materials
+{
+    // The name is left out, exporters give identical materials different names
+    static u64 HashMaterial(const Material& material)
+    {
+        u64 hash = HASH_SEED;
+        hash = HashBytes(hash, glm::value_ptr(material.albedo), sizeof(material.albedo));
+        hash = HashBytes(hash, glm::value_ptr(material.emissive), sizeof(material.emissive));
+        hash = HashBytes(hash, &material.smoothness, sizeof(material.smoothness));
+        hash = HashBytes(hash, &material.albedoTextureIdx, sizeof(material.albedoTextureIdx));
+        hash = HashBytes(hash, &material.emissiveTextureIdx, sizeof(material.emissiveTextureIdx));
+        hash = HashBytes(hash, &material.specularTextureIdx, sizeof(material.specularTextureIdx));
+        hash = HashBytes(hash, &material.normalsTextureIdx, sizeof(material.normalsTextureIdx));
+        hash = HashBytes(hash, &material.bumpTextureIdx, sizeof(material.bumpTextureIdx));
+        return hash;
+    }
+
+    static bool SameContent(const Material& a, const Material& b)
+    {
+        return a.albedo == b.albedo && a.emissive == b.emissive && a.smoothness == b.smoothness &&
+               a.albedoTextureIdx == b.albedoTextureIdx && a.emissiveTextureIdx == b.emissiveTextureIdx &&
+               a.specularTextureIdx == b.specularTextureIdx && a.normalsTextureIdx == b.normalsTextureIdx &&
+               a.bumpTextureIdx == b.bumpTextureIdx;
+    }
+
+    u32 AddMaterial(App* app, const Material& material)
+    {
+        MaterialTable& table = app->materialTable;
+        u64 hash = HashMaterial(material);
+
+        // A colliding hash with other content keeps the first material, the new one is simply not shared
+        auto it = table.lookup.find(hash);
+        if (it != table.lookup.end() && SameContent(app->materials[it->second], material))
+        {
+            ++table.duplicateCount;
+            return it->second;
+        }
+
+        // The id buffer and the table only hold MATERIAL_MAX_COUNT entries, the rest draw with the first one
+        if (app->materials.size() >= MATERIAL_MAX_COUNT)
+        {
+            if (!table.reportedOverflow)
+                ELOG("Materials::AddMaterial() - more than %u materials, the extra ones fall back to the first", MATERIAL_MAX_COUNT);
+            table.reportedOverflow = true;
+            return 0;
+        }
+
+        u32 materialIdx = app->materials.size();
+        app->materials.push_back(material);
+        if (it == table.lookup.end())
+            table.lookup[hash] = materialIdx;
+        return materialIdx;
+    }
+
+    // Missing or failed textures fall back to the first layer
+    static u32 TextureLayer(App* app, u32 textureIdx)
+    {
+        return textureIdx < app->textures.size() ? textureIdx : 0;
+    }
+
+    // Resamples every texture to a layer of one array, the shaders pick the layer from the material
+    static void CreateTextureArray(App* app)
+    {
+        MaterialTable& table = app->materialTable;
+        u32 layerCount = glm::max((u32)app->textures.size(), 1u);
+        u32 levelCount = (u32)log2f(MATERIAL_TEXTURE_SIZE) + 1;
+
+        glGenTextures(1, &table.textures);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, table.textures);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, levelCount, GL_RGBA8, MATERIAL_TEXTURE_SIZE, MATERIAL_TEXTURE_SIZE, layerCount);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        GLuint framebuffers[2];
+        glGenFramebuffers(2, framebuffers);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+        for (u32 i = 0; i < app->textures.size(); ++i)
+        {
+            GLint width, height;
+            glBindTexture(GL_TEXTURE_2D, app->textures[i].handle);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+
+            glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, app->textures[i].handle, 0);
+            glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, table.textures, 0, i);
+            glBlitFramebuffer(0, 0, width, height, 0, 0, MATERIAL_TEXTURE_SIZE, MATERIAL_TEXTURE_SIZE, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(2, framebuffers);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    void Init(App* app)
+    {
+        MaterialTable& table = app->materialTable;
+        CreateTextureArray(app);
+
+        table.uploadedCount = app->materials.size();
+
+        table.materials = BufferManager::CreateBuffer(MATERIAL_MAX_COUNT * sizeof(GpuMaterial), GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW);
+        BufferManager::MapBuffer(table.materials, GL_WRITE_ONLY);
+        for (u32 i = 0; i < table.uploadedCount; ++i)
+        {
+            const Material& material = app->materials[i];
+            GpuMaterial gpuMaterial = {};
+            gpuMaterial.albedo = vec4(material.albedo, material.smoothness);
+            gpuMaterial.emissive = vec4(material.emissive, 0.0f);
+            gpuMaterial.albedoTexture = TextureLayer(app, material.albedoTextureIdx);
+            gpuMaterial.emissiveTexture = TextureLayer(app, material.emissiveTextureIdx);
+            gpuMaterial.specularTexture = TextureLayer(app, material.specularTextureIdx);
+            gpuMaterial.normalsTexture = TextureLayer(app, material.normalsTextureIdx);
+            gpuMaterial.bumpTexture = TextureLayer(app, material.bumpTextureIdx);
+            PushData(table.materials, &gpuMaterial, sizeof(gpuMaterial));
+        }
+        BufferManager::UnmapBuffer(table.materials);
+
+        table.materialIds = CreateStaticVertexBuffer(MATERIAL_MAX_COUNT * sizeof(u32));
+        BufferManager::MapBuffer(table.materialIds, GL_WRITE_ONLY);
+        for (u32 i = 0; i < MATERIAL_MAX_COUNT; ++i)
+            PushUInt(table.materialIds, i);
+        BufferManager::UnmapBuffer(table.materialIds);
+    }
+
+    void Bind(App* app, const Program& program, u32 textureUnit)
+    {
+        const MaterialTable& table = app->materialTable;
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_TABLE_BINDING, table.materials.handle);
+        glActiveTexture(GL_TEXTURE0 + textureUnit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, table.textures);
+        glUniform1i(glGetUniformLocation(program.handle, "uMaterialTextures"), textureUnit);
+    }
+}
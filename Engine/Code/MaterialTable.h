@@ -0,0 +1,66 @@
+#ifndef MATERIAL_TABLE_FUNC
+#define MATERIAL_TABLE_FUNC
+
+#include "Globals.h"
+#include <unordered_map>
+
+struct App;
+
+// Per instance attribute holding the material of a draw, fed by the base instance of the draw call.
+// Must match RENDER_TO_FB.glsl and RENDER_TO_BB.glsl.
+#define MATERIAL_ID_LOCATION 5
+
+// Shader storage binding of the material table, must match the shaders reading it
+#define MATERIAL_TABLE_BINDING 7
+
+// Materials a draw can point at, the material id buffer holds one entry per material
+#define MATERIAL_MAX_COUNT 4096
+
+// Size of the layers textures are resampled to
+#define MATERIAL_TEXTURE_SIZE 1024
+
+// Material as read by the shaders (std430), texture indices are layers of MaterialTable::textures
+struct GpuMaterial
+{
+    vec4 albedo;   // w: smoothness
+    vec4 emissive;
+    u32  albedoTexture;
+    u32  emissiveTexture;
+    u32  specularTexture;
+    u32  normalsTexture;
+    u32  bumpTexture;
+    u32  padding[3];
+};
+
+// Every App::materials entry in one SSBO and every App::textures entry in one texture array, bound once
+// per pass. Draws pick their material through their base instance, so nothing is rebound between them
+// and draws of different models can share a call.
+struct MaterialTable
+{
+    // Content hash to App::materials index, filled while the models load
+    std::unordered_map<u64, u32> lookup;
+    u32  duplicateCount;
+    bool reportedOverflow;
+
+    Buffer materials;
+    Buffer materialIds; // 0, 1, 2... read through the material id attribute
+    u32    uploadedCount;
+
+    // No bindless textures in GL 4.3
+    GLuint textures;
+};
+
+namespace Materials
+{
+    // Index of an equal material in App::materials, the material is appended when there is none. Past
+    // MATERIAL_MAX_COUNT materials it returns 0.
+    u32 AddMaterial(App* app, const Material& material);
+
+    // Uploads the loaded materials and textures, runs after the models are loaded
+    void Init(App* app);
+
+    // Material table and texture array for a program drawing with material ids
+    void Bind(App* app, const Program& program, u32 textureUnit);
+}
+
+#endif // !MATERIAL_TABLE_FUNC
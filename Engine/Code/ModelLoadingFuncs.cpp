@@ -3,11 +3,13 @@
 
 #include <stb_image.h>
 #include <stb_image_write.h>
+#include <float.h>
 
 namespace ModelLoader
 {
     Image LoadImage(const char* filename)
     {
+        PROFILE_SCOPE("LoadImage");
         Image img = {};
         stbi_set_flip_vertically_on_load(true);
         img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
@@ -57,6 +59,7 @@ namespace ModelLoader
 
     u32 LoadTexture2D(App* app, const char* filepath)
     {
+        PROFILE_SCOPE("LoadTexture2D");
         for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
             if (app->textures[texIdx].filepath == filepath)
                 return texIdx;
@@ -81,7 +84,7 @@ namespace ModelLoader
         }
     }
 
-    void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+    void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, const std::vector<u32>& materialIndices, std::vector<u32>& submeshMaterialIndices)
     {
         std::vector<float> vertices;
         std::vector<u32> indices;
@@ -89,9 +92,16 @@ namespace ModelLoader
         bool hasTexCoords = false;
         bool hasTangentSpace = false;
 
+        vec3 aabbMin = vec3(FLT_MAX);
+        vec3 aabbMax = vec3(-FLT_MAX);
+
         // process vertices
         for (unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
+            vec3 position = vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+            aabbMin = glm::min(aabbMin, position);
+            aabbMax = glm::max(aabbMax, position);
+
             vertices.push_back(mesh->mVertices[i].x);
             vertices.push_back(mesh->mVertices[i].y);
             vertices.push_back(mesh->mVertices[i].z);
@@ -137,8 +147,17 @@ namespace ModelLoader
             }
         }
 
+        // bounding sphere centered in the box, tighter than the one enclosing the box corners
+        vec3 sphereCenter = (aabbMin + aabbMax) * 0.5f;
+        f32 sphereRadiusSq = 0.0f;
+        for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+        {
+            vec3 position = vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+            sphereRadiusSq = glm::max(sphereRadiusSq, glm::dot(position - sphereCenter, position - sphereCenter));
+        }
+
         // store the proper (previously proceessed) material for this mesh
-        submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
+        submeshMaterialIndices.push_back(materialIndices[mesh->mMaterialIndex]);
 
         // create the vertex format
         VertexBufferLayout vertexBufferLayout = {};
@@ -164,6 +183,10 @@ namespace ModelLoader
         submesh.vertexBufferLayout = vertexBufferLayout;
         submesh.vertices.swap(vertices);
         submesh.indices.swap(indices);
+        submesh.aabbMin = aabbMin;
+        submesh.aabbMax = aabbMax;
+        submesh.sphereCenter = sphereCenter;
+        submesh.sphereRadius = sqrtf(sphereRadiusSq);
         myMesh->submeshes.push_back(submesh);
     }
 
@@ -225,24 +248,25 @@ namespace ModelLoader
         //myMaterial.createNormalFromBump();
     }
 
-    void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+    void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, const std::vector<u32>& materialIndices, std::vector<u32>& submeshMaterialIndices)
     {
         // process all the node's meshes (if any)
         for (unsigned int i = 0; i < node->mNumMeshes; i++)
         {
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+            ProcessAssimpMesh(scene, mesh, myMesh, materialIndices, submeshMaterialIndices);
         }
 
         // then do the same for each of its children
         for (unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+            ProcessAssimpNode(scene, node->mChildren[i], myMesh, materialIndices, submeshMaterialIndices);
         }
     }
 
     u32 LoadModel(App* app, const char* filename)
     {
+        PROFILE_SCOPE("LoadModel");
         const aiScene* scene = aiImportFile(filename,
             aiProcess_Triangulate |
             aiProcess_GenSmoothNormals |
@@ -270,16 +294,16 @@ namespace ModelLoader
 
         String directory = GetDirectoryPart(MakeString(filename));
 
-        // Create a list of materials
-        u32 baseMeshMaterialIndex = (u32)app->materials.size();
+        // Scene material to App::materials index, equal materials of any model are shared
+        std::vector<u32> materialIndices;
         for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
         {
-            app->materials.push_back(Material{});
-            Material& material = app->materials.back();
+            Material material = {};
             ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+            materialIndices.push_back(Materials::AddMaterial(app, material));
         }
 
-        ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
+        ProcessAssimpNode(scene, scene->mRootNode, &mesh, materialIndices, model.materialIdx);
 
         aiReleaseImport(scene);
 
@@ -318,6 +342,40 @@ namespace ModelLoader
             indicesOffset += indicesSize;
         }
 
+        // Tightly packed positions for the depth pre-pass, it only needs to fetch 12 bytes per vertex
+        u32 positionBufferSize = 0;
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            const SubMesh& submesh = mesh.submeshes[i];
+            positionBufferSize += submesh.vertices.size() / (submesh.vertexBufferLayout.stride / sizeof(float)) * sizeof(vec3);
+        }
+
+        glGenBuffers(1, &mesh.positionBufferHandle);
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.positionBufferHandle);
+        glBufferData(GL_ARRAY_BUFFER, positionBufferSize, NULL, GL_STATIC_DRAW);
+
+        u32 positionsOffset = 0;
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            SubMesh& submesh = mesh.submeshes[i];
+            u32 strideInFloats = submesh.vertexBufferLayout.stride / sizeof(float);
+            u32 vertexCount = submesh.vertices.size() / strideInFloats;
+
+            std::vector<vec3> positions(vertexCount);
+            for (u32 v = 0; v < vertexCount; ++v)
+                positions[v] = glm::make_vec3(&submesh.vertices[v * strideInFloats]);
+            glBufferSubData(GL_ARRAY_BUFFER, positionsOffset, vertexCount * sizeof(vec3), positions.data());
+
+            glGenVertexArrays(1, &submesh.depthOnlyVao);
+            glBindVertexArray(submesh.depthOnlyVao);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vec3), (void*)(u64)positionsOffset);
+            glEnableVertexAttribArray(0);
+            glBindVertexArray(0);
+
+            positionsOffset += vertexCount * sizeof(vec3);
+        }
+
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
 
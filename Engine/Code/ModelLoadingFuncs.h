@@ -19,11 +19,11 @@ namespace ModelLoader
 
     u32 LoadTexture2D(App* app, const char* filepath);
 
-    void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+    void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, const std::vector<u32>& materialIndices, std::vector<u32>& submeshMaterialIndices);
 
     void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory);
 
-    void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+    void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, const std::vector<u32>& materialIndices, std::vector<u32>& submeshMaterialIndices);
 
     u32 LoadModel(App* app, const char* filename);
 }
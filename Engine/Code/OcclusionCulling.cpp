@@ -0,0 +1,190 @@
+#include "engine.h"
+#include "OcclusionCulling.h"
+
+#define HIZ_GROUP_SIZE 8
+#define CULL_GROUP_SIZE 64
+
+namespace OcclusionCulling
+{
+    static void CreateHiZ(HiZOcclusion& occlusion, ivec2 size)
+    {
+        if (occlusion.hizTexture != 0)
+            glDeleteTextures(1, &occlusion.hizTexture);
+
+        occlusion.hizSize = size;
+        occlusion.hizMipCount = 1;
+        for (i32 largest = glm::max(size.x, size.y); largest > 1; largest >>= 1)
+            ++occlusion.hizMipCount;
+
+        glGenTextures(1, &occlusion.hizTexture);
+        glBindTexture(GL_TEXTURE_2D, occlusion.hizTexture);
+        glTexStorage2D(GL_TEXTURE_2D, occlusion.hizMipCount, GL_R32F, size.x, size.y);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, occlusion.hizMipCount - 1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    static void CreateItemBuffers(HiZOcclusion& occlusion, u32 capacity)
+    {
+        if (occlusion.itemCapacity != 0)
+        {
+            glDeleteBuffers(1, &occlusion.items.handle);
+            glDeleteBuffers(1, &occlusion.phase1Commands.handle);
+            glDeleteBuffers(1, &occlusion.phase2Commands.handle);
+            glDeleteBuffers(1, &occlusion.visibilityHistory.handle);
+        }
+
+        occlusion.itemCapacity = capacity;
+        occlusion.items = BufferManager::CreateBuffer(capacity * sizeof(OcclusionItem), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+        occlusion.phase1Commands = BufferManager::CreateBuffer(capacity * sizeof(DrawElementsIndirectCommand), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+        occlusion.phase2Commands = BufferManager::CreateBuffer(capacity * sizeof(DrawElementsIndirectCommand), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+        occlusion.visibilityHistory = BufferManager::CreateBuffer(capacity * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+    }
+
+    void Init(App* app)
+    {
+        HiZOcclusion& occlusion = app->hizOcclusion;
+        occlusion.hizBuildProgramIdx = LoadComputeProgram(app, "OcclusionCulling.glsl", "HIZ_BUILD");
+        occlusion.cullProgramIdx = LoadComputeProgram(app, "OcclusionCulling.glsl", "OCCLUSION_CULL");
+
+        CreateHiZ(occlusion, app->renderTargetPool.renderSize);
+    }
+
+    void UploadItems(App* app)
+    {
+        HiZOcclusion& occlusion = app->hizOcclusion;
+        const CullingSet& set = app->cullingSet;
+        if (set.count == 0)
+        {
+            app->hizOcclusionItemCount = 0;
+            return;
+        }
+
+        bool resetHistory = false;
+        if (set.count > occlusion.itemCapacity)
+        {
+            CreateItemBuffers(occlusion, set.count + set.count / 2);
+            resetHistory = true;
+        }
+        resetHistory |= set.count != app->hizOcclusionItemCount;
+        app->hizOcclusionItemCount = set.count;
+
+        BufferManager::MapBuffer(occlusion.items, GL_WRITE_ONLY);
+        for (u32 e = 0; e < app->entities.count; ++e)
+        {
+            const Model& model = app->models[app->entities.modelIndices[e]];
+            const Mesh& mesh = app->meshes[model.meshIdx];
+            for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+            {
+                u32 item = app->entities.cullItemOffsets[e] + i;
+
+                OcclusionItem occlusionItem = {};
+                occlusionItem.center = vec4(set.centerX[item], set.centerY[item], set.centerZ[item], set.visible[item] ? 1.0f : 0.0f);
+                occlusionItem.extent = vec4(set.extentX[item], set.extentY[item], set.extentZ[item], 0.0f);
+                occlusionItem.indexCount = mesh.submeshes[i].indices.size();
+                occlusionItem.firstIndex = mesh.submeshes[i].indexOffset / sizeof(u32);
+                occlusionItem.materialIdx = model.materialIdx[i];
+                PushData(occlusion.items, &occlusionItem, sizeof(occlusionItem));
+            }
+        }
+        BufferManager::UnmapBuffer(occlusion.items);
+
+        if (resetHistory)
+        {
+            // Nothing is known about the previous frame, draw everything in phase 1
+            BufferManager::MapBuffer(occlusion.phase1Commands, GL_WRITE_ONLY);
+            for (u32 e = 0; e < app->entities.count; ++e)
+            {
+                const Model& model = app->models[app->entities.modelIndices[e]];
+                const Mesh& mesh = app->meshes[model.meshIdx];
+                for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+                {
+                    DrawElementsIndirectCommand command = {};
+                    command.count = mesh.submeshes[i].indices.size();
+                    command.instanceCount = 1;
+                    command.firstIndex = mesh.submeshes[i].indexOffset / sizeof(u32);
+                    command.baseInstance = model.materialIdx[i];
+                    PushData(occlusion.phase1Commands, &command, sizeof(command));
+                }
+            }
+            BufferManager::UnmapBuffer(occlusion.phase1Commands);
+
+            BufferManager::MapBuffer(occlusion.visibilityHistory, GL_WRITE_ONLY);
+            for (u32 i = 0; i < set.count; ++i)
+                PushUInt(occlusion.visibilityHistory, 1);
+            BufferManager::UnmapBuffer(occlusion.visibilityHistory);
+        }
+    }
+
+    void BuildHiZ(App* app, GLuint depthTexture)
+    {
+        GPU_SCOPE(app->gpuProfiler, "Hi-Z build");
+        HiZOcclusion& occlusion = app->hizOcclusion;
+        if (occlusion.hizSize != app->renderTargetPool.renderSize)
+            CreateHiZ(occlusion, app->renderTargetPool.renderSize);
+
+        const Program& program = app->programs[occlusion.hizBuildProgramIdx];
+        glUseProgram(program.handle);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glUniform1i(glGetUniformLocation(program.handle, "uDepth"), 0);
+        vec2 depthScale = vec2(app->dynamicResolution.internalSize) / vec2(occlusion.hizSize);
+        glUniform2f(glGetUniformLocation(program.handle, "uDepthScale"), depthScale.x, depthScale.y);
+        GLint levelLocation = glGetUniformLocation(program.handle, "uLevel");
+
+        ivec2 levelSize = occlusion.hizSize;
+        for (u32 level = 0; level < occlusion.hizMipCount; ++level)
+        {
+            u32 srcLevel = level > 0 ? level - 1 : 0;
+            glBindImageTexture(0, occlusion.hizTexture, srcLevel, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+            glBindImageTexture(1, occlusion.hizTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glUniform1i(levelLocation, level);
+
+            glDispatchCompute((levelSize.x + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (levelSize.y + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+            levelSize = glm::max(levelSize / 2, ivec2(1));
+        }
+
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glUseProgram(0);
+    }
+
+    void Cull(App* app)
+    {
+        GPU_SCOPE(app->gpuProfiler, "Occlusion cull");
+        HiZOcclusion& occlusion = app->hizOcclusion;
+        u32 itemCount = app->hizOcclusionItemCount;
+        if (itemCount == 0)
+            return;
+
+        const Program& program = app->programs[occlusion.cullProgramIdx];
+        glUseProgram(program.handle);
+
+        glm::mat4 viewProjection = app->projectionMatrix * app->viewMatrix;
+        glUniformMatrix4fv(glGetUniformLocation(program.handle, "uViewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+        glUniform1ui(glGetUniformLocation(program.handle, "uItemCount"), itemCount);
+        glUniform2f(glGetUniformLocation(program.handle, "uHiZSize"), (f32)occlusion.hizSize.x, (f32)occlusion.hizSize.y);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, occlusion.hizTexture);
+        glUniform1i(glGetUniformLocation(program.handle, "uHiZ"), 0);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, occlusion.items.handle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, occlusion.phase1Commands.handle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, occlusion.phase2Commands.handle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, occlusion.visibilityHistory.handle);
+
+        glDispatchCompute((itemCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+        // The commands are consumed by glDrawElementsIndirect
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(0);
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef OCCLUSION_CULLING_FUNC
+#define OCCLUSION_CULLING_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+// Layout of glDrawElementsIndirect commands
+struct DrawElementsIndirectCommand
+{
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    u32 baseVertex;
+    u32 baseInstance;
+};
+
+// Per item data read by the cull shader (std430)
+struct OcclusionItem
+{
+    vec4 center;    // w: 1 if the item passed the frustum test
+    vec4 extent;
+    u32  indexCount;
+    u32  firstIndex;
+    u32  materialIdx; // base instance of the commands
+    u32  padding;
+};
+
+// Two phase GPU occlusion culling against a hierarchical depth pyramid.
+// Phase 1 draws what was visible last frame, the pyramid is built from that depth,
+// every item is tested against it and phase 2 draws the ones that became visible.
+struct HiZOcclusion
+{
+    GLuint hizTexture;
+    ivec2  hizSize;
+    u32    hizMipCount;
+
+    u32    itemCapacity;
+    Buffer items;
+    Buffer phase1Commands;  // written by the cull pass for the next frame
+    Buffer phase2Commands;
+    Buffer visibilityHistory;
+
+    u32    hizBuildProgramIdx;
+    u32    cullProgramIdx;
+};
+
+namespace OcclusionCulling
+{
+    void Init(App* app);
+
+    // Uploads the world bounds of App::cullingSet. Resets the history when the item count changes.
+    void UploadItems(App* app);
+
+    // Max reduces the depth texture into the Hi-Z mip chain. The Hi-Z keeps the render size,
+    // the dynamic resolution region of the depth is stretched over it.
+    void BuildHiZ(App* app, GLuint depthTexture);
+
+    // Tests every item against the Hi-Z and writes the phase 2 commands and the next frame's phase 1 commands
+    void Cull(App* app);
+}
+
+#endif // !OCCLUSION_CULLING_FUNC
@@ -0,0 +1,510 @@
+#include "engine.h"
+#include "PointShadows.h"
+
+#include <algorithm>
+
+namespace PointShadows
+{
+    // Cube face directions, must match FB_TO_BB.glsl
+    static const vec3 FaceForward[6] = { vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1) };
+    static const vec3 FaceUp[6] = { vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0) };
+
+    // Per light, read by the lighting shaders (std430)
+    struct PointShadowData
+    {
+        vec4 faces[6]; // tile of every face in atlas uv: offset xy, size zw
+        vec4 params;   // x: near, y: far, z: 1 when every face is drawn
+    };
+
+    // Atlas
+
+    static void ResetAtlas(ShadowAtlas& atlas, u32 size)
+    {
+        atlas.size = size;
+        atlas.levelCount = 1;
+        while ((size >> atlas.levelCount) >= POINT_SHADOW_MIN_TILE)
+            ++atlas.levelCount;
+
+        atlas.nodes.resize(atlas.levelCount);
+        for (u32 level = 0; level < atlas.levelCount; ++level)
+            atlas.nodes[level].assign((size_t)1 << (2 * level), AtlasNode_Covered);
+        atlas.nodes[0][0] = AtlasNode_Free;
+        atlas.usedTileCount = 0;
+    }
+
+    // Takes a free node of the level, splitting a coarser free node when there is none
+    static i32 AllocateNode(ShadowAtlas& atlas, u32 level)
+    {
+        std::vector<u8>& nodes = atlas.nodes[level];
+        for (u32 i = 0; i < nodes.size(); ++i)
+        {
+            if (nodes[i] == AtlasNode_Free)
+            {
+                nodes[i] = AtlasNode_Used;
+                return i;
+            }
+        }
+        if (level == 0)
+            return -1;
+
+        i32 parent = AllocateNode(atlas, level - 1);
+        if (parent < 0)
+            return -1;
+
+        atlas.nodes[level - 1][parent] = AtlasNode_Split;
+        u32 parentSide = 1u << (level - 1);
+        u32 side = parentSide * 2;
+        u32 x = (parent % parentSide) * 2;
+        u32 y = (parent / parentSide) * 2;
+        nodes[y * side + x] = AtlasNode_Used;
+        nodes[y * side + x + 1] = AtlasNode_Free;
+        nodes[(y + 1) * side + x] = AtlasNode_Free;
+        nodes[(y + 1) * side + x + 1] = AtlasNode_Free;
+        return y * side + x;
+    }
+
+    // Frees the node and merges it with its siblings when they are all free
+    static void FreeNode(ShadowAtlas& atlas, u32 level, u32 node)
+    {
+        std::vector<u8>& nodes = atlas.nodes[level];
+        nodes[node] = AtlasNode_Free;
+        if (level == 0)
+            return;
+
+        u32 side = 1u << level;
+        u32 x = (node % side) & ~1u;
+        u32 y = (node / side) & ~1u;
+        u32 siblings[4] = { y * side + x, y * side + x + 1, (y + 1) * side + x, (y + 1) * side + x + 1 };
+        for (u32 sibling : siblings)
+        {
+            if (nodes[sibling] != AtlasNode_Free)
+                return;
+        }
+        for (u32 sibling : siblings)
+            nodes[sibling] = AtlasNode_Covered;
+        FreeNode(atlas, level - 1, (y / 2) * (side / 2) + x / 2);
+    }
+
+    // Tile of a node in texels: x, y, size
+    static ivec3 NodeRect(const ShadowAtlas& atlas, u32 level, u32 node)
+    {
+        u32 side = 1u << level;
+        u32 tile = atlas.size >> level;
+        return ivec3((node % side) * tile, (node / side) * tile, tile);
+    }
+
+    static void AllocateAtlasTexture(PointShadowAtlas& shadows)
+    {
+        if (shadows.depthTexture != 0)
+            glDeleteTextures(1, &shadows.depthTexture);
+
+        glGenTextures(1, &shadows.depthTexture);
+        glBindTexture(GL_TEXTURE_2D, shadows.depthTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, shadows.atlasSize, shadows.atlasSize);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, shadows.framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadows.depthTexture, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        // Every cached tile is gone with the old texture
+        ResetAtlas(shadows.atlas, shadows.atlasSize);
+        for (PointShadowEntry& entry : shadows.entries)
+            entry.lightIndex = -1;
+        shadows.allocatedSize = shadows.atlasSize;
+    }
+
+    static void CreateShadowDataBuffer(PointShadowAtlas& shadows, u32 capacity)
+    {
+        if (shadows.shadowDataCapacity != 0)
+            glDeleteBuffers(1, &shadows.shadowData.handle);
+
+        shadows.shadowDataCapacity = capacity;
+        shadows.shadowData = BufferManager::CreateBuffer(capacity * sizeof(PointShadowData), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+    }
+
+    void Init(App* app)
+    {
+        PointShadowAtlas& shadows = app->pointShadows;
+        shadows.casterProgramIdx = LoadProgram(app, "DepthPrePass.glsl", "SHADOW_CASTER");
+        const Program& casterProgram = app->programs[shadows.casterProgramIdx];
+        shadows.casterProgram_uWorldLightViewProjection = glGetUniformLocation(casterProgram.handle, "uWorldLightViewProjection");
+
+        glGenFramebuffers(1, &shadows.framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadows.framebuffer);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        AllocateAtlasTexture(shadows);
+        CreateShadowDataBuffer(shadows, 64);
+    }
+
+    // Entries
+
+    static void FreeEntry(PointShadowAtlas& shadows, PointShadowEntry& entry)
+    {
+        for (PointShadowFace& face : entry.faces)
+        {
+            FreeNode(shadows.atlas, entry.level, face.node);
+            face.valid = false;
+        }
+        shadows.atlas.usedTileCount -= 6;
+        entry.lightIndex = -1;
+    }
+
+    static bool AllocateFaces(PointShadowAtlas& shadows, PointShadowEntry& entry, u32 level)
+    {
+        i32 nodes[6];
+        for (u32 f = 0; f < 6; ++f)
+        {
+            nodes[f] = AllocateNode(shadows.atlas, level);
+            if (nodes[f] < 0)
+            {
+                for (u32 i = 0; i < f; ++i)
+                    FreeNode(shadows.atlas, level, nodes[i]);
+                return false;
+            }
+        }
+
+        entry.level = level;
+        for (u32 f = 0; f < 6; ++f)
+        {
+            entry.faces[f].node = nodes[f];
+            entry.faces[f].valid = false;
+        }
+        shadows.atlas.usedTileCount += 6;
+        return true;
+    }
+
+    // Least recently used entry that no light claimed this frame
+    static PointShadowEntry* FindEvictable(PointShadowAtlas& shadows)
+    {
+        PointShadowEntry* oldest = nullptr;
+        for (PointShadowEntry& entry : shadows.entries)
+        {
+            if (entry.lightIndex < 0 || entry.lastUsedFrame == shadows.frame)
+                continue;
+            if (!oldest || entry.lastUsedFrame < oldest->lastUsedFrame)
+                oldest = &entry;
+        }
+        return oldest;
+    }
+
+    // Evicts stale lights until the faces fit, then falls back to smaller tiles
+    static bool AllocateWithEviction(PointShadowAtlas& shadows, PointShadowEntry& entry, u32 level)
+    {
+        for (; level < shadows.atlas.levelCount; ++level)
+        {
+            for (;;)
+            {
+                if (AllocateFaces(shadows, entry, level))
+                    return true;
+
+                PointShadowEntry* victim = FindEvictable(shadows);
+                if (!victim)
+                    break;
+                FreeEntry(shadows, *victim);
+                shadows.evictionCount++;
+            }
+        }
+        return false;
+    }
+
+    static glm::mat4 FaceViewProjection(const PointShadowEntry& entry, u32 face)
+    {
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, POINT_SHADOW_NEAR, entry.radius);
+        return projection * glm::lookAt(entry.position, entry.position + FaceForward[face], FaceUp[face]);
+    }
+
+    struct ShadowCandidate
+    {
+        u32 lightIndex;
+        f32 importance;
+    };
+
+    void Update(App* app)
+    {
+        PROFILE_SCOPE("Point shadows");
+        PointShadowAtlas& shadows = app->pointShadows;
+        shadows.frame++;
+        shadows.shadowedLightCount = 0;
+        shadows.renderedFaceCount = 0;
+        shadows.pendingFaceCount = 0;
+        shadows.evictionCount = 0;
+        shadows.lightEntries.assign(app->lights.size(), -1);
+        for (PointShadowEntry& entry : shadows.entries)
+        {
+            for (PointShadowFace& face : entry.faces)
+                face.scheduled = false;
+        }
+
+        if (!shadows.enabled)
+            return;
+
+        shadows.atlasSize = glm::clamp(shadows.atlasSize, (u32)POINT_SHADOW_MAX_TILE, 16384u);
+        if (shadows.atlasSize != shadows.allocatedSize)
+            AllocateAtlasTexture(shadows);
+
+        // Entries of removed lights, or of lights that are no longer point lights
+        std::vector<i32> cachedEntries(app->lights.size(), -1);
+        for (u32 e = 0; e < POINT_SHADOW_MAX_LIGHTS; ++e)
+        {
+            PointShadowEntry& entry = shadows.entries[e];
+            if (entry.lightIndex < 0)
+                continue;
+            if (entry.lightIndex >= (i32)app->lights.size() || app->lights[entry.lightIndex].type != LightType_Point)
+                FreeEntry(shadows, entry);
+            else
+                cachedEntries[entry.lightIndex] = e;
+        }
+
+        // Importance is the radius of the light on screen, lights outside the view get nothing
+        Frustum viewFrustum = Culling::ExtractFrustum(app->projectionMatrix * app->viewMatrix);
+        f32 pixelsPerUnit = 0.5f * app->displaySize.y * app->projectionMatrix[1][1];
+        std::vector<ShadowCandidate> candidates;
+        for (u32 i = 0; i < app->lights.size(); ++i)
+        {
+            const Light& light = app->lights[i];
+            if (light.type != LightType_Point)
+                continue;
+
+            f32 radius = PointLightRadius(light);
+            if (radius <= 0.0f || !Culling::IsSphereVisible(viewFrustum, light.position, radius))
+                continue;
+
+            f32 distance = glm::distance(app->cameraPosition, light.position);
+            f32 importance = distance > radius ? pixelsPerUnit * radius / sqrtf(distance * distance - radius * radius) : FLT_MAX;
+            candidates.push_back({ i, importance });
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const ShadowCandidate& a, const ShadowCandidate& b) { return a.importance > b.importance; });
+        if (candidates.size() > POINT_SHADOW_MAX_LIGHTS)
+            candidates.resize(POINT_SHADOW_MAX_LIGHTS);
+
+        // Tiles, most important lights first so they are the last to fall back to smaller ones
+        std::vector<u32> shadowed;
+        for (const ShadowCandidate& candidate : candidates)
+        {
+            const Light& light = app->lights[candidate.lightIndex];
+            f32 tileSize = glm::clamp(candidate.importance * shadows.importanceScale, (f32)POINT_SHADOW_MIN_TILE, (f32)POINT_SHADOW_MAX_TILE);
+            u32 tile = POINT_SHADOW_MIN_TILE;
+            while (tile < tileSize)
+                tile *= 2;
+            u32 level = 0;
+            while ((shadows.atlasSize >> level) > tile)
+                ++level;
+
+            // A more important light may have evicted it already this frame
+            i32 e = cachedEntries[candidate.lightIndex];
+            if (e >= 0 && shadows.entries[e].lightIndex != (i32)candidate.lightIndex)
+                e = -1;
+            if (e < 0)
+            {
+                PointShadowEntry* entry = nullptr;
+                for (PointShadowEntry& free : shadows.entries)
+                {
+                    if (free.lightIndex < 0)
+                    {
+                        entry = &free;
+                        break;
+                    }
+                }
+                if (!entry)
+                {
+                    entry = FindEvictable(shadows);
+                    if (!entry)
+                        break;
+                    FreeEntry(shadows, *entry);
+                    shadows.evictionCount++;
+                }
+                if (!AllocateWithEviction(shadows, *entry, level))
+                    continue;
+                entry->lightIndex = candidate.lightIndex;
+                e = (i32)(entry - shadows.entries);
+            }
+            else
+            {
+                // Tiles grow right away but only shrink past one level, so lights near a
+                // threshold don't redraw every frame
+                PointShadowEntry& entry = shadows.entries[e];
+                if (level < entry.level || level > entry.level + 1)
+                {
+                    u32 lightIndex = entry.lightIndex;
+                    FreeEntry(shadows, entry);
+                    entry.lastUsedFrame = shadows.frame;
+                    if (!AllocateWithEviction(shadows, entry, level))
+                        continue;
+                    entry.lightIndex = lightIndex;
+                }
+            }
+
+            PointShadowEntry& entry = shadows.entries[e];
+            f32 radius = PointLightRadius(light);
+            if (entry.position != light.position || entry.radius != radius)
+            {
+                entry.position = light.position;
+                entry.radius = radius;
+                for (PointShadowFace& face : entry.faces)
+                    face.valid = false;
+            }
+            entry.lastUsedFrame = shadows.frame;
+            entry.importance = candidate.importance;
+            shadowed.push_back(e);
+        }
+
+        // Casters of every face, from the entities inside the light spheres
+        std::vector<vec4> spheres(shadowed.size());
+        for (u32 i = 0; i < shadowed.size(); ++i)
+            spheres[i] = vec4(shadows.entries[shadowed[i]].position, shadows.entries[shadowed[i]].radius);
+        std::vector<std::vector<u32>> sphereEntities(shadowed.size());
+        BVH::QuerySpheres(app->entityTree, spheres.data(), spheres.size(), sphereEntities.data());
+
+        // Budget: the dirty faces of a light are drawn together or not at all, in importance order.
+        // Faces only dirty because their casters changed keep showing the previous content meanwhile.
+        u32 budget = shadows.faceBudget;
+        std::vector<ShadowCaster> casters[6];
+        u64 hashes[6];
+        for (u32 i = 0; i < shadowed.size(); ++i)
+        {
+            PointShadowEntry& entry = shadows.entries[shadowed[i]];
+            std::sort(sphereEntities[i].begin(), sphereEntities[i].end());
+
+            u32 dirtyCount = 0;
+            for (u32 f = 0; f < 6; ++f)
+            {
+                Frustum frustum = Culling::ExtractFrustum(FaceViewProjection(entry, f));
+                hashes[f] = CascadedShadows::FindCasters(app, frustum, sphereEntities[i], casters[f]);
+                if (!entry.faces[f].valid || hashes[f] != entry.faces[f].casterHash)
+                    ++dirtyCount;
+            }
+
+            if (dirtyCount > budget)
+            {
+                shadows.pendingFaceCount += dirtyCount;
+                continue;
+            }
+            budget -= dirtyCount;
+
+            for (u32 f = 0; f < 6; ++f)
+            {
+                PointShadowFace& face = entry.faces[f];
+                if (face.valid && hashes[f] == face.casterHash)
+                    continue;
+                face.valid = true;
+                face.scheduled = true;
+                face.casterHash = hashes[f];
+                face.casters.swap(casters[f]);
+                shadows.renderedFaceCount++;
+            }
+        }
+
+        // Shadow data up to the last light with a complete shadow
+        u32 dataCount = 0;
+        for (u32 e : shadowed)
+        {
+            const PointShadowEntry& entry = shadows.entries[e];
+            bool ready = true;
+            for (const PointShadowFace& face : entry.faces)
+                ready = ready && face.valid;
+            if (!ready)
+                continue;
+
+            shadows.lightEntries[entry.lightIndex] = e;
+            shadows.shadowedLightCount++;
+            dataCount = glm::max(dataCount, (u32)entry.lightIndex + 1);
+        }
+        if (dataCount == 0)
+            return;
+
+        if (dataCount > shadows.shadowDataCapacity)
+            CreateShadowDataBuffer(shadows, dataCount + dataCount / 2);
+
+        BufferManager::MapBuffer(shadows.shadowData, GL_WRITE_ONLY);
+        for (u32 i = 0; i < dataCount; ++i)
+        {
+            PointShadowData data = {};
+            if (shadows.lightEntries[i] >= 0)
+            {
+                const PointShadowEntry& entry = shadows.entries[shadows.lightEntries[i]];
+                for (u32 f = 0; f < 6; ++f)
+                {
+                    ivec3 rect = NodeRect(shadows.atlas, entry.level, entry.faces[f].node);
+                    data.faces[f] = vec4(rect.x, rect.y, rect.z, rect.z) / (f32)shadows.atlasSize;
+                }
+                data.params = vec4(POINT_SHADOW_NEAR, entry.radius, 1.0f, 0.0f);
+            }
+            PushData(shadows.shadowData, &data, sizeof(data));
+        }
+        BufferManager::UnmapBuffer(shadows.shadowData);
+    }
+
+    void Render(App* app)
+    {
+        PointShadowAtlas& shadows = app->pointShadows;
+        shadows.casterDrawCount = 0;
+        if (!shadows.enabled || shadows.renderedFaceCount == 0)
+            return;
+
+        const Program& casterProgram = app->programs[shadows.casterProgramIdx];
+        glUseProgram(casterProgram.handle);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadows.framebuffer);
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_SCISSOR_TEST);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 2.0f);
+
+        for (PointShadowEntry& entry : shadows.entries)
+        {
+            if (entry.lightIndex < 0)
+                continue;
+
+            for (u32 f = 0; f < 6; ++f)
+            {
+                PointShadowFace& face = entry.faces[f];
+                if (!face.scheduled)
+                    continue;
+
+                // The scissor limits the clear to the tile
+                ivec3 rect = NodeRect(shadows.atlas, entry.level, face.node);
+                glViewport(rect.x, rect.y, rect.z, rect.z);
+                glScissor(rect.x, rect.y, rect.z, rect.z);
+                f32 clearDepth = 1.0f;
+                glClearBufferfv(GL_DEPTH, 0, &clearDepth);
+
+                shadows.casterDrawCount += CascadedShadows::RenderCasters(app, face.casters, FaceViewProjection(entry, f), shadows.casterProgram_uWorldLightViewProjection);
+                face.casters.clear();
+            }
+        }
+
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_SCISSOR_TEST);
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+
+    void Bind(App* app, const Program& program, u32 textureUnit)
+    {
+        const PointShadowAtlas& shadows = app->pointShadows;
+        glActiveTexture(GL_TEXTURE0 + textureUnit);
+        glBindTexture(GL_TEXTURE_2D, shadows.depthTexture);
+        glUniform1i(glGetUniformLocation(program.handle, "uPointShadowAtlas"), textureUnit);
+
+        // Lights past the count have no shadow
+        u32 count = 0;
+        if (shadows.enabled && shadows.shadowedLightCount > 0)
+        {
+            for (u32 i = 0; i < shadows.lightEntries.size(); ++i)
+                count = shadows.lightEntries[i] >= 0 ? i + 1 : count;
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, shadows.shadowData.handle);
+        }
+        glUniform1ui(glGetUniformLocation(program.handle, "uPointShadowCount"), count);
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef POINT_SHADOWS_FUNC
+#define POINT_SHADOWS_FUNC
+
+#include "Globals.h"
+#include "CascadedShadows.h"
+
+struct App;
+
+// Lights with a cached shadow, the least recently used one is evicted when the atlas runs out
+#define POINT_SHADOW_MAX_LIGHTS 64
+
+// Tile sizes of one cube face, powers of two
+#define POINT_SHADOW_MIN_TILE 64
+#define POINT_SHADOW_MAX_TILE 512
+
+// Near plane of the face projections, the far one is the light radius
+#define POINT_SHADOW_NEAR 0.05f
+
+// Square atlas split as a quadtree. A node is either covered by an ancestor, free, split in
+// four children or used by a tile. Freeing the last used child of a node merges it back.
+enum AtlasNodeState : u8
+{
+    AtlasNode_Covered,
+    AtlasNode_Free,
+    AtlasNode_Split,
+    AtlasNode_Used
+};
+
+struct ShadowAtlas
+{
+    u32 size;
+    u32 levelCount;                          // level 0 is the whole atlas, each level halves the tile size
+    std::vector<std::vector<u8>> nodes;      // per level, 4^level nodes in row major order
+    u32 usedTileCount;
+};
+
+struct PointShadowFace
+{
+    u32  node;       // in the atlas level of the light
+    u64  casterHash; // casters inside the face frustum when it was drawn
+    bool valid;      // drawn since the tile was allocated and the light last moved
+    bool scheduled;  // drawn this frame
+
+    std::vector<ShadowCaster> casters; // drawn when scheduled
+};
+
+// Six faces of the same tile size, one per cube direction
+struct PointShadowEntry
+{
+    i32  lightIndex;  // -1 when the entry is free
+    vec3 position;
+    f32  radius;
+    u32  level;
+    PointShadowFace faces[6];
+    u64  lastUsedFrame;
+    f32  importance;  // projected radius in pixels this frame
+};
+
+// Shadows of the point lights, every face in its own tile of a depth atlas sized by how large the
+// light is on screen. A face is only drawn again when its light moves, its casters change or its tile
+// does, and no more than faceBudget faces are drawn per frame.
+struct PointShadowAtlas
+{
+    bool enabled = true;
+    u32  atlasSize = 4096;
+    u32  faceBudget = 24;
+    f32  importanceScale = 1.0f; // tile size per projected pixel of the light radius
+
+    ShadowAtlas atlas;
+    GLuint depthTexture;
+    GLuint framebuffer;
+    u32 allocatedSize;
+
+    u32 casterProgramIdx;
+    GLint casterProgram_uWorldLightViewProjection;
+
+    PointShadowEntry entries[POINT_SHADOW_MAX_LIGHTS];
+    std::vector<i32> lightEntries; // entry of every light of App::lights, -1 without shadow
+    Buffer shadowData;             // per light, read by the lighting shaders
+    u32 shadowDataCapacity;
+    u64 frame;
+
+    // Stats of the last frame
+    u32 shadowedLightCount;
+    u32 renderedFaceCount;
+    u32 pendingFaceCount;
+    u32 evictionCount;
+    u32 casterDrawCount;
+};
+
+namespace PointShadows
+{
+    void Init(App* app);
+
+    // Picks the shadowed lights, allocates their tiles and schedules the faces to draw within the budget
+    void Update(App* app);
+
+    // Depth only draw of the scheduled faces
+    void Render(App* app);
+
+    // Atlas and per light shadow data of the lighting shaders
+    void Bind(App* app, const Program& program, u32 textureUnit);
+}
+
+#endif // !POINT_SHADOWS_FUNC
@@ -0,0 +1,256 @@
+#include "engine.h"
+#include "PostProcess.h"
+
+// Must match PostProcess.glsl
+#define POST_LUMINANCE_GROUP_SIZE 16
+#define POST_BLOOM_GROUP_SIZE 8
+
+namespace PostProcessing
+{
+    // Layout of the exposure buffer (std430)
+    struct ExposureData
+    {
+        u32 histogram[POST_HISTOGRAM_BINS];
+        f32 adaptedLuminance;
+        f32 exposure;
+    };
+
+    static u32 DispatchSize(u32 size, u32 groupSize)
+    {
+        return (size + groupSize - 1) / groupSize;
+    }
+
+    // Region of every bloom level holding this frame's image
+    static ivec2 BloomRegion(App* app, u32 level)
+    {
+        ivec2 region = (app->dynamicResolution.internalSize + 1) / 2;
+        for (u32 i = 0; i < level; ++i)
+            region = glm::max((region + 1) / 2, ivec2(1));
+        return region;
+    }
+
+    static void AllocateBloom(PostProcessChain& post, ivec2 size)
+    {
+        if (post.bloomTexture != 0)
+            glDeleteTextures(1, &post.bloomTexture);
+
+        u32 levels = post.bloomLevels;
+        glGenTextures(1, &post.bloomTexture);
+        glBindTexture(GL_TEXTURE_2D, post.bloomTexture);
+        glTexStorage2D(GL_TEXTURE_2D, levels, GL_R11F_G11F_B10F, size.x, size.y);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        post.bloomSize = size;
+        post.allocatedBloomLevels = levels;
+    }
+
+    void Init(App* app)
+    {
+        PostProcessChain& post = app->postProcess;
+        post.luminanceProgramIdx = LoadComputeProgram(app, "PostProcess.glsl", "POST_LUMINANCE");
+        post.exposureProgramIdx = LoadComputeProgram(app, "PostProcess.glsl", "POST_EXPOSURE");
+        post.downsampleProgramIdx = LoadComputeProgram(app, "PostProcess.glsl", "POST_BLOOM_DOWNSAMPLE");
+        post.upsampleProgramIdx = LoadComputeProgram(app, "PostProcess.glsl", "POST_BLOOM_UPSAMPLE");
+        post.tonemapProgramIdx = LoadProgram(app, "PostProcess.glsl", "POST_TONEMAP");
+
+        // Start adapted to mid grey so the first frames don't flash
+        ExposureData initial = {};
+        initial.adaptedLuminance = 0.18f;
+        initial.exposure = 1.0f;
+        post.exposure = BufferManager::CreateBuffer(sizeof(ExposureData), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, post.exposure.handle);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(initial), &initial);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Exposure used where the auto exposure result isn't, and a flag telling the shaders which one applies
+    static void SetExposureUniforms(App* app, const Program& program)
+    {
+        const PostProcessChain& post = app->postProcess;
+        glUniform1i(glGetUniformLocation(program.handle, "uAutoExposure"), post.autoExposure);
+        glUniform1f(glGetUniformLocation(program.handle, "uManualExposure"), post.manualExposure * exp2f(post.exposureCompensation));
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, post.exposure.handle);
+    }
+
+    void AddPasses(App* app, u32 hdrColor, u32 output)
+    {
+        FrameGraph& graph = app->frameGraph;
+        PostProcessChain& post = app->postProcess;
+
+        // Small windows don't have room for every level
+        ivec2 bloomSize = glm::max((app->renderTargetPool.renderSize + 1) / 2, ivec2(1));
+        u32 maxLevels = 1;
+        while (maxLevels < POST_BLOOM_MAX_LEVELS && (glm::min(bloomSize.x, bloomSize.y) >> maxLevels) > 0)
+            ++maxLevels;
+        post.bloomLevels = glm::clamp(post.bloomLevels, 1u, maxLevels);
+        if (post.bloom && (bloomSize != post.bloomSize || post.bloomLevels != post.allocatedBloomLevels))
+            AllocateBloom(post, bloomSize);
+
+        u32 exposure = FrameGraphs::ImportBuffer(graph, "Exposure", post.exposure.handle);
+        u32 bloom = FrameGraphs::ImportTexture(graph, "Bloom", post.bloomTexture, { GL_R11F_G11F_B10F, post.bloomSize, 1 });
+        u32 bloomLevels = post.bloom ? post.allocatedBloomLevels : 0;
+
+        // Histogram and bloom bright pass, one thread per half resolution texel reading 2x2 HDR pixels
+        if (post.autoExposure || post.bloom)
+        {
+            u32 luminancePass = FrameGraphs::AddPass(graph, "Luminance + bright pass", [app, hdrColor]()
+            {
+                const PostProcessChain& post = app->postProcess;
+                const Program& program = app->programs[post.luminanceProgramIdx];
+                glUseProgram(program.handle);
+                SetExposureUniforms(app, program);
+
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, FrameGraphs::GetHandle(app->frameGraph, hdrColor));
+                glUniform1i(glGetUniformLocation(program.handle, "uInput"), 0);
+                glBindImageTexture(0, post.bloomTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R11F_G11F_B10F);
+
+                ivec2 inputSize = app->dynamicResolution.internalSize;
+                ivec2 outputSize = BloomRegion(app, 0);
+                glUniform2i(glGetUniformLocation(program.handle, "uInputSize"), inputSize.x, inputSize.y);
+                glUniform2i(glGetUniformLocation(program.handle, "uOutputSize"), outputSize.x, outputSize.y);
+                glUniform1i(glGetUniformLocation(program.handle, "uHistogram"), post.autoExposure);
+                glUniform1i(glGetUniformLocation(program.handle, "uBrightPass"), post.bloom);
+                glUniform1f(glGetUniformLocation(program.handle, "uMinLogLuminance"), post.minLogLuminance);
+                glUniform1f(glGetUniformLocation(program.handle, "uInverseLogLuminanceRange"), 1.0f / (post.maxLogLuminance - post.minLogLuminance));
+                glUniform1f(glGetUniformLocation(program.handle, "uBloomThreshold"), post.bloomThreshold);
+                glUniform1f(glGetUniformLocation(program.handle, "uBloomKnee"), post.bloomKnee);
+
+                glDispatchCompute(DispatchSize(outputSize.x, POST_LUMINANCE_GROUP_SIZE), DispatchSize(outputSize.y, POST_LUMINANCE_GROUP_SIZE), 1);
+                glUseProgram(0);
+            });
+            FrameGraphs::Read(graph, luminancePass, hdrColor, FrameGraphAccess_Sampled);
+            FrameGraphs::Read(graph, luminancePass, exposure, FrameGraphAccess_Storage);
+            if (post.autoExposure)
+                FrameGraphs::Write(graph, luminancePass, exposure, FrameGraphAccess_Storage);
+            if (post.bloom)
+                FrameGraphs::Write(graph, luminancePass, bloom, FrameGraphAccess_Image);
+        }
+
+        // Average of the histogram, eased towards over time. Clears the histogram for the next frame.
+        if (post.autoExposure)
+        {
+            u32 exposurePass = FrameGraphs::AddPass(graph, "Exposure", [app]()
+            {
+                const PostProcessChain& post = app->postProcess;
+                const Program& program = app->programs[post.exposureProgramIdx];
+                glUseProgram(program.handle);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, post.exposure.handle);
+
+                // The histogram sees 4 pixels per half resolution texel, the odd edges count double
+                ivec2 region = BloomRegion(app, 0) * 2;
+                glUniform1f(glGetUniformLocation(program.handle, "uPixelCount"), (f32)region.x * region.y);
+                glUniform1f(glGetUniformLocation(program.handle, "uMinLogLuminance"), post.minLogLuminance);
+                glUniform1f(glGetUniformLocation(program.handle, "uLogLuminanceRange"), post.maxLogLuminance - post.minLogLuminance);
+                glUniform1f(glGetUniformLocation(program.handle, "uAdaptation"), 1.0f - expf(-app->deltaTime * post.adaptationRate));
+                glUniform1f(glGetUniformLocation(program.handle, "uCompensation"), exp2f(post.exposureCompensation));
+
+                glDispatchCompute(1, 1, 1);
+                glUseProgram(0);
+            });
+            FrameGraphs::Read(graph, exposurePass, exposure, FrameGraphAccess_Storage);
+            FrameGraphs::Write(graph, exposurePass, exposure, FrameGraphAccess_Storage);
+        }
+
+        if (post.bloom && bloomLevels > 1)
+        {
+            // Every level is a 4x4 tent filter of the previous one, each group caches its input footprint
+            u32 downsamplePass = FrameGraphs::AddPass(graph, "Bloom downsample", [app, bloomLevels]()
+            {
+                const PostProcessChain& post = app->postProcess;
+                const Program& program = app->programs[post.downsampleProgramIdx];
+                glUseProgram(program.handle);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, post.bloomTexture);
+                glUniform1i(glGetUniformLocation(program.handle, "uInput"), 0);
+                GLint inputLevelLocation = glGetUniformLocation(program.handle, "uInputLevel");
+                GLint inputSizeLocation = glGetUniformLocation(program.handle, "uInputSize");
+                GLint outputSizeLocation = glGetUniformLocation(program.handle, "uOutputSize");
+
+                for (u32 level = 1; level < bloomLevels; ++level)
+                {
+                    ivec2 inputSize = BloomRegion(app, level - 1);
+                    ivec2 outputSize = BloomRegion(app, level);
+                    glBindImageTexture(0, post.bloomTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R11F_G11F_B10F);
+                    glUniform1i(inputLevelLocation, level - 1);
+                    glUniform2i(inputSizeLocation, inputSize.x, inputSize.y);
+                    glUniform2i(outputSizeLocation, outputSize.x, outputSize.y);
+                    glDispatchCompute(DispatchSize(outputSize.x, POST_BLOOM_GROUP_SIZE), DispatchSize(outputSize.y, POST_BLOOM_GROUP_SIZE), 1);
+                    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+                }
+                glUseProgram(0);
+            });
+            FrameGraphs::Read(graph, downsamplePass, bloom, FrameGraphAccess_Sampled);
+            FrameGraphs::Write(graph, downsamplePass, bloom, FrameGraphAccess_Image);
+
+            // Back up the chain, every level adds the tent filtered level below it
+            u32 upsamplePass = FrameGraphs::AddPass(graph, "Bloom upsample", [app, bloomLevels]()
+            {
+                const PostProcessChain& post = app->postProcess;
+                const Program& program = app->programs[post.upsampleProgramIdx];
+                glUseProgram(program.handle);
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, post.bloomTexture);
+                glUniform1i(glGetUniformLocation(program.handle, "uInput"), 0);
+                GLint inputLevelLocation = glGetUniformLocation(program.handle, "uInputLevel");
+                GLint inputSizeLocation = glGetUniformLocation(program.handle, "uInputSize");
+                GLint outputSizeLocation = glGetUniformLocation(program.handle, "uOutputSize");
+
+                for (u32 level = bloomLevels - 1; level > 0; --level)
+                {
+                    ivec2 inputSize = BloomRegion(app, level);
+                    ivec2 outputSize = BloomRegion(app, level - 1);
+                    glBindImageTexture(0, post.bloomTexture, level - 1, GL_FALSE, 0, GL_READ_WRITE, GL_R11F_G11F_B10F);
+                    glUniform1i(inputLevelLocation, level);
+                    glUniform2i(inputSizeLocation, inputSize.x, inputSize.y);
+                    glUniform2i(outputSizeLocation, outputSize.x, outputSize.y);
+                    glDispatchCompute(DispatchSize(outputSize.x, POST_BLOOM_GROUP_SIZE), DispatchSize(outputSize.y, POST_BLOOM_GROUP_SIZE), 1);
+                    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+                }
+                glUseProgram(0);
+            });
+            FrameGraphs::Read(graph, upsamplePass, bloom, FrameGraphAccess_Sampled);
+            FrameGraphs::Write(graph, upsamplePass, bloom, FrameGraphAccess_Image);
+        }
+
+        // Exposure, bloom and tonemapping in one full screen pass, it can write the back buffer
+        u32 tonemapPass = FrameGraphs::AddPass(graph, "Tonemap", [app, hdrColor]()
+        {
+            const PostProcessChain& post = app->postProcess;
+            const Program& program = app->programs[post.tonemapProgramIdx];
+            glUseProgram(program.handle);
+            SetExposureUniforms(app, program);
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, FrameGraphs::GetHandle(app->frameGraph, hdrColor));
+            glUniform1i(glGetUniformLocation(program.handle, "uInput"), 0);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, post.bloomTexture);
+            glUniform1i(glGetUniformLocation(program.handle, "uBloom"), 1);
+
+            // Level 0 of the bloom covers half of every HDR pixel, rounded up
+            ivec2 internalSize = app->dynamicResolution.internalSize;
+            vec2 bloomScale = vec2(BloomRegion(app, 0)) / vec2(glm::max(post.bloomSize, ivec2(1))) / vec2(internalSize);
+            glUniform2f(glGetUniformLocation(program.handle, "uBloomScale"), bloomScale.x, bloomScale.y);
+            glUniform1f(glGetUniformLocation(program.handle, "uBloomIntensity"), post.bloom ? post.bloomIntensity : 0.0f);
+            glUniform1i(glGetUniformLocation(program.handle, "uTonemapper"), post.tonemapper);
+
+            glDisable(GL_DEPTH_TEST);
+            glDisable(GL_BLEND);
+            glBindVertexArray(app->vao);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+            glBindVertexArray(0);
+            glUseProgram(0);
+        });
+        FrameGraphs::Read(graph, tonemapPass, hdrColor, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, tonemapPass, exposure, FrameGraphAccess_Storage);
+        if (post.bloom)
+            FrameGraphs::Read(graph, tonemapPass, bloom, FrameGraphAccess_Sampled);
+        FrameGraphs::Write(graph, tonemapPass, output, FrameGraphAccess_ColorAttachment);
+    }
+}
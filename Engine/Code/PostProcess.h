@@ -0,0 +1,65 @@
+#ifndef POST_PROCESS_FUNC
+#define POST_PROCESS_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+// Bins of the log2 luminance histogram, bin 0 collects black pixels. Must match PostProcess.glsl
+#define POST_HISTOGRAM_BINS 256
+
+// Levels of the bloom chain, the first one is the half resolution bright pass
+#define POST_BLOOM_MAX_LEVELS 7
+
+enum Tonemapper
+{
+    Tonemapper_None,
+    Tonemapper_Reinhard,
+    Tonemapper_ACES,
+    Tonemapper_Count
+};
+
+// Lighting accumulates into an R11G11B10F target, compute passes turn it into the displayed image:
+// a luminance histogram drives the exposure, a downsample / upsample chain blurs what is above the
+// bloom threshold, and a last full screen pass applies both and the tonemapper. The histogram shares
+// its pass with the bright pass since both read the whole HDR image. Every stage is its own frame
+// graph pass, so the GPU profiler times each of them.
+struct PostProcessChain
+{
+    bool enabled = true;
+    bool autoExposure = true;
+    bool bloom = true;
+    Tonemapper tonemapper = Tonemapper_ACES;
+
+    f32 exposureCompensation = 0.0f; // EV added to the metered exposure
+    f32 manualExposure = 1.0f;       // without auto exposure
+    f32 minLogLuminance = -10.0f;    // histogram range, log2
+    f32 maxLogLuminance = 4.0f;
+    f32 adaptationRate = 1.5f;       // per second
+
+    f32 bloomThreshold = 1.0f;       // after exposure
+    f32 bloomKnee = 0.5f;            // soft transition below the threshold
+    f32 bloomIntensity = 0.05f;
+    u32 bloomLevels = 6;
+
+    Buffer exposure;                 // histogram, adapted luminance and exposure
+    GLuint bloomTexture;             // mip chain, level 0 at half the render size
+    ivec2  bloomSize;
+    u32    allocatedBloomLevels;
+
+    u32 luminanceProgramIdx;
+    u32 exposureProgramIdx;
+    u32 downsampleProgramIdx;
+    u32 upsampleProgramIdx;
+    u32 tonemapProgramIdx;
+};
+
+namespace PostProcessing
+{
+    void Init(App* app);
+
+    // From the internalSize region of the HDR target to the output, which may be the back buffer
+    void AddPasses(App* app, u32 hdrColor, u32 output);
+}
+
+#endif // !POST_PROCESS_FUNC
@@ -0,0 +1,121 @@
+#include "platform.h"
+#include "RenderStats.h"
+
+RenderStats GlobalRenderStats = {};
+
+namespace RenderStatistics
+{
+    static const char* CounterNames[] =
+    {
+#define RENDER_STATS_NAME(name, label) label,
+        RENDER_STATS_COUNTERS(RENDER_STATS_NAME)
+#undef RENDER_STATS_NAME
+    };
+    static_assert(ARRAY_COUNT(CounterNames) == RENDER_STATS_COUNT, "RenderStats must only hold the listed u64 counters");
+
+    static RenderStats history[RENDER_STATS_HISTORY];
+    static u32 historyCount = 0;
+    static u32 nextFrame = 0;
+    static RenderStats lastFrame = {};
+
+    void BeginFrame()
+    {
+        lastFrame = GlobalRenderStats;
+        history[nextFrame] = lastFrame;
+        nextFrame = (nextFrame + 1) % RENDER_STATS_HISTORY;
+        historyCount = glm::min(historyCount + 1, (u32)RENDER_STATS_HISTORY);
+
+        GlobalRenderStats = {};
+    }
+
+    const RenderStats& LastFrame()
+    {
+        return lastFrame;
+    }
+
+    u64 CounterValue(const RenderStats& stats, u32 counter)
+    {
+        return ((const u64*)&stats)[counter];
+    }
+
+    const char* CounterName(u32 counter)
+    {
+        return CounterNames[counter];
+    }
+
+    void Summarize(RenderStats& average, RenderStats& peak)
+    {
+        u64* averageValues = (u64*)&average;
+        u64* peakValues = (u64*)&peak;
+        for (u32 counter = 0; counter < RENDER_STATS_COUNT; ++counter)
+        {
+            u64 sum = 0;
+            u64 maximum = 0;
+            for (u32 i = 0; i < historyCount; ++i)
+            {
+                u64 value = CounterValue(history[i], counter);
+                sum += value;
+                maximum = glm::max(maximum, value);
+            }
+            averageValues[counter] = historyCount ? sum / historyCount : 0;
+            peakValues[counter] = maximum;
+        }
+    }
+
+    bool ExportCsv(const char* path)
+    {
+        FILE* file = fopen(path, "w");
+        if (!file)
+        {
+            ELOG("fopen() failed writing file %s", path);
+            return false;
+        }
+
+        fprintf(file, "frame");
+        for (u32 counter = 0; counter < RENDER_STATS_COUNT; ++counter)
+            fprintf(file, ",%s", CounterNames[counter]);
+        fprintf(file, "\n");
+
+        u32 first = (nextFrame + RENDER_STATS_HISTORY - historyCount) % RENDER_STATS_HISTORY;
+        for (u32 i = 0; i < historyCount; ++i)
+        {
+            const RenderStats& stats = history[(first + i) % RENDER_STATS_HISTORY];
+            fprintf(file, "%u", i);
+            for (u32 counter = 0; counter < RENDER_STATS_COUNT; ++counter)
+                fprintf(file, ",%llu", CounterValue(stats, counter));
+            fprintf(file, "\n");
+        }
+
+        fclose(file);
+        return true;
+    }
+
+    static u64 FormatComponents(GLenum format)
+    {
+        switch (format)
+        {
+        case GL_RED: case GL_RED_INTEGER: case GL_DEPTH_COMPONENT: return 1;
+        case GL_RG: case GL_RG_INTEGER: case GL_DEPTH_STENCIL:     return 2;
+        case GL_RGB: case GL_BGR: case GL_RGB_INTEGER:             return 3;
+        default:                                                   return 4;
+        }
+    }
+
+    static u64 TypeSize(GLenum type)
+    {
+        switch (type)
+        {
+        case GL_UNSIGNED_BYTE: case GL_BYTE:                      return 1;
+        case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: return 2;
+        default:                                                  return 4;
+        }
+    }
+
+    u64 TextureBytes(GLsizei width, GLsizei height, GLenum format, GLenum type)
+    {
+        // Packed types hold the whole texel
+        if (type == GL_UNSIGNED_INT_24_8 || type == GL_UNSIGNED_INT_10F_11F_11F_REV || type == GL_UNSIGNED_INT_2_10_10_10_REV)
+            return (u64)width * height * 4;
+        return (u64)width * height * FormatComponents(format) * TypeSize(type);
+    }
+}
@@ -0,0 +1,271 @@
+#ifndef RENDER_STATS_FUNC
+#define RENDER_STATS_FUNC
+
+#include "Globals.h"
+
+// Routes the GL calls below through counting wrappers in every file including this header
+#ifndef RENDER_STATS_ENABLED
+#define RENDER_STATS_ENABLED 1
+#endif
+
+// Frames kept for the averages and the CSV export
+#define RENDER_STATS_HISTORY 240
+
+// Every counter is a u64, listed once here for the struct, the GUI and the export
+#define RENDER_STATS_COUNTERS(X) \
+    X(drawCalls,          "Draw calls") \
+    X(triangles,          "Triangles submitted") \
+    X(indirectTriangles,  "Indirect triangles, before GPU culling") \
+    X(dispatches,         "Compute dispatches") \
+    X(programBinds,       "Program binds") \
+    X(vaoBinds,           "VAO binds") \
+    X(textureBinds,       "Texture binds") \
+    X(framebufferBinds,   "FBO binds") \
+    X(bufferBinds,        "Buffer binds") \
+    X(uniformCalls,       "Uniform calls") \
+    X(uniformLookups,     "Uniform location lookups") \
+    X(mappedBytes,        "Bytes written to mapped buffers") \
+    X(bufferUploads,      "Buffer uploads") \
+    X(bufferUploadBytes,  "Buffer upload bytes") \
+    X(textureUploads,     "Texture uploads") \
+    X(textureUploadBytes, "Texture upload bytes") \
+    X(vaoLookups,         "FindVAO lookups") \
+    X(vaoCacheMisses,     "FindVAO misses")
+
+struct RenderStats
+{
+#define RENDER_STATS_FIELD(name, label) u64 name;
+    RENDER_STATS_COUNTERS(RENDER_STATS_FIELD)
+#undef RENDER_STATS_FIELD
+};
+
+#define RENDER_STATS_COUNT (sizeof(RenderStats) / sizeof(u64))
+
+// Counters of the frame being recorded, GL is only called from the main thread
+extern RenderStats GlobalRenderStats;
+
+namespace RenderStatistics
+{
+    // Closes the frame being recorded and starts a new one
+    void BeginFrame();
+
+    // Last complete frame
+    const RenderStats& LastFrame();
+
+    // Average and maximum of every counter over the history
+    void Summarize(RenderStats& average, RenderStats& peak);
+
+    const char* CounterName(u32 counter);
+    u64 CounterValue(const RenderStats& stats, u32 counter);
+
+    // One row per frame, oldest first
+    bool ExportCsv(const char* path);
+
+    u64 TextureBytes(GLsizei width, GLsizei height, GLenum format, GLenum type);
+
+#if RENDER_STATS_ENABLED
+    inline void DrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+    {
+        GlobalRenderStats.drawCalls++;
+        GlobalRenderStats.triangles += mode == GL_TRIANGLES ? count / 3 : 0;
+        glad_glDrawElements(mode, count, type, indices);
+    }
+
+    inline void DrawElementsInstancedBaseInstance(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instanceCount, GLuint baseInstance)
+    {
+        GlobalRenderStats.drawCalls++;
+        GlobalRenderStats.triangles += mode == GL_TRIANGLES ? count / 3 * instanceCount : 0;
+        glad_glDrawElementsInstancedBaseInstance(mode, count, type, indices, instanceCount, baseInstance);
+    }
+
+    inline void DrawArrays(GLenum mode, GLint first, GLsizei count)
+    {
+        GlobalRenderStats.drawCalls++;
+        GlobalRenderStats.triangles += mode == GL_TRIANGLES ? count / 3 : 0;
+        glad_glDrawArrays(mode, first, count);
+    }
+
+    // The command lives on the GPU and may have been culled there, the caller adds the triangles of the
+    // submesh to indirectTriangles, an upper bound of what was drawn
+    inline void DrawElementsIndirect(GLenum mode, GLenum type, const void* indirect)
+    {
+        GlobalRenderStats.drawCalls++;
+        glad_glDrawElementsIndirect(mode, type, indirect);
+    }
+
+    inline void DispatchCompute(GLuint x, GLuint y, GLuint z)
+    {
+        GlobalRenderStats.dispatches++;
+        glad_glDispatchCompute(x, y, z);
+    }
+
+    inline void UseProgram(GLuint program)
+    {
+        GlobalRenderStats.programBinds++;
+        glad_glUseProgram(program);
+    }
+
+    inline void BindVertexArray(GLuint array)
+    {
+        GlobalRenderStats.vaoBinds++;
+        glad_glBindVertexArray(array);
+    }
+
+    inline void BindTexture(GLenum target, GLuint texture)
+    {
+        GlobalRenderStats.textureBinds++;
+        glad_glBindTexture(target, texture);
+    }
+
+    inline void BindImageTexture(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format)
+    {
+        GlobalRenderStats.textureBinds++;
+        glad_glBindImageTexture(unit, texture, level, layered, layer, access, format);
+    }
+
+    inline void BindFramebuffer(GLenum target, GLuint framebuffer)
+    {
+        GlobalRenderStats.framebufferBinds++;
+        glad_glBindFramebuffer(target, framebuffer);
+    }
+
+    inline void BindBuffer(GLenum target, GLuint buffer)
+    {
+        GlobalRenderStats.bufferBinds++;
+        glad_glBindBuffer(target, buffer);
+    }
+
+    inline void BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+    {
+        GlobalRenderStats.bufferBinds++;
+        glad_glBindBufferBase(target, index, buffer);
+    }
+
+    inline void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        GlobalRenderStats.bufferBinds++;
+        glad_glBindBufferRange(target, index, buffer, offset, size);
+    }
+
+    inline GLint GetUniformLocation(GLuint program, const GLchar* name)
+    {
+        GlobalRenderStats.uniformLookups++;
+        return glad_glGetUniformLocation(program, name);
+    }
+
+    inline void Uniform1i(GLint location, GLint v0)                       { GlobalRenderStats.uniformCalls++; glad_glUniform1i(location, v0); }
+    inline void Uniform1ui(GLint location, GLuint v0)                     { GlobalRenderStats.uniformCalls++; glad_glUniform1ui(location, v0); }
+    inline void Uniform1f(GLint location, GLfloat v0)                     { GlobalRenderStats.uniformCalls++; glad_glUniform1f(location, v0); }
+    inline void Uniform1fv(GLint location, GLsizei count, const GLfloat* value) { GlobalRenderStats.uniformCalls++; glad_glUniform1fv(location, count, value); }
+    inline void Uniform2i(GLint location, GLint v0, GLint v1)             { GlobalRenderStats.uniformCalls++; glad_glUniform2i(location, v0, v1); }
+    inline void Uniform2f(GLint location, GLfloat v0, GLfloat v1)         { GlobalRenderStats.uniformCalls++; glad_glUniform2f(location, v0, v1); }
+    inline void Uniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2) { GlobalRenderStats.uniformCalls++; glad_glUniform3f(location, v0, v1, v2); }
+    inline void Uniform3fv(GLint location, GLsizei count, const GLfloat* value) { GlobalRenderStats.uniformCalls++; glad_glUniform3fv(location, count, value); }
+    inline void Uniform4f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) { GlobalRenderStats.uniformCalls++; glad_glUniform4f(location, v0, v1, v2, v3); }
+    inline void Uniform4fv(GLint location, GLsizei count, const GLfloat* value) { GlobalRenderStats.uniformCalls++; glad_glUniform4fv(location, count, value); }
+    inline void UniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+    {
+        GlobalRenderStats.uniformCalls++;
+        glad_glUniformMatrix4fv(location, count, transpose, value);
+    }
+
+    // Allocations without data are not uploads
+    inline void BufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+    {
+        if (data)
+        {
+            GlobalRenderStats.bufferUploads++;
+            GlobalRenderStats.bufferUploadBytes += size;
+        }
+        glad_glBufferData(target, size, data, usage);
+    }
+
+    inline void BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+    {
+        GlobalRenderStats.bufferUploads++;
+        GlobalRenderStats.bufferUploadBytes += size;
+        glad_glBufferSubData(target, offset, size, data);
+    }
+
+    inline void TexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels)
+    {
+        if (pixels)
+        {
+            GlobalRenderStats.textureUploads++;
+            GlobalRenderStats.textureUploadBytes += TextureBytes(width, height, format, type);
+        }
+        glad_glTexImage2D(target, level, internalFormat, width, height, border, format, type, pixels);
+    }
+
+    inline void TexSubImage2D(GLenum target, GLint level, GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, const void* pixels)
+    {
+        GlobalRenderStats.textureUploads++;
+        GlobalRenderStats.textureUploadBytes += TextureBytes(width, height, format, type);
+        glad_glTexSubImage2D(target, level, x, y, width, height, format, type, pixels);
+    }
+#endif
+}
+
+#if RENDER_STATS_ENABLED
+#undef glDrawElements
+#undef glDrawElementsInstancedBaseInstance
+#undef glDrawArrays
+#undef glDrawElementsIndirect
+#undef glDispatchCompute
+#undef glUseProgram
+#undef glBindVertexArray
+#undef glBindTexture
+#undef glBindImageTexture
+#undef glBindFramebuffer
+#undef glBindBuffer
+#undef glBindBufferBase
+#undef glBindBufferRange
+#undef glGetUniformLocation
+#undef glUniform1i
+#undef glUniform1ui
+#undef glUniform1f
+#undef glUniform1fv
+#undef glUniform2i
+#undef glUniform2f
+#undef glUniform3f
+#undef glUniform3fv
+#undef glUniform4f
+#undef glUniform4fv
+#undef glUniformMatrix4fv
+#undef glBufferData
+#undef glBufferSubData
+#undef glTexImage2D
+#undef glTexSubImage2D
+
+#define glDrawElements         RenderStatistics::DrawElements
+#define glDrawElementsInstancedBaseInstance RenderStatistics::DrawElementsInstancedBaseInstance
+#define glDrawArrays           RenderStatistics::DrawArrays
+#define glDrawElementsIndirect RenderStatistics::DrawElementsIndirect
+#define glDispatchCompute      RenderStatistics::DispatchCompute
+#define glUseProgram           RenderStatistics::UseProgram
+#define glBindVertexArray      RenderStatistics::BindVertexArray
+#define glBindTexture          RenderStatistics::BindTexture
+#define glBindImageTexture     RenderStatistics::BindImageTexture
+#define glBindFramebuffer      RenderStatistics::BindFramebuffer
+#define glBindBuffer           RenderStatistics::BindBuffer
+#define glBindBufferBase       RenderStatistics::BindBufferBase
+#define glBindBufferRange      RenderStatistics::BindBufferRange
+#define glGetUniformLocation   RenderStatistics::GetUniformLocation
+#define glUniform1i            RenderStatistics::Uniform1i
+#define glUniform1ui           RenderStatistics::Uniform1ui
+#define glUniform1f            RenderStatistics::Uniform1f
+#define glUniform1fv           RenderStatistics::Uniform1fv
+#define glUniform2i            RenderStatistics::Uniform2i
+#define glUniform2f            RenderStatistics::Uniform2f
+#define glUniform3f            RenderStatistics::Uniform3f
+#define glUniform3fv           RenderStatistics::Uniform3fv
+#define glUniform4f            RenderStatistics::Uniform4f
+#define glUniform4fv           RenderStatistics::Uniform4fv
+#define glUniformMatrix4fv     RenderStatistics::UniformMatrix4fv
+#define glBufferData           RenderStatistics::BufferData
+#define glBufferSubData        RenderStatistics::BufferSubData
+#define glTexImage2D           RenderStatistics::TexImage2D
+#define glTexSubImage2D        RenderStatistics::TexSubImage2D
+#endif
+
+#endif // !RENDER_STATS_FUNC
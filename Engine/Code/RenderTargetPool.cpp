@@ -0,0 +1,155 @@
+#include "RenderTargetPool.h"
+#include "RenderStats.h"
+
+namespace RenderTargets
+{
+    static u32 BytesPerPixel(GLenum internalFormat)
+    {
+        switch (internalFormat)
+        {
+        case GL_R8:                 return 1;
+        case GL_R16F:               return 2;
+        case GL_RGBA16F:            return 8;
+        case GL_RGBA32F:            return 16;
+        default:                    return 4;
+        }
+    }
+
+    static bool IsDepthFormat(GLenum internalFormat)
+    {
+        return internalFormat == GL_DEPTH_COMPONENT24 || internalFormat == GL_DEPTH_COMPONENT32F ||
+               internalFormat == GL_DEPTH24_STENCIL8 || internalFormat == GL_DEPTH32F_STENCIL8;
+    }
+
+    static GLuint CreateTarget(const RenderTargetDesc& desc)
+    {
+        GLuint handle;
+        glGenTextures(1, &handle);
+
+        if (desc.samples > 1)
+        {
+            glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, handle);
+            glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, desc.samples, desc.internalFormat, desc.size.x, desc.size.y, GL_TRUE);
+            glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+            return handle;
+        }
+
+        // No data is uploaded, any format and type accepted for the internal format will do
+        GLenum format = GL_RGBA;
+        GLenum dataType = GL_FLOAT;
+        if (desc.internalFormat == GL_DEPTH24_STENCIL8 || desc.internalFormat == GL_DEPTH32F_STENCIL8)
+        {
+            format = GL_DEPTH_STENCIL;
+            dataType = GL_UNSIGNED_INT_24_8;
+        }
+        else if (IsDepthFormat(desc.internalFormat))
+        {
+            format = GL_DEPTH_COMPONENT;
+        }
+        else if (desc.internalFormat == GL_R32UI)
+        {
+            format = GL_RED_INTEGER;
+            dataType = GL_UNSIGNED_INT;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, handle);
+        glTexImage2D(GL_TEXTURE_2D, 0, desc.internalFormat, desc.size.x, desc.size.y, 0, format, dataType, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return handle;
+    }
+
+    GLuint Acquire(RenderTargetPool& pool, const RenderTargetDesc& desc)
+    {
+        for (RenderTarget& target : pool.targets)
+        {
+            if (!target.inUse && target.desc.internalFormat == desc.internalFormat &&
+                target.desc.size == desc.size && target.desc.samples == desc.samples)
+            {
+                target.inUse = true;
+                target.lastUsedFrame = pool.frame;
+                return target.handle;
+            }
+        }
+
+        RenderTarget target;
+        target.desc = desc;
+        target.handle = CreateTarget(desc);
+        target.inUse = true;
+        target.lastUsedFrame = pool.frame;
+        pool.targets.push_back(target);
+
+        pool.allocatedBytes += (u64)desc.size.x * desc.size.y * glm::max(desc.samples, 1u) * BytesPerPixel(desc.internalFormat);
+        pool.createdThisFrame++;
+        return target.handle;
+    }
+
+    void Release(RenderTargetPool& pool, GLuint handle)
+    {
+        for (RenderTarget& target : pool.targets)
+        {
+            if (target.handle == handle)
+            {
+                ASSERT(target.inUse, "Render target released twice");
+                target.inUse = false;
+                target.lastUsedFrame = pool.frame;
+                return;
+            }
+        }
+        ASSERT(false, "Render target not owned by the pool");
+    }
+
+    void BeginFrame(RenderTargetPool& pool)
+    {
+        pool.frame++;
+        pool.createdThisFrame = 0;
+
+        for (size_t i = 0; i < pool.targets.size();)
+        {
+            RenderTarget& target = pool.targets[i];
+            if (!target.inUse && pool.frame - target.lastUsedFrame > RENDER_TARGET_EVICT_FRAMES)
+            {
+                glDeleteTextures(1, &target.handle);
+                pool.allocatedBytes -= (u64)target.desc.size.x * target.desc.size.y * glm::max(target.desc.samples, 1u) * BytesPerPixel(target.desc.internalFormat);
+
+                target = pool.targets.back();
+                pool.targets.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    bool UpdateRenderSize(RenderTargetPool& pool, ivec2 displaySize, f64 time)
+    {
+        // Minimized
+        if (displaySize.x <= 0 || displaySize.y <= 0)
+            return false;
+
+        if (pool.renderSize == ivec2(0))
+        {
+            pool.renderSize = displaySize;
+            pool.pendingSize = displaySize;
+            return true;
+        }
+
+        if (displaySize != pool.pendingSize)
+        {
+            pool.pendingSize = displaySize;
+            pool.pendingSince = time;
+            return false;
+        }
+
+        if (pool.renderSize != pool.pendingSize && time - pool.pendingSince >= RENDER_TARGET_RESIZE_DEBOUNCE)
+        {
+            pool.renderSize = pool.pendingSize;
+            return true;
+        }
+        return false;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef RENDER_TARGET_POOL_FUNC
+#define RENDER_TARGET_POOL_FUNC
+
+#include "Globals.h"
+
+// Free targets not requested for this many frames are deleted
+#define RENDER_TARGET_EVICT_FRAMES 3
+
+// The render size follows the window once it stopped changing for this long (seconds)
+#define RENDER_TARGET_RESIZE_DEBOUNCE 0.2
+
+struct RenderTargetDesc
+{
+    GLenum internalFormat;
+    ivec2  size;
+    u32    samples;
+};
+
+struct RenderTarget
+{
+    RenderTargetDesc desc;
+    GLuint handle;
+    bool   inUse;
+    u64    lastUsedFrame;
+};
+
+// Textures shared by the render passes, recycled between passes and frames
+struct RenderTargetPool
+{
+    std::vector<RenderTarget> targets;
+    u64 frame;
+
+    // Size every screen sized target is created with, lags behind the window while it is being resized
+    ivec2 renderSize;
+    ivec2 pendingSize;
+    f64   pendingSince;
+
+    u64 allocatedBytes;
+    u32 createdThisFrame;
+};
+
+namespace RenderTargets
+{
+    // Returns a free target matching the description, creating one if there is none
+    GLuint Acquire(RenderTargetPool& pool, const RenderTargetDesc& desc);
+
+    // Gives the target back to the pool, it can be handed out again in the same frame
+    void Release(RenderTargetPool& pool, GLuint handle);
+
+    // Evicts the targets nobody asked for in a while
+    void BeginFrame(RenderTargetPool& pool);
+
+    // Debounces window size changes. Returns true when renderSize changed and the screen sized targets must be reacquired.
+    bool UpdateRenderSize(RenderTargetPool& pool, ivec2 displaySize, f64 time);
+}
+
+#endif // !RENDER_TARGET_POOL_FUNC
@@ -0,0 +1,151 @@
+#include "engine.h"
+#include "SSAO.h"
+
+// Must match SSAO.glsl
+#define SSAO_GROUP_SIZE 16
+#define SSAO_TILE_BORDER 16
+#define SSAO_UPSAMPLE_GROUP_SIZE 8
+
+namespace AmbientOcclusion
+{
+    static u32 DispatchSize(u32 size, u32 groupSize)
+    {
+        return (size + groupSize - 1) / groupSize;
+    }
+
+    void Init(App* app)
+    {
+        ScreenSpaceAO& ssao = app->ssao;
+        ssao.computeProgramIdx = LoadComputeProgram(app, "SSAO.glsl", "SSAO_COMPUTE");
+        ssao.blurProgramIdx = LoadComputeProgram(app, "SSAO.glsl", "SSAO_BLUR");
+        ssao.upsampleProgramIdx = LoadComputeProgram(app, "SSAO.glsl", "SSAO_UPSAMPLE");
+    }
+
+    static void SetDepthUniforms(App* app, const Program& program)
+    {
+        ivec2 internalSize = app->dynamicResolution.internalSize;
+        glUniform2i(glGetUniformLocation(program.handle, "uDepthSize"), internalSize.x, internalSize.y);
+        glUniform1f(glGetUniformLocation(program.handle, "uNear"), app->cameraNear);
+        glUniform1f(glGetUniformLocation(program.handle, "uFar"), app->cameraFar);
+        glUniform1f(glGetUniformLocation(program.handle, "uSharpness"), app->ssao.blurSharpness);
+    }
+
+    u32 AddPasses(App* app, u32 depth, u32 normals)
+    {
+        FrameGraph& graph = app->frameGraph;
+        ScreenSpaceAO& ssao = app->ssao;
+        if (!ssao.enabled)
+        {
+            ssao.occlusionTarget = UINT32_MAX;
+            return UINT32_MAX;
+        }
+
+        // Occlusion and linear depth side by side, so the blur and the upsample don't go back to the depth buffer
+        ivec2 size = app->renderTargetPool.renderSize;
+        ivec2 halfSize = glm::max((size + 1) / 2, ivec2(1));
+        u32 raw = FrameGraphs::CreateTexture(graph, "SSAORaw", { GL_RG16F, halfSize, 1 });
+        u32 blurred = FrameGraphs::CreateTexture(graph, "SSAOBlurred", { GL_RG16F, halfSize, 1 });
+        u32 occlusion = FrameGraphs::CreateTexture(graph, "AmbientOcclusion", { GL_R8, size, 1 });
+        FrameGraphs::SetExtent(graph, raw, (app->dynamicResolution.internalSize + 1) / 2);
+        FrameGraphs::SetExtent(graph, blurred, (app->dynamicResolution.internalSize + 1) / 2);
+        FrameGraphs::SetExtent(graph, occlusion, app->dynamicResolution.internalSize);
+
+        u32 computePass = FrameGraphs::AddPass(graph, "SSAO", [app, depth, normals, raw]()
+        {
+            const FrameGraph& graph = app->frameGraph;
+            const ScreenSpaceAO& ssao = app->ssao;
+            const Program& program = app->programs[ssao.computeProgramIdx];
+            glUseProgram(program.handle);
+            SetDepthUniforms(app, program);
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, FrameGraphs::GetHandle(graph, depth));
+            glUniform1i(glGetUniformLocation(program.handle, "uDepth"), 0);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, FrameGraphs::GetHandle(graph, normals));
+            glUniform1i(glGetUniformLocation(program.handle, "uNormals"), 1);
+            glBindImageTexture(0, FrameGraphs::GetHandle(graph, raw), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+
+            // View position from the linear depth, the jitter of the projection included
+            const glm::mat4& projection = app->temporalAA.jitteredProjection;
+            ivec2 outputSize = (app->dynamicResolution.internalSize + 1) / 2;
+            glUniform2i(glGetUniformLocation(program.handle, "uOutputSize"), outputSize.x, outputSize.y);
+            glUniform4f(glGetUniformLocation(program.handle, "uProjectionInfo"), 1.0f / projection[0][0], 1.0f / projection[1][1], projection[2][0], projection[2][1]);
+            glUniform1f(glGetUniformLocation(program.handle, "uProjectionScale"), projection[1][1] * 0.5f * outputSize.y);
+            glUniformMatrix4fv(glGetUniformLocation(program.handle, "uViewMatrix"), 1, GL_FALSE, glm::value_ptr(app->viewMatrix));
+            glUniform1f(glGetUniformLocation(program.handle, "uRadius"), ssao.radius);
+            glUniform1f(glGetUniformLocation(program.handle, "uIntensity"), ssao.intensity);
+            glUniform1f(glGetUniformLocation(program.handle, "uBias"), ssao.bias);
+
+            // A different rotation of the sample pattern every frame lets the temporal resolve average it
+            const TemporalAntiAliasing& taa = app->temporalAA;
+            glUniform1ui(glGetUniformLocation(program.handle, "uFrame"), taa.enabled ? taa.frameIndex : 0);
+
+            glDispatchCompute(DispatchSize(outputSize.x, SSAO_GROUP_SIZE), DispatchSize(outputSize.y, SSAO_GROUP_SIZE), 1);
+            glUseProgram(0);
+        });
+        FrameGraphs::Read(graph, computePass, depth, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, computePass, normals, FrameGraphAccess_Sampled);
+        FrameGraphs::Write(graph, computePass, raw, FrameGraphAccess_Image);
+
+        // Separable in shared memory, rows first and columns of the row results next
+        u32 blurPass = FrameGraphs::AddPass(graph, "SSAO blur", [app, raw, blurred]()
+        {
+            const FrameGraph& graph = app->frameGraph;
+            const Program& program = app->programs[app->ssao.blurProgramIdx];
+            glUseProgram(program.handle);
+            SetDepthUniforms(app, program);
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, FrameGraphs::GetHandle(graph, raw));
+            glUniform1i(glGetUniformLocation(program.handle, "uInput"), 0);
+            glBindImageTexture(0, FrameGraphs::GetHandle(graph, blurred), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+
+            ivec2 outputSize = (app->dynamicResolution.internalSize + 1) / 2;
+            glUniform2i(glGetUniformLocation(program.handle, "uOutputSize"), outputSize.x, outputSize.y);
+            glDispatchCompute(DispatchSize(outputSize.x, SSAO_GROUP_SIZE), DispatchSize(outputSize.y, SSAO_GROUP_SIZE), 1);
+            glUseProgram(0);
+        });
+        FrameGraphs::Read(graph, blurPass, raw, FrameGraphAccess_Sampled);
+        FrameGraphs::Write(graph, blurPass, blurred, FrameGraphAccess_Image);
+
+        // Each G-buffer pixel weights the four half resolution texels around it by how close their depth is
+        u32 upsamplePass = FrameGraphs::AddPass(graph, "SSAO upsample", [app, depth, blurred, occlusion]()
+        {
+            const FrameGraph& graph = app->frameGraph;
+            const Program& program = app->programs[app->ssao.upsampleProgramIdx];
+            glUseProgram(program.handle);
+            SetDepthUniforms(app, program);
+
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, FrameGraphs::GetHandle(graph, depth));
+            glUniform1i(glGetUniformLocation(program.handle, "uDepth"), 0);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, FrameGraphs::GetHandle(graph, blurred));
+            glUniform1i(glGetUniformLocation(program.handle, "uInput"), 1);
+            glBindImageTexture(0, FrameGraphs::GetHandle(graph, occlusion), 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8);
+
+            ivec2 inputSize = (app->dynamicResolution.internalSize + 1) / 2;
+            glUniform2i(glGetUniformLocation(program.handle, "uInputSize"), inputSize.x, inputSize.y);
+            ivec2 outputSize = app->dynamicResolution.internalSize;
+            glDispatchCompute(DispatchSize(outputSize.x, SSAO_UPSAMPLE_GROUP_SIZE), DispatchSize(outputSize.y, SSAO_UPSAMPLE_GROUP_SIZE), 1);
+            glUseProgram(0);
+        });
+        FrameGraphs::Read(graph, upsamplePass, depth, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, upsamplePass, blurred, FrameGraphAccess_Sampled);
+        FrameGraphs::Write(graph, upsamplePass, occlusion, FrameGraphAccess_Image);
+
+        ssao.occlusionTarget = occlusion;
+        return occlusion;
+    }
+
+    void Bind(App* app, const Program& program, u32 textureUnit)
+    {
+        const ScreenSpaceAO& ssao = app->ssao;
+        bool enabled = ssao.occlusionTarget != UINT32_MAX;
+        glActiveTexture(GL_TEXTURE0 + textureUnit);
+        glBindTexture(GL_TEXTURE_2D, enabled ? FrameGraphs::GetHandle(app->frameGraph, ssao.occlusionTarget) : 0);
+        glUniform1i(glGetUniformLocation(program.handle, "uAmbientOcclusion"), textureUnit);
+        glUniform1i(glGetUniformLocation(program.handle, "uAmbientOcclusionEnabled"), enabled);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef SSAO_FUNC
+#define SSAO_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+// Occlusion of the ambient term, computed at half resolution from the G-buffer depth and normals.
+// Every group caches the linear depth around its texels in shared memory and takes all its samples
+// from there, so the screen radius is capped to the cached border. A depth aware blur removes the
+// sampling noise and a bilateral upsample brings the result back to the G-buffer grid, where the
+// lighting passes scale the ambient strength with it.
+struct ScreenSpaceAO
+{
+    bool enabled = true;
+    f32  radius = 0.5f;         // world units
+    f32  intensity = 1.0f;
+    f32  bias = 0.05f;          // cosine below which a sample doesn't occlude
+    f32  blurSharpness = 8.0f;  // how much relative depth differences cut the blur and the upsample
+
+    u32 occlusionTarget = UINT32_MAX; // frame graph resource of this frame, UINT32_MAX when disabled
+
+    u32 computeProgramIdx;
+    u32 blurProgramIdx;
+    u32 upsampleProgramIdx;
+};
+
+namespace AmbientOcclusion
+{
+    void Init(App* app);
+
+    // Occlusion, blur and upsample passes. Returns the full resolution occlusion resource.
+    u32 AddPasses(App* app, u32 depth, u32 normals);
+
+    // Samplers and uniforms the lighting passes read the occlusion with
+    void Bind(App* app, const Program& program, u32 textureUnit);
+}
+
+#endif // !SSAO_FUNC
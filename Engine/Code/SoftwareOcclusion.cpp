@@ -0,0 +1,360 @@
+#include "engine.h"
+#include "SoftwareOcclusion.h"
+#include "JobSystem.h"
+
+#include <immintrin.h>
+#include <float.h>
+#include <unordered_map>
+
+#define SW_OCCLUSION_NEAR_W 1e-4f
+
+namespace SoftwareOcclusion
+{
+    // Between the eye and the near plane the NDC depth falls below -1, an occluder there would write a
+    // depth in front of everything
+    static bool BeforeNearPlane(const vec4& clip)
+    {
+        return clip.w < SW_OCCLUSION_NEAR_W || clip.z < -clip.w;
+    }
+
+    void RegisterOccluder(App* app, u32 modelIdx, u32 gridResolution)
+    {
+        const Mesh& mesh = app->meshes[app->models[modelIdx].meshIdx];
+
+        OccluderMesh occluder = {};
+        occluder.modelIdx = modelIdx;
+
+        std::vector<u32> vertexCounts;
+        for (const SubMesh& submesh : mesh.submeshes)
+        {
+            const u32 strideInFloats = submesh.vertexBufferLayout.stride / sizeof(float);
+            const u32 vertexCount = submesh.vertices.size() / strideInFloats;
+
+            vec3 size = submesh.aabbMax - submesh.aabbMin;
+            f32 cellSize = glm::max(size.x, glm::max(size.y, size.z)) / (f32)gridResolution;
+            if (cellSize <= 0.0f)
+                cellSize = 1.0f;
+
+            // Vertex clustering: every vertex of a cell collapses into the average of the cell
+            std::unordered_map<u64, u32> cellToVertex;
+            std::vector<u32> remap(vertexCount);
+            for (u32 v = 0; v < vertexCount; ++v)
+            {
+                const float* p = &submesh.vertices[v * strideInFloats];
+                vec3 position = vec3(p[0], p[1], p[2]);
+                ivec3 cell = ivec3(glm::floor((position - submesh.aabbMin) / cellSize));
+                u64 key = ((u64)(cell.x & 0x1FFFFF) << 42) | ((u64)(cell.y & 0x1FFFFF) << 21) | (u64)(cell.z & 0x1FFFFF);
+
+                auto found = cellToVertex.find(key);
+                if (found == cellToVertex.end())
+                {
+                    u32 newVertex = occluder.positions.size();
+                    cellToVertex[key] = newVertex;
+                    occluder.positions.push_back(position);
+                    vertexCounts.push_back(1);
+                    remap[v] = newVertex;
+                }
+                else
+                {
+                    occluder.positions[found->second] += position;
+                    vertexCounts[found->second]++;
+                    remap[v] = found->second;
+                }
+            }
+
+            for (u32 i = 0; i + 2 < submesh.indices.size(); i += 3)
+            {
+                u32 a = remap[submesh.indices[i + 0]];
+                u32 b = remap[submesh.indices[i + 1]];
+                u32 c = remap[submesh.indices[i + 2]];
+                if (a == b || b == c || a == c)
+                    continue;
+
+                occluder.indices.push_back(a);
+                occluder.indices.push_back(b);
+                occluder.indices.push_back(c);
+            }
+        }
+
+        for (u32 v = 0; v < occluder.positions.size(); ++v)
+            occluder.positions[v] /= (f32)vertexCounts[v];
+
+        ILOG("Occluder for model %u: %u triangles", modelIdx, (u32)occluder.indices.size() / 3);
+        app->occlusionRasterizer.occluders.push_back(occluder);
+    }
+
+    static void TransformOccluders(App* app, OcclusionRasterizer& rasterizer, const glm::mat4& viewProjection)
+    {
+        rasterizer.triangles.clear();
+
+        std::vector<vec4> clipPositions;
+        const EntityStorage& entities = app->entities;
+        for (u32 e = 0; e < entities.count; ++e)
+        {
+            if (!entities.visible[e])
+                continue;
+
+            const OccluderMesh* occluder = nullptr;
+            for (const OccluderMesh& candidate : rasterizer.occluders)
+                if (candidate.modelIdx == entities.modelIndices[e])
+                    occluder = &candidate;
+            if (occluder == nullptr)
+                continue;
+
+            glm::mat4 worldViewProjection = viewProjection * entities.worldMatrices[e];
+            clipPositions.resize(occluder->positions.size());
+            for (u32 v = 0; v < occluder->positions.size(); ++v)
+                clipPositions[v] = worldViewProjection * vec4(occluder->positions[v], 1.0f);
+
+            for (u32 i = 0; i < occluder->indices.size(); i += 3)
+            {
+                ScreenTriangle triangle;
+                bool clipped = false;
+                for (u32 corner = 0; corner < 3; ++corner)
+                {
+                    const vec4& clip = clipPositions[occluder->indices[i + corner]];
+
+                    // Triangles crossing the near plane are dropped, it only makes the occluders smaller
+                    if (BeforeNearPlane(clip))
+                    {
+                        clipped = true;
+                        break;
+                    }
+
+                    vec3 ndc = vec3(clip) / clip.w;
+                    triangle.v[corner] = vec3((ndc.x * 0.5f + 0.5f) * SW_OCCLUSION_WIDTH,
+                                              (ndc.y * 0.5f + 0.5f) * SW_OCCLUSION_HEIGHT,
+                                              ndc.z * 0.5f + 0.5f);
+                }
+                if (clipped)
+                    continue;
+
+                // Back faces (counter clockwise is front facing)
+                vec2 e01 = vec2(triangle.v[1] - triangle.v[0]);
+                vec2 e02 = vec2(triangle.v[2] - triangle.v[0]);
+                if (e01.x * e02.y - e01.y * e02.x <= 0.0f)
+                    continue;
+
+                vec3 minV = glm::min(triangle.v[0], glm::min(triangle.v[1], triangle.v[2]));
+                vec3 maxV = glm::max(triangle.v[0], glm::max(triangle.v[1], triangle.v[2]));
+                if (maxV.x < 0.0f || maxV.y < 0.0f || minV.x >= SW_OCCLUSION_WIDTH || minV.y >= SW_OCCLUSION_HEIGHT || minV.z > 1.0f)
+                    continue;
+
+                rasterizer.triangles.push_back(triangle);
+            }
+        }
+    }
+
+    static void BinTriangles(OcclusionRasterizer& rasterizer)
+    {
+        for (std::vector<u32>& bin : rasterizer.tileBins)
+            bin.clear();
+
+        for (u32 t = 0; t < rasterizer.triangles.size(); ++t)
+        {
+            const ScreenTriangle& triangle = rasterizer.triangles[t];
+            vec2 minV = glm::min(vec2(triangle.v[0]), glm::min(vec2(triangle.v[1]), vec2(triangle.v[2])));
+            vec2 maxV = glm::max(vec2(triangle.v[0]), glm::max(vec2(triangle.v[1]), vec2(triangle.v[2])));
+
+            i32 tileMinX = glm::clamp((i32)minV.x / SW_OCCLUSION_TILE_WIDTH, 0, SW_OCCLUSION_TILES_X - 1);
+            i32 tileMinY = glm::clamp((i32)minV.y / SW_OCCLUSION_TILE_HEIGHT, 0, SW_OCCLUSION_TILES_Y - 1);
+            i32 tileMaxX = glm::clamp((i32)maxV.x / SW_OCCLUSION_TILE_WIDTH, 0, SW_OCCLUSION_TILES_X - 1);
+            i32 tileMaxY = glm::clamp((i32)maxV.y / SW_OCCLUSION_TILE_HEIGHT, 0, SW_OCCLUSION_TILES_Y - 1);
+
+            for (i32 ty = tileMinY; ty <= tileMaxY; ++ty)
+                for (i32 tx = tileMinX; tx <= tileMaxX; ++tx)
+                    rasterizer.tileBins[ty * SW_OCCLUSION_TILES_X + tx].push_back(t);
+        }
+    }
+
+    // Half-space rasterization of the tile bin, 4 pixels per iteration
+    static void RasterizeTile(OcclusionRasterizer& rasterizer, u32 tile)
+    {
+        const i32 tileMinX = (tile % SW_OCCLUSION_TILES_X) * SW_OCCLUSION_TILE_WIDTH;
+        const i32 tileMinY = (tile / SW_OCCLUSION_TILES_X) * SW_OCCLUSION_TILE_HEIGHT;
+        const i32 tileMaxX = tileMinX + SW_OCCLUSION_TILE_WIDTH - 1;
+        const i32 tileMaxY = tileMinY + SW_OCCLUSION_TILE_HEIGHT - 1;
+
+        for (i32 y = tileMinY; y <= tileMaxY; ++y)
+            for (i32 x = tileMinX; x <= tileMaxX; ++x)
+                rasterizer.depth[y * SW_OCCLUSION_WIDTH + x] = 1.0f;
+
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+
+        for (u32 t : rasterizer.tileBins[tile])
+        {
+            const ScreenTriangle& triangle = rasterizer.triangles[t];
+            const vec3& v0 = triangle.v[0];
+            const vec3& v1 = triangle.v[1];
+            const vec3& v2 = triangle.v[2];
+
+            i32 minX = glm::max(tileMinX, (i32)floorf(glm::min(v0.x, glm::min(v1.x, v2.x))));
+            i32 minY = glm::max(tileMinY, (i32)floorf(glm::min(v0.y, glm::min(v1.y, v2.y))));
+            i32 maxX = glm::min(tileMaxX, (i32)ceilf(glm::max(v0.x, glm::max(v1.x, v2.x))));
+            i32 maxY = glm::min(tileMaxY, (i32)ceilf(glm::max(v0.y, glm::max(v1.y, v2.y))));
+            minX &= ~3;
+
+            // E(x, y) = A * x + B * y + C for the edges opposite to every vertex
+            f32 a0 = v1.y - v2.y, b0 = v2.x - v1.x, c0 = (v2.y - v1.y) * v1.x - (v2.x - v1.x) * v1.y;
+            f32 a1 = v2.y - v0.y, b1 = v0.x - v2.x, c1 = (v0.y - v2.y) * v2.x - (v0.x - v2.x) * v2.y;
+            f32 a2 = v0.y - v1.y, b2 = v1.x - v0.x, c2 = (v1.y - v0.y) * v0.x - (v1.x - v0.x) * v0.y;
+            f32 invArea = 1.0f / (a2 * v2.x + b2 * v2.y + c2);
+
+            // Depth is affine in screen space
+            f32 zA = (v0.z * a0 + v1.z * a1 + v2.z * a2) * invArea;
+            f32 zB = (v0.z * b0 + v1.z * b1 + v2.z * b2) * invArea;
+            f32 zC = (v0.z * c0 + v1.z * c1 + v2.z * c2) * invArea;
+
+            const __m128 edgeA0 = _mm_set1_ps(a0), edgeA1 = _mm_set1_ps(a1), edgeA2 = _mm_set1_ps(a2);
+            const __m128 depthA = _mm_set1_ps(zA);
+
+            for (i32 y = minY; y <= maxY; ++y)
+            {
+                f32 py = (f32)y + 0.5f;
+                const __m128 rowE0 = _mm_set1_ps(b0 * py + c0);
+                const __m128 rowE1 = _mm_set1_ps(b1 * py + c1);
+                const __m128 rowE2 = _mm_set1_ps(b2 * py + c2);
+                const __m128 rowZ = _mm_set1_ps(zB * py + zC);
+                f32* row = &rasterizer.depth[y * SW_OCCLUSION_WIDTH];
+
+                for (i32 x = minX; x <= maxX; x += 4)
+                {
+                    __m128 px = _mm_add_ps(_mm_set1_ps((f32)x), laneOffsets);
+                    __m128 e0 = _mm_add_ps(_mm_mul_ps(edgeA0, px), rowE0);
+                    __m128 e1 = _mm_add_ps(_mm_mul_ps(edgeA1, px), rowE1);
+                    __m128 e2 = _mm_add_ps(_mm_mul_ps(edgeA2, px), rowE2);
+
+                    __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+                    if (_mm_movemask_ps(inside) == 0)
+                        continue;
+
+                    __m128 z = _mm_add_ps(_mm_mul_ps(depthA, px), rowZ);
+                    __m128 previous = _mm_loadu_ps(row + x);
+                    __m128 closest = _mm_min_ps(previous, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closest), _mm_andnot_ps(inside, previous)));
+                }
+            }
+        }
+
+        f32 tileMax = 0.0f;
+        for (i32 y = tileMinY; y <= tileMaxY; ++y)
+            for (i32 x = tileMinX; x <= tileMaxX; ++x)
+                tileMax = glm::max(tileMax, rasterizer.depth[y * SW_OCCLUSION_WIDTH + x]);
+        rasterizer.tileMaxDepth[tile] = tileMax;
+    }
+
+    static bool TestItem(const OcclusionRasterizer& rasterizer, const glm::mat4& viewProjection, const vec3& center, const vec3& extent)
+    {
+        vec2 minV = vec2(FLT_MAX);
+        vec2 maxV = vec2(-FLT_MAX);
+        f32 minZ = 1.0f;
+        for (u32 i = 0; i < 8; ++i)
+        {
+            vec3 corner = center + extent * vec3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+            vec4 clip = viewProjection * vec4(corner, 1.0f);
+            if (BeforeNearPlane(clip))
+                return true;
+
+            vec3 ndc = vec3(clip) / clip.w;
+            vec2 screen = vec2((ndc.x * 0.5f + 0.5f) * SW_OCCLUSION_WIDTH, (ndc.y * 0.5f + 0.5f) * SW_OCCLUSION_HEIGHT);
+            minV = glm::min(minV, screen);
+            maxV = glm::max(maxV, screen);
+            minZ = glm::min(minZ, ndc.z * 0.5f + 0.5f);
+        }
+
+        // One extra pixel around the rectangle since the occluders are only sampled at pixel centers
+        i32 x0 = glm::clamp((i32)floorf(minV.x) - 1, 0, SW_OCCLUSION_WIDTH - 1);
+        i32 y0 = glm::clamp((i32)floorf(minV.y) - 1, 0, SW_OCCLUSION_HEIGHT - 1);
+        i32 x1 = glm::clamp((i32)ceilf(maxV.x) + 1, 0, SW_OCCLUSION_WIDTH - 1);
+        i32 y1 = glm::clamp((i32)ceilf(maxV.y) + 1, 0, SW_OCCLUSION_HEIGHT - 1);
+
+        // Coarse test against the farthest depth of every tile
+        bool closerThanSomeTile = false;
+        for (i32 ty = y0 / SW_OCCLUSION_TILE_HEIGHT; ty <= y1 / SW_OCCLUSION_TILE_HEIGHT && !closerThanSomeTile; ++ty)
+            for (i32 tx = x0 / SW_OCCLUSION_TILE_WIDTH; tx <= x1 / SW_OCCLUSION_TILE_WIDTH; ++tx)
+                if (minZ <= rasterizer.tileMaxDepth[ty * SW_OCCLUSION_TILES_X + tx])
+                {
+                    closerThanSomeTile = true;
+                    break;
+                }
+        if (!closerThanSomeTile)
+            return false;
+
+        const __m128 itemDepth = _mm_set1_ps(minZ);
+        for (i32 y = y0; y <= y1; ++y)
+        {
+            const f32* row = &rasterizer.depth[y * SW_OCCLUSION_WIDTH];
+            for (i32 x = x0 & ~3; x <= x1; x += 4)
+            {
+                if (_mm_movemask_ps(_mm_cmple_ps(itemDepth, _mm_loadu_ps(row + x))) != 0)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    void Render(App* app)
+    {
+        OcclusionRasterizer& rasterizer = app->occlusionRasterizer;
+        if (rasterizer.depth.empty())
+        {
+            rasterizer.depth.resize(SW_OCCLUSION_WIDTH * SW_OCCLUSION_HEIGHT);
+            rasterizer.tileMaxDepth.resize(SW_OCCLUSION_TILES_X * SW_OCCLUSION_TILES_Y);
+            rasterizer.tileBins.resize(SW_OCCLUSION_TILES_X * SW_OCCLUSION_TILES_Y);
+        }
+
+        const CullingSet& set = app->cullingSet;
+        const glm::mat4 viewProjection = app->projectionMatrix * app->viewMatrix;
+
+        f64 start = glfwGetTime();
+        TransformOccluders(app, rasterizer, viewProjection);
+
+        f64 transformEnd = glfwGetTime();
+        BinTriangles(rasterizer);
+
+        f64 binEnd = glfwGetTime();
+        JobSystem::ParallelFor(SW_OCCLUSION_TILES_X * SW_OCCLUSION_TILES_Y, 1, [&](u32 begin, u32 end)
+        {
+            for (u32 tile = begin; tile < end; ++tile)
+                RasterizeTile(rasterizer, tile);
+        });
+
+        f64 rasterEnd = glfwGetTime();
+
+        // Every thread owns whole 64 bit words of the bitset
+        u32 wordCount = (set.count + 63) / 64;
+        rasterizer.visibility.assign(wordCount, 0);
+        JobSystem::ParallelFor(wordCount, 16, [&](u32 begin, u32 end)
+        {
+            for (u32 word = begin; word < end; ++word)
+            {
+                u64 bits = 0;
+                for (u32 bit = 0; bit < 64; ++bit)
+                {
+                    u32 item = word * 64 + bit;
+                    if (item >= set.count || !set.visible[item])
+                        continue;
+
+                    vec3 center = vec3(set.centerX[item], set.centerY[item], set.centerZ[item]);
+                    vec3 extent = vec3(set.extentX[item], set.extentY[item], set.extentZ[item]);
+                    if (TestItem(rasterizer, viewProjection, center, extent))
+                        bits |= (u64)1 << bit;
+                }
+                rasterizer.visibility[word] = bits;
+            }
+        });
+
+        f64 testEnd = glfwGetTime();
+
+        rasterizer.occludedItemCount = 0;
+        for (u32 item = 0; item < set.count; ++item)
+            if (set.visible[item] && !IsVisible(rasterizer, item))
+                rasterizer.occludedItemCount++;
+
+        rasterizer.transformTime = (transformEnd - start) * 1000.0;
+        rasterizer.binTime = (binEnd - transformEnd) * 1000.0;
+        rasterizer.rasterTime = (rasterEnd - binEnd) * 1000.0;
+        rasterizer.testTime = (testEnd - rasterEnd) * 1000.0;
+    }
+}
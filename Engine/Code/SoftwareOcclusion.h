@@ -0,0 +1,65 @@
+#ifndef SOFTWARE_OCCLUSION_FUNC
+#define SOFTWARE_OCCLUSION_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+#define SW_OCCLUSION_WIDTH       320
+#define SW_OCCLUSION_HEIGHT      192
+#define SW_OCCLUSION_TILE_WIDTH  32
+#define SW_OCCLUSION_TILE_HEIGHT 32
+#define SW_OCCLUSION_TILES_X     (SW_OCCLUSION_WIDTH / SW_OCCLUSION_TILE_WIDTH)
+#define SW_OCCLUSION_TILES_Y     (SW_OCCLUSION_HEIGHT / SW_OCCLUSION_TILE_HEIGHT)
+
+// Simplified object space copy of an occluder model
+struct OccluderMesh
+{
+    u32 modelIdx;
+    std::vector<vec3> positions;
+    std::vector<u32>  indices;
+};
+
+struct ScreenTriangle
+{
+    vec3 v[3]; // x, y in pixels, z in [0, 1]
+};
+
+struct OcclusionRasterizer
+{
+    std::vector<OccluderMesh> occluders;
+
+    std::vector<f32> depth;         // SW_OCCLUSION_WIDTH * SW_OCCLUSION_HEIGHT, cleared to the far plane
+    std::vector<f32> tileMaxDepth;  // farthest depth of every tile after rasterization
+
+    std::vector<ScreenTriangle>   triangles;
+    std::vector<std::vector<u32>> tileBins;
+
+    // One bit per App::cullingSet item, set when the item is not occluded
+    std::vector<u64> visibility;
+
+    // Timings in milliseconds
+    f64 transformTime;
+    f64 binTime;
+    f64 rasterTime;
+    f64 testTime;
+
+    u32 occludedItemCount;
+};
+
+namespace SoftwareOcclusion
+{
+    // Builds a simplified copy of the model by clustering its vertices in a grid of gridResolution cells
+    // along its largest axis. Every entity using the model will be rasterized as an occluder.
+    void RegisterOccluder(App* app, u32 modelIdx, u32 gridResolution);
+
+    // Rasterizes the occluders with the current camera and tests every frustum visible item of App::cullingSet
+    void Render(App* app);
+
+    inline bool IsVisible(const OcclusionRasterizer& rasterizer, u32 item)
+    {
+        return (rasterizer.visibility[item >> 6] >> (item & 63)) & 1;
+    }
+}
+
+#endif // !SOFTWARE_OCCLUSION_FUNC
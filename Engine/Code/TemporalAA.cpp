@@ -0,0 +1,133 @@
+#include "engine.h"
+#include "TemporalAA.h"
+
+// Must match TemporalAA.glsl
+#define TAA_GROUP_SIZE 8
+
+namespace TemporalAA
+{
+    static f32 Halton(u32 index, u32 base)
+    {
+        f32 result = 0.0f;
+        f32 fraction = 1.0f / base;
+        while (index > 0)
+        {
+            result += fraction * (index % base);
+            index /= base;
+            fraction /= base;
+        }
+        return result;
+    }
+
+    static void AllocateHistory(TemporalAntiAliasing& taa, ivec2 size)
+    {
+        if (taa.history[0] != 0)
+            glDeleteTextures(2, taa.history);
+
+        glGenTextures(2, taa.history);
+        for (GLuint texture : taa.history)
+        {
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, size.x, size.y);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        taa.historySize = size;
+        taa.historyValid = false;
+    }
+
+    void Init(App* app)
+    {
+        app->temporalAA.resolveProgramIdx = LoadComputeProgram(app, "TemporalAA.glsl", "TAA_RESOLVE");
+    }
+
+    void UpdateJitter(App* app)
+    {
+        TemporalAntiAliasing& taa = app->temporalAA;
+
+        glm::mat4 viewProjection = app->projectionMatrix * app->viewMatrix;
+        taa.previousViewProjection = taa.hasPreviousViewProjection ? taa.viewProjection : viewProjection;
+        taa.viewProjection = viewProjection;
+        taa.hasPreviousViewProjection = true;
+
+        // Only the deferred path resolves, the forward one draws straight to the screen
+        if (!taa.enabled || app->mode != Mode_Deferred)
+        {
+            taa.jitter = vec2(0.0f);
+            taa.jitteredProjection = app->projectionMatrix;
+            taa.historyValid = false;
+            return;
+        }
+
+        // Subpixel offset in [-0.5, 0.5] pixels of the internal resolution, shifted in NDC
+        u32 sample = taa.frameIndex++ % TAA_JITTER_SAMPLES + 1;
+        vec2 offset = vec2(Halton(sample, 2), Halton(sample, 3)) - 0.5f;
+        taa.jitter = offset * 2.0f / vec2(app->dynamicResolution.internalSize);
+        taa.jitteredProjection = glm::translate(vec3(taa.jitter, 0.0f)) * app->projectionMatrix;
+    }
+
+    u32 AddResolvePass(App* app, u32 sceneColor, u32 depth, u32 velocity)
+    {
+        FrameGraph& graph = app->frameGraph;
+        TemporalAntiAliasing& taa = app->temporalAA;
+
+        ivec2 size = app->renderTargetPool.renderSize;
+        if (size != taa.historySize)
+            AllocateHistory(taa, size);
+
+        u32 history = FrameGraphs::ImportTexture(graph, "TAAHistory", taa.history[taa.current ^ 1], { GL_RGBA16F, taa.historySize, 1 });
+        u32 output = FrameGraphs::ImportTexture(graph, "TAAOutput", taa.history[taa.current], { GL_RGBA16F, taa.historySize, 1 });
+        FrameGraphs::SetExtent(graph, output, app->dynamicResolution.internalSize);
+
+        u32 resolvePass = FrameGraphs::AddPass(graph, "TAA resolve", [app, sceneColor, depth, velocity]()
+        {
+            const FrameGraph& graph = app->frameGraph;
+            TemporalAntiAliasing& taa = app->temporalAA;
+            const Program& program = app->programs[taa.resolveProgramIdx];
+            glUseProgram(program.handle);
+
+            const char* samplers[] = { "uInput", "uDepth", "uVelocity", "uHistory" };
+            GLuint textures[] = { FrameGraphs::GetHandle(graph, sceneColor), FrameGraphs::GetHandle(graph, depth),
+                FrameGraphs::GetHandle(graph, velocity), taa.history[taa.current ^ 1] };
+            for (u32 i = 0; i < ARRAY_COUNT(samplers); ++i)
+            {
+                glActiveTexture(GL_TEXTURE0 + i);
+                glBindTexture(GL_TEXTURE_2D, textures[i]);
+                glUniform1i(glGetUniformLocation(program.handle, samplers[i]), i);
+            }
+            glBindImageTexture(0, taa.history[taa.current], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+            // Sky pixels have no velocity written, they move with the camera alone
+            glm::mat4 reprojection = taa.previousViewProjection * glm::inverse(taa.viewProjection);
+            glUniformMatrix4fv(glGetUniformLocation(program.handle, "uReprojection"), 1, GL_FALSE, glm::value_ptr(reprojection));
+
+            ivec2 internalSize = app->dynamicResolution.internalSize;
+            glUniform2i(glGetUniformLocation(program.handle, "uSize"), internalSize.x, internalSize.y);
+            glUniform2f(glGetUniformLocation(program.handle, "uJitter"), taa.jitter.x, taa.jitter.y);
+            glUniform2f(glGetUniformLocation(program.handle, "uPreviousExtent"), (f32)taa.previousExtent.x, (f32)taa.previousExtent.y);
+            glUniform2f(glGetUniformLocation(program.handle, "uHistorySize"), (f32)taa.historySize.x, (f32)taa.historySize.y);
+            glUniform1i(glGetUniformLocation(program.handle, "uHistoryValid"), taa.historyValid);
+            glUniform1f(glGetUniformLocation(program.handle, "uHistoryWeight"), taa.historyWeight);
+
+            glDispatchCompute((internalSize.x + TAA_GROUP_SIZE - 1) / TAA_GROUP_SIZE, (internalSize.y + TAA_GROUP_SIZE - 1) / TAA_GROUP_SIZE, 1);
+            glUseProgram(0);
+
+            // Next frame samples this image as uHistory, past what the frame graph tracks
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+            taa.current ^= 1;
+            taa.previousExtent = internalSize;
+            taa.historyValid = true;
+        });
+        FrameGraphs::Read(graph, resolvePass, sceneColor, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, resolvePass, depth, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, resolvePass, velocity, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, resolvePass, history, FrameGraphAccess_Sampled);
+        FrameGraphs::Write(graph, resolvePass, output, FrameGraphAccess_Image);
+        return output;
+    }
+}
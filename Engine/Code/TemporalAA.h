@@ -0,0 +1,50 @@
+#ifndef TEMPORAL_AA_FUNC
+#define TEMPORAL_AA_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+// Length of the Halton (2, 3) jitter sequence
+#define TAA_JITTER_SAMPLES 8
+
+// The deferred projection is offset by a different subpixel amount every frame and the lit image is
+// accumulated over time. The G-buffer holds the motion of every pixel since the previous frame, in
+// uv units (current - previous); the history is reprojected with it and clamped to the color range
+// of the current neighborhood so disoccluded or changed pixels don't leave trails.
+struct TemporalAntiAliasing
+{
+    bool enabled = true;
+    f32  historyWeight = 0.9f; // of the reprojected history in the blend
+
+    u32  frameIndex;
+    vec2 jitter;                      // NDC offset of jitteredProjection this frame
+    glm::mat4 jitteredProjection;     // what the G-buffer is rasterized with, App::projectionMatrix stays still
+    glm::mat4 viewProjection;         // without jitter
+    glm::mat4 previousViewProjection; // without jitter
+    bool hasPreviousViewProjection;
+
+    // Resolved frames, the one written this frame and the previous one
+    GLuint history[2];
+    ivec2  historySize;
+    u32    current;
+    bool   historyValid;
+    ivec2  previousExtent; // region of the previous history holding its image
+
+    u32 resolveProgramIdx;
+};
+
+namespace TemporalAA
+{
+    void Init(App* app);
+
+    // Keeps the matrices of the previous frame and offsets jitteredProjection by the next jitter sample.
+    // The culling, occlusion and shadow fitting keep App::projectionMatrix, so they don't shimmer with
+    // the jitter. Runs once the camera matrices of the frame are known and before anything uses them.
+    void UpdateJitter(App* app);
+
+    // Blends sceneColor with the reprojected history, returns the resolved image resource
+    u32 AddResolvePass(App* app, u32 sceneColor, u32 depth, u32 velocity);
+}
+
+#endif // !TEMPORAL_AA_FUNC
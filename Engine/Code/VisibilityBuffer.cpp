@@ -0,0 +1,188 @@
+#include "engine.h"
+#include "VisibilityBuffer.h"
+
+namespace VisibilityBuffer
+{
+    static void CreateDrawBuffer(VisibilityBufferRenderer& visibility, u32 capacity)
+    {
+        if (visibility.drawCapacity != 0)
+            glDeleteBuffers(1, &visibility.draws.handle);
+
+        visibility.drawCapacity = capacity;
+        visibility.draws = BufferManager::CreateBuffer(capacity * sizeof(VisibilityDraw), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+    }
+
+    static void MergeGeometry(App* app)
+    {
+        VisibilityBufferRenderer& visibility = app->visibilityBuffer;
+
+        std::vector<float> vertices;
+        std::vector<u32> indices;
+        u32 maxTriangleCount = 0;
+        for (const Mesh& mesh : app->meshes)
+        {
+            visibility.meshFirstSubmesh.push_back(visibility.submeshes.size());
+            for (const SubMesh& submesh : mesh.submeshes)
+            {
+                maxTriangleCount = glm::max(maxTriangleCount, (u32)(submesh.indices.size() / 3));
+
+                VisibilitySubmesh entry = {};
+                entry.vertexBase = vertices.size();
+                entry.vertexStride = submesh.vertexBufferLayout.stride / sizeof(float);
+                entry.indexBase = indices.size();
+                for (const VertexBufferAttribute& attribute : submesh.vertexBufferLayout.attributes)
+                {
+                    if (attribute.location == 2)
+                        entry.texCoordOffset = attribute.offset / sizeof(float);
+                }
+                visibility.submeshes.push_back(entry);
+
+                vertices.insert(vertices.end(), submesh.vertices.begin(), submesh.vertices.end());
+                indices.insert(indices.end(), submesh.indices.begin(), submesh.indices.end());
+            }
+        }
+
+        visibility.vertices = BufferManager::CreateBuffer(glm::max((u32)(vertices.size() * sizeof(float)), 4u), GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW);
+        visibility.indices = BufferManager::CreateBuffer(glm::max((u32)(indices.size() * sizeof(u32)), 4u), GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibility.vertices.handle);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, vertices.size() * sizeof(float), vertices.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibility.indices.handle);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, indices.size() * sizeof(u32), indices.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        // Primitive ids go up to maxTriangleCount - 1, at least one bit is left for the draw index
+        visibility.triangleBits = 1;
+        while (visibility.triangleBits < 31 && (1u << visibility.triangleBits) < maxTriangleCount)
+            ++visibility.triangleBits;
+        visibility.maxDrawCount = (1u << (32 - visibility.triangleBits)) - 1;
+    }
+
+    void Init(App* app)
+    {
+        VisibilityBufferRenderer& visibility = app->visibilityBuffer;
+        visibility.geometryProgramIdx = LoadProgram(app, "VisibilityBuffer.glsl", "VISIBILITY_GEOMETRY");
+        visibility.resolveProgramIdx = LoadProgram(app, "FB_TO_BB.glsl", "VISIBILITY_RESOLVE");
+
+        MergeGeometry(app);
+        CreateDrawBuffer(visibility, glm::min(VISIBILITY_INITIAL_DRAW_CAPACITY, visibility.maxDrawCount));
+    }
+
+    void Update(App* app)
+    {
+        PROFILE_SCOPE("Visibility draws");
+        VisibilityBufferRenderer& visibility = app->visibilityBuffer;
+        visibility.drawItems.clear();
+        visibility.skippedDrawCount = 0;
+
+        // Every visible item may become a draw
+        u32 drawCount = glm::min(app->visibleItemCount, visibility.maxDrawCount);
+        if (drawCount > visibility.drawCapacity)
+            CreateDrawBuffer(visibility, glm::min(drawCount + drawCount / 2, visibility.maxDrawCount));
+
+        BufferManager::MapBuffer(visibility.draws, GL_WRITE_ONLY);
+        const EntityStorage& entities = app->entities;
+        for (u32 entityIdx = 0; entityIdx < entities.count; ++entityIdx)
+        {
+            if (!entities.visible[entityIdx])
+                continue;
+
+            const Model& model = app->models[entities.modelIndices[entityIdx]];
+            const Mesh& mesh = app->meshes[model.meshIdx];
+            for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+            {
+                if (!app->IsItemVisible(entities.cullItemOffsets[entityIdx] + i))
+                    continue;
+
+                if (visibility.drawItems.size() == visibility.maxDrawCount)
+                {
+                    ++visibility.skippedDrawCount;
+                    continue;
+                }
+
+                const VisibilitySubmesh& submesh = visibility.submeshes[visibility.meshFirstSubmesh[model.meshIdx] + i];
+                VisibilityDraw draw = {};
+                draw.world = entities.worldMatrices[entityIdx];
+                draw.vertexBase = submesh.vertexBase;
+                draw.vertexStride = submesh.vertexStride;
+                draw.texCoordOffset = submesh.texCoordOffset;
+                draw.indexBase = submesh.indexBase;
+                draw.materialIdx = model.materialIdx[i];
+                PushData(visibility.draws, &draw, sizeof(draw));
+
+                visibility.drawItems.push_back({ entityIdx, i });
+            }
+        }
+        BufferManager::UnmapBuffer(visibility.draws);
+
+        if (visibility.skippedDrawCount > 0 && !visibility.reportedSkips)
+        {
+            ELOG("VisibilityBuffer::Update() - %u draws past the limit of %u were skipped", visibility.skippedDrawCount, visibility.maxDrawCount);
+            visibility.reportedSkips = true;
+        }
+    }
+
+    void RenderGeometry(App* app)
+    {
+        const VisibilityBufferRenderer& visibility = app->visibilityBuffer;
+        const Program& program = app->programs[visibility.geometryProgramIdx];
+        glUseProgram(program.handle);
+        GLint drawIdLocation = glGetUniformLocation(program.handle, "uDrawID");
+        glUniform1ui(glGetUniformLocation(program.handle, "uTriangleBits"), visibility.triangleBits);
+        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+
+        // Positions only, the attributes are fetched by the resolve
+        const EntityStorage& entities = app->entities;
+        u32 boundEntity = UINT32_MAX;
+        for (u32 drawIdx = 0; drawIdx < visibility.drawItems.size(); ++drawIdx)
+        {
+            const VisibilityDrawItem& item = visibility.drawItems[drawIdx];
+            if (item.entityIdx != boundEntity)
+            {
+                Entities::BindTransform(app, item.entityIdx);
+                boundEntity = item.entityIdx;
+            }
+
+            const SubMesh& submesh = app->meshes[app->models[entities.modelIndices[item.entityIdx]].meshIdx].submeshes[item.submeshIdx];
+            glBindVertexArray(submesh.depthOnlyVao);
+            glUniform1ui(drawIdLocation, drawIdx + 1);
+            glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+        }
+
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+
+    void Resolve(App* app, GLuint visibilityTexture, GLuint depthTexture)
+    {
+        const VisibilityBufferRenderer& visibility = app->visibilityBuffer;
+        const Program& program = app->programs[visibility.resolveProgramIdx];
+        glUseProgram(program.handle);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, visibilityTexture);
+        glUniform1i(glGetUniformLocation(program.handle, "uVisibility"), 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glUniform1i(glGetUniformLocation(program.handle, "uDepth"), 1);
+        glUniform1ui(glGetUniformLocation(program.handle, "uTriangleBits"), visibility.triangleBits);
+        Materials::Bind(app, program, 2);
+        CascadedShadows::Bind(app, program, 3);
+        PointShadows::Bind(app, program, 4);
+
+        glm::mat4 viewProjection = app->projectionMatrix * app->viewMatrix;
+        glUniformMatrix4fv(glGetUniformLocation(program.handle, "uViewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+        glUniform2f(glGetUniformLocation(program.handle, "uViewportSize"), (f32)app->dynamicResolution.internalSize.x, (f32)app->dynamicResolution.internalSize.y);
+        glUniform3fv(glGetUniformLocation(program.handle, "uCameraPosition"), 1, glm::value_ptr(app->cameraPosition));
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, visibility.draws.handle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, visibility.vertices.handle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, visibility.indices.handle);
+        ClusteredLighting::Bind(app, program);
+
+        glBindVertexArray(app->vao);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+
+        glBindVertexArray(0);
+        glUseProgram(0);
+    }
+}
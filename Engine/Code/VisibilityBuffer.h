@@ -0,0 +1,79 @@
+#ifndef VISIBILITY_BUFFER_FUNC
+#define VISIBILITY_BUFFER_FUNC
+
+#include "Globals.h"
+
+struct App;
+
+// Draws the draw table holds before it has to grow
+#define VISIBILITY_INITIAL_DRAW_CAPACITY 1024u
+
+// Where a submesh lives in the merged buffers, in floats and indices
+struct VisibilitySubmesh
+{
+    u32 vertexBase;
+    u32 vertexStride;
+    u32 texCoordOffset; // 0 without texture coordinates
+    u32 indexBase;
+};
+
+// Draw as read by the resolve pass (std430)
+struct VisibilityDraw
+{
+    glm::mat4 world;
+    u32 vertexBase;
+    u32 vertexStride;
+    u32 texCoordOffset;
+    u32 indexBase;
+    u32 materialIdx;
+    u32 padding[3];
+};
+
+struct VisibilityDrawItem
+{
+    u32 entityIdx;
+    u32 submeshIdx;
+};
+
+// The geometry pass only writes depth and a 32 bit triangle id per pixel. A full screen pass then fetches
+// the triangle from merged copies of every mesh, rebuilds the barycentrics and derivatives of the pixel and
+// shades it once with the clustered lights, so overdraw never pays for attributes or texture reads.
+struct VisibilityBufferRenderer
+{
+    Buffer vertices;
+    Buffer indices;
+    std::vector<VisibilitySubmesh> submeshes;
+    std::vector<u32> meshFirstSubmesh;
+
+    // A visibility texel packs the draw index + 1 over the primitive of the draw. The primitive gets just
+    // the bits the largest submesh needs, the draw index the rest.
+    u32 triangleBits;
+    u32 maxDrawCount;
+
+    // Visible entity submeshes of this frame, in draw index order
+    Buffer draws;
+    u32    drawCapacity;
+    std::vector<VisibilityDrawItem> drawItems;
+    u32  skippedDrawCount; // past maxDrawCount
+    bool reportedSkips;
+
+    u32 geometryProgramIdx;
+    u32 resolveProgramIdx;
+};
+
+namespace VisibilityBuffer
+{
+    // Merges the loaded meshes, runs after the models are loaded
+    void Init(App* app);
+
+    // Uploads the draw table of the visible submeshes, before the passes reading it run
+    void Update(App* app);
+
+    // Draws every item of the draw table to the visibility and depth targets
+    void RenderGeometry(App* app);
+
+    // Full screen pass shading every covered pixel, expects the destination framebuffer to be bound
+    void Resolve(App* app, GLuint visibilityTexture, GLuint depthTexture);
+}
+
+#endif // !VISIBILITY_BUFFER_FUNC
@@ -7,6 +7,8 @@
 //#define STB_IMAGE_IMPLEMENTATION
 
 #include "engine.h"
+#include "JobSystem.h"
+#include <float.h>
 #include <imgui.h>
 #include <stb_image.h>
 #include <stb_image_write.h>
@@ -140,6 +142,7 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
 
 u32 LoadProgram(App* app, const char* filepath, const char* programName)
 {
+    PROFILE_SCOPE("LoadProgram");
     String programSource = ReadTextFile(filepath);
 
     Program program = {};
@@ -173,9 +176,79 @@ u32 LoadProgram(App* app, const char* filepath, const char* programName)
     return app->programs.size() - 1;
 }
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
+GLuint CreateComputeProgramFromSource(String programSource, const char* shaderName)
+{
+    GLchar  infoLogBuffer[1024] = {};
+    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+    GLsizei infoLogSize;
+    GLint   success;
+
+    char versionString[] = "#version 430\n";
+    char shaderNameDefine[128];
+    sprintf(shaderNameDefine, "#define %s\n", shaderName);
+    char computeShaderDefine[] = "#define COMPUTE\n";
+
+    const GLchar* computeShaderSource[] = {
+        versionString,
+        shaderNameDefine,
+        computeShaderDefine,
+        programSource.str
+    };
+    const GLint computeShaderLengths[] = {
+        (GLint)strlen(versionString),
+        (GLint)strlen(shaderNameDefine),
+        (GLint)strlen(computeShaderDefine),
+        (GLint)programSource.len
+    };
+
+    GLuint cshader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(cshader, ARRAY_COUNT(computeShaderSource), computeShaderSource, computeShaderLengths);
+    glCompileShader(cshader);
+    glGetShaderiv(cshader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(cshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glCompileShader() failed with compute shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
+
+    GLuint programHandle = glCreateProgram();
+    glAttachShader(programHandle, cshader);
+    glLinkProgram(programHandle);
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
+
+    glUseProgram(0);
+
+    glDetachShader(programHandle, cshader);
+    glDeleteShader(cshader);
+
+    return programHandle;
+}
+
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName)
+{
+    PROFILE_SCOPE("LoadComputeProgram");
+    String programSource = ReadTextFile(filepath);
+
+    Program program = {};
+    program.handle = CreateComputeProgramFromSource(programSource, programName);
+    program.filepath = filepath;
+    program.programName = programName;
+    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+
+    app->programs.push_back(program);
+
+    return app->programs.size() - 1;
+}
+
+GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program, GLuint materialIds)
 {
     GLuint ReturnValue = 0;
+    GlobalRenderStats.vaoLookups++;
 
     SubMesh& Submesh = mesh.submeshes[submeshIndex];
     for (u32 i = 0; i < (u32)Submesh.vaos.size(); ++i)
@@ -189,6 +262,7 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
 
     if (ReturnValue == 0)
     {
+        GlobalRenderStats.vaoCacheMisses++;
         glGenVertexArrays(1, &ReturnValue);
         glBindVertexArray(ReturnValue);
 
@@ -199,6 +273,17 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
         for (auto ShaderIt = ShaderLayout.cbegin(); ShaderIt != ShaderLayout.cend(); ++ShaderIt)
         {
             bool attributeWasLinked = false;
+            if (ShaderIt->location == MATERIAL_ID_LOCATION && materialIds != 0)
+            {
+                // One value per instance, the draw's base instance picks it
+                glBindBuffer(GL_ARRAY_BUFFER, materialIds);
+                glVertexAttribIPointer(MATERIAL_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(u32), (void*)0);
+                glVertexAttribDivisor(MATERIAL_ID_LOCATION, 1);
+                glEnableVertexAttribArray(MATERIAL_ID_LOCATION);
+                glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
+                continue;
+            }
+
             auto SubmeshLayout = Submesh.vertexBufferLayout.attributes;
             for (auto SubmeshIt = SubmeshLayout.cbegin(); SubmeshIt != SubmeshLayout.cend(); ++SubmeshIt)
             {
@@ -249,70 +334,10 @@ void App::ColorAttachment(GLuint& colorAttachmentHandle)
 
 }
 
-void App::DepthAttachment(GLuint& depthAttachmentHandle)
-{
-    glGenTextures(1, &depthAttachmentHandle);
-    glBindTexture(GL_TEXTURE_2D, depthAttachmentHandle);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, displaySize.x, displaySize.y, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_2D, 0);
-}
-
-void App::ConfigureFrameBuffer(FrameBuffer& aConfigFB)
-{
-
-
-
-    const GLuint NUMBER_OF_CA = 3;
-    /*for (GLuint i = 0; i < NUMBER_OF_CA; i++)
-    {
-        GLuint colorAttachmentHandle = 0;
-
-        ColorAttachment(colorAttachmentHandle);
-
-        aConfigFB.ColorAttachment.push_back(colorAttachmentHandle);
-    }
-    */
-
-    aConfigFB.ColorAttachment.push_back(CreateTexture());
-    aConfigFB.ColorAttachment.push_back(CreateTexture(true));
-    aConfigFB.ColorAttachment.push_back(CreateTexture(true));
-    aConfigFB.ColorAttachment.push_back(CreateTexture(true));
-
-    DepthAttachment(aConfigFB.depthHandle);
-    glGenFramebuffers(1, &aConfigFB.fbHandle);
-    glBindFramebuffer(GL_FRAMEBUFFER, aConfigFB.fbHandle);
-
-    std::vector<GLuint> drawBuffers;
-
-    for (size_t i = 0; i < aConfigFB.ColorAttachment.size(); i++)
-    {
-        GLuint position = GL_COLOR_ATTACHMENT0 + i;
-        glFramebufferTexture(GL_FRAMEBUFFER, position, aConfigFB.ColorAttachment[i], 0);
-        drawBuffers.push_back(position);
-    }
-
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, aConfigFB.depthHandle, 0);
-
-    glDrawBuffers(drawBuffers.size(), drawBuffers.data());
-
-    GLenum framebufferStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-
-    if (framebufferStatus != GL_FRAMEBUFFER_COMPLETE)
-    {
-        int i = 0;
-    }
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-}
-
 void Init(App* app)
 {
+    PROFILE_SCOPE("Init");
+
     //Get OPENGL info.
     app->openglDebugInfo += "OpeGL version:\n" + std::string(reinterpret_cast<const char*>(glGetString(GL_VERSION)));
 
@@ -384,13 +409,11 @@ void Init(App* app)
     //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
     app->skyboxFragmentShaderToVertexShader = LoadProgram(app, "SkyboxFragmentShader.glsl", "SFS");
     app->equirrectangularToCubeMap = LoadProgram(app, "EquirectangularShader.glsl", "ESH");
-    app->backgroundShader = LoadProgram(app, "BackGroundShader.glsl", "BKSH");
+    app->backgroundShader = LoadProgram(app, "BackGroundShader.glsl", "SKY");
     //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 
     //app->texturedMeshProgramIdx = LoadProgram(app, "base_model.glsl", "BASE_MODEL");
-    const Program& texturedMeshProgram = app->programs[app->renderToFrameBufferShader];
-    app->texturedMeshProgram_uTexture = glGetUniformLocation(texturedMeshProgram.handle, "uTexture");
     u32 PatrickModelIndex = ModelLoader::LoadModel(app, "Patrick/Patrick.obj");
     u32 GroundModelIndex = ModelLoader::LoadModel(app, "Patrick/Ground.obj");
     u32 SphereLModelIndex = ModelLoader::LoadModel(app, "PointLightSphere/pointLightSphere.obj");
@@ -398,6 +421,9 @@ void Init(App* app)
     u32 PenguinModelIndex = ModelLoader::LoadModel(app, "Penguin/PenguinBaseMesh.obj");
     u32 SkullModelIndex = ModelLoader::LoadModel(app, "Skull/Skull.obj");
 
+    SoftwareOcclusion::RegisterOccluder(app, PatrickModelIndex, 24);
+    SoftwareOcclusion::RegisterOccluder(app, GroundModelIndex, 8);
+
     VertexBufferLayout vertexBufferLayout = {};
     vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
     vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, 3 * sizeof(float) });
@@ -412,7 +438,7 @@ void Init(App* app)
     app->localUniformBuffer = CreateConstantBuffer(app->maxUniformBufferSize);
 
  
-  // app->entities.push_back({ TransformPositionScale(vec3(0.0, -3.0, 0.0), vec3(1.0, 1.0, 1.0)), GroundModelIndex, 0, 0 });
+  // Entities::Create(app, GroundModelIndex, vec3(0.0, -3.0, 0.0), glm::quat(1.0, 0.0, 0.0, 0.0), vec3(1.0, 1.0, 1.0));
  
     //lights
    
@@ -425,20 +451,239 @@ void Init(App* app)
     //app->lights.push_back({ LightType::LightType_Directional,vec3(1.0,1.0,1.0),vec3(0.0,-0.0,0.0),vec3(0.0,0.0,0.0) });
     app->lights.push_back({ LightType::LightType_Point,vec3(1.0,1.0,1.0),vec3(1.0,1.0,1.0),vec3(0.0,0.0,0.0) });
 
-    app->ConfigureFrameBuffer(app->defferredFrameBuffer);
+    RenderTargets::UpdateRenderSize(app->renderTargetPool, app->displaySize, glfwGetTime());
     app->EquirrectangularToCubeMap();
 
+    OcclusionCulling::Init(app);
+    ClusteredLighting::Init(app);
+    ForwardPlus::Init(app);
+    LightVolumes::Init(app, SphereLModelIndex);
+    ResolutionScaling::Init(app);
+    PostProcessing::Init(app);
+    TemporalAA::Init(app);
+    AmbientOcclusion::Init(app);
+    Materials::Init(app);
+    VisibilityBuffer::Init(app);
+
+    app->depthPrePassProgramIdx = LoadProgram(app, "DepthPrePass.glsl", "DEPTH_PREPASS");
+    CascadedShadows::Init(app);
+    PointShadows::Init(app);
+    GpuProfiling::Init(app->gpuProfiler);
+
     app->mode = Mode_Deferred;
 
 }
 
+// Geometry scopes per render mode, without and with the depth pre-pass
+static const char* GeometryScopeNames[Mode_Count][2] =
+{
+    { "Forward geometry", "Forward geometry + pre-pass" },
+    { "G-buffer geometry", "G-buffer geometry + pre-pass" },
+    { "Forward+", "Forward+" }, // always after its pre-pass, timed by the frame graph
+    { "Visibility geometry", "Visibility geometry" }, // depth only already
+};
+
+static void GpuProfilerGui(App* app)
+{
+    const GpuProfiler& profiler = app->gpuProfiler;
+    ImGui::Begin("GPU Profiler");
+
+    if (!profiler.stats.empty())
+    {
+        // Whole frame over the history, the frame scope is always the first one
+        const GpuScopeStats& frame = profiler.stats[0];
+        char overlay[64];
+        sprintf(overlay, "%.3f ms", frame.lastMs);
+        ImGui::PlotLines("Frame", frame.samples, frame.sampleCount, frame.sampleCount == GPU_PROFILER_HISTORY ? frame.nextSample : 0,
+            overlay, 0.0f, glm::max(frame.p99Ms * 1.5f, 1.0f), ImVec2(0, 60));
+    }
+
+    // Timeline of the last resolved frame, one row per nesting level
+    const f32 rowHeight = 18.0f;
+    f32 width = ImGui::GetContentRegionAvail().x;
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    u32 maxDepth = 0;
+    for (const GpuTimelineEntry& entry : profiler.timeline)
+    {
+        f32 x0 = origin.x + entry.beginMs / glm::max(profiler.timelineMs, 1e-3f) * width;
+        f32 x1 = origin.x + entry.endMs / glm::max(profiler.timelineMs, 1e-3f) * width;
+        f32 y0 = origin.y + entry.depth * rowHeight;
+        ImU32 color = ImColor::HSV((entry.stats * 0.13f) - (u32)(entry.stats * 0.13f), 0.5f, 0.7f);
+        drawList->AddRectFilled(ImVec2(x0, y0), ImVec2(glm::max(x1, x0 + 1.0f), y0 + rowHeight - 1.0f), color);
+
+        const char* name = profiler.stats[entry.stats].name.c_str();
+        if (ImGui::CalcTextSize(name).x < x1 - x0)
+            drawList->AddText(ImVec2(x0 + 2.0f, y0 + 2.0f), IM_COL32_WHITE, name);
+        if (ImGui::IsMouseHoveringRect(ImVec2(x0, y0), ImVec2(x1, y0 + rowHeight)))
+            ImGui::SetTooltip("%s: %.3f ms", name, entry.endMs - entry.beginMs);
+
+        maxDepth = glm::max(maxDepth, entry.depth);
+    }
+    ImGui::Dummy(ImVec2(width, (maxDepth + 1) * rowHeight));
+
+    if (ImGui::BeginTable("GpuScopes", 5, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+    {
+        ImGui::TableSetupColumn("Scope");
+        ImGui::TableSetupColumn("Last");
+        ImGui::TableSetupColumn("Min");
+        ImGui::TableSetupColumn("Avg");
+        ImGui::TableSetupColumn("P99");
+        ImGui::TableHeadersRow();
+        for (const GpuScopeStats& stats : profiler.stats)
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn(); ImGui::TextUnformatted(stats.name.c_str());
+            ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.lastMs);
+            ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.minMs);
+            ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.avgMs);
+            ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.p99Ms);
+        }
+        ImGui::EndTable();
+    }
+
+    ImGui::Text("Dropped frames: %u | Scopes over the limit: %u", profiler.droppedFrames, profiler.overflowedScopes);
+    if (ImGui::Button("Export CSV"))
+        GpuProfiling::ExportCsv(profiler, "gpu_profile.csv");
+
+    ImGui::End();
+}
+
+static void CpuProfilerGui(App* app)
+{
+    ImGui::Begin("CPU Profiler");
+
+    bool recording = CpuProfiling::recording;
+    if (ImGui::Checkbox("Recording (O)", &recording))
+        CpuProfiling::recording = recording;
+    ImGui::SameLine();
+    if (ImGui::Button("Export Chrome trace (P)"))
+        CpuProfiling::ExportChromeTrace("cpu_trace.json");
+
+    u64 frameBegin, frameEnd;
+    CpuProfiling::LastFrame(frameBegin, frameEnd);
+    f64 frameMs = CpuProfiling::TicksToMs(frameEnd - frameBegin);
+    ImGui::Text("Last frame: %.3f ms", frameMs);
+
+    // Flame graph of the last frame, one block of rows per thread with a row per nesting level
+    static std::vector<std::string> threadNames;
+    static std::vector<std::vector<CpuEvent>> threadEvents;
+    CpuProfiling::CopyEvents(frameBegin, frameEnd, threadNames, threadEvents);
+
+    const f32 rowHeight = 18.0f;
+    f32 width = ImGui::GetContentRegionAvail().x;
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    for (u32 t = 0; t < threadNames.size(); ++t)
+    {
+        if (threadEvents[t].empty())
+            continue;
+
+        ImGui::TextUnformatted(threadNames[t].c_str());
+        ImVec2 origin = ImGui::GetCursorScreenPos();
+        u32 maxDepth = 0;
+        for (const CpuEvent& event : threadEvents[t])
+        {
+            u64 begin = glm::max(event.begin, frameBegin);
+            u64 end = glm::min(event.end, frameEnd);
+            f32 x0 = origin.x + (f32)((begin - frameBegin) / (f64)(frameEnd - frameBegin)) * width;
+            f32 x1 = origin.x + (f32)((end - frameBegin) / (f64)(frameEnd - frameBegin)) * width;
+            f32 y0 = origin.y + event.depth * rowHeight;
+            f32 hue = (u32)((uintptr_t)event.name >> 3) * 0.13f;
+            drawList->AddRectFilled(ImVec2(x0, y0), ImVec2(glm::max(x1, x0 + 1.0f), y0 + rowHeight - 1.0f), ImColor::HSV(hue - (u32)hue, 0.5f, 0.7f));
+
+            if (ImGui::CalcTextSize(event.name).x < x1 - x0)
+                drawList->AddText(ImVec2(x0 + 2.0f, y0 + 2.0f), IM_COL32_WHITE, event.name);
+            if (ImGui::IsMouseHoveringRect(ImVec2(x0, y0), ImVec2(x1, y0 + rowHeight)))
+                ImGui::SetTooltip("%s: %.3f ms", event.name, CpuProfiling::TicksToMs(event.end - event.begin));
+
+            maxDepth = glm::max(maxDepth, event.depth);
+        }
+        ImGui::Dummy(ImVec2(width, (maxDepth + 1) * rowHeight));
+    }
+
+    // Per frame entity systems over a synthetic scene, with everything moving
+    ImGui::Text("Entities: %u | Transforms updated: %u | Uploaded: %u", app->entities.count, app->entities.updatedCount, app->entities.uploadedCount);
+    if (ImGui::Button("Run entity benchmark"))
+    {
+        app->entityBenchmarks.clear();
+        for (u32 entityCount : { 1000u, 10000u, 100000u })
+            app->entityBenchmarks.push_back(Entities::Benchmark(app, entityCount));
+    }
+    if (!app->entityBenchmarks.empty() && ImGui::BeginTable("EntityBenchmark", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+    {
+        const char* systems[] = { "Transforms", "Upload", "CullEntities" };
+        ImGui::TableSetupColumn("Entities");
+        for (const char* system : systems)
+            ImGui::TableSetupColumn(system);
+        ImGui::TableHeadersRow();
+        for (const EntityBenchmarkResult& result : app->entityBenchmarks)
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn(); ImGui::Text("%u", result.entityCount);
+            for (u32 i = 0; i < ARRAY_COUNT(systems); ++i)
+            {
+                ImGui::TableNextColumn();
+                ImGui::Text("%.3f ms", result.ms[i]);
+            }
+        }
+        ImGui::EndTable();
+    }
+
+    ImGui::End();
+}
+
+static void RenderStatsGui()
+{
+    ImGui::Begin("Render Stats");
+
+    RenderStats average, peak;
+    RenderStatistics::Summarize(average, peak);
+    const RenderStats& last = RenderStatistics::LastFrame();
+    if (ImGui::BeginTable("RenderStats", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+    {
+        ImGui::TableSetupColumn("Counter");
+        ImGui::TableSetupColumn("Last frame");
+        ImGui::TableSetupColumn("Avg");
+        ImGui::TableSetupColumn("Max");
+        ImGui::TableHeadersRow();
+        for (u32 counter = 0; counter < RENDER_STATS_COUNT; ++counter)
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn(); ImGui::TextUnformatted(RenderStatistics::CounterName(counter));
+            ImGui::TableNextColumn(); ImGui::Text("%llu", RenderStatistics::CounterValue(last, counter));
+            ImGui::TableNextColumn(); ImGui::Text("%llu", RenderStatistics::CounterValue(average, counter));
+            ImGui::TableNextColumn(); ImGui::Text("%llu", RenderStatistics::CounterValue(peak, counter));
+        }
+        ImGui::EndTable();
+    }
+
+    if (ImGui::Button("Export CSV"))
+        RenderStatistics::ExportCsv("render_stats.csv");
+
+    ImGui::End();
+}
+
 void Gui(App* app)
 {
     ImGui::Begin("Info");
     ImGui::Text("FPS: %f", 1.0f / app->deltaTime);
     ImGui::Text("%s", app->openglDebugInfo.c_str());
 
-    const char* RenderModes[] = { "FORWARD", "DEFERRED" };
+    ImGui::Checkbox("Frustum culling", &app->frustumCulling);
+    ImGui::Text("Visible submeshes: %u / %u", app->visibleItemCount, app->cullingSet.count);
+    ImGui::Checkbox("BVH culling", &app->bvhCulling);
+    ImGui::Text("BVH leaves: %u | Rebuilds: %u", app->entityTree.leafCount, app->entityTree.rebuildCount);
+    ImGui::Checkbox("GPU occlusion culling (deferred)", &app->gpuOcclusionCulling);
+    ImGui::Checkbox("Software occlusion culling", &app->softwareOcclusionCulling);
+    if (app->softwareOcclusionCulling)
+    {
+        const OcclusionRasterizer& rasterizer = app->occlusionRasterizer;
+        ImGui::Text("Occluded submeshes: %u (%u occluder triangles)", rasterizer.occludedItemCount, (u32)rasterizer.triangles.size());
+        ImGui::Text("Transform %.3f ms | Bin %.3f ms | Raster %.3f ms | Test %.3f ms",
+            rasterizer.transformTime, rasterizer.binTime, rasterizer.rasterTime, rasterizer.testTime);
+    }
+
+    const char* RenderModes[] = { "FORWARD", "DEFERRED", "FORWARD+", "VISIBILITY" };
     if (ImGui::BeginCombo("Render Mode", RenderModes[app->mode]))
     {
         for (size_t i = 0; i < ARRAY_COUNT(RenderModes); ++i)
@@ -451,19 +696,175 @@ void Gui(App* app)
         }
         ImGui::EndCombo();
     }
+    const RenderTargetPool& pool = app->renderTargetPool;
+    ImGui::Text("Render targets: %u (%.1f MB) at %dx%d, %u created this frame", (u32)pool.targets.size(),
+        pool.allocatedBytes / (1024.0 * 1024.0), pool.renderSize.x, pool.renderSize.y, pool.createdThisFrame);
+    const FrameGraph& graph = app->frameGraph;
+    ImGui::Text("Frame graph: %u passes (%u culled), %u transients (%u live at most), %u clears, %u barriers",
+        (u32)graph.passes.size(), graph.culledPassCount, graph.transientCount, graph.peakTransientCount, graph.clearCount, graph.barrierCount);
+    ImGui::Text("Materials: %u (%u duplicates shared) | Texture layers: %u", (u32)app->materials.size(),
+        app->materialTable.duplicateCount, (u32)app->textures.size());
+    if (app->mode == Mode_ForwardPlus)
+    {
+        const char* SampleCounts[] = { "Off", "2x", "4x", "8x" };
+        i32 sampleIdx = app->forwardPlus.sampleCount <= 1 ? 0 : app->forwardPlus.sampleCount <= 2 ? 1 : app->forwardPlus.sampleCount <= 4 ? 2 : 3;
+        if (ImGui::Combo("MSAA", &sampleIdx, SampleCounts, ARRAY_COUNT(SampleCounts)))
+            app->forwardPlus.sampleCount = 1u << sampleIdx;
+        ImGui::Text("Tiles: %dx%d | Depth: %.3f ms | Light tiles: %.3f ms | Shading: %.3f ms",
+            app->forwardPlus.tileCount.x, app->forwardPlus.tileCount.y, GpuProfiling::AverageMs(app->gpuProfiler, "Forward+ depth"),
+            GpuProfiling::AverageMs(app->gpuProfiler, "Light tiles"), GpuProfiling::AverageMs(app->gpuProfiler, "Forward+"));
+    }
+    else if (app->mode == Mode_Visibility)
+    {
+        // Both sides shade with the clustered lights, the deferred numbers are from the last frames spent in that mode
+        const VisibilityBufferRenderer& visibility = app->visibilityBuffer;
+        ImGui::Text("Draws: %u of at most %u (%u triangle bits), %u skipped", (u32)visibility.drawItems.size(), visibility.maxDrawCount,
+            visibility.triangleBits, visibility.skippedDrawCount);
+        ImGui::Text("Deferred: GBuffer %.3f + ClusteredShading %.3f ms | Visibility: geometry %.3f + resolve %.3f ms",
+            GpuProfiling::AverageMs(app->gpuProfiler, "GBuffer"), GpuProfiling::AverageMs(app->gpuProfiler, "ClusteredShading"),
+            GpuProfiling::AverageMs(app->gpuProfiler, "Visibility geometry"), GpuProfiling::AverageMs(app->gpuProfiler, "Visibility resolve"));
+    }
+    else
+    {
+        ImGui::Checkbox("Depth pre-pass", &app->depthPrePass[app->mode]);
+        ImGui::Text("Geometry GPU time: %.3f ms without pre-pass | %.3f ms with pre-pass",
+            GpuProfiling::AverageMs(app->gpuProfiler, GeometryScopeNames[app->mode][0]),
+            GpuProfiling::AverageMs(app->gpuProfiler, GeometryScopeNames[app->mode][1]));
+    }
     if (app->mode == Mode::Mode_Deferred)
     {
-        for (size_t i = 0; i < app->defferredFrameBuffer.ColorAttachment.size(); i++)
+        const char* LightingModes[] = { "FULL SCREEN", "CLUSTERED", "LIGHT VOLUMES" };
+        if (ImGui::BeginCombo("Lighting", LightingModes[app->deferredLighting]))
+        {
+            for (size_t i = 0; i < ARRAY_COUNT(LightingModes); ++i)
+            {
+                bool isSelected = (i == app->deferredLighting);
+                if (ImGui::Selectable(LightingModes[i], isSelected))
+                {
+                    app->deferredLighting = static_cast<DeferredLighting>(i);
+                }
+            }
+            ImGui::EndCombo();
+        }
+        ImGui::Text("Lights: %u", (u32)app->lights.size());
+        CascadedShadowMap& shadows = app->cascadedShadows;
+        ImGui::Checkbox("Cascaded shadows", &shadows.enabled);
+        if (shadows.enabled)
+        {
+            if (shadows.lightIndex < 0 && ImGui::Button("Add directional light"))
+                app->lights.push_back({ LightType::LightType_Directional, vec3(0.8f, 0.75f, 0.7f), vec3(0.4f, 1.0f, 0.3f), vec3(0.0f) });
+
+            const char* Resolutions[] = { "1024", "2048", "4096" };
+            i32 resolutionIdx = shadows.resolution <= 1024 ? 0 : shadows.resolution <= 2048 ? 1 : 2;
+            if (ImGui::Combo("Shadow resolution", &resolutionIdx, Resolutions, ARRAY_COUNT(Resolutions)))
+                shadows.resolution = 1024 << resolutionIdx;
+            i32 cascadeCount = shadows.cascadeCount;
+            if (ImGui::SliderInt("Cascades", &cascadeCount, 1, SHADOW_MAX_CASCADES))
+                shadows.cascadeCount = cascadeCount;
+            i32 firstCachedCascade = shadows.firstCachedCascade;
+            if (ImGui::SliderInt("First cached cascade", &firstCachedCascade, 0, SHADOW_MAX_CASCADES))
+                shadows.firstCachedCascade = firstCachedCascade;
+            ImGui::SliderFloat("Shadow distance", &shadows.maxDistance, 5.0f, 500.0f);
+            ImGui::SliderFloat("Split lambda", &shadows.splitLambda, 0.0f, 1.0f);
+            ImGui::Text("Cascades rendered: %u | Caster draws: %u", shadows.renderedCascadeCount, shadows.casterDrawCount);
+        }
+        PointShadowAtlas& pointShadows = app->pointShadows;
+        ImGui::Checkbox("Point light shadows", &pointShadows.enabled);
+        if (pointShadows.enabled)
+        {
+            const char* AtlasSizes[] = { "2048", "4096", "8192" };
+            i32 atlasSizeIdx = pointShadows.atlasSize <= 2048 ? 0 : pointShadows.atlasSize <= 4096 ? 1 : 2;
+            if (ImGui::Combo("Atlas size", &atlasSizeIdx, AtlasSizes, ARRAY_COUNT(AtlasSizes)))
+                pointShadows.atlasSize = 2048 << atlasSizeIdx;
+            i32 faceBudget = pointShadows.faceBudget;
+            if (ImGui::SliderInt("Faces per frame", &faceBudget, 6, 96))
+                pointShadows.faceBudget = faceBudget;
+            ImGui::SliderFloat("Tile size scale", &pointShadows.importanceScale, 0.25f, 4.0f);
+            ImGui::Text("Shadowed lights: %u | Tiles: %u", pointShadows.shadowedLightCount, pointShadows.atlas.usedTileCount);
+            ImGui::Text("Faces drawn: %u | Pending: %u | Evictions: %u | Caster draws: %u", pointShadows.renderedFaceCount,
+                pointShadows.pendingFaceCount, pointShadows.evictionCount, pointShadows.casterDrawCount);
+        }
+        if (app->deferredLighting == DeferredLighting_LightVolumes)
+            ImGui::Text("Light volumes drawn: %u", app->lightVolumes.drawnLightCount);
+        ScreenSpaceAO& ssao = app->ssao;
+        ImGui::Checkbox("Ambient occlusion", &ssao.enabled);
+        if (ssao.enabled)
+        {
+            ImGui::SliderFloat("AO radius", &ssao.radius, 0.05f, 4.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+            ImGui::SliderFloat("AO intensity", &ssao.intensity, 0.0f, 4.0f);
+            ImGui::SliderFloat("AO blur sharpness", &ssao.blurSharpness, 0.0f, 32.0f);
+            ImGui::Text("SSAO: %.3f ms | Blur: %.3f ms | Upsample: %.3f ms", GpuProfiling::AverageMs(app->gpuProfiler, "SSAO"),
+                GpuProfiling::AverageMs(app->gpuProfiler, "SSAO blur"), GpuProfiling::AverageMs(app->gpuProfiler, "SSAO upsample"));
+        }
+        DynamicResolution& resolution = app->dynamicResolution;
+        PostProcessChain& post = app->postProcess;
+        ImGui::Checkbox("HDR post processing", &post.enabled);
+        if (post.enabled)
+        {
+            ImGui::Checkbox("Auto exposure", &post.autoExposure);
+            if (!post.autoExposure)
+                ImGui::SliderFloat("Exposure", &post.manualExposure, 0.05f, 8.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+            ImGui::SliderFloat("Exposure compensation (EV)", &post.exposureCompensation, -4.0f, 4.0f);
+            ImGui::Checkbox("Bloom", &post.bloom);
+            if (post.bloom)
+            {
+                ImGui::SliderFloat("Bloom threshold", &post.bloomThreshold, 0.0f, 4.0f);
+                ImGui::SliderFloat("Bloom intensity", &post.bloomIntensity, 0.0f, 0.5f);
+                i32 bloomLevels = post.bloomLevels;
+                if (ImGui::SliderInt("Bloom levels", &bloomLevels, 2, POST_BLOOM_MAX_LEVELS))
+                    post.bloomLevels = bloomLevels;
+            }
+            const char* Tonemappers[] = { "None", "Reinhard", "ACES" };
+            i32 tonemapper = post.tonemapper;
+            if (ImGui::Combo("Tonemapper", &tonemapper, Tonemappers, ARRAY_COUNT(Tonemappers)))
+                post.tonemapper = (Tonemapper)tonemapper;
+        }
+        TemporalAntiAliasing& taa = app->temporalAA;
+        ImGui::Checkbox("Temporal antialiasing", &taa.enabled);
+        if (taa.enabled)
+            ImGui::SliderFloat("History weight", &taa.historyWeight, 0.5f, 0.98f);
+        ImGui::Checkbox("Dynamic resolution", &resolution.enabled);
+        if (resolution.enabled)
+        {
+            ImGui::SliderFloat("GPU budget (ms)", &resolution.targetMs, 1.0f, 33.0f);
+            ImGui::SliderFloat("Sharpness", &resolution.sharpness, 0.0f, 1.0f);
+            ImGui::Text("Scale: %.2f (%dx%d) | G-buffer + lighting: %.3f ms", resolution.scale,
+                resolution.internalSize.x, resolution.internalSize.y, resolution.gpuTimeMs);
+        }
+
+        if (ImGui::Button("Add 256 point lights"))
+        {
+            for (u32 i = 0; i < 256; ++i)
+            {
+                vec3 color = vec3(rand() % 256, rand() % 256, rand() % 256) / 255.0f;
+                vec3 position = vec3(rand() % 8001 - 4000, rand() % 401, rand() % 8001 - 4000) / 100.0f;
+                app->lights.push_back({ LightType::LightType_Point, color * 0.05f, vec3(1.0, 1.0, 1.0), position });
+            }
+        }
+
+        ImGui::Checkbox("Show G-buffer", &app->showGBuffer);
+        const FrameBuffer& viewer = app->gBufferViewer;
+        if (app->showGBuffer && viewer.depthHandle != 0)
         {
-            ImGui::Image((ImTextureID)app->defferredFrameBuffer.ColorAttachment[i], ImVec2(250, 150), ImVec2(0, 1), ImVec2(1, 0));
+            // Only the internal size region holds the frame
+            vec2 region = vec2(resolution.internalSize) / glm::max(vec2(app->gBufferViewerSize), vec2(1.0f));
+            for (size_t i = 0; i < viewer.ColorAttachment.size(); i++)
+            {
+                ImGui::Image((ImTextureID)viewer.ColorAttachment[i], ImVec2(250, 150), ImVec2(0, region.y), ImVec2(region.x, 0));
+            }
+            ImGui::Image((ImTextureID)viewer.depthHandle, ImVec2(250, 150), ImVec2(0, region.y), ImVec2(region.x, 0));
         }
-        ImGui::Image((ImTextureID)app->defferredFrameBuffer.depthHandle, ImVec2(250, 150), ImVec2(0, 1), ImVec2(1, 0));
     }
     ImGui::End();
+
+    GpuProfilerGui(app);
+    CpuProfilerGui(app);
+    RenderStatsGui();
 }
 
 void Update(App* app)
 {
+    PROFILE_SCOPE("Update");
     const float cameraSpeed = 2.5f *  app->deltaTime; // adjust accordingly
     if (glfwGetKey(glfwGetCurrentContext(), GLFW_KEY_W) == GLFW_PRESS)
         app->cameraPosition += cameraSpeed * app->cameraFront;
@@ -473,6 +874,11 @@ void Update(App* app)
         app->cameraPosition -= glm::normalize(glm::cross(app->cameraFront, app->cameraUp)) * cameraSpeed;
     if (glfwGetKey(glfwGetCurrentContext(), GLFW_KEY_D) == GLFW_PRESS)
         app->cameraPosition += glm::normalize(glm::cross(app->cameraFront, app->cameraUp)) * cameraSpeed;
+
+    if (app->input.keys[K_O] == BUTTON_PRESS)
+        CpuProfiling::recording = !CpuProfiling::recording;
+    if (app->input.keys[K_P] == BUTTON_PRESS)
+        CpuProfiling::ExportChromeTrace("cpu_trace.json");
 }
 
 glm::mat4 TransformScale(const vec3& scaleFactors)
@@ -481,197 +887,750 @@ glm::mat4 TransformScale(const vec3& scaleFactors)
 }
 
 
-void Render(App* app)
+static void AddForwardPasses(App* app, u32 backBuffer)
 {
-    switch (app->mode)
-    {
-    case Mode_Forward:
-    {
-        app->UpdateEntityBuffer();
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    FrameGraph& graph = app->frameGraph;
+    FrameGraphs::ClearColor(graph, backBuffer, vec4(0.1f, 0.1f, 0.1f, 1.0f));
+    FrameGraphs::ClearDepthStencil(graph, backBuffer, 1.0f, 0);
 
-        glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+    u32 pass = FrameGraphs::AddPass(graph, "Forward", [app]()
+    {
+        bool depthPrePass = app->depthPrePass[Mode_Forward];
+        GPU_SCOPE(app->gpuProfiler, GeometryScopeNames[Mode_Forward][depthPrePass]);
+        if (depthPrePass)
+        {
+            app->RenderDepthPrePass();
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        }
 
         const Program& texturedMeshProgram = app->programs[app->renderToBackBufferShader];
         glUseProgram(texturedMeshProgram.handle);
 
         app->RenderGeometry(texturedMeshProgram);
-        
 
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    });
+    FrameGraphs::Write(graph, pass, backBuffer, FrameGraphAccess_ColorAttachment);
+    FrameGraphs::Write(graph, pass, backBuffer, FrameGraphAccess_DepthAttachment);
+}
 
-    
-    }
-    break;
+// Shadow maps read by the deferred and visibility buffer lighting
+static void AddShadowPasses(App* app, u32& shadowMap, u32& pointShadowAtlas)
+{
+    FrameGraph& graph = app->frameGraph;
+
+    // Only the cascades whose region, casters or light changed are drawn
+    CascadedShadows::Update(app);
+    const CascadedShadowMap& shadows = app->cascadedShadows;
+    shadowMap = FrameGraphs::ImportTexture(graph, "ShadowCascades", shadows.depthArray, { GL_DEPTH_COMPONENT32F, ivec2(shadows.resolution), 1 });
+    u32 shadowPass = FrameGraphs::AddPass(graph, "Shadows", [app]() { CascadedShadows::Render(app); });
+    FrameGraphs::Write(graph, shadowPass, shadowMap, FrameGraphAccess_Framebuffer);
+
+    // Point light faces within the per frame budget, the rest of the atlas is reused
+    PointShadows::Update(app);
+    const PointShadowAtlas& pointShadows = app->pointShadows;
+    pointShadowAtlas = FrameGraphs::ImportTexture(graph, "PointShadowAtlas", pointShadows.depthTexture, { GL_DEPTH_COMPONENT32F, ivec2(pointShadows.allocatedSize), 1 });
+    u32 pointShadowPass = FrameGraphs::AddPass(graph, "Point shadows", [app]() { PointShadows::Render(app); });
+    FrameGraphs::Write(graph, pointShadowPass, pointShadowAtlas, FrameGraphAccess_Framebuffer);
+}
 
-    case Mode_Deferred:
+// The lighting passes skip the pixels nothing was drawn to, the sky fills them afterwards
+static void AddSkyPass(App* app, u32 sceneColor, u32 depth, u32 backBuffer)
+{
+    FrameGraph& graph = app->frameGraph;
+    // Offscreen the scene depth is attached and the far plane test does the work. Sampling it as well
+    // would be a feedback loop, so it is only read when drawing to the back buffer.
+    bool sampleDepth = sceneColor == backBuffer;
+    u32 skyPass = FrameGraphs::AddPass(graph, "Sky", [app, depth, sampleDepth]()
     {
-        app->UpdateEntityBuffer();
+        GPU_SCOPE(app->gpuProfiler, "Sky");
+        const Program& skyProgram = app->programs[app->backgroundShader];
+        glUseProgram(skyProgram.handle);
+
+        glm::mat4 rotationViewProjection = app->temporalAA.jitteredProjection * glm::mat4(glm::mat3(app->viewMatrix));
+        glm::mat4 inverseViewProjection = glm::inverse(rotationViewProjection);
+        glUniformMatrix4fv(glGetUniformLocation(skyProgram.handle, "uInverseViewProjection"), 1, GL_FALSE, glm::value_ptr(inverseViewProjection));
+        glUniform1i(glGetUniformLocation(skyProgram.handle, "uTonemap"), !app->postProcess.enabled);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, app->envCubemap);
+        glUniform1i(glGetUniformLocation(skyProgram.handle, "environmentMap"), 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, sampleDepth ? FrameGraphs::GetHandle(app->frameGraph, depth) : 0);
+        glUniform1i(glGetUniformLocation(skyProgram.handle, "uDepth"), 1);
+        glUniform1i(glGetUniformLocation(skyProgram.handle, "uSampleDepth"), sampleDepth);
 
+        glDisable(GL_BLEND);
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(app->vao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
 
-        //Render to FB ColorAtt
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+        glBindVertexArray(0);
+        glUseProgram(0);
+    });
+    FrameGraphs::Read(graph, skyPass, depth, sampleDepth ? FrameGraphAccess_Sampled : FrameGraphAccess_DepthAttachment);
+    FrameGraphs::Write(graph, skyPass, sceneColor, FrameGraphAccess_ColorAttachment);
+}
 
-        glBindFramebuffer(GL_FRAMEBUFFER, app->defferredFrameBuffer.fbHandle);
+// Post processing when enabled, then to the screen unless the image is already there
+static void AddPresentPasses(App* app, u32 sceneColor, u32 backBuffer)
+{
+    FrameGraph& graph = app->frameGraph;
+    ivec2 size = app->renderTargetPool.renderSize;
+    const DynamicResolution& resolution = app->dynamicResolution;
+    if (app->postProcess.enabled)
+    {
+        u32 displayColor = backBuffer;
+        if (resolution.enabled || size != app->displaySize)
+        {
+            displayColor = FrameGraphs::CreateTexture(graph, "SceneColor", { GL_RGBA8, size, 1 });
+            FrameGraphs::SetExtent(graph, displayColor, resolution.internalSize);
+        }
+        PostProcessing::AddPasses(app, sceneColor, displayColor);
+        sceneColor = displayColor;
+    }
 
-       
-        glDrawBuffers(app->defferredFrameBuffer.ColorAttachment.size(), app->defferredFrameBuffer.ColorAttachment.data());
+    if (sceneColor == backBuffer)
+        return;
 
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (resolution.enabled)
+        ResolutionScaling::AddUpscalePasses(app, sceneColor, backBuffer);
+    else
+        FrameGraphs::AddBlitPass(graph, "Present", sceneColor, backBuffer);
+}
 
-        const Program& texturedMeshProgram = app->programs[app->renderToFrameBufferShader];
-        glUseProgram(texturedMeshProgram.handle);
-        app->RenderGeometry(texturedMeshProgram);
+// The tile pass needs the pre-pass depth as a texture, so the scene is drawn to its own target and
+// copied to the screen. Multisampled targets are resolved at the render size first, the copy may scale.
+static void AddForwardPlusPasses(App* app, u32 backBuffer)
+{
+    FrameGraph& graph = app->frameGraph;
+    ivec2 size = app->renderTargetPool.renderSize;
+    u32 samples = app->forwardPlus.sampleCount;
 
-        //skybox
-       // const Program& SFStoVS = app->programs[app->skyboxFragmentShaderToVertexShader];
-       // glUseProgram(SFStoVS.handle);
-       //
-       // GLint projectionLoc = glGetUniformLocation(SFStoVS.handle, "projection");
-       // GLint viewLoc = glGetUniformLocation(SFStoVS.handle, "view");
-       //
-       // glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(app->projectionMatrix));
-       // glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(app->viewMatrix));
-       //
-       // glBindVertexArray(app->vaoSkybox);
-       // glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemapTexture);
-       // glDrawArrays(GL_TRIANGLES, 0, 36);
-       // glDepthMask(GL_TRUE);
-
-        const Program& backSh = app->programs[app->backgroundShader];
-        glUseProgram(backSh.handle);
-        glUniform1i(glGetUniformLocation(backSh.handle, "environmentMap"), 0);
-        //backgroundShader.setInt("environmentMap", 0);
-        GLint projectionLoc = glGetUniformLocation(backSh.handle, "projection");
-
-        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(app->projectionMatrix));
-        GLint viewLoc = glGetUniformLocation(backSh.handle, "view");
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(app->viewMatrix));
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, app->envCubemap);
-        app->renderCube();
+    u32 sceneColor = FrameGraphs::CreateTexture(graph, "SceneColor", { GL_RGBA8, size, samples });
+    u32 depth = FrameGraphs::CreateTexture(graph, "Depth", { GL_DEPTH24_STENCIL8, size, samples });
+    FrameGraphs::ClearColor(graph, sceneColor, vec4(0.1f, 0.1f, 0.1f, 1.0f));
+    FrameGraphs::ClearDepthStencil(graph, depth, 1.0f, 0);
 
+    ForwardPlus::Update(app, size);
+    const ForwardPlusLights& forwardPlus = app->forwardPlus;
+    u32 lightCounts = FrameGraphs::ImportBuffer(graph, "TileLightCounts", forwardPlus.tileLightCounts.handle);
+    u32 lightIndices = FrameGraphs::ImportBuffer(graph, "TileLightIndices", forwardPlus.tileLightIndices.handle);
 
-        //eq
+    u32 depthPass = FrameGraphs::AddPass(graph, "Forward+ depth", [app]() { app->RenderDepthPrePass(); });
+    FrameGraphs::Write(graph, depthPass, depth, FrameGraphAccess_DepthAttachment);
 
+    u32 tilePass = FrameGraphs::AddPass(graph, "Light tiles", [app, depth, size]()
+    {
+        ForwardPlus::BuildTiles(app, FrameGraphs::GetHandle(app->frameGraph, depth), size);
+    });
+    FrameGraphs::Read(graph, tilePass, depth, FrameGraphAccess_Sampled);
+    FrameGraphs::Write(graph, tilePass, lightCounts, FrameGraphAccess_Storage);
+    FrameGraphs::Write(graph, tilePass, lightIndices, FrameGraphAccess_Storage);
+
+    // Only the surfaces the pre-pass kept are shaded
+    u32 shadePass = FrameGraphs::AddPass(graph, "Forward+", [app]()
+    {
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+        ForwardPlus::Shade(app);
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    });
+    FrameGraphs::Read(graph, shadePass, lightCounts, FrameGraphAccess_Storage);
+    FrameGraphs::Read(graph, shadePass, lightIndices, FrameGraphAccess_Storage);
+    FrameGraphs::Read(graph, shadePass, depth, FrameGraphAccess_DepthAttachment);
+    FrameGraphs::Write(graph, shadePass, sceneColor, FrameGraphAccess_ColorAttachment);
+
+    if (samples > 1)
+    {
+        u32 resolved = FrameGraphs::CreateTexture(graph, "SceneColor resolved", { GL_RGBA8, size, 1 });
+        FrameGraphs::AddBlitPass(graph, "Resolve", sceneColor, resolved);
+        sceneColor = resolved;
+    }
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    FrameGraphs::AddBlitPass(graph, "Present", sceneColor, backBuffer);
+}
 
-        //Render to BB ColorAtt
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+// Depth and triangle ids first, then one full screen pass fetches the attributes of every covered pixel
+// and shades it with the clustered lights. Same shadows, sky and post processing as the deferred path.
+static void AddVisibilityPasses(App* app, u32 backBuffer)
+{
+    FrameGraph& graph = app->frameGraph;
+    ivec2 size = app->renderTargetPool.renderSize;
+    const DynamicResolution& resolution = app->dynamicResolution;
 
-        const Program& FBtoBB = app->programs[app->freamebufferToQuadShader];
-        glUseProgram(FBtoBB.handle);
-        //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+    // Not cleared, the resolve skips the pixels where the depth is still clear
+    u32 visibility = FrameGraphs::CreateTexture(graph, "Visibility", { GL_R32UI, size, 1 });
+    u32 depth = FrameGraphs::CreateTexture(graph, "Depth", { GL_DEPTH24_STENCIL8, size, 1 });
+    FrameGraphs::ClearDepthStencil(graph, depth, 1.0f, 0);
 
+    u32 sceneColor = app->postProcess.enabled
+        ? FrameGraphs::CreateTexture(graph, "HDRColor", { GL_R11F_G11F_B10F, size, 1 })
+        : FrameGraphs::CreateTexture(graph, "SceneColor", { GL_RGBA8, size, 1 });
+    for (u32 target : { visibility, depth, sceneColor })
+        FrameGraphs::SetExtent(graph, target, resolution.internalSize);
 
-      // glDepthMask(GL_FALSE);
-      //
-      // glActiveTexture(GL_TEXTURE0);
-      // glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubemapTexture);
-      // glBindVertexArray(app->vaoSkybox);
-      // glDrawArrays(GL_TRIANGLES, 0, 36);
-      // glDepthMask(GL_TRUE);
+    u32 shadowMap, pointShadowAtlas;
+    AddShadowPasses(app, shadowMap, pointShadowAtlas);
 
-        //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-        //Render Quad
-        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+    // Draw table of the visible submeshes, written here and only read by the GPU this frame
+    VisibilityBuffer::Update(app);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, app->defferredFrameBuffer.ColorAttachment[0]);
-        glUniform1i(glGetUniformLocation(FBtoBB.handle, "uAlbedo"), 0);
+    u32 geometryPass = FrameGraphs::AddPass(graph, "Visibility geometry", [app]()
+    {
+        if (app->dynamicResolution.enabled)
+            ResolutionScaling::BeginTimer(app);
+        VisibilityBuffer::RenderGeometry(app);
+    });
+    FrameGraphs::Write(graph, geometryPass, visibility, FrameGraphAccess_ColorAttachment);
+    FrameGraphs::Write(graph, geometryPass, depth, FrameGraphAccess_DepthAttachment);
+
+    ClusteredLights& clustered = app->clusteredLights;
+    u32 lightCounts = FrameGraphs::ImportBuffer(graph, "ClusterLightCounts", clustered.clusterLightCounts.handle);
+    u32 lightIndices = FrameGraphs::ImportBuffer(graph, "ClusterLightIndices", clustered.clusterLightIndices.handle);
+
+    u32 buildPass = FrameGraphs::AddPass(graph, "ClusterBuild", [app]() { ClusteredLighting::BuildClusters(app); });
+    FrameGraphs::Write(graph, buildPass, lightCounts, FrameGraphAccess_Storage);
+    FrameGraphs::Write(graph, buildPass, lightIndices, FrameGraphAccess_Storage);
+
+    u32 resolvePass = FrameGraphs::AddPass(graph, "Visibility resolve", [app, visibility, depth]()
+    {
+        const FrameGraph& graph = app->frameGraph;
+        VisibilityBuffer::Resolve(app, FrameGraphs::GetHandle(graph, visibility), FrameGraphs::GetHandle(graph, depth));
+    });
+    FrameGraphs::Read(graph, resolvePass, visibility, FrameGraphAccess_Sampled);
+    FrameGraphs::Read(graph, resolvePass, depth, FrameGraphAccess_Sampled);
+    FrameGraphs::Read(graph, resolvePass, shadowMap, FrameGraphAccess_Sampled);
+    FrameGraphs::Read(graph, resolvePass, pointShadowAtlas, FrameGraphAccess_Sampled);
+    FrameGraphs::Read(graph, resolvePass, lightCounts, FrameGraphAccess_Storage);
+    FrameGraphs::Read(graph, resolvePass, lightIndices, FrameGraphAccess_Storage);
+    FrameGraphs::Write(graph, resolvePass, sceneColor, FrameGraphAccess_ColorAttachment);
+
+    AddSkyPass(app, sceneColor, depth, backBuffer);
+    AddPresentPasses(app, sceneColor, backBuffer);
+}
 
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, app->defferredFrameBuffer.ColorAttachment[1]);
-        glUniform1i(glGetUniformLocation(FBtoBB.handle, "uNormals"), 1);
+// Copies the G-buffer to textures the viewer owns, the GUI shows them the next frame
+static void AddGBufferViewerPass(App* app, const std::vector<u32>& colors, u32 depth)
+{
+    FrameGraph& graph = app->frameGraph;
+    FrameBuffer& viewer = app->gBufferViewer;
+    ivec2 size = app->renderTargetPool.renderSize;
 
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, app->defferredFrameBuffer.ColorAttachment[2]);
-        glUniform1i(glGetUniformLocation(FBtoBB.handle, "uPosition"), 2);
+    std::vector<u32> sources = colors;
+    sources.push_back(depth);
+    if (app->gBufferViewerSize != size || viewer.ColorAttachment.size() != colors.size())
+    {
+        if (!viewer.ColorAttachment.empty())
+            glDeleteTextures(viewer.ColorAttachment.size(), viewer.ColorAttachment.data());
+        if (viewer.depthHandle != 0)
+            glDeleteTextures(1, &viewer.depthHandle);
+
+        viewer.ColorAttachment.resize(colors.size());
+        glGenTextures(viewer.ColorAttachment.size(), viewer.ColorAttachment.data());
+        glGenTextures(1, &viewer.depthHandle);
+        for (u32 i = 0; i < sources.size(); ++i)
+        {
+            glBindTexture(GL_TEXTURE_2D, i < colors.size() ? viewer.ColorAttachment[i] : viewer.depthHandle);
+            glTexStorage2D(GL_TEXTURE_2D, 1, graph.resources[sources[i]].desc.internalFormat, size.x, size.y);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+        app->gBufferViewerSize = size;
+    }
 
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, app->defferredFrameBuffer.ColorAttachment[3]);
-        glUniform1i(glGetUniformLocation(FBtoBB.handle, "uViewDir"), 3);
+    u32 viewerPass = FrameGraphs::AddPass(graph, "GBuffer viewer", [app, sources]()
+    {
+        const FrameGraph& graph = app->frameGraph;
+        const FrameBuffer& viewer = app->gBufferViewer;
+        ivec2 extent = app->dynamicResolution.internalSize;
+        for (u32 i = 0; i < sources.size(); ++i)
+        {
+            GLuint destination = i < viewer.ColorAttachment.size() ? viewer.ColorAttachment[i] : viewer.depthHandle;
+            glCopyImageSubData(FrameGraphs::GetHandle(graph, sources[i]), GL_TEXTURE_2D, 0, 0, 0, 0,
+                destination, GL_TEXTURE_2D, 0, 0, 0, 0, extent.x, extent.y, 1);
+        }
+    });
+    for (u32 source : sources)
+        FrameGraphs::Read(graph, viewerPass, source, FrameGraphAccess_BlitSource);
+    FrameGraphs::SetSideEffects(graph, viewerPass);
+}
 
-        glBindVertexArray(app->vao);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+static void AddDeferredPasses(App* app, u32 backBuffer)
+{
+    FrameGraph& graph = app->frameGraph;
+    ivec2 size = app->renderTargetPool.renderSize;
+
+    // Albedo, octahedral encoded normals and material parameters. Position and view direction
+    // are reconstructed from the depth by the lighting passes, the stencil masks the light volumes.
+    u32 albedo = FrameGraphs::CreateTexture(graph, "Albedo", { GL_RGBA8, size, 1 });
+    u32 normals = FrameGraphs::CreateTexture(graph, "Normals", { GL_RG16, size, 1 });
+    u32 material = FrameGraphs::CreateTexture(graph, "Material", { GL_RGBA8, size, 1 });
+    u32 depth = FrameGraphs::CreateTexture(graph, "Depth", { GL_DEPTH24_STENCIL8, size, 1 });
+    FrameGraphs::ClearColor(graph, albedo, vec4(0.0f));
+    FrameGraphs::ClearColor(graph, normals, vec4(0.0f));
+    FrameGraphs::ClearColor(graph, material, vec4(0.0f));
+    FrameGraphs::ClearDepthStencil(graph, depth, 1.0f, 0);
+    u32 gBuffer[] = { albedo, normals, material };
+
+    // Screen motion of every pixel since the previous frame, for the temporal passes. Not read by the
+    // lighting, so it stays out of gBuffer.
+    u32 velocity = FrameGraphs::CreateTexture(graph, "Velocity", { GL_RG16F, size, 1 });
+    FrameGraphs::ClearColor(graph, velocity, vec4(0.0f));
+
+    // With dynamic resolution only the internal size region of the targets is rendered
+    const DynamicResolution& resolution = app->dynamicResolution;
+    for (u32 target : { albedo, normals, material, velocity, depth })
+        FrameGraphs::SetExtent(graph, target, resolution.internalSize);
+
+    // Lighting shares the pixel grid of the G-buffer. It goes straight to the screen when nothing scales
+    // or resolves it, or to the HDR target of the post processing chain.
+    const PostProcessChain& post = app->postProcess;
+    const TemporalAntiAliasing& taa = app->temporalAA;
+    u32 sceneColor = backBuffer;
+    if (post.enabled)
+    {
+        sceneColor = FrameGraphs::CreateTexture(graph, "HDRColor", { GL_R11F_G11F_B10F, size, 1 });
+        FrameGraphs::ClearColor(graph, sceneColor, vec4(0.0f));
+    }
+    else if (app->deferredLighting == DeferredLighting_LightVolumes)
+    {
+        // The stencil is still clear from the G-buffer pass, which never writes it
+        sceneColor = FrameGraphs::CreateTexture(graph, "LightAccumulation", { GL_RGBA16F, size, 1 });
+        FrameGraphs::ClearColor(graph, sceneColor, vec4(0.0f));
+    }
+    else if (taa.enabled || resolution.enabled || size != app->displaySize)
+    {
+        sceneColor = FrameGraphs::CreateTexture(graph, "SceneColor", { GL_RGBA8, size, 1 });
+    }
+    if (sceneColor != backBuffer)
+        FrameGraphs::SetExtent(graph, sceneColor, resolution.internalSize);
 
-        glBindVertexArray(0);
-        glUseProgram(0);
+    u32 shadowMap, pointShadowAtlas;
+    AddShadowPasses(app, shadowMap, pointShadowAtlas);
+
+    u32 geometryPass = FrameGraphs::AddPass(graph, "GBuffer", [app, albedo, normals, material, velocity, depth]()
+    {
+        const FrameGraph& graph = app->frameGraph;
+        FrameBuffer& gBuffer = app->defferredFrameBuffer;
+        gBuffer.ColorAttachment = { FrameGraphs::GetHandle(graph, albedo), FrameGraphs::GetHandle(graph, normals),
+            FrameGraphs::GetHandle(graph, material), FrameGraphs::GetHandle(graph, velocity) };
+        gBuffer.depthHandle = FrameGraphs::GetHandle(graph, depth);
+
+        if (app->dynamicResolution.enabled)
+            ResolutionScaling::BeginTimer(app);
+
+        {
+            bool depthPrePass = app->depthPrePass[Mode_Deferred];
+            GPU_SCOPE(app->gpuProfiler, GeometryScopeNames[Mode_Deferred][depthPrePass]);
+            const Program& texturedMeshProgram = app->programs[app->renderToFrameBufferShader];
+            glUseProgram(texturedMeshProgram.handle);
+            if (app->gpuOcclusionCulling && depthPrePass)
+            {
+                OcclusionCulling::UploadItems(app);
+
+                // Both phases only lay down depth
+                app->RenderDepthPrePass(app->hizOcclusion.phase1Commands.handle);
+                OcclusionCulling::BuildHiZ(app, gBuffer.depthHandle);
+                OcclusionCulling::Cull(app);
+                app->RenderDepthPrePass(app->hizOcclusion.phase2Commands.handle);
+
+                // After the cull pass the phase 1 commands hold everything visible this frame
+                glDepthFunc(GL_EQUAL);
+                glDepthMask(GL_FALSE);
+                glUseProgram(texturedMeshProgram.handle);
+                app->RenderGeometry(texturedMeshProgram, app->hizOcclusion.phase1Commands.handle);
+            }
+            else if (app->gpuOcclusionCulling)
+            {
+                OcclusionCulling::UploadItems(app);
+
+                // Phase 1: what was visible last frame
+                app->RenderGeometry(texturedMeshProgram, app->hizOcclusion.phase1Commands.handle);
+
+                OcclusionCulling::BuildHiZ(app, gBuffer.depthHandle);
+                OcclusionCulling::Cull(app);
+
+                // Phase 2: what became visible this frame
+                glUseProgram(texturedMeshProgram.handle);
+                app->RenderGeometry(texturedMeshProgram, app->hizOcclusion.phase2Commands.handle);
+            }
+            else
+            {
+                app->hizOcclusionItemCount = 0;
+                if (depthPrePass)
+                {
+                    app->RenderDepthPrePass();
+                    glDepthFunc(GL_EQUAL);
+                    glDepthMask(GL_FALSE);
+                    glUseProgram(texturedMeshProgram.handle);
+                }
+                app->RenderGeometry(texturedMeshProgram);
+            }
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+        }
+    });
+    for (u32 target : gBuffer)
+        FrameGraphs::Write(graph, geometryPass, target, FrameGraphAccess_ColorAttachment);
+    FrameGraphs::Write(graph, geometryPass, velocity, FrameGraphAccess_ColorAttachment);
+    FrameGraphs::Write(graph, geometryPass, depth, FrameGraphAccess_DepthAttachment);
+
+    // Read by every lighting path through BindGBuffer
+    u32 occlusion = AmbientOcclusion::AddPasses(app, depth, normals);
+
+    if (app->deferredLighting == DeferredLighting_Clustered)
+    {
+        ClusteredLights& clustered = app->clusteredLights;
+        u32 lightCounts = FrameGraphs::ImportBuffer(graph, "ClusterLightCounts", clustered.clusterLightCounts.handle);
+        u32 lightIndices = FrameGraphs::ImportBuffer(graph, "ClusterLightIndices", clustered.clusterLightIndices.handle);
+
+        u32 buildPass = FrameGraphs::AddPass(graph, "ClusterBuild", [app]() { ClusteredLighting::BuildClusters(app); });
+        FrameGraphs::Write(graph, buildPass, lightCounts, FrameGraphAccess_Storage);
+        FrameGraphs::Write(graph, buildPass, lightIndices, FrameGraphAccess_Storage);
+
+        u32 shadePass = FrameGraphs::AddPass(graph, "ClusteredShading", [app]() { ClusteredLighting::Shade(app); });
+        for (u32 target : gBuffer)
+            FrameGraphs::Read(graph, shadePass, target, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, shadePass, depth, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, shadePass, shadowMap, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, shadePass, pointShadowAtlas, FrameGraphAccess_Sampled);
+        if (occlusion != UINT32_MAX)
+            FrameGraphs::Read(graph, shadePass, occlusion, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, shadePass, lightCounts, FrameGraphAccess_Storage);
+        FrameGraphs::Read(graph, shadePass, lightIndices, FrameGraphAccess_Storage);
+        FrameGraphs::Write(graph, shadePass, sceneColor, FrameGraphAccess_ColorAttachment);
+    }
+    else if (app->deferredLighting == DeferredLighting_LightVolumes)
+    {
+        // The pass tests against the G-buffer depth and writes its stencil, the shaders read a copy
+        u32 depthCopy = FrameGraphs::CreateTexture(graph, "DepthCopy", { GL_DEPTH24_STENCIL8, size, 1 });
+        FrameGraphs::SetExtent(graph, depthCopy, resolution.internalSize);
+        FrameGraphs::AddDepthBlitPass(graph, "Depth copy", depth, depthCopy);
 
+        u32 lightingPass = FrameGraphs::AddPass(graph, "LightVolumes", [app, depthCopy]()
+        {
+            LightVolumes::Render(app, FrameGraphs::GetHandle(app->frameGraph, depthCopy));
+        });
+        for (u32 target : gBuffer)
+            FrameGraphs::Read(graph, lightingPass, target, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, lightingPass, depthCopy, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, lightingPass, shadowMap, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, lightingPass, pointShadowAtlas, FrameGraphAccess_Sampled);
+        if (occlusion != UINT32_MAX)
+            FrameGraphs::Read(graph, lightingPass, occlusion, FrameGraphAccess_Sampled);
+        FrameGraphs::Write(graph, lightingPass, depth, FrameGraphAccess_DepthAttachment);
+        FrameGraphs::Write(graph, lightingPass, sceneColor, FrameGraphAccess_ColorAttachment);
+    }
+    else
+    {
+        u32 lightingPass = FrameGraphs::AddPass(graph, "Lighting", [app]()
+        {
+            const Program& FBtoBB = app->programs[app->freamebufferToQuadShader];
+            glUseProgram(FBtoBB.handle);
+            glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->localUniformBuffer.handle, app->globalParamsOffset, app->globalParamsSize);
+
+            app->BindGBuffer(FBtoBB);
+
+            glBindVertexArray(app->vao);
+            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+
+            glBindVertexArray(0);
+            glUseProgram(0);
+        });
+        for (u32 target : gBuffer)
+            FrameGraphs::Read(graph, lightingPass, target, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, lightingPass, depth, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, lightingPass, shadowMap, FrameGraphAccess_Sampled);
+        FrameGraphs::Read(graph, lightingPass, pointShadowAtlas, FrameGraphAccess_Sampled);
+        if (occlusion != UINT32_MAX)
+            FrameGraphs::Read(graph, lightingPass, occlusion, FrameGraphAccess_Sampled);
+        FrameGraphs::Write(graph, lightingPass, sceneColor, FrameGraphAccess_ColorAttachment);
     }
-    break;
 
+    AddSkyPass(app, sceneColor, depth, backBuffer);
+
+    // Before the post processing, so bloom and exposure see the antialiased image
+    if (taa.enabled)
+        sceneColor = TemporalAA::AddResolvePass(app, sceneColor, depth, velocity);
+
+    AddPresentPasses(app, sceneColor, backBuffer);
+
+    if (app->showGBuffer)
+        AddGBufferViewerPass(app, { albedo, normals, material, velocity }, depth);
+}
+
+void Render(App* app)
+{
+    PROFILE_SCOPE("Render");
+
+    // Closed by the platform layer once ImGui has been drawn
+    GpuProfiling::BeginFrame(app->gpuProfiler);
+
+    RenderTargets::BeginFrame(app->renderTargetPool);
+
+    // Screen sized targets follow the window once it stops being resized, the frame graph
+    // asks the pool for them at renderSize every frame
+    RenderTargets::UpdateRenderSize(app->renderTargetPool, app->displaySize, glfwGetTime());
+    ResolutionScaling::BeginFrame(app);
+
+    app->UpdateEntityBuffer();
+
+    FrameGraph& graph = app->frameGraph;
+    FrameGraphs::Reset(graph);
+    u32 backBuffer = FrameGraphs::ImportBackBuffer(graph, app->displaySize);
+
+    switch (app->mode)
+    {
+    case Mode_Forward:     AddForwardPasses(app, backBuffer); break;
+    case Mode_Deferred:    AddDeferredPasses(app, backBuffer); break;
+    case Mode_ForwardPlus: AddForwardPlusPasses(app, backBuffer); break;
+    case Mode_Visibility:  AddVisibilityPasses(app, backBuffer); break;
     default:;
     }
+
+    FrameGraphs::Compile(graph);
+    FrameGraphs::Execute(graph, app->renderTargetPool, app->gpuProfiler);
 }
 
 
-void App::RenderGeometry(const Program& texturedMeshProgram)
+void App::RenderGeometry(const Program& texturedMeshProgram, GLuint indirectCommands)
 {
+    PROFILE_SCOPE("RenderGeometry");
+
+    // The indirect commands have one element per cull item, written by the GPU
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectCommands);
+
     glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, globalParamsOffset, globalParamsSize);
 
-    for (auto it = entities.begin(); it != entities.end(); ++it)
+    // Bound once, every draw reads its material through the base instance
+    Materials::Bind(this, texturedMeshProgram, 0);
+
+    for (u32 e = 0; e < entities.count; ++e)
     {
-        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), localUniformBuffer.handle, it->localParamsOffset, it->localParamsSize);
+        if (!entities.visible[e])
+            continue;
+
+        Entities::BindTransform(this, e);
 
 
-        Model& model = models[it->modelIndex];
+        Model& model = models[entities.modelIndices[e]];
         Mesh& mesh = meshes[model.meshIdx];
 
         for (u32 i = 0; i < mesh.submeshes.size(); ++i)
         {
-            GLuint vao = FindVAO(mesh, i, texturedMeshProgram);
+            if (!IsItemVisible(entities.cullItemOffsets[e] + i))
+                continue;
+
+            GLuint vao = FindVAO(mesh, i, texturedMeshProgram, materialTable.materialIds.handle);
             glBindVertexArray(vao);
 
-            u32 subMeshmaterialIdx = model.materialIdx[i];
-            Material& subMeshMaterial = materials[subMeshmaterialIdx];
+            // The indirect commands carry the material id as well
+            SubMesh& submesh = mesh.submeshes[i];
+            if (indirectCommands != 0)
+            {
+                u64 commandOffset = (entities.cullItemOffsets[e] + i) * sizeof(DrawElementsIndirectCommand);
+                glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)commandOffset);
+                GlobalRenderStats.indirectTriangles += submesh.indices.size() / 3;
+            }
+            else
+            {
+                glDrawElementsInstancedBaseInstance(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset, 1, model.materialIdx[i]);
+            }
+        }
+
+
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+bool App::IsItemVisible(u32 item) const
+{
+    if (!cullingSet.visible[item])
+        return false;
+    return !softwareOcclusionCulling || SoftwareOcclusion::IsVisible(occlusionRasterizer, item);
+}
+
+void App::RenderDepthPrePass(GLuint indirectCommands)
+{
+    PROFILE_SCOPE("RenderDepthPrePass");
+    const Program& depthProgram = programs[depthPrePassProgramIdx];
+    glUseProgram(depthProgram.handle);
+    glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), localUniformBuffer.handle, globalParamsOffset, globalParamsSize);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectCommands);
+
+    for (u32 e = 0; e < entities.count; ++e)
+    {
+        if (!entities.visible[e])
+            continue;
+
+        Entities::BindTransform(this, e);
 
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, textures[subMeshMaterial.albedoTextureIdx].handle);
-            glUniform1i(texturedMeshProgram_uTexture, 0);
+        Mesh& mesh = meshes[models[entities.modelIndices[e]].meshIdx];
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            if (!IsItemVisible(entities.cullItemOffsets[e] + i))
+                continue;
 
             SubMesh& submesh = mesh.submeshes[i];
-            glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+            glBindVertexArray(submesh.depthOnlyVao);
+            if (indirectCommands != 0)
+            {
+                u64 commandOffset = (entities.cullItemOffsets[e] + i) * sizeof(DrawElementsIndirectCommand);
+                glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)commandOffset);
+                GlobalRenderStats.indirectTriangles += submesh.indices.size() / 3;
+            }
+            else
+            {
+                glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+            }
         }
+    }
 
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
 
+void App::BindGBuffer(const Program& program, GLuint depthTexture)
+{
+    const char* samplers[] = { "uAlbedo", "uNormals", "uMaterial" };
+    for (u32 i = 0; i < ARRAY_COUNT(samplers); ++i)
+    {
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, defferredFrameBuffer.ColorAttachment[i]);
+        glUniform1i(glGetUniformLocation(program.handle, samplers[i]), i);
     }
+
+    glActiveTexture(GL_TEXTURE0 + ARRAY_COUNT(samplers));
+    glBindTexture(GL_TEXTURE_2D, depthTexture != 0 ? depthTexture : defferredFrameBuffer.depthHandle);
+    glUniform1i(glGetUniformLocation(program.handle, "uDepth"), ARRAY_COUNT(samplers));
+
+    // Position and view direction are rebuilt from the depth, which was rasterized with the jitter
+    glm::mat4 inverseViewProjection = glm::inverse(temporalAA.jitteredProjection * viewMatrix);
+    glUniformMatrix4fv(glGetUniformLocation(program.handle, "uInverseViewProjection"), 1, GL_FALSE, glm::value_ptr(inverseViewProjection));
+    glUniform2f(glGetUniformLocation(program.handle, "uViewportSize"), (f32)dynamicResolution.internalSize.x, (f32)dynamicResolution.internalSize.y);
+    glUniform3fv(glGetUniformLocation(program.handle, "uCameraPosition"), 1, glm::value_ptr(cameraPosition));
+
+    CascadedShadows::Bind(this, program, ARRAY_COUNT(samplers) + 1);
+    PointShadows::Bind(this, program, ARRAY_COUNT(samplers) + 2);
+    AmbientOcclusion::Bind(this, program, ARRAY_COUNT(samplers) + 3);
 }
 
-const GLuint App::CreateTexture(const bool isFloatingPoint)
+void App::CullEntities()
 {
-    GLuint textureHandle;
+    PROFILE_SCOPE("CullEntities");
+    // Created or destroyed entities shift the items, every bound is redone then
+    u32 itemCount = 0;
+    bool itemsMoved = false;
+    for (u32 e = 0; e < entities.count; ++e)
+    {
+        itemsMoved |= entities.cullItemOffsets[e] != itemCount;
+        entities.cullItemOffsets[e] = itemCount;
+        itemCount += meshes[models[entities.modelIndices[e]].meshIdx].submeshes.size();
+    }
+
+    if (cullingSet.count != itemCount)
+    {
+        Culling::ResizeCullingSet(cullingSet, itemCount);
+        itemsMoved = true;
+    }
+
+    auto updateBounds = [&](u32 e)
+    {
+        const glm::mat4& world = entities.worldMatrices[e];
+        const Mesh& mesh = meshes[models[entities.modelIndices[e]].meshIdx];
+        AABB box = { vec3(FLT_MAX), vec3(-FLT_MAX) };
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            const SubMesh& submesh = mesh.submeshes[i];
+            u32 item = entities.cullItemOffsets[e] + i;
+            Culling::SetItemBounds(cullingSet, item, world, submesh.aabbMin, submesh.aabbMax);
+
+            // Entity bounds are the union of their submeshes
+            vec3 center(cullingSet.centerX[item], cullingSet.centerY[item], cullingSet.centerZ[item]);
+            vec3 extent(cullingSet.extentX[item], cullingSet.extentY[item], cullingSet.extentZ[item]);
+            box.min = glm::min(box.min, center - extent);
+            box.max = glm::max(box.max, center + extent);
+        }
+        entities.bounds[e] = box;
+    };
+
+    // Otherwise only the entities whose world matrix changed this frame
+    const std::vector<u32>& moved = entities.movedEntities;
+    u32 updateCount = itemsMoved ? entities.count : moved.size();
+    JobSystem::ParallelFor(updateCount, CULLING_BATCH_SIZE, [&](u32 begin, u32 end)
+    {
+        for (u32 i = begin; i < end; ++i)
+            updateBounds(itemsMoved ? i : moved[i]);
+    });
 
-    GLenum internalFormat = isFloatingPoint? GL_RGBA16F : GL_RGBA8;
-    GLenum format = GL_RGBA;
-    GLenum dataType = isFloatingPoint ? GL_FLOAT : GL_UNSIGNED_BYTE;
+    // The tree isn't thread safe, proxies are destroyed with their entity
+    for (u32 i = 0; i < updateCount; ++i)
+    {
+        u32 e = itemsMoved ? i : moved[i];
+        if (entities.proxies[e] != AABB_TREE_NULL_NODE)
+            BVH::MoveProxy(entityTree, entities.proxies[e], entities.bounds[e]);
+        else
+            entities.proxies[e] = BVH::CreateProxy(entityTree, entities.bounds[e], e);
+    }
+    BVH::Refit(entityTree);
+
+    if (frustumCulling && bvhCulling)
+    {
+        Frustum frustum = Culling::ExtractFrustum(projectionMatrix * viewMatrix);
+        std::vector<u32> candidates;
+        BVH::QueryFrustums(entityTree, &frustum, 1, &candidates);
+
+        // The submeshes of the candidates go through the SIMD kernel, the rest of the items stay culled
+        std::vector<CullingRange> ranges;
+        ranges.reserve(candidates.size());
+        for (u32 e : candidates)
+        {
+            u32 submeshCount = meshes[models[entities.modelIndices[e]].meshIdx].submeshes.size();
+            ranges.push_back({ entities.cullItemOffsets[e], entities.cullItemOffsets[e] + submeshCount });
+        }
+        Culling::CullFrustumRanges(frustum, cullingSet, ranges);
+    }
+    else if (frustumCulling)
+    {
+        Culling::CullFrustum(Culling::ExtractFrustum(projectionMatrix * viewMatrix), cullingSet);
+    }
+    else
+    {
+        std::fill(cullingSet.visible.begin(), cullingSet.visible.end(), 1);
+    }
 
-    glGenTextures(1, &textureHandle);
-    glBindTexture(GL_TEXTURE_2D, textureHandle);
-    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, displaySize.x, displaySize.y, 0, format, dataType, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    return textureHandle;
+    visibleItemCount = 0;
+    for (u32 e = 0; e < entities.count; ++e)
+    {
+        u32 submeshCount = meshes[models[entities.modelIndices[e]].meshIdx].submeshes.size();
+        entities.visible[e] = false;
+        for (u32 i = 0; i < submeshCount; ++i)
+        {
+            if (cullingSet.visible[entities.cullItemOffsets[e] + i])
+            {
+                entities.visible[e] = true;
+                ++visibleItemCount;
+            }
+        }
+    }
 }
 
 void App::UpdateEntityBuffer()
 {
+    PROFILE_SCOPE("UpdateEntityBuffer");
     float aspectRatio = (float)displaySize.x / (float)displaySize.y;
-    float znear = 0.1f;
-    float zfar = 1000.0f;
-    projectionMatrix = glm::perspective(glm::radians(60.0f), aspectRatio, znear, zfar);
+    projectionMatrix = glm::perspective(glm::radians(60.0f), aspectRatio, cameraNear, cameraFar);
 
 
 
@@ -681,14 +1640,44 @@ void App::UpdateEntityBuffer()
 
 
     viewMatrix = lookAt(cameraPosition, cameraPosition + cameraFront, cameraUp);
+    TemporalAA::UpdateJitter(this);
+
+    Entities::UpdateTransforms(this);
+    CullEntities();
+
+    if (softwareOcclusionCulling)
+    {
+        SoftwareOcclusion::Render(this);
+
+        for (u32 e = 0; e < entities.count; ++e)
+        {
+            if (!entities.visible[e])
+                continue;
+
+            u32 submeshCount = meshes[models[entities.modelIndices[e]].meshIdx].submeshes.size();
+            entities.visible[e] = false;
+            for (u32 i = 0; i < submeshCount && !entities.visible[e]; ++i)
+                entities.visible[e] = SoftwareOcclusion::IsVisible(occlusionRasterizer, entities.cullItemOffsets[e] + i);
+        }
+    }
 
     BufferManager::MapBuffer(localUniformBuffer, GL_WRITE_ONLY);
 
     //Push light local params
     globalParamsOffset = localUniformBuffer.head;
+
+    // The per entity part lives in EntityStorage::transforms, only rewritten for entities that changed
+    glm::mat4 viewProjection = temporalAA.jitteredProjection * viewMatrix;
+    vec4 jitter = vec4(temporalAA.jitter, 0.0f, 0.0f);
+    PushMat4(localUniformBuffer, viewProjection);
+    PushMat4(localUniformBuffer, temporalAA.previousViewProjection);
+    PushVec4(localUniformBuffer, jitter);
+
     PushVec3(localUniformBuffer, cameraPosition);
-    PushUInt(localUniformBuffer, lights.size());
-    for (size_t i = 0; i < lights.size(); ++i)
+    // The clustered path reads every light from its own buffer, the uniform block only holds the first ones
+    u32 uniformLightCount = glm::min((u32)lights.size(), (u32)MAX_UBO_LIGHTS);
+    PushUInt(localUniformBuffer, uniformLightCount);
+    for (size_t i = 0; i < uniformLightCount; ++i)
     {
         BufferManager::AlignHead(localUniformBuffer, sizeof(vec4));
 
@@ -700,23 +1689,7 @@ void App::UpdateEntityBuffer()
     }
     //AQUIUIIIII
     globalParamsSize = localUniformBuffer.head - globalParamsOffset;
-    u32 iteration = 0;
-    for (auto it = entities.begin(); it != entities.end(); ++it)
-    {
-        glm::mat4 world = it->worldMatrix;
-        glm::mat4 WVP = projectionMatrix * viewMatrix * world;
-
-        Buffer& localBuffer = localUniformBuffer;
-        BufferManager::AlignHead(localBuffer, uniformBlockAligment);
-        it->localParamsOffset = localBuffer.head;
-        PushMat4(localBuffer, world);
-        PushMat4(localBuffer, WVP);
-        it->localParamsSize = localBuffer.head - it->localParamsOffset;
-        ++iteration;
-    }
     BufferManager::UnmapBuffer(localUniformBuffer);
-
-
 }
 
 
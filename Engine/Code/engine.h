@@ -5,8 +5,29 @@
 #pragma once
 
 #include "platform.h"
+#include "RenderStats.h"
 #include "BufferSupFuncs.h"
 #include "ModelLoadingFuncs.h"
+#include "Culling.h"
+#include "AABBTree.h"
+#include "OcclusionCulling.h"
+#include "SoftwareOcclusion.h"
+#include "ClusteredLighting.h"
+#include "ForwardPlus.h"
+#include "LightVolumes.h"
+#include "RenderTargetPool.h"
+#include "GpuProfiler.h"
+#include "FrameGraph.h"
+#include "DynamicResolution.h"
+#include "CascadedShadows.h"
+#include "PointShadows.h"
+#include "PostProcess.h"
+#include "TemporalAA.h"
+#include "SSAO.h"
+#include "VisibilityBuffer.h"
+#include "MaterialTable.h"
+#include "EntityStorage.h"
+#include "CpuProfiler.h"
 #include "Globals.h"
 
 const VertexV3V2 vertices[] = {
@@ -25,13 +46,21 @@ const u16 indices[] =
 struct App
 {
     void ColorAttachment(GLuint& colorAttachmentHandle);
-    void DepthAttachment(GLuint& depthAttachmentHandle);
     void UpdateEntityBuffer();
+    void CullEntities();
 
-    void ConfigureFrameBuffer(FrameBuffer& aConfigFB);
-    void RenderGeometry(const Program& texturedMeshProgram);
+    void RenderGeometry(const Program& texturedMeshProgram, GLuint indirectCommands = 0);
+
+    // Frustum and software occlusion result of a cull item
+    bool IsItemVisible(u32 item) const;
+
+    // Depth only draw of the same items RenderGeometry would draw
+    void RenderDepthPrePass(GLuint indirectCommands = 0);
+
+    // Binds the G-buffer textures and the matrices the lighting shaders need to decode it. A pass that
+    // keeps the G-buffer depth attached samples a copy of it instead.
+    void BindGBuffer(const Program& program, GLuint depthTexture = 0);
 
-    const GLuint CreateTexture(const bool isFloatingPoint = false);
     // ---------------------------------------------------------------------------------------
     unsigned int loadCubemapTextures(std::vector<std::string> faces);
     void loadhdr();
@@ -68,6 +97,9 @@ struct App
     std::vector<Model>      models;
     std::vector<Program>    programs;
 
+    // App::materials and App::textures as the shaders see them
+    MaterialTable materialTable;
+
     GLuint renderToBackBufferShader;
     GLuint renderToFrameBufferShader;
     GLuint freamebufferToQuadShader;
@@ -91,7 +123,6 @@ struct App
     u32 texturedMeshProgramIdx = 0;
 
     u32 patricioModel = 0;
-    GLuint texturedMeshProgram_uTexture;
     
     unsigned int envCubemap;
 
@@ -126,21 +157,77 @@ struct App
     GLint maxUniformBufferSize;
     GLint uniformBlockAligment;
     Buffer localUniformBuffer;
-    std::vector<Entity> entities;
+    EntityStorage entities;
+    std::vector<EntityBenchmarkResult> entityBenchmarks; // last run of the CPU profiler window
     std::vector<Light> lights;
 
     GLuint globalParamsOffset;
     GLuint globalParamsSize;
 
+    // Owns the screen sized textures, sized to renderSize which follows displaySize after a resize settles
+    RenderTargetPool renderTargetPool;
+    FrameGraph frameGraph;
+
+    // Timestamps of every frame graph pass and of the scopes inside them
+    GpuProfiler gpuProfiler;
+
+    // Internal resolution of the deferred passes
+    DynamicResolution dynamicResolution;
+
+    // G-buffer textures of the last deferred frame, handed out by the frame graph
     FrameBuffer defferredFrameBuffer;
 
+    // Copies of the G-buffer for the debug viewer. The GUI is built before the frame graph runs and the
+    // transients go back to the pool after their last pass, so it can't show those.
+    bool showGBuffer;
+    FrameBuffer gBufferViewer;
+    ivec2 gBufferViewerSize;
+
     vec3 target = vec3(0.f, 0.f, 0.f);
     vec3 cameraPosition = vec3(5.0, 5.0, 5.0);
     vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
     vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
 
+    f32 cameraNear = 0.1f;
+    f32 cameraFar = 1000.0f;
+
     glm::mat4x4 projectionMatrix;
     glm::mat4x4 viewMatrix;
+
+    // Depth pre-pass per render mode, the main pass then tests with GL_EQUAL and doesn't write depth
+    bool depthPrePass[Mode_Count] = {};
+    u32 depthPrePassProgramIdx;
+
+    DeferredLighting deferredLighting = DeferredLighting_Clustered;
+    ClusteredLights clusteredLights;
+    ForwardPlusLights forwardPlus;
+    VisibilityBufferRenderer visibilityBuffer;
+    LightVolumePass lightVolumes;
+
+    // Shadows of the first directional light in the deferred lighting passes
+    CascadedShadowMap cascadedShadows;
+    PointShadowAtlas pointShadows;
+    PostProcessChain postProcess;
+    TemporalAntiAliasing temporalAA;
+    ScreenSpaceAO ssao;
+
+    // Frustum culling, one item per entity submesh
+    bool frustumCulling = true;
+    CullingSet cullingSet;
+    u32 visibleItemCount;
+
+    // Entity level BVH queried before the per submesh test
+    bool bvhCulling = true;
+    AABBTree entityTree;
+
+    // Hi-Z occlusion culling of the G-buffer pass
+    bool gpuOcclusionCulling = true;
+    HiZOcclusion hizOcclusion;
+    u32 hizOcclusionItemCount;
+
+    // CPU occlusion culling against a few rasterized occluders
+    bool softwareOcclusionCulling = false;
+    OcclusionRasterizer occlusionRasterizer;
    // Texture *texture = nullptr;
    // bool needsProcessing = false;
    //
@@ -161,6 +248,13 @@ struct EnviroMement {
 
 };
 // ---------------------------------------------------------------------------------------
+u32 LoadProgram(App* app, const char* filepath, const char* programName);
+
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName);
+
+// Material ids come from materialIds when the program reads them, see MaterialTable.h
+GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program, GLuint materialIds = 0);
+
 void Init(App* app);
 
 void Gui(App* app);
@@ -16,6 +16,8 @@
 #endif
 
 #include "engine.h"
+#include "JobSystem.h"
+#include "CpuProfiler.h"
 #include <stdio.h>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
@@ -226,19 +228,31 @@ int main()
 
     GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
 
+    CpuProfiling::Init();
+    JobSystem::Init();
+
     Init(&app);
 
     while (app.isRunning)
     {
+        CpuProfiling::BeginFrame();
+        RenderStatistics::BeginFrame();
+
         // Tell GLFW to call platform callbacks
-        glfwPollEvents();
+        {
+            PROFILE_SCOPE("PollEvents");
+            glfwPollEvents();
+        }
 
         // ImGui
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
-        Gui(&app);
-        ImGui::Render();
+        {
+            PROFILE_SCOPE("Gui");
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+            Gui(&app);
+            ImGui::Render();
+        }
 
         // Clear input state if required by ImGui
         if (ImGui::GetIO().WantCaptureKeyboard)
@@ -269,8 +283,14 @@ int main()
         Render(&app);
 
         // ImGui Render
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        {
+            PROFILE_SCOPE("ImGui Render");
+            GPU_SCOPE(app.gpuProfiler, "ImGui");
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
+        GpuProfiling::EndFrame(app.gpuProfiler);
         if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable) {
+            PROFILE_SCOPE("ImGui Platform Windows");
             GLFWwindow* backup_current_context = glfwGetCurrentContext();
             ImGui::UpdatePlatformWindows();
             ImGui::RenderPlatformWindowsDefault();
@@ -278,7 +298,10 @@ int main()
         }
 
         // Present image on screen
-        glfwSwapBuffers(window);
+        {
+            PROFILE_SCOPE("SwapBuffers");
+            glfwSwapBuffers(window);
+        }
 
         // Frame time
         f64 currentFrameTime = glfwGetTime();
@@ -289,6 +312,12 @@ int main()
         GlobalFrameArenaHead = 0;
     }
 
+    if (CpuProfiling::recording)
+        CpuProfiling::ExportChromeTrace("cpu_trace.json");
+
+    JobSystem::Shutdown();
+    CpuProfiling::Shutdown();
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
@@ -1,24 +1,19 @@
-#ifdef BKSH
+#ifdef SKY
 
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
 
-layout (location = 0) in vec3 aPos;
+// Single triangle covering the screen, on the far plane so only the pixels the G-buffer left at
+// the cleared depth pass the depth test
+const vec2 positions[3] = vec2[3](vec2(-1.0, -1.0), vec2(3.0, -1.0), vec2(-1.0, 3.0));
 
-uniform mat4 projection;
-uniform mat4 view;
-
-out vec3 localPos;
+out vec2 ndc;
 
 void main()
 {
-    localPos = aPos;
-
-    mat4 rotView = mat4(mat3(view)); // remove translation from the view matrix
-    vec4 clipPos = projection * rotView * vec4(localPos, 1.0);
-
-    gl_Position = clipPos.xyww;
+    ndc = positions[gl_VertexID];
+    gl_Position = vec4(ndc, 1.0, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -26,19 +21,31 @@ void main()
 
 out vec4 FragColor;
 
-in vec3 localPos;
-  
+in vec2 ndc;
+
 uniform samplerCube environmentMap;
-  
+uniform sampler2D uDepth;
+uniform bool uSampleDepth;           // the depth isn't attached, only on the back buffer
+uniform mat4 uInverseViewProjection; // of the view rotation only
+uniform bool uTonemap;               // the target isn't HDR, no post processing follows
+
 void main()
 {
-    vec3 envColor = texture(environmentMap, localPos).rgb;
-    
-    envColor = envColor / (envColor + vec3(1.0));
-    envColor = pow(envColor, vec3(1.0/2.2)); 
-  
+    // The back buffer can't take the G-buffer depth, test it here instead
+    if (uSampleDepth && texelFetch(uDepth, ivec2(gl_FragCoord.xy), 0).r < 1.0)
+        discard;
+
+    vec4 direction = uInverseViewProjection * vec4(ndc, 1.0, 1.0);
+    vec3 envColor = texture(environmentMap, direction.xyz / direction.w).rgb;
+
+    if (uTonemap)
+    {
+        envColor = envColor / (envColor + vec3(1.0));
+        envColor = pow(envColor, vec3(1.0/2.2));
+    }
+
     FragColor = vec4(envColor, 1.0);
 }
 
 #endif
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,114 @@
+///////////////////////////////////////////////////////////////////////
+#ifdef CLUSTER_BUILD
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// Must match ClusteredLighting.h
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+#define CLUSTER_MAX_LIGHTS 256
+
+#define GROUP_SIZE 64
+
+layout(local_size_x = GROUP_SIZE) in;
+
+struct LightData
+{
+	vec4 color;     // w: type
+	vec4 direction;
+	vec4 position;  // w: radius
+};
+
+layout(std430, binding = 0) readonly buffer Lights
+{
+	LightData uLights[];
+};
+
+layout(std430, binding = 1) writeonly buffer ClusterLightCounts
+{
+	uint uClusterLightCount[];
+};
+
+layout(std430, binding = 2) writeonly buffer ClusterLightIndices
+{
+	uint uClusterLightIndices[];
+};
+
+uniform mat4 uInverseProjection;
+uniform mat4 uView;
+uniform uint uLightCount;
+uniform uint uDirectionalLightCount;
+uniform float uNear;
+uniform float uFar;
+
+// View space position and radius of a batch of point lights
+shared vec4 sLights[GROUP_SIZE];
+
+// View space point of the ray through an NDC position at the given view depth
+vec3 PointAtDepth(vec2 ndc, float depth)
+{
+	vec4 nearPoint = uInverseProjection * vec4(ndc, -1.0, 1.0);
+	vec3 ray = nearPoint.xyz / nearPoint.w;
+	return ray * (depth / -ray.z);
+}
+
+void main()
+{
+	uint clusterIdx = gl_GlobalInvocationID.x;
+	bool validCluster = clusterIdx < CLUSTER_COUNT;
+
+	uvec3 cluster = uvec3(clusterIdx % CLUSTER_GRID_X,
+	                      (clusterIdx / CLUSTER_GRID_X) % CLUSTER_GRID_Y,
+	                      clusterIdx / (CLUSTER_GRID_X * CLUSTER_GRID_Y));
+
+	vec2 ndcMin = vec2(cluster.xy) / vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y) * 2.0 - 1.0;
+	vec2 ndcMax = vec2(cluster.xy + 1u) / vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y) * 2.0 - 1.0;
+
+	// Exponential slices so clusters stay roughly cubic with distance
+	float sliceNear = uNear * pow(uFar / uNear, float(cluster.z) / float(CLUSTER_GRID_Z));
+	float sliceFar = uNear * pow(uFar / uNear, float(cluster.z + 1u) / float(CLUSTER_GRID_Z));
+
+	vec3 aabbMin = vec3(1e30);
+	vec3 aabbMax = vec3(-1e30);
+	for (int i = 0; i < 4; ++i)
+	{
+		vec2 ndc = vec2((i & 1) != 0 ? ndcMax.x : ndcMin.x, (i & 2) != 0 ? ndcMax.y : ndcMin.y);
+		vec3 nearCorner = PointAtDepth(ndc, sliceNear);
+		vec3 farCorner = PointAtDepth(ndc, sliceFar);
+		aabbMin = min(aabbMin, min(nearCorner, farCorner));
+		aabbMax = max(aabbMax, max(nearCorner, farCorner));
+	}
+
+	uint lightCount = 0u;
+	for (uint base = uDirectionalLightCount; base < uLightCount; base += GROUP_SIZE)
+	{
+		uint lightIdx = base + gl_LocalInvocationIndex;
+		if (lightIdx < uLightCount)
+		{
+			vec4 position = uLights[lightIdx].position;
+			sLights[gl_LocalInvocationIndex] = vec4((uView * vec4(position.xyz, 1.0)).xyz, position.w);
+		}
+		barrier();
+
+		uint batchCount = min(uint(GROUP_SIZE), uLightCount - base);
+		for (uint i = 0u; validCluster && i < batchCount; ++i)
+		{
+			vec4 light = sLights[i];
+			vec3 offset = clamp(light.xyz, aabbMin, aabbMax) - light.xyz;
+			if (dot(offset, offset) <= light.w * light.w && lightCount < CLUSTER_MAX_LIGHTS)
+			{
+				uClusterLightIndices[clusterIdx * CLUSTER_MAX_LIGHTS + lightCount] = base + i;
+				++lightCount;
+			}
+		}
+		barrier();
+	}
+
+	if (validCluster)
+		uClusterLightCount[clusterIdx] = lightCount;
+}
+
+#endif
+#endif
@@ -0,0 +1,59 @@
+///////////////////////////////////////////////////////////////////////
+#ifdef DEPTH_PREPASS
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+
+// Leading member of the GlobalParams block
+layout(binding = 0, std140) uniform GlobalParams
+{
+	mat4 uViewProjection;
+};
+
+layout(binding = 1, std140) uniform LocalParams
+{
+	mat4 uWorldMatrix;
+	mat4 uPreviousWorldMatrix;
+};
+
+// Must produce the exact same depth as the main passes, which test with GL_EQUAL
+invariant gl_Position;
+
+void main()
+{
+	vec4 worldPosition = uWorldMatrix * vec4(aPosition, 1.0);
+	gl_Position = uViewProjection * worldPosition;
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+void main()
+{
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+#ifdef SHADOW_CASTER
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+
+uniform mat4 uWorldLightViewProjection;
+
+void main()
+{
+	gl_Position = uWorldLightViewProjection * vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+void main()
+{
+}
+
+#endif
+#endif
@@ -1,20 +1,67 @@
-#ifdef FB_TO_BB
+#if defined(FB_TO_BB) || defined(FB_TO_BB_CLUSTERED) || defined(LIGHT_VOLUME) || defined(VISIBILITY_RESOLVE)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
+#ifdef LIGHT_VOLUME
+
 layout(location = 0) in vec3 aPosition;
-layout(location = 1) in vec2 aTexCoord;
 
-out vec2 vTexCoord;
+uniform mat4 uWorldViewProjection;
+
+void main()
+{
+	gl_Position = uWorldViewProjection * vec4(aPosition, 1.0);
+}
+
+#else
+
+layout(location = 0) in vec3 aPosition;
 
 void main()
 {
-	vTexCoord = aTexCoord;
 	gl_Position = vec4(aPosition, 1.0);
 }
 
+#endif
+
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
+#ifndef VISIBILITY_RESOLVE
+uniform sampler2D uAlbedo;
+uniform sampler2D uNormals;  // octahedral encoded
+uniform sampler2D uMaterial; // r: specular strength, g: shininess / 255, b: ambient strength
+uniform sampler2D uAmbientOcclusion; // scales the ambient strength
+uniform bool uAmbientOcclusionEnabled;
+uniform mat4 uInverseViewProjection;
+#endif
+uniform sampler2D uDepth;
+uniform vec2 uViewportSize;  // region of the G-buffer holding this frame, the output shares its pixel grid
+layout(location = 0) out vec4 oColor;
+
+// Cascaded shadows of the first directional light, must match CascadedShadows.h
+#define SHADOW_MAX_CASCADES 4
+uniform sampler2DArrayShadow uShadowMap;
+uniform int uShadowCascadeCount; // 0 without shadows
+uniform mat4 uShadowMatrices[SHADOW_MAX_CASCADES];  // world to shadow map texture space
+uniform float uShadowTexelSizes[SHADOW_MAX_CASCADES]; // world size of a shadow map texel
+
+// Point light shadows, six tiles of a depth atlas per light, must match PointShadows.cpp
+struct PointShadowData
+{
+	vec4 faces[6]; // atlas uv: offset xy, size zw
+	vec4 params;   // x: near, y: far, z: 1 when the light has a shadow
+};
+
+layout(std430, binding = 3) readonly buffer PointShadows
+{
+	PointShadowData uPointShadows[];
+};
+
+uniform sampler2DShadow uPointShadowAtlas;
+uniform uint uPointShadowCount; // lights from this index on have no shadow
+
+#ifdef FB_TO_BB
+
 struct Light
 {
 	uint type;
@@ -25,79 +72,450 @@ struct Light
 
 layout(binding = 0, std140) uniform GlobalParams
 {
+	mat4 uViewProjection;         // jittered
+	mat4 uPreviousViewProjection; // unjittered
+	vec4 uJitter;                 // xy: NDC offset of uViewProjection
 	vec3 uCameraPosition;
 	int uLightCount;
 	Light uLight[16];
 };
 
-in vec2 vTexCoord;
+#else
 
-uniform sampler2D uAlbedo;
-uniform sampler2D uNormals;
-uniform sampler2D uPosition;
-uniform sampler2D uViewDir;
-layout(location = 0) out vec4 oColor;
+uniform vec3 uCameraPosition;
 
-void CalculateBlitVars(in Light light, out vec3 ambient, out vec3 diffuse, out vec3 specular)
+#endif
+
+struct GBufferSample
 {
-		vec3 vNormal = texture(uNormals, vTexCoord).xyz;
-		vec3 vViewDir = texture(uViewDir, vTexCoord).xyz;
-		vec3 lightDir = normalize(light.direction);
+	vec4 albedo;
+	vec3 normal;
+	vec3 position;
+	vec3 viewDir;
+	float specularStrength;
+	float shininess;
+	float ambientStrength;
+};
 
-		float ambientStrenght = 0.2;
-		ambient = ambientStrenght * light.color;
+vec3 DecodeOctahedral(vec2 encoded)
+{
+	vec2 e = encoded * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+#ifdef VISIBILITY_RESOLVE
+
+uniform uint uTriangleBits; // low bits of a texel holding the primitive, see VisibilityBuffer.h
+
+struct DrawData
+{
+	mat4 world;
+	uint vertexBase;     // in floats
+	uint vertexStride;   // in floats
+	uint texCoordOffset; // in floats, 0 without texture coordinates
+	uint indexBase;
+	uint materialIdx;
+	uint padding[3];
+};
 
-		float diff = max(dot(vNormal, lightDir), 0.0f);
-		diffuse = diff * light.color;
+layout(std430, binding = 4) readonly buffer VisibilityDraws
+{
+	DrawData uDraws[];
+};
 
-		float specularStrength = 0.1f;
-		vec3 reflectDir = reflect(-lightDir, vNormal);
-		vec3 normalViewDir = normalize(vViewDir);
-		float spec = pow(max(dot(normalViewDir, reflectDir),0.0f), 32);
-		specular = specularStrength * spec * light.color;
+layout(std430, binding = 5) readonly buffer VisibilityVertices
+{
+	float uVertices[];
+};
+
+layout(std430, binding = 6) readonly buffer VisibilityIndices
+{
+	uint uIndices[];
+};
+
+// Material table, must match MaterialTable.h
+struct Material
+{
+	vec4 albedo;   // w: smoothness
+	vec4 emissive;
+	uint albedoTexture; // layers of uMaterialTextures
+	uint emissiveTexture;
+	uint specularTexture;
+	uint normalsTexture;
+	uint bumpTexture;
+	uint padding[3];
+};
+
+layout(std430, binding = 7) readonly buffer Materials
+{
+	Material uMaterials[];
+};
+
+uniform sampler2DArray uMaterialTextures;
+uniform usampler2D uVisibility; // draw index + 1 and primitive of the draw
+uniform mat4 uViewProjection;
+
+struct Barycentrics
+{
+	vec3 lambda;
+	vec3 ddx; // change of lambda one pixel to the right
+	vec3 ddy; // and one pixel up
+};
+
+// Perspective correct barycentrics of a pixel and their screen derivatives, from the clip positions
+// of the triangle. The derivatives stand in for the ones of the rasterizer when sampling textures.
+Barycentrics ComputeBarycentrics(vec4 p0, vec4 p1, vec4 p2, vec2 ndc)
+{
+	vec3 invW = 1.0 / vec3(p0.w, p1.w, p2.w);
+	vec2 ndc0 = p0.xy * invW.x;
+	vec2 ndc1 = p1.xy * invW.y;
+	vec2 ndc2 = p2.xy * invW.z;
+
+	float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+	vec3 ddx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+	vec3 ddy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+	float ddxSum = ddx.x + ddx.y + ddx.z;
+	float ddySum = ddy.x + ddy.y + ddy.z;
+
+	vec2 delta = ndc - ndc0;
+	float interpolatedInvW = invW.x + delta.x * ddxSum + delta.y * ddySum;
+	float interpolatedW = 1.0 / interpolatedInvW;
+
+	Barycentrics b;
+	b.lambda = interpolatedW * (vec3(invW.x, 0.0, 0.0) + delta.x * ddx + delta.y * ddy);
+
+	// From NDC units to pixels
+	ddx *= 2.0 / uViewportSize.x;
+	ddy *= 2.0 / uViewportSize.y;
+	ddxSum *= 2.0 / uViewportSize.x;
+	ddySum *= 2.0 / uViewportSize.y;
+
+	b.ddx = (b.lambda * interpolatedInvW + ddx) / (interpolatedInvW + ddxSum) - b.lambda;
+	b.ddy = (b.lambda * interpolatedInvW + ddy) / (interpolatedInvW + ddySum) - b.lambda;
+	return b;
 }
 
+vec3 LoadVec3(uint index)
+{
+	return vec3(uVertices[index], uVertices[index + 1u], uVertices[index + 2u]);
+}
+
+// The triangle the geometry pass kept, its attributes fetched and interpolated here
+GBufferSample SampleGBuffer(ivec2 texel)
+{
+	// Nothing was drawn here, the sky pass fills it. The visibility target isn't cleared.
+	if(texelFetch(uDepth, texel, 0).r == 1.0)
+		discard;
+
+	uint visibility = texelFetch(uVisibility, texel, 0).r;
+	DrawData draw = uDraws[(visibility >> uTriangleBits) - 1u];
+	uint triangle = visibility & ((1u << uTriangleBits) - 1u);
+
+	vec3 positions[3];
+	vec4 clipPositions[3];
+	uint vertices[3];
+	for(int i = 0; i < 3; ++i)
+	{
+		vertices[i] = draw.vertexBase + uIndices[draw.indexBase + triangle * 3u + uint(i)] * draw.vertexStride;
+		positions[i] = (draw.world * vec4(LoadVec3(vertices[i]), 1.0)).xyz;
+		clipPositions[i] = uViewProjection * vec4(positions[i], 1.0);
+	}
+
+	vec2 ndc = (vec2(texel) + 0.5) / uViewportSize * 2.0 - 1.0;
+	Barycentrics b = ComputeBarycentrics(clipPositions[0], clipPositions[1], clipPositions[2], ndc);
+
+	GBufferSample g;
+	g.position = b.lambda.x * positions[0] + b.lambda.y * positions[1] + b.lambda.z * positions[2];
+	g.viewDir = normalize(uCameraPosition - g.position);
+
+	vec3 normal = b.lambda.x * LoadVec3(vertices[0] + 3u) + b.lambda.y * LoadVec3(vertices[1] + 3u) + b.lambda.z * LoadVec3(vertices[2] + 3u);
+	g.normal = normalize(mat3(draw.world) * normal);
+
+	g.albedo = vec4(1.0);
+	if(draw.texCoordOffset != 0u)
+	{
+		vec2 uvs[3];
+		for(int i = 0; i < 3; ++i)
+			uvs[i] = vec2(uVertices[vertices[i] + draw.texCoordOffset], uVertices[vertices[i] + draw.texCoordOffset + 1u]);
+
+		vec2 uv = b.lambda.x * uvs[0] + b.lambda.y * uvs[1] + b.lambda.z * uvs[2];
+		vec2 uvDdx = b.ddx.x * uvs[0] + b.ddx.y * uvs[1] + b.ddx.z * uvs[2];
+		vec2 uvDdy = b.ddy.x * uvs[0] + b.ddy.y * uvs[1] + b.ddy.z * uvs[2];
+		g.albedo = textureGrad(uMaterialTextures, vec3(uv, float(uMaterials[draw.materialIdx].albedoTexture)), uvDdx, uvDdy);
+	}
+
+	// Same constants the G-buffer pass writes
+	g.specularStrength = 0.1;
+	g.shininess = 32.0;
+	g.ambientStrength = 0.2;
+	return g;
+}
+
+#else
+
+GBufferSample SampleGBuffer(ivec2 texel)
+{
+	GBufferSample g;
+	g.albedo = texelFetch(uAlbedo, texel, 0);
+	g.normal = DecodeOctahedral(texelFetch(uNormals, texel, 0).xy);
+
+	// Nothing was drawn here, the sky pass fills it
+	float depth = texelFetch(uDepth, texel, 0).r;
+	if(depth == 1.0)
+		discard;
+
+	vec2 texCoord = (vec2(texel) + 0.5) / uViewportSize;
+	vec4 position = uInverseViewProjection * vec4(vec3(texCoord, depth) * 2.0 - 1.0, 1.0);
+	g.position = position.xyz / position.w;
+	g.viewDir = normalize(uCameraPosition - g.position);
+
+	vec4 material = texelFetch(uMaterial, texel, 0);
+	g.specularStrength = material.r;
+	g.shininess = material.g * 255.0;
+	g.ambientStrength = material.b;
+	if(uAmbientOcclusionEnabled)
+		g.ambientStrength *= texelFetch(uAmbientOcclusion, texel, 0).r;
+	return g;
+}
+
+#endif
+
+float Attenuation(float distance)
+{
+	float constant = 1.0f;
+	float linear = 0.09f;
+	float quadratic = 0.032f;
+	return 1.0f / (constant + linear * distance + quadratic * (distance * distance));
+}
+
+// Cached cascades may lag behind the camera, the first one covering the position is used
+float DirectionalShadow(in GBufferSample g, vec3 direction)
+{
+	vec2 texelSize = 1.0 / vec2(textureSize(uShadowMap, 0).xy);
+	float grazing = 1.0 - clamp(dot(g.normal, normalize(direction)), 0.0, 1.0);
+
+	for(int c = 0; c < uShadowCascadeCount; ++c)
+	{
+		// Normal offset, larger at grazing angles where the depth slope is steep
+		vec3 position = g.position + g.normal * uShadowTexelSizes[c] * (1.0 + 2.0 * grazing);
+		vec3 coords = (uShadowMatrices[c] * vec4(position, 1.0)).xyz;
+		if(any(lessThan(coords.xy, 2.0 * texelSize)) || any(greaterThan(coords.xy, 1.0 - 2.0 * texelSize)) || coords.z > 1.0)
+			continue;
+
+		// 3x3 taps of the bilinear hardware comparison
+		float lit = 0.0;
+		for(int y = -1; y <= 1; ++y)
+			for(int x = -1; x <= 1; ++x)
+				lit += texture(uShadowMap, vec4(coords.xy + vec2(x, y) * texelSize, float(c), coords.z));
+		return lit / 9.0;
+	}
+	return 1.0;
+}
+
+// Cube face directions, must match PointShadows.cpp
+const vec3 PointShadowForward[6] = vec3[6](vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1));
+const vec3 PointShadowUp[6] = vec3[6](vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0));
+
+int PointShadowFace(vec3 v)
+{
+	vec3 a = abs(v);
+	if(a.x >= a.y && a.x >= a.z)
+		return v.x > 0.0 ? 0 : 1;
+	if(a.y >= a.z)
+		return v.y > 0.0 ? 2 : 3;
+	return v.z > 0.0 ? 4 : 5;
+}
+
+float PointShadow(uint lightIndex, in GBufferSample g, vec3 lightPosition)
+{
+	if(lightIndex >= uPointShadowCount || uPointShadows[lightIndex].params.z == 0.0)
+		return 1.0;
+
+	PointShadowData data = uPointShadows[lightIndex];
+	float near = data.params.x;
+	float far = data.params.y;
+	float atlasSize = float(textureSize(uPointShadowAtlas, 0).x);
+	float tileTexels = data.faces[0].z * atlasSize;
+
+	// Normal offset of about one texel at this distance, the face planes are 90 degrees wide
+	vec3 v = g.position - lightPosition;
+	float texelSize = 2.0 * max(abs(v.x), max(abs(v.y), abs(v.z))) / tileTexels;
+	v += g.normal * texelSize * 1.5;
+
+	// Same basis as glm::lookAt with a 90 degree perspective
+	int face = PointShadowFace(v);
+	vec3 forward = PointShadowForward[face];
+	vec3 side = normalize(cross(forward, PointShadowUp[face]));
+	vec3 up = cross(side, forward);
+	float d = dot(forward, v);
+	if(d <= near || d >= far)
+		return 1.0;
+
+	vec2 ndc = vec2(dot(side, v), dot(up, v)) / d;
+	float depth = ((far + near) / (far - near) - 2.0 * far * near / ((far - near) * d)) * 0.5 + 0.5;
+
+	// 2x2 taps of the bilinear hardware comparison, kept inside the tile
+	vec4 tile = data.faces[face];
+	float texel = 1.0 / atlasSize;
+	vec2 uv = tile.xy + (ndc * 0.5 + 0.5) * tile.zw;
+	vec2 minUV = tile.xy + 1.5 * texel;
+	vec2 maxUV = tile.xy + tile.zw - 1.5 * texel;
+	float lit = 0.0;
+	for(int y = 0; y < 2; ++y)
+		for(int x = 0; x < 2; ++x)
+			lit += texture(uPointShadowAtlas, vec3(clamp(uv + (vec2(x, y) - 0.5) * texel, minUV, maxUV), depth));
+	return lit * 0.25;
+}
+
+// Ambient + diffuse + specular of one light, scaled by its attenuation. The shadow only dims the direct part.
+vec3 ShadeLight(in GBufferSample g, vec3 color, vec3 direction, float attenuation, float shadow)
+{
+	vec3 lightDir = normalize(direction);
+
+	vec3 ambient = g.ambientStrength * color;
+
+	float diff = max(dot(g.normal, lightDir), 0.0f);
+	vec3 diffuse = diff * color;
+
+	vec3 reflectDir = reflect(-lightDir, g.normal);
+	float spec = pow(max(dot(g.viewDir, reflectDir), 0.0f), g.shininess);
+	vec3 specular = g.specularStrength * spec * color;
+
+	return (ambient + (diffuse + specular) * shadow) * attenuation;
+}
+
+#ifdef FB_TO_BB
+
 void main()
 {
-	vec4 textureColor = texture(uAlbedo, vTexCoord);
+	GBufferSample g = SampleGBuffer(ivec2(gl_FragCoord.xy));
 	vec4 finalColor = vec4(0.0);
+	bool shadowed = false;
 
 	for(int i = 0; i < uLightCount; ++i)
 	{
+		Light light = uLight[i];
+
+		float attenuation = 1.0f;
+		float shadow = 1.0f;
+		if(light.type != 0)
+		{
+			attenuation = Attenuation(length(light.position - g.position));
+			shadow = PointShadow(uint(i), g, light.position);
+		}
+		else if(!shadowed)
+		{
+			shadow = DirectionalShadow(g, light.direction);
+			shadowed = true;
+		}
+
+		vec3 lightResult = ShadeLight(g, light.color, light.direction, attenuation, shadow);
+		finalColor += vec4(lightResult,1.0) * g.albedo;
+	}
+
+	oColor = finalColor;
+}
+
+#elif defined(LIGHT_VOLUME)
+
+uniform uint uLightType;
+uniform vec3 uLightColor;
+uniform vec3 uLightDirection;
+uniform vec3 uLightPosition;
+uniform float uLightRadius;
+uniform int uLightShadowed;
+uniform uint uLightIndex; // in App::lights, for the point light shadows
+
+void main()
+{
+	GBufferSample g = SampleGBuffer(ivec2(gl_FragCoord.xy));
+
+	float attenuation = 1.0f;
+	float shadow = 1.0f;
+	if(uLightType != 0u)
+	{
+		float distance = length(uLightPosition - g.position);
+		if(distance >= uLightRadius)
+			discard;
+		attenuation = Attenuation(distance);
+		shadow = PointShadow(uLightIndex, g, uLightPosition);
+	}
+	else if(uLightShadowed != 0)
+	{
+		shadow = DirectionalShadow(g, uLightDirection);
+	}
 
-		vec3 lightResult = vec3(0.0f);
+	// Blended additively into the accumulation target
+	oColor = vec4(ShadeLight(g, uLightColor, uLightDirection, attenuation, shadow), 1.0) * g.albedo;
+}
 
-		vec3 ambient = vec3(0.0);
-		vec3 diffuse = vec3(0.0);
-		vec3 specular = vec3(0.0);
+#else // FB_TO_BB_CLUSTERED, VISIBILITY_RESOLVE
 
-		if(uLight[i].type == 0)
-		{
-			Light light = uLight[i];
+// Must match ClusteredLighting.h
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_MAX_LIGHTS 256
 
-			CalculateBlitVars(light,ambient,diffuse,specular);
+struct LightData
+{
+	vec4 color;     // w: type
+	vec4 direction; // w: index in App::lights
+	vec4 position;  // w: radius
+};
 
-			lightResult = ambient + diffuse + specular;
-			finalColor += vec4(lightResult,1.0) * textureColor;
-		}
-		else
-		{
-			Light light = uLight[i];
+layout(std430, binding = 0) readonly buffer Lights
+{
+	LightData uLights[];
+};
+
+layout(std430, binding = 1) readonly buffer ClusterLightCounts
+{
+	uint uClusterLightCount[];
+};
 
-			float constant = 1.0f;
-			float linear = 0.09f;
-			float quadratic = 0.032f;
-			float distance = length(light.position - texture(uPosition,vTexCoord).xyz);
-			float attenuation = 1.0f / (constant + linear * distance + quadratic *(distance*distance));
+layout(std430, binding = 2) readonly buffer ClusterLightIndices
+{
+	uint uClusterLightIndices[];
+};
 
-			CalculateBlitVars(light,ambient,diffuse,specular);
-			lightResult = (ambient * attenuation) + (diffuse * attenuation) + (specular * attenuation);
-			finalColor += vec4(lightResult,1.0) * textureColor;
-		}
+uniform mat4 uView;
+uniform vec2 uTileSize;
+uniform float uSliceScale;
+uniform float uSliceBias;
+uniform uint uDirectionalLightCount;
+
+void main()
+{
+	GBufferSample g = SampleGBuffer(ivec2(gl_FragCoord.xy));
+	vec3 color = vec3(0.0);
+
+	// The first light is the first directional one, the one with shadows
+	for(uint i = 0u; i < uDirectionalLightCount; ++i)
+		color += ShadeLight(g, uLights[i].color.rgb, uLights[i].direction.xyz, 1.0, i == 0u ? DirectionalShadow(g, uLights[i].direction.xyz) : 1.0);
+
+	float viewDepth = max(-(uView * vec4(g.position, 1.0)).z, 1e-4);
+	uvec2 tile = min(uvec2(gl_FragCoord.xy / uTileSize), uvec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+	uint slice = uint(clamp(log(viewDepth) * uSliceScale + uSliceBias, 0.0, float(CLUSTER_GRID_Z - 1)));
+	uint clusterIdx = tile.x + CLUSTER_GRID_X * (tile.y + CLUSTER_GRID_Y * slice);
+
+	uint lightCount = uClusterLightCount[clusterIdx];
+	for(uint i = 0u; i < lightCount; ++i)
+	{
+		LightData light = uLights[uClusterLightIndices[clusterIdx * CLUSTER_MAX_LIGHTS + i]];
+
+		float distance = length(light.position.xyz - g.position);
+		if(distance < light.position.w)
+			color += ShadeLight(g, light.color.rgb, light.direction.xyz, Attenuation(distance), PointShadow(uint(light.direction.w), g, light.position.xyz));
 	}
 
-	oColor = finalColor;
+	oColor = vec4(color, 1.0) * g.albedo;
 }
 
 #endif
-#endif
\ No newline at end of file
+#endif
+#endif
@@ -0,0 +1,148 @@
+///////////////////////////////////////////////////////////////////////
+#if defined(FORWARD_PLUS_CULL) || defined(FORWARD_PLUS_CULL_MULTISAMPLE)
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+// Must match ForwardPlus.h
+#define FORWARD_PLUS_TILE_SIZE 16
+#define FORWARD_PLUS_MAX_LIGHTS 256
+
+#define GROUP_SIZE (FORWARD_PLUS_TILE_SIZE * FORWARD_PLUS_TILE_SIZE)
+
+// One group per tile, one thread per pixel
+layout(local_size_x = FORWARD_PLUS_TILE_SIZE, local_size_y = FORWARD_PLUS_TILE_SIZE) in;
+
+struct LightData
+{
+	vec4 color;     // w: type
+	vec4 direction;
+	vec4 position;  // w: radius
+};
+
+layout(std430, binding = 0) readonly buffer Lights
+{
+	LightData uLights[];
+};
+
+layout(std430, binding = 1) writeonly buffer TileLightCounts
+{
+	uint uTileLightCount[];
+};
+
+layout(std430, binding = 2) writeonly buffer TileLightIndices
+{
+	uint uTileLightIndices[];
+};
+
+#ifdef FORWARD_PLUS_CULL_MULTISAMPLE
+uniform sampler2DMS uDepth;
+#else
+uniform sampler2D uDepth;
+#endif
+uniform int uSampleCount;
+uniform mat4 uInverseProjection;
+uniform mat4 uView;
+uniform uint uLightCount;
+uniform uint uDirectionalLightCount;
+uniform ivec2 uViewportSize;
+uniform ivec2 uTileCount;
+
+// View depths of the tile as float bits, positive floats sort like their bits
+shared uint sMinDepth;
+shared uint sMaxDepth;
+shared uint sLightCount;
+shared uint sLightIndices[FORWARD_PLUS_MAX_LIGHTS];
+
+vec3 ViewPosition(vec2 ndc, float depth)
+{
+	vec4 position = uInverseProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+	return position.xyz / position.w;
+}
+
+void main()
+{
+	if(gl_LocalInvocationIndex == 0u)
+	{
+		sMinDepth = floatBitsToUint(3.402823e38);
+		sMaxDepth = 0u;
+		sLightCount = 0u;
+	}
+	barrier();
+
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	if(all(lessThan(pixel, uViewportSize)))
+	{
+		// Every sample is shaded, so the range covers all of them. Pixels nothing was drawn to don't widen it.
+		float minDepth = 1.0;
+		float maxDepth = 0.0;
+		for(int s = 0; s < uSampleCount; ++s)
+		{
+			float depth = texelFetch(uDepth, pixel, s).r;
+			if(depth < 1.0)
+			{
+				minDepth = min(minDepth, depth);
+				maxDepth = max(maxDepth, depth);
+			}
+		}
+
+		if(minDepth <= maxDepth)
+		{
+			vec2 ndc = (vec2(pixel) + 0.5) / vec2(uViewportSize) * 2.0 - 1.0;
+			atomicMin(sMinDepth, floatBitsToUint(-ViewPosition(ndc, minDepth).z));
+			atomicMax(sMaxDepth, floatBitsToUint(-ViewPosition(ndc, maxDepth).z));
+		}
+	}
+	barrier();
+
+	// Empty tiles keep an empty list
+	if(sMaxDepth != 0u)
+	{
+		float minDepth = uintBitsToFloat(sMinDepth);
+		float maxDepth = uintBitsToFloat(sMaxDepth);
+
+		// Side planes of the tile frustum, through the camera and pointing inwards
+		ivec2 tile = ivec2(gl_WorkGroupID.xy);
+		vec2 ndcMin = vec2(tile * FORWARD_PLUS_TILE_SIZE) / vec2(uViewportSize) * 2.0 - 1.0;
+		vec2 ndcMax = min(vec2((tile + 1) * FORWARD_PLUS_TILE_SIZE) / vec2(uViewportSize) * 2.0 - 1.0, vec2(1.0));
+		vec3 corners[4] = vec3[4](ViewPosition(ndcMin, 0.0), ViewPosition(vec2(ndcMax.x, ndcMin.y), 0.0),
+		                          ViewPosition(ndcMax, 0.0), ViewPosition(vec2(ndcMin.x, ndcMax.y), 0.0));
+		vec3 center = ViewPosition((ndcMin + ndcMax) * 0.5, 0.0);
+		vec3 planes[4];
+		for(int i = 0; i < 4; ++i)
+		{
+			planes[i] = normalize(cross(corners[i], corners[(i + 1) % 4]));
+			if(dot(planes[i], center) < 0.0)
+				planes[i] = -planes[i];
+		}
+
+		for(uint lightIdx = uDirectionalLightCount + gl_LocalInvocationIndex; lightIdx < uLightCount; lightIdx += GROUP_SIZE)
+		{
+			vec4 light = uLights[lightIdx].position;
+			vec3 position = (uView * vec4(light.xyz, 1.0)).xyz;
+			if(-position.z + light.w < minDepth || -position.z - light.w > maxDepth)
+				continue;
+
+			bool inside = true;
+			for(int i = 0; i < 4; ++i)
+				inside = inside && dot(planes[i], position) >= -light.w;
+
+			if(inside)
+			{
+				uint slot = atomicAdd(sLightCount, 1u);
+				if(slot < FORWARD_PLUS_MAX_LIGHTS)
+					sLightIndices[slot] = lightIdx;
+			}
+		}
+	}
+	barrier();
+
+	uint tileIdx = gl_WorkGroupID.y * uint(uTileCount.x) + gl_WorkGroupID.x;
+	uint lightCount = min(sLightCount, uint(FORWARD_PLUS_MAX_LIGHTS));
+	for(uint i = gl_LocalInvocationIndex; i < lightCount; i += GROUP_SIZE)
+		uTileLightIndices[tileIdx * FORWARD_PLUS_MAX_LIGHTS + i] = sLightIndices[i];
+	if(gl_LocalInvocationIndex == 0u)
+		uTileLightCount[tileIdx] = lightCount;
+}
+
+#endif
+#endif
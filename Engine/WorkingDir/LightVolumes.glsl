@@ -0,0 +1,23 @@
+///////////////////////////////////////////////////////////////////////
+#ifdef LIGHT_STENCIL
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+
+uniform mat4 uWorldViewProjection;
+
+void main()
+{
+	gl_Position = uWorldViewProjection * vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+// Only the stencil is written
+void main()
+{
+}
+
+#endif
+#endif
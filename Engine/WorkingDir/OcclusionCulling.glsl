@@ -0,0 +1,184 @@
+///////////////////////////////////////////////////////////////////////
+#ifdef HIZ_BUILD
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+uniform sampler2D uDepth;
+uniform vec2 uDepthScale; // region of the depth holding this frame over the Hi-Z size
+uniform int uLevel;
+
+layout(binding = 0, r32f) uniform readonly image2D uSrcLevel;
+layout(binding = 1, r32f) uniform writeonly image2D uDstLevel;
+
+float LoadSrc(ivec2 texel, ivec2 srcSize)
+{
+	return imageLoad(uSrcLevel, min(texel, srcSize - ivec2(1))).r;
+}
+
+void main()
+{
+	ivec2 dst = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 dstSize = imageSize(uDstLevel);
+	if (dst.x >= dstSize.x || dst.y >= dstSize.y)
+		return;
+
+	if (uLevel == 0)
+	{
+		imageStore(uDstLevel, dst, vec4(texelFetch(uDepth, ivec2((vec2(dst) + 0.5) * uDepthScale), 0).r));
+		return;
+	}
+
+	ivec2 srcSize = imageSize(uSrcLevel);
+	ivec2 src = dst * 2;
+
+	float depth = max(max(LoadSrc(src, srcSize), LoadSrc(src + ivec2(1, 0), srcSize)),
+	                  max(LoadSrc(src + ivec2(0, 1), srcSize), LoadSrc(src + ivec2(1, 1), srcSize)));
+
+	// Odd sizes: the last row/column of the destination also covers the extra source texels
+	bool extraColumn = (srcSize.x & 1) != 0 && dst.x == dstSize.x - 1;
+	bool extraRow = (srcSize.y & 1) != 0 && dst.y == dstSize.y - 1;
+	if (extraColumn)
+	{
+		depth = max(depth, LoadSrc(src + ivec2(2, 0), srcSize));
+		depth = max(depth, LoadSrc(src + ivec2(2, 1), srcSize));
+	}
+	if (extraRow)
+	{
+		depth = max(depth, LoadSrc(src + ivec2(0, 2), srcSize));
+		depth = max(depth, LoadSrc(src + ivec2(1, 2), srcSize));
+	}
+	if (extraColumn && extraRow)
+	{
+		depth = max(depth, LoadSrc(src + ivec2(2, 2), srcSize));
+	}
+
+	imageStore(uDstLevel, dst, vec4(depth));
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+#ifdef OCCLUSION_CULL
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = 64) in;
+
+struct DrawCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	uint baseVertex;
+	uint baseInstance;
+};
+
+struct Item
+{
+	vec4 center; // w: 1 if inside the frustum
+	vec4 extent;
+	uint indexCount;
+	uint firstIndex;
+	uint materialIdx; // base instance, read by the material id attribute
+	uint padding;
+};
+
+layout(std430, binding = 0) readonly buffer Items
+{
+	Item uItems[];
+};
+
+layout(std430, binding = 1) writeonly buffer Phase1Commands
+{
+	DrawCommand uPhase1Commands[];
+};
+
+layout(std430, binding = 2) writeonly buffer Phase2Commands
+{
+	DrawCommand uPhase2Commands[];
+};
+
+layout(std430, binding = 3) buffer VisibilityHistory
+{
+	uint uWasVisible[];
+};
+
+uniform sampler2D uHiZ;
+uniform mat4 uViewProjection;
+uniform uint uItemCount;
+uniform vec2 uHiZSize;
+
+bool IsVisible(vec3 center, vec3 extent)
+{
+	vec2 minUV = vec2(1.0);
+	vec2 maxUV = vec2(0.0);
+	float minDepth = 1.0;
+
+	for (int i = 0; i < 8; ++i)
+	{
+		vec3 corner = center + extent * vec3((i & 1) != 0 ? 1.0 : -1.0,
+		                                     (i & 2) != 0 ? 1.0 : -1.0,
+		                                     (i & 4) != 0 ? 1.0 : -1.0);
+		vec4 clip = uViewProjection * vec4(corner, 1.0);
+
+		// The box crosses the camera plane, it can't be occluded
+		if (clip.w <= 0.0)
+			return true;
+
+		vec3 ndc = clip.xyz / clip.w;
+		minUV = min(minUV, ndc.xy * 0.5 + 0.5);
+		maxUV = max(maxUV, ndc.xy * 0.5 + 0.5);
+		minDepth = min(minDepth, ndc.z * 0.5 + 0.5);
+	}
+
+	minUV = clamp(minUV, vec2(0.0), vec2(1.0));
+	maxUV = clamp(maxUV, vec2(0.0), vec2(1.0));
+
+	// Pick the level where the rectangle covers at most 2x2 texels
+	vec2 sizeInPixels = (maxUV - minUV) * uHiZSize;
+	int level = int(ceil(log2(max(max(sizeInPixels.x, sizeInPixels.y), 1.0))));
+	level = min(level, textureQueryLevels(uHiZ) - 1);
+
+	ivec2 levelSize = textureSize(uHiZ, level);
+	ivec2 minTexel = min(ivec2(minUV * vec2(levelSize)), levelSize - ivec2(1));
+	ivec2 maxTexel = min(ivec2(maxUV * vec2(levelSize)), levelSize - ivec2(1));
+
+	float occluderDepth = max(max(texelFetch(uHiZ, minTexel, level).r, texelFetch(uHiZ, ivec2(maxTexel.x, minTexel.y), level).r),
+	                          max(texelFetch(uHiZ, ivec2(minTexel.x, maxTexel.y), level).r, texelFetch(uHiZ, maxTexel, level).r));
+
+	return minDepth <= occluderDepth;
+}
+
+void main()
+{
+	uint itemIdx = gl_GlobalInvocationID.x;
+	if (itemIdx >= uItemCount)
+		return;
+
+	Item item = uItems[itemIdx];
+
+	bool visible = item.center.w > 0.0 && IsVisible(item.center.xyz, item.extent.xyz);
+	bool wasVisible = uWasVisible[itemIdx] != 0u;
+
+	DrawCommand command;
+	command.count = item.indexCount;
+	command.firstIndex = item.firstIndex;
+	command.baseVertex = 0u;
+	command.baseInstance = item.materialIdx;
+
+	// Phase 2 only draws what phase 1 missed
+	command.instanceCount = (visible && !wasVisible) ? 1u : 0u;
+	uPhase2Commands[itemIdx] = command;
+
+	// Next frame's phase 1
+	command.instanceCount = visible ? 1u : 0u;
+	uPhase1Commands[itemIdx] = command;
+
+	uWasVisible[itemIdx] = visible ? 1u : 0u;
+}
+
+#endif
+#endif
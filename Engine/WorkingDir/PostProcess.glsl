@@ -0,0 +1,293 @@
+///////////////////////////////////////////////////////////////////////
+// Must match PostProcess.h / PostProcess.cpp
+#define HISTOGRAM_BINS 256
+#define LUMINANCE_GROUP_SIZE 16
+#define BLOOM_GROUP_SIZE 8
+
+#if defined(POST_LUMINANCE) || defined(POST_EXPOSURE) || defined(POST_TONEMAP)
+
+layout(std430, binding = 0) buffer Exposure
+{
+	uint uHistogram[HISTOGRAM_BINS];
+	float uAdaptedLuminance;
+	float uExposure;
+};
+
+#endif
+
+float Luminance(vec3 color)
+{
+	return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+///////////////////////////////////////////////////////////////////////
+#ifdef POST_LUMINANCE
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = LUMINANCE_GROUP_SIZE, local_size_y = LUMINANCE_GROUP_SIZE) in;
+
+uniform sampler2D uInput;
+layout(r11f_g11f_b10f, binding = 0) uniform writeonly image2D uBloom;
+
+uniform ivec2 uInputSize;  // region of uInput holding the image
+uniform ivec2 uOutputSize; // half of it, rounded up
+uniform bool uHistogram;
+uniform bool uBrightPass;
+uniform bool uAutoExposure;
+uniform float uManualExposure;
+uniform float uMinLogLuminance;
+uniform float uInverseLogLuminanceRange;
+uniform float uBloomThreshold;
+uniform float uBloomKnee;
+
+shared uint sHistogram[HISTOGRAM_BINS];
+
+uint HistogramBin(float luminance)
+{
+	if(luminance < 1e-5)
+		return 0u;
+	float t = clamp((log2(luminance) - uMinLogLuminance) * uInverseLogLuminanceRange, 0.0, 1.0);
+	return uint(t * float(HISTOGRAM_BINS - 2) + 1.0);
+}
+
+void main()
+{
+	sHistogram[gl_LocalInvocationIndex] = 0u;
+	barrier();
+
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if(all(lessThan(texel, uOutputSize)))
+	{
+		// Karis average of the 2x2 block, bright single pixels don't turn into flickering squares
+		vec3 sum = vec3(0.0);
+		float weightSum = 0.0;
+		for(int i = 0; i < 4; ++i)
+		{
+			ivec2 source = min(texel * 2 + ivec2(i & 1, i >> 1), uInputSize - 1);
+			vec3 color = texelFetch(uInput, source, 0).rgb;
+			float luminance = Luminance(color);
+			if(uHistogram)
+				atomicAdd(sHistogram[HistogramBin(luminance)], 1u);
+
+			float weight = 1.0 / (1.0 + luminance);
+			sum += color * weight;
+			weightSum += weight;
+		}
+
+		if(uBrightPass)
+		{
+			// Thresholded after exposure, last frame's is close enough
+			vec3 color = sum / weightSum * (uAutoExposure ? uExposure : uManualExposure);
+			float brightness = max(color.r, max(color.g, color.b));
+			float soft = clamp(brightness - uBloomThreshold + uBloomKnee, 0.0, 2.0 * uBloomKnee);
+			soft = soft * soft / (4.0 * uBloomKnee + 1e-4);
+			float contribution = max(soft, brightness - uBloomThreshold) / max(brightness, 1e-4);
+			imageStore(uBloom, texel, vec4(color * contribution, 1.0));
+		}
+	}
+
+	barrier();
+	if(uHistogram && sHistogram[gl_LocalInvocationIndex] != 0u)
+		atomicAdd(uHistogram[gl_LocalInvocationIndex], sHistogram[gl_LocalInvocationIndex]);
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+#ifdef POST_EXPOSURE
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = HISTOGRAM_BINS) in;
+
+uniform float uPixelCount;
+uniform float uMinLogLuminance;
+uniform float uLogLuminanceRange;
+uniform float uAdaptation;   // fraction of the way to the metered luminance covered this frame
+uniform float uCompensation;
+
+shared float sWeightedBins[HISTOGRAM_BINS];
+
+void main()
+{
+	uint bin = gl_LocalInvocationIndex;
+	uint count = uHistogram[bin];
+	sWeightedBins[bin] = float(count) * float(bin);
+	uHistogram[bin] = 0u;
+	barrier();
+
+	for(uint stride = HISTOGRAM_BINS / 2; stride > 0u; stride >>= 1)
+	{
+		if(bin < stride)
+			sWeightedBins[bin] += sWeightedBins[bin + stride];
+		barrier();
+	}
+
+	if(bin == 0u)
+	{
+		// Black pixels (bin 0) don't take part in the average
+		float litPixels = max(uPixelCount - float(count), 1.0);
+		float averageBin = sWeightedBins[0] / litPixels - 1.0;
+		float logLuminance = averageBin / float(HISTOGRAM_BINS - 2) * uLogLuminanceRange + uMinLogLuminance;
+		float luminance = exp2(logLuminance);
+
+		uAdaptedLuminance += (luminance - uAdaptedLuminance) * uAdaptation;
+		uExposure = uCompensation * 0.18 / max(uAdaptedLuminance, 1e-4);
+	}
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+#ifdef POST_BLOOM_DOWNSAMPLE
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = BLOOM_GROUP_SIZE, local_size_y = BLOOM_GROUP_SIZE) in;
+
+uniform sampler2D uInput;
+layout(r11f_g11f_b10f, binding = 0) uniform writeonly image2D uOutput;
+uniform int uInputLevel;
+uniform ivec2 uInputSize;
+uniform ivec2 uOutputSize;
+
+// Input footprint of the group: two texels per output texel and one of border on each side
+#define TILE_SIZE (BLOOM_GROUP_SIZE * 2 + 2)
+shared vec3 sTile[TILE_SIZE * TILE_SIZE];
+
+void main()
+{
+	ivec2 tileOrigin = ivec2(gl_WorkGroupID.xy) * BLOOM_GROUP_SIZE * 2 - 1;
+	for(uint i = gl_LocalInvocationIndex; i < TILE_SIZE * TILE_SIZE; i += BLOOM_GROUP_SIZE * BLOOM_GROUP_SIZE)
+	{
+		ivec2 texel = clamp(tileOrigin + ivec2(i % TILE_SIZE, i / TILE_SIZE), ivec2(0), uInputSize - 1);
+		sTile[i] = texelFetch(uInput, texel, uInputLevel).rgb;
+	}
+	barrier();
+
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if(any(greaterThanEqual(texel, uOutputSize)))
+		return;
+
+	// Separable 4x4 tent, weights 1 3 3 1
+	const float weights[4] = float[4](0.125, 0.375, 0.375, 0.125);
+	ivec2 base = ivec2(gl_LocalInvocationID.xy) * 2;
+	vec3 color = vec3(0.0);
+	for(int y = 0; y < 4; ++y)
+		for(int x = 0; x < 4; ++x)
+			color += sTile[(base.y + y) * TILE_SIZE + base.x + x] * (weights[x] * weights[y]);
+
+	imageStore(uOutput, texel, vec4(color, 1.0));
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+#ifdef POST_BLOOM_UPSAMPLE
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = BLOOM_GROUP_SIZE, local_size_y = BLOOM_GROUP_SIZE) in;
+
+uniform sampler2D uInput;
+layout(r11f_g11f_b10f, binding = 0) uniform image2D uOutput;
+uniform int uInputLevel;
+uniform ivec2 uInputSize;
+uniform ivec2 uOutputSize;
+
+// The coarse texels under the group: half as many plus two of border on each side
+#define TILE_SIZE (BLOOM_GROUP_SIZE / 2 + 4)
+shared vec3 sTile[TILE_SIZE * TILE_SIZE];
+
+// Bilinear weights at fraction f convolved with a 1 2 1 tent, over 4 coarse texels
+vec4 UpsampleWeights(float f)
+{
+	return vec4(1.0 - f, 2.0 - f, 1.0 + f, f) * 0.25;
+}
+
+void main()
+{
+	ivec2 tileOrigin = ivec2(gl_WorkGroupID.xy) * (BLOOM_GROUP_SIZE / 2) - 2;
+	for(uint i = gl_LocalInvocationIndex; i < TILE_SIZE * TILE_SIZE; i += BLOOM_GROUP_SIZE * BLOOM_GROUP_SIZE)
+	{
+		ivec2 texel = clamp(tileOrigin + ivec2(i % TILE_SIZE, i / TILE_SIZE), ivec2(0), uInputSize - 1);
+		sTile[i] = texelFetch(uInput, texel, uInputLevel).rgb;
+	}
+	barrier();
+
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if(any(greaterThanEqual(texel, uOutputSize)))
+		return;
+
+	vec2 position = (vec2(texel) + 0.5) * 0.5 - 0.5;
+	ivec2 base = ivec2(floor(position));
+	vec2 f = position - vec2(base);
+	vec4 weightsX = UpsampleWeights(f.x);
+	vec4 weightsY = UpsampleWeights(f.y);
+
+	ivec2 local = base - 1 - tileOrigin;
+	vec3 color = vec3(0.0);
+	for(int y = 0; y < 4; ++y)
+		for(int x = 0; x < 4; ++x)
+			color += sTile[(local.y + y) * TILE_SIZE + local.x + x] * (weightsX[x] * weightsY[y]);
+
+	imageStore(uOutput, texel, vec4(imageLoad(uOutput, texel).rgb + color, 1.0));
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+#ifdef POST_TONEMAP
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+
+void main()
+{
+	gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+uniform sampler2D uInput;
+uniform sampler2D uBloom;
+uniform vec2 uBloomScale;  // from output pixels to bloom uv
+uniform float uBloomIntensity;
+uniform bool uAutoExposure;
+uniform float uManualExposure;
+uniform int uTonemapper;   // Tonemapper in PostProcess.h
+
+layout(location = 0) out vec4 oColor;
+
+// Narkowicz's fit of the ACES filmic curve
+vec3 ACESFilm(vec3 x)
+{
+	return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+void main()
+{
+	vec3 color = texelFetch(uInput, ivec2(gl_FragCoord.xy), 0).rgb;
+	float exposure = uAutoExposure ? uExposure : uManualExposure;
+	color *= exposure;
+
+	// The bloom chain already holds exposed values
+	if(uBloomIntensity > 0.0)
+		color += textureLod(uBloom, gl_FragCoord.xy * uBloomScale, 0.0).rgb * uBloomIntensity;
+
+	if(uTonemapper == 1)
+		color = color / (1.0 + Luminance(color));
+	else if(uTonemapper == 2)
+		color = ACESFilm(color);
+
+	oColor = vec4(color, 1.0);
+}
+
+#endif
+#endif
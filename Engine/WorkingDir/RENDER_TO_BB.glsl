@@ -1,10 +1,11 @@
-#ifdef RENDER_TO_BB
+#if defined(RENDER_TO_BB) || defined(RENDER_TO_BB_TILED)
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
 layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
+layout(location = 5) in uint aMaterialID; // per instance, the base instance of the draw
 //layout(location = 3) in vec3 aTangent;
 //layout(location = 4) in vec3 aBitangent;
 
@@ -18,33 +19,41 @@ struct Light
 
 layout(binding = 0, std140) uniform GlobalParams
 {
+	mat4 uViewProjection;         // jittered
+	mat4 uPreviousViewProjection; // unjittered
+	vec4 uJitter;                 // xy: NDC offset of uViewProjection
 	vec3 uCameraPosition;
 	int uLightCount;
 	Light uLight[16];
 };
 
+// Must match ENTITY_TRANSFORM_SIZE
 layout(binding = 1, std140) uniform LocalParams
 {
 	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectMatrix;
+	mat4 uPreviousWorldMatrix;
 };
 
+// Matches the depth pre-pass bit for bit
+invariant gl_Position;
+
 out vec2 vTexCoord;
 out vec3 vPosition;
 out vec3 vNormal;
 out vec3 vViewDir;
+flat out uint vMaterialID;
 
 void main()
 {
 	vTexCoord = aTexCoord;
+	vMaterialID = aMaterialID;
 
-	vPosition = vec3( uWorldMatrix * vec4(aPosition, 1.0));
+	vec4 worldPosition = uWorldMatrix * vec4(aPosition, 1.0);
+	vPosition = vec3(worldPosition);
 	vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
 	vViewDir = uCameraPosition - vPosition;
-	
-	float clippingScale = 1.0;
 
-	gl_Position = uWorldViewProjectMatrix * vec4(aPosition, clippingScale);
+	gl_Position = uViewProjection * worldPosition;
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -59,6 +68,9 @@ struct Light
 
 layout(binding = 0, std140) uniform GlobalParams
 {
+	mat4 uViewProjection;         // jittered
+	mat4 uPreviousViewProjection; // unjittered
+	vec4 uJitter;                 // xy: NDC offset of uViewProjection
 	vec3 uCameraPosition;
 	int uLightCount;
 	Light uLight[16];
@@ -68,10 +80,68 @@ in vec2 vTexCoord;
 in vec3 vPosition;
 in vec3 vNormal;
 in vec3 vViewDir;
+flat in uint vMaterialID;
+
+// Material table, must match MaterialTable.h
+struct Material
+{
+	vec4 albedo;   // w: smoothness
+	vec4 emissive;
+	uint albedoTexture; // layers of uMaterialTextures
+	uint emissiveTexture;
+	uint specularTexture;
+	uint normalsTexture;
+	uint bumpTexture;
+	uint padding[3];
+};
 
-uniform sampler2D uTexture;
+layout(std430, binding = 7) readonly buffer Materials
+{
+	Material uMaterials[];
+};
+
+uniform sampler2DArray uMaterialTextures;
 layout(location = 0) out vec4 oColor;
 
+#ifdef RENDER_TO_BB_TILED
+
+// Must match ForwardPlus.h
+#define FORWARD_PLUS_TILE_SIZE 16
+#define FORWARD_PLUS_MAX_LIGHTS 256
+
+struct LightData
+{
+	vec4 color;     // w: type
+	vec4 direction;
+	vec4 position;  // w: radius
+};
+
+layout(std430, binding = 0) readonly buffer Lights
+{
+	LightData uLights[];
+};
+
+layout(std430, binding = 1) readonly buffer TileLightCounts
+{
+	uint uTileLightCount[];
+};
+
+layout(std430, binding = 2) readonly buffer TileLightIndices
+{
+	uint uTileLightIndices[];
+};
+
+uniform uint uDirectionalLightCount; // first in uLights, they light every tile
+uniform int uTileCountX;
+
+Light UnpackLight(uint index)
+{
+	LightData data = uLights[index];
+	return Light(uint(data.color.w), data.color.rgb, data.direction.xyz, data.position.xyz);
+}
+
+#endif
+
 void CalculateBlitVars(in Light light, out vec3 ambient, out vec3 diffuse, out vec3 specular)
 {
 		vec3 lightDir = normalize(light.direction);
@@ -89,43 +159,53 @@ void CalculateBlitVars(in Light light, out vec3 ambient, out vec3 diffuse, out v
 		specular = specularStrength * spec * light.color;
 }
 
+vec4 ShadeLight(in Light light, vec4 textureColor)
+{
+	vec3 lightResult = vec3(0.0f);
+	vec3 ambient = vec3(0.0);
+	vec3 diffuse = vec3(0.0);
+	vec3 specular = vec3(0.0);
+
+	if(light.type == 0)
+	{
+		CalculateBlitVars(light,ambient,diffuse,specular);
+
+		lightResult = ambient + diffuse + specular;
+	}
+	else
+	{
+		float constant = 1.0f;
+		float linear = 0.09f;
+		float quadratic = 0.032f;
+		float distance = length(light.position - vPosition);
+		float attenuation = 1.0f / (constant + linear * distance + quadratic *(distance*distance));
+
+		CalculateBlitVars(light,ambient,diffuse,specular);
+
+		lightResult = (ambient * attenuation) + (diffuse * attenuation) + (specular * attenuation);
+	}
+	return vec4(lightResult,1.0) * textureColor;
+}
+
 void main()
 {
-	vec4 textureColor = texture(uTexture, vTexCoord);
+	vec4 textureColor = texture(uMaterialTextures, vec3(vTexCoord, float(uMaterials[vMaterialID].albedoTexture)));
 	vec4 finalColor = vec4(0.0);
 
+#ifdef RENDER_TO_BB_TILED
+	for(uint i = 0u; i < uDirectionalLightCount; ++i)
+		finalColor += ShadeLight(UnpackLight(i), textureColor);
+
+	// Point lights touching this pixel's tile
+	uvec2 tile = uvec2(gl_FragCoord.xy) / uint(FORWARD_PLUS_TILE_SIZE);
+	uint tileIdx = tile.y * uint(uTileCountX) + tile.x;
+	uint lightCount = uTileLightCount[tileIdx];
+	for(uint i = 0u; i < lightCount; ++i)
+		finalColor += ShadeLight(UnpackLight(uTileLightIndices[tileIdx * FORWARD_PLUS_MAX_LIGHTS + i]), textureColor);
+#else
 	for(int i = 0; i < uLightCount; ++i)
-	{
-		vec3 lightResult = vec3(0.0f);
-		vec3 ambient = vec3(0.0);
-		vec3 diffuse = vec3(0.0);
-		vec3 specular = vec3(0.0);
-
-		if(uLight[i].type == 0)
-		{
-			Light light = uLight[i];
-
-			CalculateBlitVars(light,ambient,diffuse,specular);
-
-			lightResult = ambient + diffuse + specular;
-			finalColor += vec4(lightResult,1.0) * textureColor;
-		}
-		else
-		{
-		    Light light = uLight[i];
-
-			float constant = 1.0f;
-			float linear = 0.09f;
-			float quadratic = 0.032f;
-			float distance = length(light.position - vPosition);
-			float attenuation = 1.0f / (constant + linear * distance + quadratic *(distance*distance));
-
-			CalculateBlitVars(light,ambient,diffuse,specular);
-
-			lightResult = (ambient * attenuation) + (diffuse * attenuation) + (specular * attenuation);
-			finalColor += vec4(lightResult,1.0) * textureColor;
-		}
-	}
+		finalColor += ShadeLight(uLight[i], textureColor);
+#endif
 
 	oColor = finalColor;
 }
@@ -5,6 +5,7 @@
 layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
 layout(location = 2) in vec2 aTexCoord;
+layout(location = 5) in uint aMaterialID; // per instance, the base instance of the draw
 
 struct Light
 {
@@ -16,68 +17,97 @@ struct Light
 
 layout(binding = 0, std140) uniform GlobalParams
 {
+	mat4 uViewProjection;         // jittered
+	mat4 uPreviousViewProjection; // unjittered
+	vec4 uJitter;                 // xy: NDC offset of uViewProjection
 	vec3 uCameraPosition;
 	int uLightCount;
 	Light uLight[16];
 };
 
+// Must match ENTITY_TRANSFORM_SIZE
 layout(binding = 1, std140) uniform LocalParams
 {
 	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectMatrix;
+	mat4 uPreviousWorldMatrix;
 };
 
+// Matches the depth pre-pass bit for bit
+invariant gl_Position;
+
 out vec2 vTexCoord;
-out vec3 vPosition;
 out vec3 vNormal;
-out vec3 vViewDir;
+out vec4 vClipPosition;
+out vec4 vPreviousClipPosition;
+flat out uint vMaterialID;
 
 void main()
 {
 	vTexCoord = aTexCoord;
-	vPosition = vec3( uWorldMatrix * vec4(aPosition, 1.0));
+	vMaterialID = aMaterialID;
 	vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
-	vViewDir = uCameraPosition - vPosition;
-	float clippingScale = 1.0;
 
-	gl_Position = uWorldViewProjectMatrix * vec4(aPosition, clippingScale);
+	vec4 worldPosition = uWorldMatrix * vec4(aPosition, 1.0);
+	gl_Position = uViewProjection * worldPosition;
+
+	// Without the jitter, so still surfaces have no motion
+	vClipPosition = gl_Position - vec4(uJitter.xy * gl_Position.w, 0.0, 0.0);
+	vPreviousClipPosition = uPreviousViewProjection * (uPreviousWorldMatrix * vec4(aPosition, 1.0));
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
 
-struct Light
+in vec2 vTexCoord;
+in vec3 vNormal;
+in vec4 vClipPosition;
+in vec4 vPreviousClipPosition;
+flat in uint vMaterialID;
+
+// Material table, must match MaterialTable.h
+struct Material
 {
-	uint type;
-	vec3 color;
-	vec3 direction;
-	vec3 position;
+	vec4 albedo;   // w: smoothness
+	vec4 emissive;
+	uint albedoTexture; // layers of uMaterialTextures
+	uint emissiveTexture;
+	uint specularTexture;
+	uint normalsTexture;
+	uint bumpTexture;
+	uint padding[3];
 };
 
-layout(binding = 0, std140) uniform GlobalParams
+layout(std430, binding = 7) readonly buffer Materials
 {
-	vec3 uCameraPosition;
-	int uLightCount;
-	Light uLight[16];
+	Material uMaterials[];
 };
 
-in vec2 vTexCoord;
-in vec3 vPosition;
-in vec3 vNormal;
-in vec3 vViewDir;
-
-uniform sampler2D uTexture;
+uniform sampler2DArray uMaterialTextures;
 layout(location = 0) out vec4 oAlbedo;
-layout(location = 1) out vec4 oNormals;
-layout(location = 2) out vec4 oPosition;
-layout(location = 3) out vec4 oViewDir;
+layout(location = 1) out vec2 oNormals;
+layout(location = 2) out vec4 oMaterial;
+layout(location = 3) out vec2 oVelocity;
+
+// Unit vector folded onto the octahedron and mapped to [0, 1]
+vec2 EncodeOctahedral(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.xy;
+	if (n.z < 0.0)
+		e = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return e * 0.5 + 0.5;
+}
 
 void main()
 {
-	oAlbedo = texture(uTexture, vTexCoord);
-	oNormals = vec4(vNormal, 1.0);
-	oPosition = vec4(vPosition,1.0);
-	oViewDir = vec4(vViewDir, 1.0);
+	oAlbedo = texture(uMaterialTextures, vec3(vTexCoord, float(uMaterials[vMaterialID].albedoTexture)));
+	oNormals = EncodeOctahedral(normalize(vNormal));
+
+	// Specular strength, shininess / 255 and ambient strength used by the lighting passes
+	oMaterial = vec4(0.1, 32.0 / 255.0, 0.2, 1.0);
+
+	// Screen uv motion since the previous frame, for the temporal passes
+	oVelocity = (vClipPosition.xy / vClipPosition.w - vPreviousClipPosition.xy / vPreviousClipPosition.w) * 0.5;
 }
 
 #endif
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,241 @@
+///////////////////////////////////////////////////////////////////////
+// Must match SSAO.cpp
+#define SSAO_GROUP_SIZE 16
+#define SSAO_TILE_BORDER 16 // half resolution texels, also the largest sampling radius
+#define SSAO_UPSAMPLE_GROUP_SIZE 8
+#define SSAO_SAMPLE_COUNT 16
+#define SSAO_SPIRAL_TURNS 7.0
+#define SSAO_BLUR_RADIUS 4
+
+uniform ivec2 uDepthSize; // region of the G-buffer holding this frame
+uniform float uNear;
+uniform float uFar;
+uniform float uSharpness;
+
+float LinearDepth(float depth)
+{
+	float z = depth * 2.0 - 1.0;
+	return 2.0 * uNear * uFar / (uFar + uNear - z * (uFar - uNear));
+}
+
+// Falls off with the depth difference relative to the depth of the center
+float DepthWeight(float depth, float centerDepth)
+{
+	return exp(-abs(depth - centerDepth) / centerDepth * uSharpness);
+}
+
+///////////////////////////////////////////////////////////////////////
+#ifdef SSAO_COMPUTE
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = SSAO_GROUP_SIZE, local_size_y = SSAO_GROUP_SIZE) in;
+
+uniform sampler2D uDepth;
+uniform sampler2D uNormals; // octahedral encoded, world space
+layout(rg16f, binding = 0) uniform writeonly image2D uOutput; // occlusion, linear depth
+
+uniform ivec2 uOutputSize;
+uniform vec4 uProjectionInfo;   // 1 / P[0][0], 1 / P[1][1], P[2][0], P[2][1]
+uniform float uProjectionScale; // half resolution pixels per world unit at distance 1
+uniform mat4 uViewMatrix;
+uniform float uRadius;
+uniform float uIntensity;
+uniform float uBias;
+uniform uint uFrame;
+
+#define TILE_SIZE (SSAO_GROUP_SIZE + 2 * SSAO_TILE_BORDER)
+shared float sDepth[TILE_SIZE * TILE_SIZE];
+
+vec3 DecodeOctahedral(vec2 encoded)
+{
+	vec2 e = encoded * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+// Half resolution texel h stands for the G-buffer pixel 2h
+ivec2 FullResolutionTexel(ivec2 texel)
+{
+	return clamp(texel * 2, ivec2(0), uDepthSize - 1);
+}
+
+vec3 ViewPosition(ivec2 texel, float linearDepth)
+{
+	vec2 ndc = (vec2(texel * 2) + 0.5) / vec2(uDepthSize) * 2.0 - 1.0;
+	return vec3((ndc + uProjectionInfo.zw) * uProjectionInfo.xy * linearDepth, -linearDepth);
+}
+
+float InterleavedGradientNoise(vec2 position)
+{
+	return fract(52.9829189 * fract(dot(position, vec2(0.06711056, 0.00583715))));
+}
+
+void main()
+{
+	// Linear depth of the group's texels and of the border around them
+	ivec2 tileOrigin = ivec2(gl_WorkGroupID.xy) * SSAO_GROUP_SIZE - SSAO_TILE_BORDER;
+	for(uint i = gl_LocalInvocationIndex; i < TILE_SIZE * TILE_SIZE; i += SSAO_GROUP_SIZE * SSAO_GROUP_SIZE)
+	{
+		ivec2 texel = clamp(tileOrigin + ivec2(i % TILE_SIZE, i / TILE_SIZE), ivec2(0), uOutputSize - 1);
+		sDepth[i] = LinearDepth(texelFetch(uDepth, FullResolutionTexel(texel), 0).r);
+	}
+	barrier();
+
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if(any(greaterThanEqual(texel, uOutputSize)))
+		return;
+
+	ivec2 local = ivec2(gl_LocalInvocationID.xy) + SSAO_TILE_BORDER;
+	float depth = sDepth[local.y * TILE_SIZE + local.x];
+	float screenRadius = min(uRadius * uProjectionScale / depth, float(SSAO_TILE_BORDER));
+
+	// The sky and samples that would all land on the center texel
+	if(depth > uFar * 0.999 || screenRadius < 1.0)
+	{
+		imageStore(uOutput, texel, vec4(1.0, depth, 0.0, 0.0));
+		return;
+	}
+
+	vec3 position = ViewPosition(texel, depth);
+	vec3 normal = mat3(uViewMatrix) * DecodeOctahedral(texelFetch(uNormals, FullResolutionTexel(texel), 0).xy);
+	float rotation = InterleavedGradientNoise(vec2(texel) + float(uFrame % 64u) * 5.588238) * 6.2831853;
+	float inverseRadius2 = 1.0 / (uRadius * uRadius);
+
+	// Spiral of samples over the disk, every one checks how far above the tangent plane it is
+	float occlusion = 0.0;
+	for(int i = 0; i < SSAO_SAMPLE_COUNT; ++i)
+	{
+		float alpha = (float(i) + 0.5) / float(SSAO_SAMPLE_COUNT);
+		float angle = alpha * SSAO_SPIRAL_TURNS * 6.2831853 + rotation;
+		ivec2 offset = ivec2(round(vec2(cos(angle), sin(angle)) * alpha * screenRadius));
+
+		ivec2 sampleLocal = local + offset;
+		vec3 samplePosition = ViewPosition(texel + offset, sDepth[sampleLocal.y * TILE_SIZE + sampleLocal.x]);
+		vec3 v = samplePosition - position;
+		float vv = dot(v, v);
+		float cosine = dot(v, normal) * inversesqrt(vv + 1e-6);
+		occlusion += max(cosine - uBias, 0.0) * max(1.0 - vv * inverseRadius2, 0.0);
+	}
+
+	occlusion = max(1.0 - occlusion * uIntensity * (2.0 / float(SSAO_SAMPLE_COUNT)), 0.0);
+	imageStore(uOutput, texel, vec4(occlusion, depth, 0.0, 0.0));
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+#ifdef SSAO_BLUR
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = SSAO_GROUP_SIZE, local_size_y = SSAO_GROUP_SIZE) in;
+
+uniform sampler2D uInput;  // occlusion, linear depth
+layout(rg16f, binding = 0) uniform writeonly image2D uOutput;
+uniform ivec2 uOutputSize;
+
+#define TILE_SIZE (SSAO_GROUP_SIZE + 2 * SSAO_BLUR_RADIUS)
+shared vec2 sTile[TILE_SIZE * TILE_SIZE];
+shared vec2 sRows[TILE_SIZE * SSAO_GROUP_SIZE]; // rows of the tile blurred horizontally
+
+const float weights[SSAO_BLUR_RADIUS + 1] = float[](0.2270, 0.1945, 0.1216, 0.0540, 0.0162);
+
+vec2 Blur(vec2 center, vec2 samples[2 * SSAO_BLUR_RADIUS + 1])
+{
+	float sum = center.x * weights[0];
+	float weightSum = weights[0];
+	for(int i = 1; i <= SSAO_BLUR_RADIUS; ++i)
+	{
+		for(int side = -1; side <= 1; side += 2)
+		{
+			vec2 s = samples[SSAO_BLUR_RADIUS + i * side];
+			float weight = weights[i] * DepthWeight(s.y, center.y);
+			sum += s.x * weight;
+			weightSum += weight;
+		}
+	}
+	return vec2(sum / weightSum, center.y);
+}
+
+void main()
+{
+	ivec2 tileOrigin = ivec2(gl_WorkGroupID.xy) * SSAO_GROUP_SIZE - SSAO_BLUR_RADIUS;
+	for(uint i = gl_LocalInvocationIndex; i < TILE_SIZE * TILE_SIZE; i += SSAO_GROUP_SIZE * SSAO_GROUP_SIZE)
+	{
+		ivec2 texel = clamp(tileOrigin + ivec2(i % TILE_SIZE, i / TILE_SIZE), ivec2(0), uOutputSize - 1);
+		sTile[i] = texelFetch(uInput, texel, 0).rg;
+	}
+	barrier();
+
+	// Every row of the tile, only the columns of the group
+	for(uint i = gl_LocalInvocationIndex; i < TILE_SIZE * SSAO_GROUP_SIZE; i += SSAO_GROUP_SIZE * SSAO_GROUP_SIZE)
+	{
+		uint row = i / SSAO_GROUP_SIZE;
+		uint column = i % SSAO_GROUP_SIZE + SSAO_BLUR_RADIUS;
+		vec2 samples[2 * SSAO_BLUR_RADIUS + 1];
+		for(int k = 0; k <= 2 * SSAO_BLUR_RADIUS; ++k)
+			samples[k] = sTile[row * TILE_SIZE + column - SSAO_BLUR_RADIUS + k];
+		sRows[i] = Blur(samples[SSAO_BLUR_RADIUS], samples);
+	}
+	barrier();
+
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if(any(greaterThanEqual(texel, uOutputSize)))
+		return;
+
+	ivec2 local = ivec2(gl_LocalInvocationID.xy);
+	vec2 samples[2 * SSAO_BLUR_RADIUS + 1];
+	for(int k = 0; k <= 2 * SSAO_BLUR_RADIUS; ++k)
+		samples[k] = sRows[(local.y + k) * SSAO_GROUP_SIZE + local.x];
+	imageStore(uOutput, texel, vec4(Blur(samples[SSAO_BLUR_RADIUS], samples), 0.0, 0.0));
+}
+
+#endif
+#endif
+
+///////////////////////////////////////////////////////////////////////
+#ifdef SSAO_UPSAMPLE
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = SSAO_UPSAMPLE_GROUP_SIZE, local_size_y = SSAO_UPSAMPLE_GROUP_SIZE) in;
+
+uniform sampler2D uDepth;
+uniform sampler2D uInput;  // occlusion, linear depth at half resolution
+layout(r8, binding = 0) uniform writeonly image2D uOutput;
+uniform ivec2 uInputSize;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if(any(greaterThanEqual(texel, uDepthSize)))
+		return;
+
+	float depth = LinearDepth(texelFetch(uDepth, texel, 0).r);
+
+	// Bilinear weights towards the four closest half resolution texels, cut by their depth difference
+	vec2 position = vec2(texel) * 0.5;
+	ivec2 base = ivec2(floor(position));
+	vec2 f = position - vec2(base);
+	float sum = 0.0;
+	float weightSum = 0.0;
+	for(int i = 0; i < 4; ++i)
+	{
+		ivec2 corner = ivec2(i & 1, i >> 1);
+		vec2 s = texelFetch(uInput, min(base + corner, uInputSize - 1), 0).rg;
+		vec2 bilinear = mix(1.0 - f, f, vec2(corner));
+		float weight = bilinear.x * bilinear.y * DepthWeight(s.y, depth) + 1e-4;
+		sum += s.x * weight;
+		weightSum += weight;
+	}
+
+	imageStore(uOutput, texel, vec4(sum / weightSum));
+}
+
+#endif
+#endif
@@ -0,0 +1,118 @@
+///////////////////////////////////////////////////////////////////////
+// Must match TemporalAA.cpp
+#define TAA_GROUP_SIZE 8
+
+#ifdef TAA_RESOLVE
+
+#if defined(COMPUTE) //////////////////////////////////////////////////
+
+layout(local_size_x = TAA_GROUP_SIZE, local_size_y = TAA_GROUP_SIZE) in;
+
+uniform sampler2D uInput;
+uniform sampler2D uDepth;
+uniform sampler2D uVelocity;       // uv motion since the previous frame, current - previous
+uniform sampler2D uHistory;
+layout(rgba16f, binding = 0) uniform writeonly image2D uOutput;
+
+uniform ivec2 uSize;               // region of the inputs holding the image
+uniform vec2 uJitter;              // NDC offset of this frame's projection
+uniform mat4 uReprojection;        // unjittered, from this frame's clip space to the previous one
+uniform vec2 uPreviousExtent;      // region of uHistory holding the previous image
+uniform vec2 uHistorySize;
+uniform bool uHistoryValid;
+uniform float uHistoryWeight;
+
+vec3 RGBToYCoCg(vec3 c)
+{
+	return vec3(dot(c, vec3(0.25, 0.5, 0.25)), dot(c, vec3(0.5, 0.0, -0.5)), dot(c, vec3(-0.25, 0.5, -0.25)));
+}
+
+vec3 YCoCgToRGB(vec3 c)
+{
+	return vec3(c.x + c.y - c.z, c.x + c.z, c.x - c.y - c.z);
+}
+
+// Moves the history towards the center of the box until it is inside
+vec3 ClipToBox(vec3 history, vec3 boxMin, vec3 boxMax)
+{
+	vec3 center = 0.5 * (boxMax + boxMin);
+	vec3 extents = 0.5 * (boxMax - boxMin) + 1e-5;
+	vec3 offset = history - center;
+	vec3 units = abs(offset / extents);
+	float maxUnit = max(units.x, max(units.y, units.z));
+	return maxUnit > 1.0 ? center + offset / maxUnit : history;
+}
+
+void main()
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	if(any(greaterThanEqual(texel, uSize)))
+		return;
+
+	// Color moments of the neighborhood, and the closest surface in it so edges carry the motion of
+	// the foreground
+	vec3 current = vec3(0.0);
+	vec3 m1 = vec3(0.0);
+	vec3 m2 = vec3(0.0);
+	vec3 boxMin = vec3(1e9);
+	vec3 boxMax = vec3(-1e9);
+	float closestDepth = 1.0;
+	ivec2 closestTexel = texel;
+	for(int y = -1; y <= 1; ++y)
+	{
+		for(int x = -1; x <= 1; ++x)
+		{
+			ivec2 neighbor = clamp(texel + ivec2(x, y), ivec2(0), uSize - 1);
+			vec3 color = RGBToYCoCg(texelFetch(uInput, neighbor, 0).rgb);
+			if(x == 0 && y == 0)
+				current = color;
+			m1 += color;
+			m2 += color * color;
+			boxMin = min(boxMin, color);
+			boxMax = max(boxMax, color);
+
+			float depth = texelFetch(uDepth, neighbor, 0).r;
+			if(depth < closestDepth)
+			{
+				closestDepth = depth;
+				closestTexel = neighbor;
+			}
+		}
+	}
+
+	vec2 uv = (vec2(texel) + 0.5) / vec2(uSize);
+	vec2 velocity;
+	if(closestDepth < 1.0)
+	{
+		velocity = texelFetch(uVelocity, closestTexel, 0).rg;
+	}
+	else
+	{
+		vec4 previous = uReprojection * vec4(uv * 2.0 - 1.0 - uJitter, 1.0, 1.0);
+		velocity = uv - (previous.xy / previous.w * 0.5 + 0.5);
+	}
+	vec2 previousUV = uv - velocity;
+
+	vec3 result = current;
+	if(uHistoryValid && all(greaterThanEqual(previousUV, vec2(0.0))) && all(lessThanEqual(previousUV, vec2(1.0))))
+	{
+		// Keep the bilinear footprint inside the region the previous frame wrote
+		vec2 historyPixel = clamp(previousUV * uPreviousExtent, vec2(0.5), uPreviousExtent - 0.5);
+		vec3 history = RGBToYCoCg(textureLod(uHistory, historyPixel / uHistorySize, 0.0).rgb);
+
+		// Variance box, tighter than min / max where the neighborhood is mostly flat
+		vec3 mean = m1 / 9.0;
+		vec3 sigma = sqrt(max(m2 / 9.0 - mean * mean, vec3(0.0)));
+		history = ClipToBox(history, max(boxMin, mean - sigma), min(boxMax, mean + sigma));
+
+		// Weighted by inverse luminance so single bright samples don't flicker
+		float currentWeight = (1.0 - uHistoryWeight) / (1.0 + current.x);
+		float historyWeight = uHistoryWeight / (1.0 + history.x);
+		result = (current * currentWeight + history * historyWeight) / (currentWeight + historyWeight);
+	}
+
+	imageStore(uOutput, texel, vec4(YCoCgToRGB(result), 1.0));
+}
+
+#endif
+#endif
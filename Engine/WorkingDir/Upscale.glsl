@@ -0,0 +1,147 @@
+///////////////////////////////////////////////////////////////////////
+#if defined(UPSCALE) || defined(SHARPEN)
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+
+void main()
+{
+	gl_Position = vec4(aPosition, 1.0);
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+uniform sampler2D uInput;
+layout(location = 0) out vec4 oColor;
+
+#ifdef UPSCALE
+
+uniform vec2 uInputSize;  // region of uInput holding the image
+uniform vec2 uOutputSize;
+
+vec3 Load(ivec2 texel)
+{
+	return texelFetch(uInput, clamp(texel, ivec2(0), ivec2(uInputSize) - 1), 0).rgb;
+}
+
+float Luma(vec3 color)
+{
+	return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+// Lanczos 2 approximation without sin or sqrt, the lobe moves the negative ring:
+// (25/16 * (2/5 * d2 - 1)^2 - (25/16 - 1)) * (lobe * d2 - 1)^2
+float Lanczos2(float d2, float lobe)
+{
+	float base = 0.4 * d2 - 1.0;
+	float window = lobe * d2 - 1.0;
+	base = 25.0 / 16.0 * base * base - (25.0 / 16.0 - 1.0);
+	return base * window * window;
+}
+
+// Edge adaptive upscale: the 4x4 input texels around the output pixel are filtered with a
+// Lanczos kernel stretched along the local edge, then clamped to the nearest 2x2 to avoid ringing
+void main()
+{
+	vec2 position = gl_FragCoord.xy * (uInputSize / uOutputSize) - 0.5;
+	ivec2 base = ivec2(floor(position));
+	vec2 f = position - vec2(base);
+
+	vec3 color[16];
+	float luma[16];
+	for (int j = 0; j < 4; ++j)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			color[j * 4 + i] = Load(base + ivec2(i - 1, j - 1));
+			luma[j * 4 + i] = Luma(color[j * 4 + i]);
+		}
+	}
+
+	// Gradient and edge strength of the 2x2 centre texels, bilinearly weighted
+	vec2 direction = vec2(0.0);
+	float edge = 0.0;
+	for (int j = 1; j <= 2; ++j)
+	{
+		for (int i = 1; i <= 2; ++i)
+		{
+			float weight = (i == 1 ? 1.0 - f.x : f.x) * (j == 1 ? 1.0 - f.y : f.y);
+			float centre = luma[j * 4 + i];
+			float left = luma[j * 4 + i - 1];
+			float right = luma[j * 4 + i + 1];
+			float down = luma[(j - 1) * 4 + i];
+			float up = luma[(j + 1) * 4 + i];
+
+			direction += vec2(right - left, up - down) * weight;
+
+			// 1 for a clean step or ramp, 0 for a single texel spike
+			float edgeX = clamp(abs(right - left) / max(max(abs(right - centre), abs(centre - left)), 1e-5), 0.0, 1.0);
+			float edgeY = clamp(abs(up - down) / max(max(abs(up - centre), abs(centre - down)), 1e-5), 0.0, 1.0);
+			edge += (edgeX * edgeX + edgeY * edgeY) * 0.5 * weight;
+		}
+	}
+
+	float directionLength2 = dot(direction, direction);
+	direction = directionLength2 < 1.0 / 32768.0 ? vec2(1.0, 0.0) : direction * inversesqrt(directionLength2);
+	edge *= edge;
+
+	// Narrow across the edge, wide along it
+	float stretch = 1.0 / max(abs(direction.x), abs(direction.y));
+	vec2 scale = vec2(1.0 + (stretch - 1.0) * edge, 1.0 - 0.5 * edge);
+	float lobe = 0.5 + ((1.0 / 4.0 - 0.04) - 0.5) * edge;
+	float clip = 1.0 / lobe;
+
+	vec3 sum = vec3(0.0);
+	float weightSum = 0.0;
+	for (int j = 0; j < 4; ++j)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			vec2 offset = vec2(i - 1, j - 1) - f;
+			vec2 rotated = vec2(dot(offset, direction), dot(offset, vec2(-direction.y, direction.x))) * scale;
+			float weight = Lanczos2(min(dot(rotated, rotated), clip), lobe);
+			sum += color[j * 4 + i] * weight;
+			weightSum += weight;
+		}
+	}
+
+	vec3 minColor = min(min(color[5], color[6]), min(color[9], color[10]));
+	vec3 maxColor = max(max(color[5], color[6]), max(color[9], color[10]));
+	oColor = vec4(clamp(sum / max(weightSum, 1e-5), minColor, maxColor), 1.0);
+}
+
+#else // SHARPEN
+
+uniform float uSharpness;
+
+vec3 Load(ivec2 texel)
+{
+	return texelFetch(uInput, clamp(texel, ivec2(0), textureSize(uInput, 0) - 1), 0).rgb;
+}
+
+// Contrast adaptive sharpening on a cross: the negative lobe is as strong as possible
+// without pushing the result out of the [0, 1] range of the neighbourhood
+void main()
+{
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	vec3 b = Load(texel + ivec2(0, 1));
+	vec3 d = Load(texel + ivec2(-1, 0));
+	vec3 e = Load(texel);
+	vec3 f = Load(texel + ivec2(1, 0));
+	vec3 h = Load(texel + ivec2(0, -1));
+
+	vec3 minColor = min(min(b, d), min(f, h));
+	vec3 maxColor = max(max(b, d), max(f, h));
+
+	vec3 hitMin = min(minColor, e) / (4.0 * maxColor + 1e-5);
+	vec3 hitMax = (1.0 - max(maxColor, e)) / min(4.0 * minColor - 4.0, -1e-5);
+	vec3 lobes = max(-hitMin, hitMax);
+	float lobe = max(-0.1875, min(max(lobes.r, max(lobes.g, lobes.b)), 0.0)) * uSharpness;
+
+	oColor = vec4((lobe * (b + d + f + h) + e) / (4.0 * lobe + 1.0), 1.0);
+}
+
+#endif
+#endif
+#endif
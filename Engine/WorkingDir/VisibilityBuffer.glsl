@@ -0,0 +1,38 @@
+///////////////////////////////////////////////////////////////////////
+#ifdef VISIBILITY_GEOMETRY
+
+#if defined(VERTEX) ///////////////////////////////////////////////////
+
+layout(location = 0) in vec3 aPosition;
+
+// Leading member of the GlobalParams block
+layout(binding = 0, std140) uniform GlobalParams
+{
+	mat4 uViewProjection;
+};
+
+layout(binding = 1, std140) uniform LocalParams
+{
+	mat4 uWorldMatrix;
+	mat4 uPreviousWorldMatrix;
+};
+
+void main()
+{
+	vec4 worldPosition = uWorldMatrix * vec4(aPosition, 1.0);
+	gl_Position = uViewProjection * worldPosition;
+}
+
+#elif defined(FRAGMENT) ///////////////////////////////////////////////
+
+uniform uint uDrawID;       // index in the draw table + 1
+uniform uint uTriangleBits; // low bits holding the primitive, see VisibilityBuffer.h
+layout(location = 0) out uint oVisibility;
+
+void main()
+{
+	oVisibility = (uDrawID << uTriangleBits) | uint(gl_PrimitiveID);
+}
+
+#endif
+#endif